@@ -30,6 +30,9 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "board.h"
+#include "cdc_stream.h"
+#include "cdc_proto.h"
+#include "ux_device_descriptors.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -56,7 +59,11 @@
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 /* USER CODE BEGIN PFP */
-
+static void app_pma_config(void);
+static void app_data_run(void);
+static void app_rtc_record(uint8_t *payload);
+static UCHAR app_command(UCHAR command, const UCHAR *request, ULONG request_length,
+                         UCHAR *response, ULONG *response_length);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -101,11 +108,7 @@ int main(void)
   /* USER CODE BEGIN 2 */
 	MX_USB_PCD_Init();
 	/* Set Rx and Tx FIFO */
-	HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x00, PCD_SNG_BUF, 0x14);
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x80, PCD_SNG_BUF, 0x54);
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x81, PCD_SNG_BUF, 0x94);
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x01, PCD_SNG_BUF, 0xD4);
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x82, PCD_SNG_BUF, 0x114);
+	app_pma_config();
 
   ux_dcd_stm32_initialize((ULONG)USB_DRD_FS, (ULONG)&hpcd_USB_DRD_FS);
 
@@ -123,15 +126,13 @@ int main(void)
 	
 	uint32_t tick = HAL_GetTick();
 	uint32_t tick_usb = tick;
-	uint32_t tick_usb_tx = tick;
 	uint32_t tick_button = tick;
 	
-	uint8_t txbuf[50]; 
-	ULONG length;
-	ULONG actual_length;
-	length = sprintf(( char *)txbuf,"Hello! WeAct Studio\r\n");
-	UINT write_state = UX_STATE_RESET;
-	UINT ux_status = UX_STATE_RESET;
+	uint8_t record[CDC_PROTO_RTC_LENGTH];
+	uint8_t button = 0;
+	uint32_t millivolts;
+	UINT cdc_active = UX_FALSE;
+	cdc_proto_set_handler(app_command);
   while (1)
   {
 		tick = HAL_GetTick();
@@ -143,33 +144,39 @@ int main(void)
 		
 		if(tick >= tick_button)
 		{
-			if(board_button_getstate())
+			if(board_button_getstate() != button)
+			{
+				button = !button;
+				cdc_proto_send(CDC_PROTO_BUTTON, &button, 1);
+				cdc_tx_flush(CDC_PROTO_CHANNEL);
+			}
+			
+			if(button)
 			{
 				tick_button = tick + 100;
 				board_led_toggle();
-				length = sprintf(( char *)txbuf,"Key Pressed\r\n");
 			}
 			else
 			{
 				tick_button = tick + 500;
-				RTC_DateTypeDef sdatestructureget;
-        RTC_TimeTypeDef stimestructureget;
         static uint8_t Seconds_o;
-        int text_lenth;
         
-        /* Get the RTC current Time */
-        HAL_RTC_GetTime(&hrtc, &stimestructureget, RTC_FORMAT_BIN);
-        /* Get the RTC current Date */
-        HAL_RTC_GetDate(&hrtc, &sdatestructureget, RTC_FORMAT_BIN);
+        app_rtc_record(record);
         
-        if(Seconds_o != stimestructureget.Seconds)
+        if(Seconds_o != record[5])
         {
-          Seconds_o = stimestructureget.Seconds;
+          Seconds_o = record[5];
           
           board_led_set(1);
           
-          length = sprintf((char *) &txbuf,"20%02d.%02d.%02d %02d:%02d %02d ,%dmV\r\n",sdatestructureget.Year,sdatestructureget.Month,sdatestructureget.Date, \
-                                            stimestructureget.Hours,stimestructureget.Minutes,stimestructureget.Seconds,(((uint32_t)adc_inp)*3300)>>10);
+          cdc_proto_send(CDC_PROTO_RTC, record, CDC_PROTO_RTC_LENGTH);
+          
+          millivolts = (((uint32_t)adc_inp)*3300)>>10;
+          record[0] = (uint8_t)millivolts;
+          record[1] = (uint8_t)(millivolts >> 8);
+          record[2] = (uint8_t)adc_inp;
+          record[3] = (uint8_t)(adc_inp >> 8);
+          cdc_proto_send(CDC_PROTO_ADC, record, 4);
         }
         else
         {
@@ -178,51 +185,19 @@ int main(void)
 			}
 		}
 		
-		if(tick >= tick_usb_tx)
+		if(cdc_stream_active(CDC_PROTO_CHANNEL) != cdc_active)
 		{
-			tick_usb_tx = tick + 1;
-			
-			extern UX_SLAVE_CLASS_CDC_ACM  *cdc_acm;
-			if(cdc_acm != UX_NULL)
+			cdc_active = cdc_stream_active(CDC_PROTO_CHANNEL);
+			if(cdc_active)
 			{
-				switch(write_state)
-				{
-				case UX_STATE_RESET:
-
-					ux_status = ux_device_class_cdc_acm_write_run(cdc_acm, txbuf,length, &actual_length);
-						
-					if (ux_status != UX_STATE_WAIT)
-					{
-						/* Reset state.  */
-						write_state = UX_STATE_RESET;
-						break;
-					}
-					write_state = UX_STATE_WAIT;
-					break;
-						
-				case UX_STATE_WAIT:    	
-					/* Continue to run state machine.  */
-					ux_status = ux_device_class_cdc_acm_write_run(cdc_acm, UX_NULL, 0, &actual_length);
-					/* Check if there is  fatal error.  */
-					if (ux_status < UX_STATE_IDLE)
-					{
-						/* Reset state.  */
-						write_state = UX_STATE_RESET;
-						break;
-					}
-					/* Check if dataset is transmitted */
-					if (ux_status <= UX_STATE_NEXT)
-					{
-						write_state = UX_STATE_RESET;
-						tick_usb_tx = tick + 1000;
-					}
-					/* Keep waiting.  */
-					break;
-				default:
-					break;
-				}
+				cdc_proto_send(CDC_PROTO_HELLO, (const UCHAR *)"WeAct Studio", 12);
 			}
 		}
+		
+		/* Host commands, then keep the endpoints busy while data is queued */
+		cdc_proto_run();
+		app_data_run();
+		cdc_stream_run();
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -308,7 +283,136 @@ void SystemClock_Config(void)
 }
 
 /* USER CODE BEGIN 4 */
+/**
+  * @brief  Give every endpoint of the device framework its packet memory.
+  * @param  None
+  * @retval None
+  */
+static void app_pma_config(void)
+{
+  uint8_t ep_addr[2U + (3U * USBD_CDC_ACM_INSTANCES)];
+  uint32_t pma_addr[2U + (3U * USBD_CDC_ACM_INSTANCES)];
+  uint32_t count;
+  uint32_t i;
+
+  count = USBD_Get_PMA_Config(ep_addr, pma_addr, sizeof(ep_addr));
+  for(i = 0; i < count; i++)
+  {
+    HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, ep_addr[i], PCD_SNG_BUF, pma_addr[i]);
+  }
+}
 
+/**
+  * @brief  Loop bulk data back on the channels after the protocol one, they
+  *         have their own endpoints so the records never wait behind them.
+  * @param  None
+  * @retval None
+  */
+static void app_data_run(void)
+{
+  UCHAR data[64];
+  ULONG length;
+  UINT channel;
+
+  for(channel = 0; channel < CDC_STREAM_CHANNELS; channel++)
+  {
+    if(channel == CDC_PROTO_CHANNEL)
+    {
+      continue;
+    }
+
+    length = cdc_tx_space(channel);
+    if(length > sizeof(data))
+    {
+      length = sizeof(data);
+    }
+    length = cdc_rx_read(channel, data, length);
+    if(length != 0)
+    {
+      cdc_tx_write(channel, data, length);
+    }
+  }
+}
+
+/**
+  * @brief  Fill an RTC record with the current date and time.
+  * @param  payload: CDC_PROTO_RTC_LENGTH bytes
+  * @retval None
+  */
+static void app_rtc_record(uint8_t *payload)
+{
+  RTC_DateTypeDef sdatestructureget;
+  RTC_TimeTypeDef stimestructureget;
+
+  /* Get the RTC current Time, then Date to unlock the shadow registers */
+  HAL_RTC_GetTime(&hrtc, &stimestructureget, RTC_FORMAT_BIN);
+  HAL_RTC_GetDate(&hrtc, &sdatestructureget, RTC_FORMAT_BIN);
+
+  payload[0] = sdatestructureget.Year;
+  payload[1] = sdatestructureget.Month;
+  payload[2] = sdatestructureget.Date;
+  payload[3] = stimestructureget.Hours;
+  payload[4] = stimestructureget.Minutes;
+  payload[5] = stimestructureget.Seconds;
+}
+
+/**
+  * @brief  Application commands of the CDC protocol.
+  * @param  command: command type
+  * @param  request: request payload
+  * @param  request_length: request payload length
+  * @param  response: response payload
+  * @param  response_length: response payload length
+  * @retval CDC_PROTO_STATUS_xxx
+  */
+static UCHAR app_command(UCHAR command, const UCHAR *request, ULONG request_length,
+                         UCHAR *response, ULONG *response_length)
+{
+  static const uint8_t month_offset[12] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+  RTC_DateTypeDef sdatestructure = {0};
+  RTC_TimeTypeDef stimestructure = {0};
+  uint32_t year;
+
+  switch(command)
+  {
+  case CDC_PROTO_CMD_GET_TIME:
+    app_rtc_record(response);
+    *response_length = CDC_PROTO_RTC_LENGTH;
+    return CDC_PROTO_STATUS_OK;
+
+  case CDC_PROTO_CMD_SET_TIME:
+    if((request_length != CDC_PROTO_RTC_LENGTH) || (request[0] > 99) ||
+       (request[1] < 1) || (request[1] > 12) || (request[2] < 1) || (request[2] > 31) ||
+       (request[3] > 23) || (request[4] > 59) || (request[5] > 59))
+    {
+      return CDC_PROTO_STATUS_INVALID;
+    }
+
+    /* Day of the week, Sakamoto's method, Monday is 1 and Sunday 7 */
+    year = 2000 + request[0] - (request[1] < 3);
+    sdatestructure.WeekDay = (year + year/4 - year/100 + year/400 + month_offset[request[1] - 1] + request[2]) % 7;
+    if(sdatestructure.WeekDay == 0)
+    {
+      sdatestructure.WeekDay = RTC_WEEKDAY_SUNDAY;
+    }
+    sdatestructure.Year = request[0];
+    sdatestructure.Month = request[1];
+    sdatestructure.Date = request[2];
+    stimestructure.Hours = request[3];
+    stimestructure.Minutes = request[4];
+    stimestructure.Seconds = request[5];
+
+    if((HAL_RTC_SetTime(&hrtc, &stimestructure, RTC_FORMAT_BIN) != HAL_OK) ||
+       (HAL_RTC_SetDate(&hrtc, &sdatestructure, RTC_FORMAT_BIN) != HAL_OK))
+    {
+      return CDC_PROTO_STATUS_FAILED;
+    }
+    return CDC_PROTO_STATUS_OK;
+
+  default:
+    return CDC_PROTO_STATUS_UNKNOWN;
+  }
+}
 /* USER CODE END 4 */
 
 /**
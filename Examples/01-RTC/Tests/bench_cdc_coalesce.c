@@ -0,0 +1,123 @@
+/**
+  ******************************************************************************
+  * @file    bench_cdc_coalesce.c
+  * @brief   Host measure of the CDC transmit coalescing
+  ******************************************************************************
+  * Records of 4 to 23 bytes are written every 40 us on average, one in 500
+  * is flushed, and the host takes one IN packet every 50 us at most. Prints
+  * the packets per KB sent and the latency of each byte from its write to
+  * the host, in simulated time. The Makefile builds it with
+  * CDC_TX_COALESCE_MS at 0, 1 and 5.
+  ******************************************************************************
+  */
+#include "cdc_sim.h"
+#include "test.h"
+
+TEST_MAIN_DEFINE
+
+#define BENCH_CHANNEL       0U
+#define BENCH_SECONDS       5U
+#define BENCH_POLL_US       50U
+#define BENCH_RECORD_US     40U
+
+/* Write time of the bytes in flight, they are fewer than the ring size */
+#define BENCH_TIMES         (2U * CDC_TX_RING_SIZE)
+
+static unsigned long now_us;
+static unsigned long next_poll_us;
+static unsigned long written;
+static unsigned long received;
+static unsigned long packets;
+static unsigned long zlps;
+static unsigned long errors;
+static unsigned long write_us[BENCH_TIMES];
+static double latency_sum;
+static unsigned long latency_max;
+
+static UCHAR bench_byte(unsigned long index)
+{
+  return (UCHAR)((index * 7U) + (index >> 8));
+}
+
+ULONG cdc_sim_host_out(UINT channel, UCHAR *packet, ULONG size)
+{
+  (void)channel;
+  (void)packet;
+  (void)size;
+  return CDC_SIM_NAK;
+}
+
+UINT cdc_sim_host_in(UINT channel, const UCHAR *packet, ULONG length)
+{
+  if ((channel != BENCH_CHANNEL) || (now_us < next_poll_us))
+  {
+    return (channel != BENCH_CHANNEL) ? UX_TRUE : UX_FALSE;
+  }
+  next_poll_us = now_us + BENCH_POLL_US;
+
+  packets++;
+  zlps += (length == 0U) ? 1U : 0U;
+  for (ULONG i = 0U; i < length; i++)
+  {
+    unsigned long latency = now_us - write_us[received % BENCH_TIMES];
+
+    latency_sum += (double)latency;
+    latency_max = (latency > latency_max) ? latency : latency_max;
+    if (packet[i] != bench_byte(received++))
+    {
+      errors++;
+    }
+  }
+  return UX_TRUE;
+}
+
+static void bench_record(void)
+{
+  UCHAR data[24];
+  ULONG length = 4U + (test_random() % 20U);
+
+  for (ULONG i = 0U; i < length; i++)
+  {
+    data[i] = bench_byte(written + i);
+    write_us[(written + i) % BENCH_TIMES] = now_us;
+  }
+  if (cdc_tx_write(BENCH_CHANNEL, data, length) != length)
+  {
+    errors++;
+    return;
+  }
+  written += length;
+
+  if ((test_random() % 500U) == 0U)
+  {
+    cdc_tx_flush(BENCH_CHANNEL);
+  }
+}
+
+int main(void)
+{
+  for (UINT channel = 0U; channel < CDC_STREAM_CHANNELS; channel++)
+  {
+    cdc_sim_attach(channel);
+  }
+
+  /* 1 us steps, then long enough for the last deadline */
+  for (now_us = 0U; now_us < (BENCH_SECONDS * 1000000U) + 100000U; now_us++)
+  {
+    if ((now_us < (BENCH_SECONDS * 1000000U)) && ((test_random() % BENCH_RECORD_US) == 0U))
+    {
+      bench_record();
+    }
+    cdc_sim_time = now_us / 1000U;
+    cdc_stream_run();
+  }
+
+  CHECK_EQ(received, written);
+  CHECK_EQ(errors, 0U);
+
+  printf("bench_cdc_coalesce, %u ms: %.1f packets/KB, %lu ZLPs, latency %.0f us mean, %lu us max\n",
+         (unsigned)CDC_TX_COALESCE_MS, (double)packets * 1024.0 / (double)received, zlps,
+         latency_sum / (double)received, latency_max);
+
+  return test_failures ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+/**
+  ******************************************************************************
+  * @file    bench_cdc_throughput.c
+  * @brief   Host measure of the sustained CDC transmit throughput
+  ******************************************************************************
+  * A producer keeps the TX ring topped up with writes of 1, 16, 64 and 500
+  * bytes. First on the full speed bus of the simulation: the host takes one
+  * 64 byte IN packet every 53 us at most, the bulk bandwidth of a frame with
+  * nothing else on the bus. Prints the bytes per second over 2 s of
+  * simulated time against that limit; the host checks every byte. Then as
+  * fast as the host CPU runs the writes, cdc_stream_run() and the simulated
+  * DCD, the host taking every packet: prints the cycles (x86 TSC) and ns per
+  * byte, the best of 5 runs. The simulated DCD does not copy the packets
+  * out as the FS controller does into its PMA, so this is the cost of the
+  * ring and its state machines. These only compare write sizes and builds,
+  * within the noise of the host, the Cortex-M33 counts come from its DWT
+  * counter. The Makefile also builds it with CDC_TX_ZERO_COPY_ALIGN at a
+  * boundary no address of the non-PIE program meets, so that every
+  * transfer goes through the endpoint buffer.
+  ******************************************************************************
+  */
+#include "cdc_sim.h"
+#include "test.h"
+#include <time.h>
+
+/* The TSC through the builtin, x86intrin.h does not build after the CMSIS
+   __I and __O */
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_CYCLES()      __builtin_ia32_rdtsc()
+#endif
+
+TEST_MAIN_DEFINE
+
+#define BENCH_CHANNEL       0U
+#define BENCH_SIM_MS        2000U
+#define BENCH_PACKET_US     53U
+#define BENCH_CPU_BYTES     (16UL * 1024UL * 1024UL)
+#define BENCH_CPU_RUNS      5U
+
+static const ULONG bench_sizes[] = { 1U, 16U, 64U, 500U };
+
+static UINT bench_timed;             /* the host takes packets on the bus grid */
+static unsigned long now_us;
+static unsigned long next_poll_us;
+static unsigned long written;
+static unsigned long received;
+static unsigned long packets;
+static unsigned long zlps;
+static unsigned long errors;
+
+static UCHAR bench_byte(unsigned long index)
+{
+  return (UCHAR)((index * 7U) + (index >> 8));
+}
+
+ULONG cdc_sim_host_out(UINT channel, UCHAR *packet, ULONG size)
+{
+  (void)channel;
+  (void)packet;
+  (void)size;
+  return CDC_SIM_NAK;
+}
+
+UINT cdc_sim_host_in(UINT channel, const UCHAR *packet, ULONG length)
+{
+  if (channel != BENCH_CHANNEL)
+  {
+    return UX_TRUE;
+  }
+  if (bench_timed)
+  {
+    if (now_us < next_poll_us)
+    {
+      return UX_FALSE;
+    }
+    next_poll_us = now_us + BENCH_PACKET_US;
+    for (ULONG i = 0U; i < length; i++)
+    {
+      if (packet[i] != bench_byte(received + i))
+      {
+        errors++;
+      }
+    }
+  }
+
+  packets++;
+  zlps += (length == 0U) ? 1U : 0U;
+  received += length;
+  return UX_TRUE;
+}
+
+/* Writes of 'size' bytes while the ring takes them */
+static void bench_produce(ULONG size)
+{
+  UCHAR data[512];
+
+  while (cdc_tx_space(BENCH_CHANNEL) >= size)
+  {
+    for (ULONG i = 0U; i < size; i++)
+    {
+      data[i] = bench_byte(written + i);
+    }
+    if (cdc_tx_write(BENCH_CHANNEL, data, size) != size)
+    {
+      errors++;
+      return;
+    }
+    written += size;
+  }
+}
+
+static void bench_start(void)
+{
+  for (UINT channel = 0U; channel < CDC_STREAM_CHANNELS; channel++)
+  {
+    cdc_sim_attach(channel);
+  }
+  now_us = 0U;
+  next_poll_us = 0U;
+  written = 0U;
+  received = 0U;
+  packets = 0U;
+  zlps = 0U;
+  errors = 0U;
+}
+
+/* Bytes per second on the simulated bus, 1 us per main loop pass */
+static void bench_bus(ULONG size)
+{
+  double limit = (double)CDC_SIM_PACKET_SIZE * 1e6 / BENCH_PACKET_US;
+  double rate;
+
+  bench_start();
+  bench_timed = UX_TRUE;
+  for (now_us = 0U; now_us < (BENCH_SIM_MS * 1000U); now_us++)
+  {
+    bench_produce(size);
+    cdc_sim_time = now_us / 1000U;
+    cdc_stream_run();
+  }
+
+  CHECK(received > 0U);
+  CHECK(received <= written);
+  CHECK_EQ(errors, 0U);
+
+  rate = (double)received * 1000.0 / BENCH_SIM_MS;
+  printf("  %3lu byte writes  bus %.3f MB/s (%.1f %% of %.3f MB/s), %lu packets, %lu ZLPs\n",
+         size, rate / 1e6, 100.0 * rate / limit, limit / 1e6, packets, zlps);
+}
+
+static double bench_now(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/* Host time of the stream per byte, the host taking every packet: the
+   fastest run */
+static void bench_cpu(ULONG size)
+{
+  double start;
+  double seconds = 0.0;
+#ifdef BENCH_CYCLES
+  unsigned long long cycles = 0U;
+  unsigned long long run_cycles;
+#endif
+
+  for (ULONG run = 0U; run < BENCH_CPU_RUNS; run++)
+  {
+    bench_start();
+    bench_timed = UX_FALSE;
+    cdc_sim_time = 0U;
+    start = bench_now();
+#ifdef BENCH_CYCLES
+    run_cycles = BENCH_CYCLES();
+#endif
+    while (received < BENCH_CPU_BYTES)
+    {
+      bench_produce(size);
+      cdc_stream_run();
+    }
+#ifdef BENCH_CYCLES
+    run_cycles = BENCH_CYCLES() - run_cycles;
+    cycles = ((run == 0U) || (run_cycles < cycles)) ? run_cycles : cycles;
+#endif
+    start = bench_now() - start;
+    seconds = ((run == 0U) || (start < seconds)) ? start : seconds;
+    CHECK_EQ(errors, 0U);
+  }
+
+  printf("  %3lu byte writes  host", size);
+#ifdef BENCH_CYCLES
+  printf(" %.2f cycles/byte,", (double)cycles / (double)received);
+#endif
+  printf(" %.2f ns/byte, %.0f MB/s\n", seconds * 1e9 / (double)received,
+         (double)received / seconds / 1e6);
+}
+
+int main(void)
+{
+  ULONG i;
+
+  printf("bench_cdc_throughput (%s): ring %u bytes, coalescing %u ms\n",
+         (CDC_TX_ZERO_COPY_ALIGN == 1U) ? "zero copy" : "copy", (unsigned)CDC_TX_RING_SIZE,
+         (unsigned)CDC_TX_COALESCE_MS);
+  for (i = 0U; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++)
+  {
+    bench_bus(bench_sizes[i]);
+  }
+  for (i = 0U; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++)
+  {
+    bench_cpu(bench_sizes[i]);
+  }
+
+  return test_failures ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+/**
+  ******************************************************************************
+  * @file    cdc_sim.c
+  * @brief   Simulated USB bus under the CDC stream, for the host tests
+  ******************************************************************************
+  * An OUT transfer ends on a short packet or once the requested length is
+  * in. An IN transfer ends once its data is sent, with a ZLP when it ends on
+  * a whole packet and the host was told to expect more, as the DCD does.
+  ******************************************************************************
+  */
+#include "cdc_sim.h"
+#include <string.h>
+
+typedef struct
+{
+  UX_SLAVE_CLASS_CDC_ACM cdc_acm;
+  UX_SLAVE_INTERFACE interface;
+  UX_SLAVE_ENDPOINT endpoint_in;
+  UX_SLAVE_ENDPOINT endpoint_out;
+  UCHAR buffer_in[UX_SLAVE_REQUEST_DATA_MAX_LENGTH];
+  UCHAR buffer_out[UX_SLAVE_REQUEST_DATA_MAX_LENGTH];
+} CDC_SimTypeDef;
+
+static CDC_SimTypeDef cdc_sim[CDC_STREAM_CHANNELS];
+
+ULONG cdc_sim_time;
+LONG cdc_sim_interrupt_depth;
+
+/* Stubs of the USBX utilities ----------------------------------------------*/
+ULONG _ux_utility_time_get(VOID)
+{
+  return cdc_sim_time;
+}
+
+ALIGN_TYPE _ux_utility_interrupt_disable(VOID)
+{
+  return (ALIGN_TYPE)cdc_sim_interrupt_depth++;
+}
+
+VOID _ux_utility_interrupt_restore(ALIGN_TYPE flags)
+{
+  cdc_sim_interrupt_depth = (LONG)flags;
+}
+
+/* Bus ----------------------------------------------------------------------*/
+VOID cdc_sim_attach(UINT channel)
+{
+  CDC_SimTypeDef *sim = &cdc_sim[channel];
+  UX_SLAVE_ENDPOINT *in = &sim->endpoint_in;
+  UX_SLAVE_ENDPOINT *out = &sim->endpoint_out;
+
+  memset(sim, 0, sizeof(*sim));
+  sim->cdc_acm.ux_slave_class_cdc_acm_interface = &sim->interface;
+
+  /* OUT first, the stream must find the IN endpoint either way */
+  sim->interface.ux_slave_interface_first_endpoint = out;
+  out->ux_slave_endpoint_next_endpoint = in;
+
+  in->ux_slave_endpoint_descriptor.bEndpointAddress = (UCHAR)(0x81U + (2U * channel));
+  in->ux_slave_endpoint_descriptor.wMaxPacketSize = CDC_SIM_PACKET_SIZE;
+  in->ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer = sim->buffer_in;
+  in->ux_slave_endpoint_transfer_request.ux_slave_transfer_request_endpoint = in;
+
+  out->ux_slave_endpoint_descriptor.bEndpointAddress = (UCHAR)(0x01U + (2U * channel));
+  out->ux_slave_endpoint_descriptor.wMaxPacketSize = CDC_SIM_PACKET_SIZE;
+  out->ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer = sim->buffer_out;
+  out->ux_slave_endpoint_transfer_request.ux_slave_transfer_request_endpoint = out;
+
+  cdc_stream_activate(channel, &sim->cdc_acm);
+}
+
+UINT _ux_device_stack_transfer_run(UX_SLAVE_TRANSFER *transfer_request, ULONG slave_length,
+                                   ULONG host_length)
+{
+  UX_SLAVE_ENDPOINT *endpoint = transfer_request->ux_slave_transfer_request_endpoint;
+  UCHAR *data = transfer_request->ux_slave_transfer_request_data_pointer;
+  ULONG actual = transfer_request->ux_slave_transfer_request_actual_length;
+  UINT channel = (UINT)((endpoint->ux_slave_endpoint_descriptor.bEndpointAddress & 0x0FU) - 1U) / 2U;
+  ULONG packet;
+
+  /* A new transfer: nothing moves before the next call */
+  if (transfer_request->ux_slave_transfer_request_state == UX_STATE_RESET)
+  {
+    transfer_request->ux_slave_transfer_request_state = UX_STATE_WAIT;
+    transfer_request->ux_slave_transfer_request_requested_length = slave_length;
+    transfer_request->ux_slave_transfer_request_actual_length = 0U;
+    return UX_STATE_WAIT;
+  }
+
+  packet = slave_length - actual;
+  if (packet > CDC_SIM_PACKET_SIZE)
+  {
+    packet = CDC_SIM_PACKET_SIZE;
+  }
+
+  if ((endpoint->ux_slave_endpoint_descriptor.bEndpointAddress & UX_ENDPOINT_DIRECTION) == UX_ENDPOINT_OUT)
+  {
+    packet = cdc_sim_host_out(channel, &data[actual], packet);
+    if (packet == CDC_SIM_NAK)
+    {
+      return UX_STATE_WAIT;
+    }
+    actual += packet;
+    transfer_request->ux_slave_transfer_request_actual_length = actual;
+    if ((packet == CDC_SIM_PACKET_SIZE) && (actual < slave_length))
+    {
+      return UX_STATE_WAIT;
+    }
+  }
+  else
+  {
+    if (!cdc_sim_host_in(channel, &data[actual], packet))
+    {
+      return UX_STATE_WAIT;
+    }
+    actual += packet;
+    transfer_request->ux_slave_transfer_request_actual_length = actual;
+    /* A whole last packet is followed by a ZLP when the host expects more */
+    if ((actual < slave_length) ||
+        ((packet == CDC_SIM_PACKET_SIZE) && (host_length > slave_length)))
+    {
+      return UX_STATE_WAIT;
+    }
+  }
+
+  transfer_request->ux_slave_transfer_request_state = UX_STATE_RESET;
+  return UX_STATE_NEXT;
+}
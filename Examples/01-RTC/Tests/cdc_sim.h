@@ -0,0 +1,42 @@
+/**
+  ******************************************************************************
+  * @file    cdc_sim.h
+  * @brief   Simulated USB bus under the CDC stream, for the host tests
+  ******************************************************************************
+  * cdc_sim.c stands in for the USBX transfer and utility calls cdc_stream.c
+  * makes. Each channel gets a CDC ACM instance with a bulk IN and a bulk OUT
+  * endpoint of CDC_SIM_PACKET_SIZE bytes. Transfers move one packet per
+  * ux_device_stack_transfer_run() call, the test decides what the host does
+  * with each packet through the two hooks below.
+  ******************************************************************************
+  */
+#ifndef CDC_SIM_H
+#define CDC_SIM_H
+
+#include "cdc_stream.h"
+
+/* Full speed bulk endpoints */
+#define CDC_SIM_PACKET_SIZE     64U
+
+/* Host hook result: no packet this time, the endpoint NAKs */
+#define CDC_SIM_NAK             0xFFFFFFFFU
+
+/* Time in ms, returned by _ux_utility_time_get() */
+extern ULONG cdc_sim_time;
+
+/* Interrupt disable nesting, back to 0 after each call of the stream */
+extern LONG cdc_sim_interrupt_depth;
+
+/* Attach channel 'channel' to a new simulated instance, as the class
+   activate callback does */
+VOID cdc_sim_attach(UINT channel);
+
+/* Implemented by each test: the host sends a packet of up to 'size' bytes to
+   the OUT endpoint, returns its length or CDC_SIM_NAK */
+ULONG cdc_sim_host_out(UINT channel, UCHAR *packet, ULONG size);
+
+/* Implemented by each test: the host polls the IN endpoint, 'length' is 0
+   for a ZLP. Returns UX_FALSE when the host does not poll this time */
+UINT cdc_sim_host_in(UINT channel, const UCHAR *packet, ULONG length);
+
+#endif /* CDC_SIM_H */
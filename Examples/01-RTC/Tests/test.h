@@ -0,0 +1,62 @@
+/**
+  ******************************************************************************
+  * @file    test.h
+  * @brief   Minimal checks for the host tests
+  ******************************************************************************
+  * Each test program counts its failed checks and returns non-zero when one
+  * failed. A failed check prints its location and goes on, so that one run
+  * shows every mismatch.
+  ******************************************************************************
+  */
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+extern unsigned test_failures;
+
+#define CHECK(cond)                                                          \
+  do                                                                         \
+  {                                                                          \
+    if (!(cond))                                                             \
+    {                                                                        \
+      test_failures++;                                                       \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);        \
+    }                                                                        \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                       \
+  do                                                                         \
+  {                                                                          \
+    long long check_a = (long long)(a);                                      \
+    long long check_b = (long long)(b);                                      \
+    if (check_a != check_b)                                                  \
+    {                                                                        \
+      test_failures++;                                                       \
+      printf("%s:%d: check failed: %s == %s (%lld != %lld)\n",               \
+             __FILE__, __LINE__, #a, #b, check_a, check_b);                  \
+    }                                                                        \
+  } while (0)
+
+/* Once per test program */
+#define TEST_MAIN_DEFINE unsigned test_failures = 0;
+
+static inline int test_report(const char *name)
+{
+  printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+  return test_failures ? 1 : 0;
+}
+
+/* Reproducible pseudo-random bytes, xorshift32 */
+static inline uint32_t test_random(void)
+{
+  static uint32_t state = 0x12345678U;
+
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+#endif /* TEST_H */
@@ -0,0 +1,221 @@
+/**
+  ******************************************************************************
+  * @file    test_cdc_coalesce.c
+  * @brief   Host checks of the CDC transmit coalescing
+  ******************************************************************************
+  * Small writes must leave as whole packets, data short of a packet must
+  * wait for the CDC_TX_COALESCE_MS deadline or cdc_tx_flush(), and an open
+  * host transfer must be closed by a ZLP. The Makefile also builds this
+  * test with CDC_TX_COALESCE_MS at 0, where every write leaves at once.
+  ******************************************************************************
+  */
+#include "cdc_sim.h"
+#include "test.h"
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define TEST_CHANNEL        0U
+#define TEST_PACKETS_MAX    64U
+
+/* Packet lengths the host read since the last coalesce_expect() */
+static ULONG packets[TEST_PACKETS_MAX];
+static ULONG packet_count;
+static unsigned long written;
+static unsigned long received;
+static unsigned long errors;
+
+static UCHAR test_byte(unsigned long index)
+{
+  return (UCHAR)((index * 13U) + (index >> 8));
+}
+
+ULONG cdc_sim_host_out(UINT channel, UCHAR *packet, ULONG size)
+{
+  (void)channel;
+  (void)packet;
+  (void)size;
+  return CDC_SIM_NAK;
+}
+
+UINT cdc_sim_host_in(UINT channel, const UCHAR *packet, ULONG length)
+{
+  if (channel != TEST_CHANNEL)
+  {
+    CHECK_EQ(length, 0U);
+    return UX_TRUE;
+  }
+
+  if (packet_count < TEST_PACKETS_MAX)
+  {
+    packets[packet_count++] = length;
+  }
+  for (ULONG i = 0U; i < length; i++)
+  {
+    if (packet[i] != test_byte(received++))
+    {
+      errors++;
+    }
+  }
+  return UX_TRUE;
+}
+
+static void coalesce_write(ULONG length)
+{
+  UCHAR data[512];
+
+  for (ULONG i = 0U; i < length; i++)
+  {
+    data[i] = test_byte(written + i);
+  }
+  CHECK_EQ(cdc_tx_write(TEST_CHANNEL, data, length), length);
+  written += length;
+}
+
+/* The stream runs without time passing */
+static void coalesce_run(void)
+{
+  for (UINT i = 0U; i < 32U; i++)
+  {
+    cdc_stream_run();
+  }
+}
+
+/* The packets read since the last call, 'count' lengths */
+static void coalesce_expect(const ULONG *lengths, ULONG count, int line)
+{
+  if ((packet_count != count) || (memcmp(packets, lengths, count * sizeof(ULONG)) != 0))
+  {
+    printf("%s:%d: packets", __FILE__, line);
+    for (ULONG i = 0U; i < packet_count; i++)
+    {
+      printf(" %lu", packets[i]);
+    }
+    printf(", expected");
+    for (ULONG i = 0U; i < count; i++)
+    {
+      printf(" %lu", lengths[i]);
+    }
+    printf("\n");
+    test_failures++;
+  }
+  packet_count = 0U;
+}
+
+#define EXPECT(...)                                                          \
+  coalesce_expect((const ULONG[]){ __VA_ARGS__ },                            \
+                  sizeof((const ULONG[]){ __VA_ARGS__ }) / sizeof(ULONG), __LINE__)
+#define EXPECT_NONE()   coalesce_expect(NULL, 0U, __LINE__)
+
+#if CDC_TX_COALESCE_MS > 0U
+static void coalesce_deadline(void)
+{
+  cdc_sim_time += CDC_TX_COALESCE_MS;
+  coalesce_run();
+}
+
+static void test_whole_packets(void)
+{
+  /* Short of a packet: held */
+  coalesce_write(10U);
+  coalesce_run();
+  EXPECT_NONE();
+
+  /* A whole packet leaves, the host transfer stays open */
+  coalesce_write(54U);
+  coalesce_run();
+  EXPECT(64U);
+
+  /* Until the deadline closes it with a ZLP */
+  cdc_sim_time += CDC_TX_COALESCE_MS - 1U;
+  coalesce_run();
+  EXPECT_NONE();
+  coalesce_deadline();
+  EXPECT(0U);
+
+  /* Whole packets of a large write, the rest at the deadline */
+  coalesce_write(3U * 64U + 20U);
+  coalesce_run();
+  EXPECT(64U, 64U, 64U);
+  coalesce_deadline();
+  EXPECT(20U);
+}
+
+static void test_flush(void)
+{
+  /* Sent at once, a short packet ends the transfer */
+  coalesce_write(5U);
+  cdc_tx_flush(TEST_CHANNEL);
+  coalesce_run();
+  EXPECT(5U);
+
+  /* On a packet multiple the flush adds the ZLP */
+  coalesce_write(128U);
+  cdc_tx_flush(TEST_CHANNEL);
+  coalesce_run();
+  EXPECT(64U, 64U, 0U);
+
+  /* Nothing queued, nothing open: no ZLP */
+  cdc_tx_flush(TEST_CHANNEL);
+  coalesce_run();
+  EXPECT_NONE();
+}
+
+static void test_wrap(void)
+{
+  ULONG length;
+
+  /* Bring the ring head 100 bytes short of its end, off a packet boundary */
+  while ((length = (CDC_TX_RING_SIZE - 100U - written) % CDC_TX_RING_SIZE) != 0U)
+  {
+    coalesce_write((length > 500U) ? 500U : length);
+    cdc_tx_flush(TEST_CHANNEL);
+    coalesce_run();
+  }
+  packet_count = 0U;
+
+  /* The packet across the ring end stays whole */
+  coalesce_write(300U);
+  coalesce_run();
+  EXPECT(64U, 64U, 64U, 64U);
+  coalesce_deadline();
+  EXPECT(44U);
+}
+#else
+static void test_at_once(void)
+{
+  /* Without a deadline each write leaves at once, a ZLP after a whole one */
+  coalesce_write(10U);
+  coalesce_run();
+  EXPECT(10U);
+
+  coalesce_write(64U);
+  coalesce_run();
+  EXPECT(64U, 0U);
+}
+#endif
+
+int main(void)
+{
+  char name[48];
+
+  for (UINT channel = 0U; channel < CDC_STREAM_CHANNELS; channel++)
+  {
+    cdc_sim_attach(channel);
+  }
+
+#if CDC_TX_COALESCE_MS > 0U
+  test_whole_packets();
+  test_flush();
+  test_wrap();
+#else
+  test_at_once();
+#endif
+
+  CHECK_EQ(received, written);
+  CHECK_EQ(errors, 0U);
+  CHECK_EQ(cdc_sim_interrupt_depth, 0);
+
+  snprintf(name, sizeof(name), "test_cdc_coalesce, %u ms", (unsigned)CDC_TX_COALESCE_MS);
+  return test_report(name);
+}
@@ -0,0 +1,212 @@
+/**
+  ******************************************************************************
+  * @file    test_cdc_descriptors.c
+  * @brief   Host checks of the CDC ACM framework and packet memory layout
+  ******************************************************************************
+  * The full and high speed frameworks the builder makes are walked as a
+  * host would parse them: lengths, IADs, interface numbering, endpoints and
+  * packet sizes. The packet memory layout from USBD_Get_PMA_Config() must
+  * give every endpoint of the descriptors its own buffer within the 2 KB.
+  * The Makefile builds this test for 1, 2 and 3 instances.
+  ******************************************************************************
+  */
+#include "ux_device_descriptors.h"
+#include "test.h"
+
+TEST_MAIN_DEFINE
+
+#define DESC_DEVICE         0x01U
+#define DESC_CONFIGURATION  0x02U
+#define DESC_INTERFACE      0x04U
+#define DESC_ENDPOINT       0x05U
+#define DESC_QUALIFIER      0x06U
+#define DESC_IAD            0x0BU
+
+#define DESC_PMA_SIZE       2048U
+
+#define DESC_INSTANCES      ((uint32_t)USBD_CDC_ACM_INSTANCES)
+
+/* Endpoints of the full speed framework, for the packet memory check */
+static uint8_t fs_ep_addr[16];
+static uint32_t fs_ep_size[16];
+static uint32_t fs_ep_count;
+
+static uint32_t desc_word(const uint8_t *desc)
+{
+  return (uint32_t)desc[0] | ((uint32_t)desc[1] << 8);
+}
+
+static void test_framework(uint8_t speed)
+{
+  uint32_t bulk_size = (speed == USBD_HIGH_SPEED) ? USBD_CDCACM_EPIN_HS_MPS : USBD_CDCACM_EPIN_FS_MPS;
+  uint8_t type_of_number[16] = { 0U };
+  uint32_t interfaces = 0U;
+  uint32_t iads = 0U;
+  uint32_t endpoints = 0U;
+  const uint8_t *config = NULL;
+  const uint8_t *framework;
+  uint32_t at = 0U;
+  ULONG length;
+
+  framework = USBD_Get_Device_Framework_Speed(speed, &length);
+  CHECK(length <= USBD_FRAMEWORK_MAX_DESC_SZ);
+
+  /* A composite device with IADs, or a plain CDC device */
+  CHECK_EQ(framework[0], 18U);
+  CHECK_EQ(framework[1], DESC_DEVICE);
+  CHECK_EQ(framework[4], (DESC_INSTANCES > 1U) ? 0xEFU : 0x02U);
+  CHECK_EQ(framework[7], USBD_MAX_EP0_SIZE);
+
+  while (at < length)
+  {
+    const uint8_t *desc = &framework[at];
+
+    CHECK(desc[0] >= 2U);
+    CHECK(at + desc[0] <= length);
+    if ((desc[0] < 2U) || (at + desc[0] > length))
+    {
+      return;
+    }
+
+    switch (desc[1])
+    {
+      case DESC_DEVICE:
+        CHECK_EQ(at, 0U);
+        break;
+
+      case DESC_QUALIFIER:
+        CHECK_EQ(speed, USBD_HIGH_SPEED);
+        CHECK_EQ(desc[0], 10U);
+        break;
+
+      case DESC_CONFIGURATION:
+        config = desc;
+        CHECK_EQ(desc_word(&desc[2]), length - at);
+        CHECK_EQ(desc[4], 2U * DESC_INSTANCES);
+        break;
+
+      case DESC_IAD:
+        /* One function per instance, its two interfaces in order */
+        CHECK_EQ(desc[2], 2U * iads);
+        CHECK_EQ(desc[3], 2U);
+        CHECK_EQ(desc[4], 0x02U);
+        CHECK_EQ(desc[5], 0x02U);
+        CHECK_EQ(desc[6], 0x01U);
+        CHECK_EQ(USBD_Get_Interface_Number(CLASS_TYPE_CDC_ACM, (uint8_t)iads), 2U * iads);
+        iads++;
+        break;
+
+      case DESC_INTERFACE:
+        CHECK_EQ(desc[2], interfaces);
+        interfaces++;
+        break;
+
+      case DESC_ENDPOINT:
+      {
+        uint32_t number = desc[2] & 0x0FU;
+        uint32_t type = desc[3] & 0x03U;
+        uint32_t size = desc_word(&desc[4]);
+
+        /* Unique addresses, one transfer type per endpoint number */
+        for (uint32_t i = 0U; (speed == USBD_FULL_SPEED) && (i < fs_ep_count); i++)
+        {
+          CHECK(fs_ep_addr[i] != desc[2]);
+        }
+        CHECK((type_of_number[number] == 0U) || (type_of_number[number] == type + 1U));
+        type_of_number[number] = (uint8_t)(type + 1U);
+
+        CHECK_EQ(size, (type == USBD_EP_TYPE_INTR) ? USBD_CDCACM_EPINCMD_FS_MPS : bulk_size);
+        if ((speed == USBD_FULL_SPEED) && (fs_ep_count < 16U))
+        {
+          fs_ep_addr[fs_ep_count] = desc[2];
+          fs_ep_size[fs_ep_count] = size;
+          fs_ep_count++;
+        }
+        endpoints++;
+        break;
+      }
+
+      default:
+        /* CDC functional descriptors */
+        CHECK_EQ(desc[1], 0x24U);
+        break;
+    }
+
+    at += desc[0];
+  }
+
+  CHECK(config != NULL);
+  CHECK_EQ(at, length);
+  CHECK_EQ(iads, DESC_INSTANCES);
+  CHECK_EQ(interfaces, 2U * DESC_INSTANCES);
+  CHECK_EQ(endpoints, 3U * DESC_INSTANCES);
+}
+
+static void test_packet_memory(void)
+{
+  uint8_t ep_addr[16];
+  uint32_t pma_addr[16];
+  uint32_t pma_size[16];
+  uint32_t count = USBD_Get_PMA_Config(ep_addr, pma_addr, 16U);
+  uint32_t number_max = 0U;
+
+  /* The control endpoint, then each endpoint of the descriptors once */
+  CHECK_EQ(count, 2U + fs_ep_count);
+  if (count != 2U + fs_ep_count)
+  {
+    return;
+  }
+  CHECK_EQ(ep_addr[0], 0x00U);
+  CHECK_EQ(ep_addr[1], 0x80U);
+  pma_size[0] = USBD_MAX_EP0_SIZE;
+  pma_size[1] = USBD_MAX_EP0_SIZE;
+  for (uint32_t i = 2U; i < count; i++)
+  {
+    uint32_t found = 0U;
+
+    for (uint32_t e = 0U; e < fs_ep_count; e++)
+    {
+      if (fs_ep_addr[e] == ep_addr[i])
+      {
+        pma_size[i] = fs_ep_size[e];
+        found++;
+      }
+    }
+    CHECK_EQ(found, 1U);
+    if (found != 1U)
+    {
+      return;
+    }
+    for (uint32_t j = 2U; j < i; j++)
+    {
+      CHECK(ep_addr[j] != ep_addr[i]);
+    }
+    number_max = ((ep_addr[i] & 0x0FU) > number_max) ? (ep_addr[i] & 0x0FU) : number_max;
+  }
+
+  /* After the buffer descriptor table, word aligned, no overlap, in 2 KB */
+  CHECK(pma_addr[0] >= 8U * (number_max + 1U));
+  for (uint32_t i = 0U; i < count; i++)
+  {
+    uint32_t size = pma_size[i];
+
+    CHECK_EQ(pma_addr[i] % 4U, 0U);
+    if (i + 1U < count)
+    {
+      CHECK(pma_addr[i + 1U] >= pma_addr[i] + size);
+    }
+    CHECK(pma_addr[i] + size <= DESC_PMA_SIZE);
+  }
+}
+
+int main(void)
+{
+  char name[48];
+
+  test_framework(USBD_FULL_SPEED);
+  test_packet_memory();
+  test_framework(USBD_HIGH_SPEED);
+
+  snprintf(name, sizeof(name), "test_cdc_descriptors, %u CDC ACM", (unsigned)DESC_INSTANCES);
+  return test_report(name);
+}
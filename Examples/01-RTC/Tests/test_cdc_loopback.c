@@ -0,0 +1,156 @@
+/**
+  ******************************************************************************
+  * @file    test_cdc_loopback.c
+  * @brief   Host check of the CDC receive ring through the data loopback
+  ******************************************************************************
+  * The host streams a known byte sequence to the OUT endpoint in packets of
+  * random length, the device echoes it as app_data_run() does, and the host
+  * checks every byte it reads back. The host stops reading for a while now
+  * and then: the TX ring, then the RX ring fill up and the OUT endpoint must
+  * NAK, nothing may be lost. The byte count is the first argument, 1 MB by
+  * default.
+  ******************************************************************************
+  */
+#include "cdc_sim.h"
+#include "test.h"
+#include <stdlib.h>
+
+TEST_MAIN_DEFINE
+
+/* The data channel, after the protocol one when there are two */
+#define LOOP_CHANNEL        (CDC_STREAM_CHANNELS - 1U)
+
+static unsigned long host_sent;
+static unsigned long host_received;
+static unsigned long host_total;
+static unsigned long host_errors;
+/* Host not reading until then, in calls of the IN hook */
+static unsigned long host_stalled;
+
+static UCHAR loop_byte(unsigned long index)
+{
+  return (UCHAR)((index * 7U) + (index >> 8));
+}
+
+ULONG cdc_sim_host_out(UINT channel, UCHAR *packet, ULONG size)
+{
+  ULONG length = test_random() % (CDC_SIM_PACKET_SIZE + 1U);
+
+  /* Busy host, or nothing left to send on the data channel */
+  if ((channel != LOOP_CHANNEL) || ((test_random() & 3U) == 0U) || (host_sent == host_total))
+  {
+    return CDC_SIM_NAK;
+  }
+
+  /* Mostly whole packets, some short ones that end the transfer */
+  if ((test_random() & 1U) != 0U)
+  {
+    length = CDC_SIM_PACKET_SIZE;
+  }
+  if (length > size)
+  {
+    length = size;
+  }
+  if (length > (host_total - host_sent))
+  {
+    length = host_total - host_sent;
+  }
+
+  for (ULONG i = 0U; i < length; i++)
+  {
+    packet[i] = loop_byte(host_sent++);
+  }
+  return length;
+}
+
+UINT cdc_sim_host_in(UINT channel, const UCHAR *packet, ULONG length)
+{
+  /* Nothing is sent on the other channels */
+  if (channel != LOOP_CHANNEL)
+  {
+    CHECK_EQ(length, 0U);
+    return UX_TRUE;
+  }
+  if (host_stalled != 0U)
+  {
+    host_stalled--;
+    return UX_FALSE;
+  }
+  if ((test_random() % 4096U) == 0U)
+  {
+    host_stalled = 2000U;
+  }
+
+  for (ULONG i = 0U; i < length; i++)
+  {
+    if (packet[i] != loop_byte(host_received++))
+    {
+      host_errors++;
+    }
+  }
+  return UX_TRUE;
+}
+
+/* Echo as the application loop does, bounded by the TX ring room */
+static void loop_echo(void)
+{
+  UCHAR data[64];
+  ULONG length = cdc_tx_space(LOOP_CHANNEL);
+  ULONG chunk = (test_random() % sizeof(data)) + 1U;
+
+  if (length > chunk)
+  {
+    length = chunk;
+  }
+  length = cdc_rx_read(LOOP_CHANNEL, data, length);
+  if (length != 0U)
+  {
+    CHECK_EQ(cdc_tx_write(LOOP_CHANNEL, data, length), length);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long idle = 0U;
+  unsigned long calls = 0U;
+  unsigned long rx_full = 0U;
+
+  host_total = (argc > 1) ? strtoul(argv[1], NULL, 0) : (1UL << 20);
+
+  for (UINT channel = 0U; channel < CDC_STREAM_CHANNELS; channel++)
+  {
+    cdc_sim_attach(channel);
+  }
+
+  /* Until everything came back, or nothing moved for a long time */
+  while ((host_received < host_total) && (idle < 100000U))
+  {
+    unsigned long before = host_received;
+
+    loop_echo();
+    cdc_stream_run();
+    CHECK_EQ(cdc_sim_interrupt_depth, 0);
+
+    /* No room for a packet: the OUT transfer is not armed */
+    if ((CDC_RX_RING_SIZE - cdc_rx_available(LOOP_CHANNEL)) < CDC_SIM_PACKET_SIZE)
+    {
+      rx_full++;
+    }
+    /* 1 ms every 16 calls, for the coalescing deadline */
+    if ((++calls % 16U) == 0U)
+    {
+      cdc_sim_time++;
+    }
+    idle = (host_received == before) ? idle + 1U : 0U;
+  }
+
+  CHECK_EQ(host_sent, host_total);
+  CHECK_EQ(host_received, host_total);
+  CHECK_EQ(host_errors, 0U);
+  /* The host stalls did fill the receive ring, the OUT endpoint NAKed */
+  CHECK(rx_full > 0U);
+  CHECK_EQ(cdc_rx_available(LOOP_CHANNEL), 0U);
+
+  printf("test_cdc_loopback: %lu bytes, receive ring full for %lu calls\n", host_received, rx_full);
+  return test_report("test_cdc_loopback");
+}
@@ -0,0 +1,394 @@
+/**
+  ******************************************************************************
+  * @file    test_cdc_proto.c
+  * @brief   Host checks of the COBS/CRC record protocol
+  ******************************************************************************
+  * The host side is a separate reference COBS encoder and decoder and a
+  * bitwise CRC-16/CCITT-FALSE. Records sent by the device must decode, match
+  * their CRC and encode back to the same bytes. Commands, corrupted and
+  * oversized frames go the other way and the responses and statistics are
+  * checked.
+  ******************************************************************************
+  */
+#include "cdc_sim.h"
+#include "cdc_proto.h"
+#include "test.h"
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define HOST_BUFFER_SIZE    16384U
+#define HOST_FRAMES_MAX     128U
+
+typedef struct
+{
+  UCHAR type;
+  UCHAR sequence;
+  UCHAR payload[CDC_PROTO_PAYLOAD_MAX];
+  ULONG length;
+} Host_FrameTypeDef;
+
+/* Bytes read from the IN endpoint, bytes queued for the OUT endpoint */
+static UCHAR host_in[HOST_BUFFER_SIZE];
+static ULONG host_in_length;
+static UCHAR host_out[HOST_BUFFER_SIZE];
+static ULONG host_out_length;
+static ULONG host_out_sent;
+
+static Host_FrameTypeDef host_frames[HOST_FRAMES_MAX];
+static ULONG host_frame_count;
+
+/* Reference of the host side -----------------------------------------------*/
+static USHORT ref_crc(const UCHAR *data, ULONG length)
+{
+  USHORT crc = 0xFFFFU;
+
+  while (length--)
+  {
+    crc ^= (USHORT)(*data++ << 8);
+    for (UINT bit = 0U; bit < 8U; bit++)
+    {
+      crc = (crc & 0x8000U) ? (USHORT)((crc << 1) ^ 0x1021U) : (USHORT)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static ULONG ref_cobs_encode(UCHAR *out, const UCHAR *data, ULONG length)
+{
+  ULONG code_at = 0U;
+  ULONG at = 1U;
+  UCHAR code = 1U;
+
+  for (ULONG i = 0U; i < length; i++)
+  {
+    if (data[i] != 0U)
+    {
+      out[at++] = data[i];
+      code++;
+    }
+    if ((data[i] == 0U) || (code == 0xFFU))
+    {
+      out[code_at] = code;
+      code_at = at++;
+      code = 1U;
+    }
+  }
+  out[code_at] = code;
+  return at;
+}
+
+/* Returns the decoded length, 0 when the encoding is invalid */
+static ULONG ref_cobs_decode(UCHAR *out, const UCHAR *data, ULONG length)
+{
+  ULONG at = 0U;
+  ULONG decoded = 0U;
+
+  while (at < length)
+  {
+    UCHAR code = data[at++];
+
+    if ((code == 0U) || ((at + code - 1U) > length))
+    {
+      return 0U;
+    }
+    for (UCHAR i = 1U; i < code; i++)
+    {
+      out[decoded++] = data[at++];
+    }
+    if ((code != 0xFFU) && (at < length))
+    {
+      out[decoded++] = 0U;
+    }
+  }
+  return decoded;
+}
+
+/* Frame as the host sends it: type, sequence, payload, CRC, COBS, 0x00 */
+static ULONG ref_frame(UCHAR *out, UCHAR type, UCHAR sequence, const UCHAR *payload, ULONG length)
+{
+  UCHAR decoded[2U + 128U + 2U];
+  USHORT crc;
+  ULONG encoded;
+
+  decoded[0] = type;
+  decoded[1] = sequence;
+  memcpy(&decoded[2], payload, length);
+  crc = ref_crc(decoded, length + 2U);
+  decoded[length + 2U] = (UCHAR)(crc & 0xFFU);
+  decoded[length + 3U] = (UCHAR)(crc >> 8);
+
+  encoded = ref_cobs_encode(out, decoded, length + 4U);
+  out[encoded] = 0U;
+  return encoded + 1U;
+}
+
+/* Simulated host -----------------------------------------------------------*/
+ULONG cdc_sim_host_out(UINT channel, UCHAR *packet, ULONG size)
+{
+  ULONG length = host_out_length - host_out_sent;
+
+  if ((channel != CDC_PROTO_CHANNEL) || (length == 0U))
+  {
+    return CDC_SIM_NAK;
+  }
+  if (length > size)
+  {
+    length = size;
+  }
+  memcpy(packet, &host_out[host_out_sent], length);
+  host_out_sent += length;
+  return length;
+}
+
+UINT cdc_sim_host_in(UINT channel, const UCHAR *packet, ULONG length)
+{
+  if (channel != CDC_PROTO_CHANNEL)
+  {
+    CHECK_EQ(length, 0U);
+    return UX_TRUE;
+  }
+  CHECK(host_in_length + length <= HOST_BUFFER_SIZE);
+  if (host_in_length + length <= HOST_BUFFER_SIZE)
+  {
+    memcpy(&host_in[host_in_length], packet, length);
+    host_in_length += length;
+  }
+  return UX_TRUE;
+}
+
+static void host_queue(UCHAR type, UCHAR sequence, const UCHAR *payload, ULONG length)
+{
+  host_out_length += ref_frame(&host_out[host_out_length], type, sequence, payload, length);
+}
+
+static void host_queue_raw(const UCHAR *bytes, ULONG length)
+{
+  memcpy(&host_out[host_out_length], bytes, length);
+  host_out_length += length;
+}
+
+/* Run the device until both directions are idle past the coalescing
+   deadline, then split what the host read into frames */
+static void host_exchange(void)
+{
+  ULONG start = 0U;
+
+  for (UINT i = 0U; i < 2000U; i++)
+  {
+    cdc_proto_run();
+    cdc_stream_run();
+    CHECK_EQ(cdc_sim_interrupt_depth, 0);
+    if ((i % 8U) == 0U)
+    {
+      cdc_sim_time++;
+    }
+  }
+  CHECK_EQ(host_out_sent, host_out_length);
+
+  host_frame_count = 0U;
+  for (ULONG at = 0U; at < host_in_length; at++)
+  {
+    UCHAR decoded[256];
+    UCHAR encoded[256];
+    ULONG length;
+    Host_FrameTypeDef *frame;
+
+    if (host_in[at] != 0U)
+    {
+      continue;
+    }
+
+    /* Each frame decodes, carries its CRC and is the canonical encoding */
+    length = ref_cobs_decode(decoded, &host_in[start], at - start);
+    CHECK(length >= 4U);
+    CHECK(host_frame_count < HOST_FRAMES_MAX);
+    if ((length < 4U) || (host_frame_count >= HOST_FRAMES_MAX))
+    {
+      start = at + 1U;
+      continue;
+    }
+    CHECK_EQ(ref_crc(decoded, length - 2U),
+             decoded[length - 2U] | ((USHORT)decoded[length - 1U] << 8));
+    CHECK_EQ(ref_cobs_encode(encoded, decoded, length), at - start);
+    CHECK(memcmp(encoded, &host_in[start], at - start) == 0);
+
+    frame = &host_frames[host_frame_count++];
+    frame->type = decoded[0];
+    frame->sequence = decoded[1];
+    frame->length = length - 4U;
+    memcpy(frame->payload, &decoded[2], frame->length);
+    start = at + 1U;
+  }
+
+  /* Nothing after the last delimiter */
+  CHECK_EQ(start, host_in_length);
+  host_in_length = 0U;
+  host_out_length = 0U;
+  host_out_sent = 0U;
+}
+
+/* Application commands, as main.c installs them ----------------------------*/
+static UCHAR test_time[CDC_PROTO_RTC_LENGTH] = { 26, 10, 17, 12, 0, 0 };
+
+static UCHAR test_handler(UCHAR command, const UCHAR *request, ULONG request_length,
+                          UCHAR *response, ULONG *response_length)
+{
+  switch (command)
+  {
+    case CDC_PROTO_CMD_GET_TIME:
+      memcpy(response, test_time, CDC_PROTO_RTC_LENGTH);
+      *response_length = CDC_PROTO_RTC_LENGTH;
+      return CDC_PROTO_STATUS_OK;
+
+    case CDC_PROTO_CMD_SET_TIME:
+      if (request_length != CDC_PROTO_RTC_LENGTH)
+      {
+        return CDC_PROTO_STATUS_INVALID;
+      }
+      memcpy(test_time, request, CDC_PROTO_RTC_LENGTH);
+      return CDC_PROTO_STATUS_OK;
+
+    default:
+      return CDC_PROTO_STATUS_UNKNOWN;
+  }
+}
+
+/* Tests --------------------------------------------------------------------*/
+static void test_crc_reference(void)
+{
+  /* The CRC-16/CCITT-FALSE check value */
+  CHECK_EQ(ref_crc((const UCHAR *)"123456789", 9U), 0x29B1U);
+}
+
+static void test_records(void)
+{
+  UCHAR payload[CDC_PROTO_PAYLOAD_MAX + 1U];
+
+  /* Zeros at both ends and inside, every length */
+  for (ULONG i = 0U; i < sizeof(payload); i++)
+  {
+    payload[i] = ((i % 5U) == 0U) ? 0U : (UCHAR)(i * 37U);
+  }
+  for (ULONG length = 0U; length <= CDC_PROTO_PAYLOAD_MAX; length++)
+  {
+    CHECK_EQ(cdc_proto_send(CDC_PROTO_ADC, payload, length), UX_SUCCESS);
+    if ((length % 16U) == 15U)
+    {
+      host_exchange();
+      for (ULONG f = 0U; f < host_frame_count; f++)
+      {
+        ULONG expect = length - 15U + f;
+
+        CHECK_EQ(host_frames[f].type, CDC_PROTO_ADC);
+        CHECK_EQ(host_frames[f].sequence, (UCHAR)expect);
+        CHECK_EQ(host_frames[f].length, expect);
+        CHECK(memcmp(host_frames[f].payload, payload, expect) == 0);
+      }
+      CHECK_EQ(host_frame_count, 16U);
+    }
+  }
+
+  /* The last one, then one too long for a frame */
+  host_exchange();
+  CHECK_EQ(host_frame_count, 1U);
+  CHECK_EQ(host_frames[0].length, CDC_PROTO_PAYLOAD_MAX);
+  CHECK_EQ(cdc_proto_send(CDC_PROTO_ADC, payload, CDC_PROTO_PAYLOAD_MAX + 1U), UX_ERROR);
+  host_exchange();
+  CHECK_EQ(host_frame_count, 0U);
+}
+
+static void test_commands(void)
+{
+  static const UCHAR bad_cobs[] = { 0x05U, 0x81U, 0x01U, 0x00U };
+  UCHAR ping[CDC_PROTO_PAYLOAD_MAX];
+  UCHAR frame[128];
+  UCHAR time[CDC_PROTO_RTC_LENGTH] = { 27, 1, 2, 3, 4, 5 };
+  ULONG length;
+  const UCHAR *stats;
+
+  for (ULONG i = 0U; i < sizeof(ping); i++)
+  {
+    ping[i] = (UCHAR)(i * 3U);
+  }
+
+  cdc_proto_set_handler(test_handler);
+
+  host_queue(CDC_PROTO_CMD_PING, 1U, ping, 10U);
+  host_queue(CDC_PROTO_CMD_GET_TIME, 2U, NULL, 0U);
+  host_queue(CDC_PROTO_CMD_SET_TIME, 3U, time, sizeof(time));
+  host_queue(0x90U, 4U, NULL, 0U);
+
+  /* A flipped payload bit, a record type, a code past the end: rejected */
+  length = ref_frame(frame, CDC_PROTO_CMD_PING, 5U, ping, 4U);
+  frame[3] ^= 0x01U;
+  host_queue_raw(frame, length);
+  host_queue(CDC_PROTO_ADC, 6U, NULL, 0U);
+  host_queue_raw(bad_cobs, sizeof(bad_cobs));
+  /* Longer than any frame: dropped up to its delimiter */
+  memset(frame, 0x55U, sizeof(frame));
+  frame[sizeof(frame) - 1U] = 0U;
+  host_queue_raw(frame, sizeof(frame));
+  /* Empty frames are ignored */
+  host_queue_raw((const UCHAR *)"\0\0", 2U);
+  /* The longest ping, the echo keeps what fits after the status */
+  host_queue(CDC_PROTO_CMD_PING, 7U, ping, CDC_PROTO_PAYLOAD_MAX);
+  host_queue(CDC_PROTO_CMD_GET_STATS, 8U, NULL, 0U);
+
+  host_exchange();
+  CHECK_EQ(host_frame_count, 6U);
+  if (host_frame_count != 6U)
+  {
+    return;
+  }
+
+  /* Responses in order, with the type and sequence of the request */
+  CHECK_EQ(host_frames[0].type, CDC_PROTO_CMD_PING);
+  CHECK_EQ(host_frames[0].sequence, 1U);
+  CHECK_EQ(host_frames[0].length, 11U);
+  CHECK_EQ(host_frames[0].payload[0], CDC_PROTO_STATUS_OK);
+  CHECK(memcmp(&host_frames[0].payload[1], ping, 10U) == 0);
+
+  CHECK_EQ(host_frames[1].type, CDC_PROTO_CMD_GET_TIME);
+  CHECK_EQ(host_frames[1].sequence, 2U);
+  CHECK_EQ(host_frames[1].length, 1U + CDC_PROTO_RTC_LENGTH);
+  CHECK(memcmp(&host_frames[1].payload[1], (const UCHAR[]){ 26, 10, 17, 12, 0, 0 },
+               CDC_PROTO_RTC_LENGTH) == 0);
+
+  CHECK_EQ(host_frames[2].type, CDC_PROTO_CMD_SET_TIME);
+  CHECK_EQ(host_frames[2].payload[0], CDC_PROTO_STATUS_OK);
+  CHECK(memcmp(test_time, time, sizeof(time)) == 0);
+
+  CHECK_EQ(host_frames[3].type, 0x90U);
+  CHECK_EQ(host_frames[3].sequence, 4U);
+  CHECK_EQ(host_frames[3].length, 1U);
+  CHECK_EQ(host_frames[3].payload[0], CDC_PROTO_STATUS_UNKNOWN);
+
+  CHECK_EQ(host_frames[4].sequence, 7U);
+  CHECK_EQ(host_frames[4].length, CDC_PROTO_PAYLOAD_MAX);
+  CHECK(memcmp(&host_frames[4].payload[1], ping, CDC_PROTO_PAYLOAD_MAX - 1U) == 0);
+
+  /* Records sent, dropped, frames received, rejected, commands */
+  CHECK_EQ(host_frames[5].type, CDC_PROTO_CMD_GET_STATS);
+  CHECK_EQ(host_frames[5].length, 1U + CDC_PROTO_STATS_LENGTH);
+  stats = &host_frames[5].payload[1];
+  CHECK_EQ(stats[0] | (stats[1] << 8), CDC_PROTO_PAYLOAD_MAX + 1U);
+  CHECK_EQ(stats[4], 1U);
+  CHECK_EQ(stats[8], 6U);
+  CHECK_EQ(stats[12], 4U);
+  CHECK_EQ(stats[16], 6U);
+}
+
+int main(void)
+{
+  for (UINT channel = 0U; channel < CDC_STREAM_CHANNELS; channel++)
+  {
+    cdc_sim_attach(channel);
+  }
+
+  test_crc_reference();
+  test_records();
+  test_commands();
+
+  return test_report("test_cdc_proto");
+}
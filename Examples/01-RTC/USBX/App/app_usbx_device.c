@@ -50,8 +50,8 @@
 #pragma data_alignment=4
 #endif
 __ALIGN_BEGIN static UCHAR ux_device_byte_pool_buffer[UX_DEVICE_APP_MEM_POOL_SIZE] __ALIGN_END;
-static ULONG cdc_acm_interface_number;
-static ULONG cdc_acm_configuration_number;
+static ULONG cdc_acm_interface_number[USBD_CDC_ACM_INSTANCES];
+static ULONG cdc_acm_configuration_number[USBD_CDC_ACM_INSTANCES];
 static UX_SLAVE_CLASS_CDC_ACM_PARAMETER cdc_acm_parameter;
 
 /* USER CODE BEGIN PV */
@@ -81,6 +81,7 @@ UINT MX_USBX_Device_Init(VOID)
   UCHAR *string_framework;
   UCHAR *language_id_framework;
   UCHAR *pointer;
+  UINT instance;
 
   /* USER CODE BEGIN MX_USBX_Device_Init0 */
 
@@ -134,22 +135,27 @@ UINT MX_USBX_Device_Init(VOID)
 
   /* USER CODE END CDC_ACM_PARAMETER */
 
-  /* Get cdc acm configuration number */
-  cdc_acm_configuration_number = USBD_Get_Configuration_Number(CLASS_TYPE_CDC_ACM, 0);
-
-  /* Find cdc acm interface number */
-  cdc_acm_interface_number = USBD_Get_Interface_Number(CLASS_TYPE_CDC_ACM, 0);
-
-  /* Initialize the device cdc acm class */
-  if (ux_device_stack_class_register(_ux_system_slave_class_cdc_acm_name,
-                                     ux_device_class_cdc_acm_entry,
-                                     cdc_acm_configuration_number,
-                                     cdc_acm_interface_number,
-                                     &cdc_acm_parameter) != UX_SUCCESS)
+  for (instance = 0U; instance < USBD_CDC_ACM_INSTANCES; instance++)
   {
-    /* USER CODE BEGIN USBX_DEVICE_CDC_ACM_REGISTER_ERROR */
-    return UX_ERROR;
-    /* USER CODE END USBX_DEVICE_CDC_ACM_REGISTER_ERROR */
+    /* Get cdc acm configuration number */
+    cdc_acm_configuration_number[instance] = USBD_Get_Configuration_Number(CLASS_TYPE_CDC_ACM,
+                                                                           (uint8_t)instance);
+
+    /* Find cdc acm interface number */
+    cdc_acm_interface_number[instance] = USBD_Get_Interface_Number(CLASS_TYPE_CDC_ACM,
+                                                                   (uint8_t)instance);
+
+    /* Initialize the device cdc acm class */
+    if (ux_device_stack_class_register(_ux_system_slave_class_cdc_acm_name,
+                                       ux_device_class_cdc_acm_entry,
+                                       cdc_acm_configuration_number[instance],
+                                       cdc_acm_interface_number[instance],
+                                       &cdc_acm_parameter) != UX_SUCCESS)
+    {
+      /* USER CODE BEGIN USBX_DEVICE_CDC_ACM_REGISTER_ERROR */
+      return UX_ERROR;
+      /* USER CODE END USBX_DEVICE_CDC_ACM_REGISTER_ERROR */
+    }
   }
 
   /* USER CODE BEGIN MX_USBX_Device_Init1 */
@@ -42,8 +42,9 @@ extern "C" {
 /* USER CODE END ET */
 
 /* Exported constants --------------------------------------------------------*/
-#define UX_DEVICE_APP_MEM_POOL_SIZE         1024
-#define USBX_DEVICE_MEMORY_STACK_SIZE       6*1024
+/* Endpoint buffers and class instances take about 2K per CDC ACM function */
+#define USBX_DEVICE_MEMORY_STACK_SIZE       (4*1024 + 2*1024*USBD_CDC_ACM_INSTANCES)
+#define UX_DEVICE_APP_MEM_POOL_SIZE         USBX_DEVICE_MEMORY_STACK_SIZE
 
 /* USER CODE BEGIN EC */
 
@@ -0,0 +1,403 @@
+/**
+  ******************************************************************************
+  * @file    cdc_proto.c
+  * @brief   Binary record protocol over the CDC ACM stream
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "cdc_proto.h"
+#include "cdc_stream.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+/* type, sequence, payload and CRC */
+#define CDC_PROTO_DECODED_MAX     (2U + CDC_PROTO_PAYLOAD_MAX + 2U)
+
+/* One COBS code byte per 254 bytes plus the delimiter */
+#define CDC_PROTO_FRAME_MAX       (CDC_PROTO_DECODED_MAX + (CDC_PROTO_DECODED_MAX / 254U) + 2U)
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  CDC_TxReserveTypeDef *reserve;
+  ULONG code_index;
+  ULONG index;
+  UCHAR code;
+  USHORT crc;
+} CDC_ProtoEncoderTypeDef;
+
+typedef struct
+{
+  ULONG records_sent;
+  ULONG records_dropped;
+  ULONG frames_received;
+  ULONG frames_rejected;
+  ULONG commands;
+} CDC_ProtoStatsTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+static CDC_ProtoHandlerTypeDef cdc_proto_handler;
+static CDC_ProtoStatsTypeDef cdc_proto_stats;
+static UCHAR cdc_proto_sequence;
+
+/* Encoded frame being received, discarded up to the next delimiter when it
+   does not fit */
+static UCHAR cdc_proto_frame[CDC_PROTO_FRAME_MAX];
+static ULONG cdc_proto_frame_length;
+static UINT cdc_proto_frame_overflow;
+
+/* Private function prototypes -----------------------------------------------*/
+static USHORT cdc_proto_crc(USHORT crc, UCHAR byte);
+static UCHAR *cdc_proto_at(CDC_TxReserveTypeDef *reserve, ULONG index);
+static VOID cdc_proto_put(CDC_ProtoEncoderTypeDef *encoder, UCHAR byte);
+static UINT cdc_proto_frame_send(UCHAR type, UCHAR sequence, const UCHAR *header, ULONG header_length,
+                                 const UCHAR *payload, ULONG length);
+static ULONG cdc_proto_decode(UCHAR *frame, ULONG length);
+static VOID cdc_proto_stats_get(UCHAR *payload);
+static VOID cdc_proto_command(UCHAR type, UCHAR sequence, const UCHAR *request, ULONG length);
+static VOID cdc_proto_receive(VOID);
+
+/* Private user code ---------------------------------------------------------*/
+/**
+  * @brief  cdc_proto_crc
+  *         CRC-16/CCITT-FALSE update.
+  * @param  crc: current value, 0xFFFF to start.
+  * @param  byte: next byte.
+  * @retval updated CRC
+  */
+static USHORT cdc_proto_crc(USHORT crc, UCHAR byte)
+{
+  UINT bit;
+
+  crc ^= (USHORT)((USHORT)byte << 8);
+  for (bit = 0U; bit < 8U; bit++)
+  {
+    crc = ((crc & 0x8000U) != 0U) ? (USHORT)((crc << 1) ^ 0x1021U) : (USHORT)(crc << 1);
+  }
+
+  return crc;
+}
+
+/**
+  * @brief  cdc_proto_at
+  *         Address of a byte of a TX ring reservation.
+  * @param  reserve: reservation.
+  * @param  index: byte index from the start of the reservation.
+  * @retval byte address
+  */
+static UCHAR *cdc_proto_at(CDC_TxReserveTypeDef *reserve, ULONG index)
+{
+  if (index < reserve->length[0])
+  {
+    return &reserve->data[0][index];
+  }
+
+  return &reserve->data[1][index - reserve->length[0]];
+}
+
+/**
+  * @brief  cdc_proto_put
+  *         COBS encode one byte into the reservation.
+  * @param  encoder: encoder state.
+  * @param  byte: decoded byte.
+  * @retval none
+  */
+static VOID cdc_proto_put(CDC_ProtoEncoderTypeDef *encoder, UCHAR byte)
+{
+  encoder->crc = cdc_proto_crc(encoder->crc, byte);
+
+  if (byte != 0U)
+  {
+    *cdc_proto_at(encoder->reserve, encoder->index++) = byte;
+    encoder->code++;
+  }
+
+  /* A zero, or a full block, closes the block with its code byte */
+  if ((byte == 0U) || (encoder->code == 0xFFU))
+  {
+    *cdc_proto_at(encoder->reserve, encoder->code_index) = encoder->code;
+    encoder->code_index = encoder->index++;
+    encoder->code = 1U;
+  }
+}
+
+/**
+  * @brief  cdc_proto_frame_send
+  *         Encode a frame straight into the TX ring.
+  * @param  type: record or command type.
+  * @param  sequence: frame sequence number.
+  * @param  header: payload bytes sent first, may be NULL.
+  * @param  header_length: number of header bytes.
+  * @param  payload: rest of the payload.
+  * @param  length: number of payload bytes.
+  * @retval UX_SUCCESS, or UX_ERROR when the ring is full
+  */
+static UINT cdc_proto_frame_send(UCHAR type, UCHAR sequence, const UCHAR *header, ULONG header_length,
+                                 const UCHAR *payload, ULONG length)
+{
+  CDC_TxReserveTypeDef reserve;
+  CDC_ProtoEncoderTypeDef encoder;
+  USHORT crc;
+  ULONG i;
+
+  if (cdc_tx_reserve(CDC_PROTO_CHANNEL, &reserve, CDC_PROTO_FRAME_MAX) != UX_SUCCESS)
+  {
+    return UX_ERROR;
+  }
+
+  encoder.reserve = &reserve;
+  encoder.code_index = 0U;
+  encoder.index = 1U;
+  encoder.code = 1U;
+  encoder.crc = 0xFFFFU;
+
+  cdc_proto_put(&encoder, type);
+  cdc_proto_put(&encoder, sequence);
+  for (i = 0U; i < header_length; i++)
+  {
+    cdc_proto_put(&encoder, header[i]);
+  }
+  for (i = 0U; i < length; i++)
+  {
+    cdc_proto_put(&encoder, payload[i]);
+  }
+
+  crc = encoder.crc;
+  cdc_proto_put(&encoder, (UCHAR)(crc & 0xFFU));
+  cdc_proto_put(&encoder, (UCHAR)(crc >> 8));
+
+  *cdc_proto_at(&reserve, encoder.code_index) = encoder.code;
+  *cdc_proto_at(&reserve, encoder.index++) = 0U;
+
+  cdc_tx_commit(&reserve, encoder.index);
+
+  return UX_SUCCESS;
+}
+
+/**
+  * @brief  cdc_proto_decode
+  *         COBS decode a frame in place.
+  * @param  frame: encoded bytes, without the delimiter.
+  * @param  length: number of encoded bytes.
+  * @retval decoded length, 0 when the encoding is invalid
+  */
+static ULONG cdc_proto_decode(UCHAR *frame, ULONG length)
+{
+  ULONG in = 0U;
+  ULONG out = 0U;
+  ULONG code;
+  ULONG i;
+
+  while (in < length)
+  {
+    code = frame[in++];
+    if ((code == 0U) || ((in + code - 1U) > length))
+    {
+      return 0U;
+    }
+
+    for (i = 1U; i < code; i++)
+    {
+      frame[out++] = frame[in++];
+    }
+
+    /* Every block but a full one and the last one stands for a zero */
+    if ((code != 0xFFU) && (in < length))
+    {
+      frame[out++] = 0U;
+    }
+  }
+
+  return out;
+}
+
+/**
+  * @brief  cdc_proto_stats_get
+  *         Fill a stats record payload.
+  * @param  payload: CDC_PROTO_STATS_LENGTH bytes.
+  * @retval none
+  */
+static VOID cdc_proto_stats_get(UCHAR *payload)
+{
+  ULONG values[CDC_PROTO_STATS_LENGTH / 4U];
+  ULONG i;
+
+  values[0] = cdc_proto_stats.records_sent;
+  values[1] = cdc_proto_stats.records_dropped;
+  values[2] = cdc_proto_stats.frames_received;
+  values[3] = cdc_proto_stats.frames_rejected;
+  values[4] = cdc_proto_stats.commands;
+
+  for (i = 0U; i < (CDC_PROTO_STATS_LENGTH / 4U); i++)
+  {
+    payload[(i * 4U) + 0U] = (UCHAR)(values[i]);
+    payload[(i * 4U) + 1U] = (UCHAR)(values[i] >> 8);
+    payload[(i * 4U) + 2U] = (UCHAR)(values[i] >> 16);
+    payload[(i * 4U) + 3U] = (UCHAR)(values[i] >> 24);
+  }
+}
+
+/**
+  * @brief  cdc_proto_command
+  *         Run a host command and send its response.
+  * @param  type: command type.
+  * @param  sequence: sequence of the request, echoed.
+  * @param  request: request payload.
+  * @param  length: request payload length.
+  * @retval none
+  */
+static VOID cdc_proto_command(UCHAR type, UCHAR sequence, const UCHAR *request, ULONG length)
+{
+  UCHAR response[CDC_PROTO_PAYLOAD_MAX - 1U];
+  ULONG response_length = 0U;
+  UCHAR status;
+
+  cdc_proto_stats.commands++;
+
+  switch (type)
+  {
+    case CDC_PROTO_CMD_PING:
+      memcpy(response, request, (length < sizeof(response)) ? length : sizeof(response));
+      response_length = (length < sizeof(response)) ? length : sizeof(response);
+      status = CDC_PROTO_STATUS_OK;
+      break;
+
+    case CDC_PROTO_CMD_GET_STATS:
+      cdc_proto_stats_get(response);
+      response_length = CDC_PROTO_STATS_LENGTH;
+      status = CDC_PROTO_STATUS_OK;
+      break;
+
+    default:
+      status = CDC_PROTO_STATUS_UNKNOWN;
+      if (cdc_proto_handler != UX_NULL)
+      {
+        status = cdc_proto_handler(type, request, length, response, &response_length);
+      }
+      break;
+  }
+
+  if (cdc_proto_frame_send(type, sequence, &status, 1U, response, response_length) != UX_SUCCESS)
+  {
+    cdc_proto_stats.records_dropped++;
+  }
+
+  /* The host waits for the response, do not hold it for coalescing */
+  cdc_tx_flush(CDC_PROTO_CHANNEL);
+}
+
+/**
+  * @brief  cdc_proto_receive
+  *         Check and dispatch the frame held in cdc_proto_frame.
+  * @param  none
+  * @retval none
+  */
+static VOID cdc_proto_receive(VOID)
+{
+  ULONG length = cdc_proto_decode(cdc_proto_frame, cdc_proto_frame_length);
+  USHORT crc = 0xFFFFU;
+  ULONG i;
+
+  if (length < 4U)
+  {
+    cdc_proto_stats.frames_rejected++;
+    return;
+  }
+
+  for (i = 0U; i < (length - 2U); i++)
+  {
+    crc = cdc_proto_crc(crc, cdc_proto_frame[i]);
+  }
+  if ((cdc_proto_frame[length - 2U] != (UCHAR)(crc & 0xFFU)) ||
+      (cdc_proto_frame[length - 1U] != (UCHAR)(crc >> 8)) ||
+      ((cdc_proto_frame[0] & CDC_PROTO_CMD) == 0U))
+  {
+    cdc_proto_stats.frames_rejected++;
+    return;
+  }
+
+  cdc_proto_stats.frames_received++;
+  cdc_proto_command(cdc_proto_frame[0], cdc_proto_frame[1], &cdc_proto_frame[2], length - 4U);
+}
+
+/**
+  * @brief  cdc_proto_set_handler
+  *         Install the handler of the application commands.
+  * @param  handler: called for the commands not handled here, may be NULL.
+  * @retval none
+  */
+VOID cdc_proto_set_handler(CDC_ProtoHandlerTypeDef handler)
+{
+  cdc_proto_handler = handler;
+}
+
+/**
+  * @brief  cdc_proto_send
+  *         Send a record, from the main loop.
+  * @param  type: record type.
+  * @param  payload: record payload.
+  * @param  length: payload length, up to CDC_PROTO_PAYLOAD_MAX.
+  * @retval UX_SUCCESS, or UX_ERROR when the record is dropped
+  */
+UINT cdc_proto_send(UCHAR type, const UCHAR *payload, ULONG length)
+{
+  UINT status = UX_ERROR;
+
+  if (length <= CDC_PROTO_PAYLOAD_MAX)
+  {
+    status = cdc_proto_frame_send(type, cdc_proto_sequence, UX_NULL, 0U, payload, length);
+  }
+
+  if (status == UX_SUCCESS)
+  {
+    cdc_proto_sequence++;
+    cdc_proto_stats.records_sent++;
+  }
+  else
+  {
+    cdc_proto_stats.records_dropped++;
+  }
+
+  return status;
+}
+
+/**
+  * @brief  cdc_proto_run
+  *         Receive commands, called from the main loop. Reading stops while
+  *         a response could not be queued, which holds the host off.
+  * @param  none
+  * @retval none
+  */
+VOID cdc_proto_run(VOID)
+{
+  UCHAR byte;
+
+  while ((cdc_tx_space(CDC_PROTO_CHANNEL) >= CDC_PROTO_FRAME_MAX) && (cdc_rx_read(CDC_PROTO_CHANNEL, &byte, 1U) != 0U))
+  {
+    if (byte != 0U)
+    {
+      if (cdc_proto_frame_length < sizeof(cdc_proto_frame))
+      {
+        cdc_proto_frame[cdc_proto_frame_length++] = byte;
+      }
+      else
+      {
+        cdc_proto_frame_overflow = UX_TRUE;
+      }
+      continue;
+    }
+
+    if (cdc_proto_frame_overflow)
+    {
+      cdc_proto_stats.frames_rejected++;
+    }
+    else if (cdc_proto_frame_length != 0U)
+    {
+      cdc_proto_receive();
+    }
+
+    cdc_proto_frame_length = 0U;
+    cdc_proto_frame_overflow = UX_FALSE;
+  }
+}
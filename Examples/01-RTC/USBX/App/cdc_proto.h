@@ -0,0 +1,83 @@
+/**
+  ******************************************************************************
+  * @file    cdc_proto.h
+  * @brief   Binary record protocol over the CDC ACM stream
+  ******************************************************************************
+  * Every frame is COBS encoded and terminated by a 0x00 byte. Decoded it is
+  *   type (1) | sequence (1) | payload (0 to CDC_PROTO_PAYLOAD_MAX) | CRC (2)
+  * where the CRC is the CRC-16/CCITT-FALSE of type, sequence and payload.
+  * Multi-byte fields are little endian.
+  *
+  * Records sent by the device, the sequence counts them:
+  *  - CDC_PROTO_HELLO   board name, ASCII
+  *  - CDC_PROTO_RTC     year - 2000, month, day, hours, minutes, seconds
+  *  - CDC_PROTO_ADC     millivolts (2), raw sample (2)
+  *  - CDC_PROTO_BUTTON  state (1), 1 when pressed
+  *  - CDC_PROTO_STATS   records sent, records dropped, frames received,
+  *                      frames rejected, commands (4 bytes each)
+  *
+  * Commands from the host have the top bit of the type set. The response has
+  * the type and sequence of the request, its payload starts with a status:
+  *  - CDC_PROTO_CMD_PING       the request payload is echoed
+  *  - CDC_PROTO_CMD_GET_STATS  followed by a stats record payload
+  *  - CDC_PROTO_CMD_GET_TIME   followed by an RTC record payload
+  *  - CDC_PROTO_CMD_SET_TIME   request payload is an RTC record payload
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __CDC_PROTO_H__
+#define __CDC_PROTO_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "ux_api.h"
+
+/* Exported constants --------------------------------------------------------*/
+/* CDC stream channel carrying the protocol */
+#ifndef CDC_PROTO_CHANNEL
+#define CDC_PROTO_CHANNEL           0U
+#endif
+
+#define CDC_PROTO_PAYLOAD_MAX       64U
+
+/* Record types */
+#define CDC_PROTO_HELLO             0x01U
+#define CDC_PROTO_RTC               0x02U
+#define CDC_PROTO_ADC               0x03U
+#define CDC_PROTO_BUTTON            0x04U
+#define CDC_PROTO_STATS             0x05U
+
+/* Command types */
+#define CDC_PROTO_CMD               0x80U
+#define CDC_PROTO_CMD_PING          0x80U
+#define CDC_PROTO_CMD_GET_STATS     0x81U
+#define CDC_PROTO_CMD_GET_TIME      0x82U
+#define CDC_PROTO_CMD_SET_TIME      0x83U
+
+/* Response status */
+#define CDC_PROTO_STATUS_OK         0x00U
+#define CDC_PROTO_STATUS_UNKNOWN    0x01U
+#define CDC_PROTO_STATUS_INVALID    0x02U
+#define CDC_PROTO_STATUS_FAILED     0x03U
+
+#define CDC_PROTO_RTC_LENGTH        6U
+#define CDC_PROTO_STATS_LENGTH      20U
+
+/* Exported types ------------------------------------------------------------*/
+/* Application commands, returns a status and fills up to
+   CDC_PROTO_PAYLOAD_MAX - 1 bytes of response */
+typedef UCHAR (*CDC_ProtoHandlerTypeDef)(UCHAR command, const UCHAR *request, ULONG request_length,
+                                         UCHAR *response, ULONG *response_length);
+
+/* Exported functions prototypes ---------------------------------------------*/
+VOID cdc_proto_set_handler(CDC_ProtoHandlerTypeDef handler);
+UINT cdc_proto_send(UCHAR type, const UCHAR *payload, ULONG length);
+VOID cdc_proto_run(VOID);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  /* __CDC_PROTO_H__ */
@@ -0,0 +1,595 @@
+/**
+  ******************************************************************************
+  * @file    cdc_stream.c
+  * @brief   Streaming bulk transfers of the CDC ACM interface
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "cdc_stream.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CDC_TX_RING_MASK          (CDC_TX_RING_SIZE - 1U)
+#define CDC_RX_RING_MASK          (CDC_RX_RING_SIZE - 1U)
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  UCHAR buffer[CDC_TX_RING_SIZE];
+
+  /* Free running indexes, head is moved by the producers, tail once the
+     host acknowledged the data */
+  volatile ULONG head;
+  volatile ULONG tail;
+
+  /* Transfer in flight */
+  UINT busy;
+  ULONG length;
+  ULONG host_length;
+
+  /* Coalescing: the host transfer is left open after whole packets, data
+     short of a packet is held from hold_tick until the deadline */
+  UINT open;
+  UINT holding;
+  ULONG hold_tick;
+  volatile UINT flush;
+
+  UX_SLAVE_TRANSFER *transfer;
+  UCHAR *transfer_buffer;    /* endpoint buffer allocated by the stack */
+  ULONG packet_size;
+} CDC_TxTypeDef;
+
+typedef struct
+{
+  UCHAR buffer[CDC_RX_RING_SIZE];
+
+  /* Free running indexes, head is moved by cdc_stream_run, tail by the
+     reader */
+  volatile ULONG head;
+  volatile ULONG tail;
+
+  /* Transfer armed, length is 0 when idle */
+  ULONG length;
+  UINT in_place;             /* received straight into the ring */
+
+  UX_SLAVE_TRANSFER *transfer;
+  UCHAR *transfer_buffer;
+  ULONG packet_size;
+} CDC_RxTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+static CDC_TxTypeDef cdc_tx[CDC_STREAM_CHANNELS];
+static CDC_RxTypeDef cdc_rx[CDC_STREAM_CHANNELS];
+
+/* Private function prototypes -----------------------------------------------*/
+static UINT cdc_stream_tx_start(CDC_TxTypeDef *tx);
+static VOID cdc_stream_tx_run(CDC_TxTypeDef *tx);
+static UINT cdc_stream_rx_start(CDC_RxTypeDef *rx);
+static VOID cdc_stream_rx_run(CDC_RxTypeDef *rx);
+
+/* Private user code ---------------------------------------------------------*/
+/**
+  * @brief  cdc_stream_tx_start
+  *         Point the IN transfer at the oldest part of the ring. Unless the
+  *         data is flushed or held past the deadline, only whole packets are
+  *         sent and the host transfer is left open.
+  * @param  tx: transmit state of the channel.
+  * @retval UX_FALSE when nothing is to be sent yet
+  */
+static UINT cdc_stream_tx_start(CDC_TxTypeDef *tx)
+{
+  UX_SLAVE_TRANSFER *transfer = tx->transfer;
+  ULONG head = tx->head;
+  ULONG tail = tx->tail;
+  ULONG offset = tail & CDC_TX_RING_MASK;
+  ULONG contiguous = CDC_TX_RING_SIZE - offset;
+  ULONG length = head - tail;
+  ULONG first;
+  UINT flush;
+
+  /* Past the deadline the held data is flushed, up to the ring head */
+#if CDC_TX_COALESCE_MS > 0U
+  if (tx->holding && ((_ux_utility_time_get() - tx->hold_tick) >= CDC_TX_COALESCE_MS))
+#endif
+  {
+    tx->flush = UX_TRUE;
+  }
+  flush = tx->flush;
+
+  if (!flush)
+  {
+    length -= length % tx->packet_size;
+  }
+
+  /* Nothing to send but maybe an open host transfer to close, wait for the
+     deadline or a flush */
+  if ((length == 0U) && (!flush || (!tx->open && (head == tail))))
+  {
+    if (!tx->holding && (tx->open || (head != tail)))
+    {
+      tx->holding = UX_TRUE;
+      tx->hold_tick = _ux_utility_time_get();
+    }
+    if (flush)
+    {
+      tx->flush = UX_FALSE;
+    }
+    return UX_FALSE;
+  }
+
+  if ((length > contiguous) && ((contiguous % tx->packet_size) == 0U))
+  {
+    /* Wrap on a packet boundary, the rest goes next */
+    length = contiguous;
+  }
+
+  if ((length <= contiguous) && (((ULONG)&tx->buffer[offset] % CDC_TX_ZERO_COPY_ALIGN) == 0U))
+  {
+    /* The DCD sends straight from the ring */
+    transfer->ux_slave_transfer_request_data_pointer = &tx->buffer[offset];
+  }
+  else
+  {
+    if (length > UX_SLAVE_REQUEST_DATA_MAX_LENGTH)
+    {
+      length = UX_SLAVE_REQUEST_DATA_MAX_LENGTH;
+    }
+    first = (contiguous < length) ? contiguous : length;
+    memcpy(tx->transfer_buffer, &tx->buffer[offset], first);
+    memcpy(&tx->transfer_buffer[first], tx->buffer, length - first);
+  }
+
+  tx->length = length;
+  tx->host_length = length;
+  tx->open = ((length % tx->packet_size) == 0U) ? UX_TRUE : UX_FALSE;
+  tx->holding = UX_FALSE;
+
+  /* When a flush drains the ring the host is told to expect more than sent,
+     so that a packet multiple, or nothing, is closed by a ZLP */
+  if (flush && ((tail + length) == head))
+  {
+    tx->host_length = length + 1U;
+    tx->open = UX_FALSE;
+    tx->flush = UX_FALSE;
+  }
+
+  tx->busy = UX_TRUE;
+  UX_SLAVE_TRANSFER_STATE_RESET(transfer);
+
+  return UX_TRUE;
+}
+
+/**
+  * @brief  cdc_stream_tx_run
+  *         Transmit state machine. A new transfer is started as soon as the
+  *         previous one ends and data is queued.
+  * @param  tx: transmit state of the channel.
+  * @retval none
+  */
+static VOID cdc_stream_tx_run(CDC_TxTypeDef *tx)
+{
+  UX_SLAVE_TRANSFER *transfer = tx->transfer;
+  UINT status;
+
+  for (;;)
+  {
+    if (!tx->busy && (cdc_stream_tx_start(tx) == UX_FALSE))
+    {
+      return;
+    }
+
+    status = ux_device_stack_transfer_run(transfer, tx->length, tx->host_length);
+    if (status == UX_STATE_WAIT)
+    {
+      return;
+    }
+
+    transfer->ux_slave_transfer_request_data_pointer = tx->transfer_buffer;
+    tx->busy = UX_FALSE;
+    if (status != UX_STATE_NEXT)
+    {
+      /* Keep the data, it is sent again on the next call */
+      return;
+    }
+
+    tx->tail += tx->length;
+  }
+}
+
+/**
+  * @brief  cdc_stream_rx_start
+  *         Arm the OUT transfer for as many whole packets as the ring takes.
+  * @param  rx: receive state of the channel.
+  * @retval UX_FALSE when the ring is too full, the endpoint then NAKs
+  */
+static UINT cdc_stream_rx_start(CDC_RxTypeDef *rx)
+{
+  UX_SLAVE_TRANSFER *transfer = rx->transfer;
+  ULONG offset = rx->head & CDC_RX_RING_MASK;
+  ULONG length = CDC_RX_RING_SIZE - (rx->head - rx->tail);
+
+  if (length > UX_SLAVE_REQUEST_DATA_MAX_LENGTH)
+  {
+    length = UX_SLAVE_REQUEST_DATA_MAX_LENGTH;
+  }
+  length -= length % rx->packet_size;
+  if (length == 0U)
+  {
+    return UX_FALSE;
+  }
+
+  /* Receive in place unless the transfer would cross the end of the ring */
+  rx->in_place = ((CDC_RX_RING_SIZE - offset) >= length) ? UX_TRUE : UX_FALSE;
+  if (rx->in_place)
+  {
+    transfer->ux_slave_transfer_request_data_pointer = &rx->buffer[offset];
+  }
+
+  rx->length = length;
+  UX_SLAVE_TRANSFER_STATE_RESET(transfer);
+
+  return UX_TRUE;
+}
+
+/**
+  * @brief  cdc_stream_rx_run
+  *         Receive state machine. The OUT transfer is armed again as soon as
+  *         the previous one ends, as long as the ring has room.
+  * @param  rx: receive state of the channel.
+  * @retval none
+  */
+static VOID cdc_stream_rx_run(CDC_RxTypeDef *rx)
+{
+  UX_SLAVE_TRANSFER *transfer = rx->transfer;
+  ULONG head;
+  ULONG offset;
+  ULONG first;
+  ULONG length;
+  UINT status;
+
+  for (;;)
+  {
+    if ((rx->length == 0U) && (cdc_stream_rx_start(rx) == UX_FALSE))
+    {
+      return;
+    }
+
+    status = ux_device_stack_transfer_run(transfer, rx->length, rx->length);
+    if (status == UX_STATE_WAIT)
+    {
+      return;
+    }
+
+    transfer->ux_slave_transfer_request_data_pointer = rx->transfer_buffer;
+    rx->length = 0U;
+    if (status != UX_STATE_NEXT)
+    {
+      return;
+    }
+
+    head = rx->head;
+    length = transfer->ux_slave_transfer_request_actual_length;
+    if (!rx->in_place)
+    {
+      offset = head & CDC_RX_RING_MASK;
+      first = CDC_RX_RING_SIZE - offset;
+      if (first > length)
+      {
+        first = length;
+      }
+      memcpy(&rx->buffer[offset], rx->transfer_buffer, first);
+      memcpy(rx->buffer, &rx->transfer_buffer[first], length - first);
+    }
+
+    /* Published once the bytes are in the ring */
+    rx->head = head + length;
+  }
+}
+
+/**
+  * @brief  cdc_stream_activate
+  *         Attach the rings of a channel to the endpoints of a configured
+  *         interface.
+  * @param  channel: CDC ACM instance.
+  * @param  cdc_acm_instance: Pointer to the cdc acm class instance.
+  * @retval none
+  */
+VOID cdc_stream_activate(UINT channel, UX_SLAVE_CLASS_CDC_ACM *cdc_acm_instance)
+{
+  CDC_TxTypeDef *tx = &cdc_tx[channel];
+  CDC_RxTypeDef *rx = &cdc_rx[channel];
+  UX_SLAVE_ENDPOINT *endpoint_in;
+  UX_SLAVE_ENDPOINT *endpoint_out;
+
+  if (channel >= CDC_STREAM_CHANNELS)
+  {
+    return;
+  }
+
+  endpoint_in = cdc_acm_instance->ux_slave_class_cdc_acm_interface->ux_slave_interface_first_endpoint;
+  endpoint_out = endpoint_in->ux_slave_endpoint_next_endpoint;
+  if ((endpoint_in->ux_slave_endpoint_descriptor.bEndpointAddress & UX_ENDPOINT_DIRECTION) != UX_ENDPOINT_IN)
+  {
+    endpoint_out = endpoint_in;
+    endpoint_in = endpoint_in->ux_slave_endpoint_next_endpoint;
+  }
+
+  /* Data queued while the host was away is dropped, received data is kept
+     for the reader */
+  tx->tail = tx->head;
+  tx->busy = UX_FALSE;
+  tx->open = UX_FALSE;
+  tx->holding = UX_FALSE;
+  tx->flush = UX_FALSE;
+  tx->packet_size = endpoint_in->ux_slave_endpoint_descriptor.wMaxPacketSize & 0x7FFU;
+  tx->transfer_buffer = endpoint_in->ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer;
+  tx->transfer = &endpoint_in->ux_slave_endpoint_transfer_request;
+
+  rx->length = 0U;
+  rx->packet_size = endpoint_out->ux_slave_endpoint_descriptor.wMaxPacketSize & 0x7FFU;
+  rx->transfer_buffer = endpoint_out->ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer;
+  rx->transfer = &endpoint_out->ux_slave_endpoint_transfer_request;
+}
+
+/**
+  * @brief  cdc_stream_deactivate
+  *         Detach the rings, the endpoints get their own buffers back.
+  * @param  channel: CDC ACM instance.
+  * @retval none
+  */
+VOID cdc_stream_deactivate(UINT channel)
+{
+  CDC_TxTypeDef *tx = &cdc_tx[channel];
+  CDC_RxTypeDef *rx = &cdc_rx[channel];
+
+  if (channel >= CDC_STREAM_CHANNELS)
+  {
+    return;
+  }
+
+  if (tx->transfer != UX_NULL)
+  {
+    tx->transfer->ux_slave_transfer_request_data_pointer = tx->transfer_buffer;
+    tx->transfer = UX_NULL;
+  }
+  tx->busy = UX_FALSE;
+
+  if (rx->transfer != UX_NULL)
+  {
+    rx->transfer->ux_slave_transfer_request_data_pointer = rx->transfer_buffer;
+    rx->transfer = UX_NULL;
+  }
+  rx->length = 0U;
+}
+
+/**
+  * @brief  cdc_stream_active
+  *         Tell if the host configured the interface.
+  * @param  channel: CDC ACM instance.
+  * @retval UX_TRUE or UX_FALSE
+  */
+UINT cdc_stream_active(UINT channel)
+{
+  if (channel >= CDC_STREAM_CHANNELS)
+  {
+    return UX_FALSE;
+  }
+
+  return (cdc_tx[channel].transfer != UX_NULL) ? UX_TRUE : UX_FALSE;
+}
+
+/**
+  * @brief  cdc_stream_run
+  *         Transfer state machines of all channels, called from the main
+  *         loop.
+  * @param  none
+  * @retval none
+  */
+VOID cdc_stream_run(VOID)
+{
+  UINT channel;
+
+  for (channel = 0U; channel < CDC_STREAM_CHANNELS; channel++)
+  {
+    if (cdc_tx[channel].transfer != UX_NULL)
+    {
+      cdc_stream_rx_run(&cdc_rx[channel]);
+      cdc_stream_tx_run(&cdc_tx[channel]);
+    }
+  }
+}
+
+/**
+  * @brief  cdc_tx_write
+  *         Queue data for the host, from the main loop or an interrupt.
+  *         The copy runs with interrupts disabled so that writers do not
+  *         interleave, keep the writes short.
+  * @param  channel: CDC ACM instance.
+  * @param  data: bytes to send.
+  * @param  length: number of bytes.
+  * @retval length when queued, 0 when the ring has not enough room
+  */
+ULONG cdc_tx_write(UINT channel, const UCHAR *data, ULONG length)
+{
+  CDC_TxTypeDef *tx = &cdc_tx[channel];
+  ULONG head;
+  ULONG offset;
+  ULONG first;
+  UX_INTERRUPT_SAVE_AREA
+
+  if (channel >= CDC_STREAM_CHANNELS)
+  {
+    return 0U;
+  }
+
+  UX_DISABLE
+  head = tx->head;
+  if ((length == 0U) || (length > (CDC_TX_RING_SIZE - (head - tx->tail))))
+  {
+    UX_RESTORE
+    return 0U;
+  }
+
+  offset = head & CDC_TX_RING_MASK;
+  first = CDC_TX_RING_SIZE - offset;
+  if (first > length)
+  {
+    first = length;
+  }
+  memcpy(&tx->buffer[offset], data, first);
+  memcpy(tx->buffer, &data[first], length - first);
+
+  tx->head = head + length;
+  UX_RESTORE
+
+  return length;
+}
+
+/**
+  * @brief  cdc_tx_flush
+  *         Send the queued data without waiting for the coalescing deadline,
+  *         for latency sensitive messages.
+  * @param  channel: CDC ACM instance.
+  * @retval none
+  */
+VOID cdc_tx_flush(UINT channel)
+{
+  if (channel < CDC_STREAM_CHANNELS)
+  {
+    cdc_tx[channel].flush = UX_TRUE;
+  }
+}
+
+/**
+  * @brief  cdc_tx_space
+  *         Room left in the ring.
+  * @param  channel: CDC ACM instance.
+  * @retval number of bytes cdc_tx_write accepts
+  */
+ULONG cdc_tx_space(UINT channel)
+{
+  if (channel >= CDC_STREAM_CHANNELS)
+  {
+    return 0U;
+  }
+
+  return CDC_TX_RING_SIZE - (cdc_tx[channel].head - cdc_tx[channel].tail);
+}
+
+/**
+  * @brief  cdc_tx_reserve
+  *         Reserve room at the head of the ring. On success interrupts stay
+  *         disabled until cdc_tx_commit().
+  * @param  channel: CDC ACM instance.
+  * @param  reserve: filled with the reserved room.
+  * @param  length: largest number of bytes the caller may write.
+  * @retval UX_SUCCESS, or UX_ERROR when the ring has not enough room
+  */
+UINT cdc_tx_reserve(UINT channel, CDC_TxReserveTypeDef *reserve, ULONG length)
+{
+  CDC_TxTypeDef *tx = &cdc_tx[channel];
+  ULONG head;
+  ULONG offset;
+  ULONG first;
+
+  if (channel >= CDC_STREAM_CHANNELS)
+  {
+    return UX_ERROR;
+  }
+
+  reserve->channel = channel;
+  reserve->interrupt_save = _ux_utility_interrupt_disable();
+  head = tx->head;
+  if ((length == 0U) || (length > (CDC_TX_RING_SIZE - (head - tx->tail))))
+  {
+    _ux_utility_interrupt_restore(reserve->interrupt_save);
+    return UX_ERROR;
+  }
+
+  offset = head & CDC_TX_RING_MASK;
+  first = CDC_TX_RING_SIZE - offset;
+  if (first > length)
+  {
+    first = length;
+  }
+  reserve->data[0] = &tx->buffer[offset];
+  reserve->length[0] = first;
+  reserve->data[1] = tx->buffer;
+  reserve->length[1] = length - first;
+
+  return UX_SUCCESS;
+}
+
+/**
+  * @brief  cdc_tx_commit
+  *         Queue the bytes written in a reservation and release it.
+  * @param  reserve: reservation returned by cdc_tx_reserve.
+  * @param  length: number of bytes written, 0 to cancel.
+  * @retval none
+  */
+VOID cdc_tx_commit(CDC_TxReserveTypeDef *reserve, ULONG length)
+{
+  cdc_tx[reserve->channel].head += length;
+  _ux_utility_interrupt_restore(reserve->interrupt_save);
+}
+
+/**
+  * @brief  cdc_rx_available
+  *         Bytes waiting in the receive ring.
+  * @param  channel: CDC ACM instance.
+  * @retval number of bytes
+  */
+ULONG cdc_rx_available(UINT channel)
+{
+  if (channel >= CDC_STREAM_CHANNELS)
+  {
+    return 0U;
+  }
+
+  return cdc_rx[channel].head - cdc_rx[channel].tail;
+}
+
+/**
+  * @brief  cdc_rx_read
+  *         Take received bytes out of the ring. Reading makes room for the
+  *         next OUT transfer.
+  * @param  channel: CDC ACM instance.
+  * @param  data: destination.
+  * @param  length: size of the destination.
+  * @retval number of bytes read
+  */
+ULONG cdc_rx_read(UINT channel, UCHAR *data, ULONG length)
+{
+  CDC_RxTypeDef *rx = &cdc_rx[channel];
+  ULONG tail;
+  ULONG available;
+  ULONG offset;
+  ULONG first;
+
+  if (channel >= CDC_STREAM_CHANNELS)
+  {
+    return 0U;
+  }
+
+  tail = rx->tail;
+  available = rx->head - tail;
+  offset = tail & CDC_RX_RING_MASK;
+
+  if (length > available)
+  {
+    length = available;
+  }
+
+  first = CDC_RX_RING_SIZE - offset;
+  if (first > length)
+  {
+    first = length;
+  }
+  memcpy(data, &rx->buffer[offset], first);
+  memcpy(&data[first], rx->buffer, length - first);
+
+  rx->tail = tail + length;
+
+  return length;
+}
@@ -0,0 +1,100 @@
+/**
+  ******************************************************************************
+  * @file    cdc_stream.h
+  * @brief   Streaming bulk transfers of the CDC ACM interface
+  ******************************************************************************
+  * Each CDC ACM instance of the device is a channel with its own rings.
+  * Producers queue bytes with cdc_tx_write() into a ring buffer, from the main
+  * loop or from interrupt handlers. cdc_stream_run(), called from the main
+  * loop, keeps the bulk IN transfer armed as long as the ring holds data.
+  * Small writes are coalesced into whole packets, see CDC_TX_COALESCE_MS.
+  * Ring segments are handed to the DCD in place when their address meets
+  * CDC_TX_ZERO_COPY_ALIGN, otherwise they go through the endpoint buffer.
+  *
+  * cdc_tx_reserve() and cdc_tx_commit() let an encoder write a record of
+  * unknown final length straight into the ring. The reservation is held with
+  * interrupts disabled, so the encoding in between must be short.
+  *
+  * The same function keeps a bulk OUT transfer armed into the receive ring.
+  * The ring has one producer, cdc_stream_run(), and one consumer, the caller
+  * of cdc_rx_read(). A transfer is only armed when the ring can take a whole
+  * one, while it is full the endpoint NAKs the host.
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __CDC_STREAM_H__
+#define __CDC_STREAM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "ux_api.h"
+#include "ux_device_class_cdc_acm.h"
+#include "ux_device_descriptors.h"
+
+/* Exported constants --------------------------------------------------------*/
+/* One channel per CDC ACM instance */
+#define CDC_STREAM_CHANNELS       USBD_CDC_ACM_INSTANCES
+
+/* Transmit ring size in bytes, power of two */
+#ifndef CDC_TX_RING_SIZE
+#define CDC_TX_RING_SIZE          2048U
+#endif
+
+/* Address alignment the DCD needs to send straight from the ring. The FS
+   controller copies to the PMA with unaligned reads, so any address is fine */
+#ifndef CDC_TX_ZERO_COPY_ALIGN
+#define CDC_TX_ZERO_COPY_ALIGN    1U
+#endif
+
+/* Coalescing deadline in ms. Writes are sent as whole packets, data short
+   of a packet waits up to this long for more, or for cdc_tx_flush(). 0 sends
+   everything as soon as possible */
+#ifndef CDC_TX_COALESCE_MS
+#define CDC_TX_COALESCE_MS        1U
+#endif
+
+/* Receive ring size in bytes, power of two, at least one packet */
+#ifndef CDC_RX_RING_SIZE
+#define CDC_RX_RING_SIZE          1024U
+#endif
+
+#if (CDC_TX_RING_SIZE & (CDC_TX_RING_SIZE - 1U)) != 0U
+#error "CDC_TX_RING_SIZE must be a power of two"
+#endif
+#if ((CDC_RX_RING_SIZE & (CDC_RX_RING_SIZE - 1U)) != 0U) || (CDC_RX_RING_SIZE < 64U)
+#error "CDC_RX_RING_SIZE must be a power of two of at least 64"
+#endif
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  /* Reserved room, the second part is where the ring wraps */
+  UCHAR *data[2];
+  ULONG length[2];
+
+  UINT channel;
+  ALIGN_TYPE interrupt_save;
+} CDC_TxReserveTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+VOID  cdc_stream_activate(UINT channel, UX_SLAVE_CLASS_CDC_ACM *cdc_acm_instance);
+VOID  cdc_stream_deactivate(UINT channel);
+UINT  cdc_stream_active(UINT channel);
+VOID  cdc_stream_run(VOID);
+
+ULONG cdc_tx_write(UINT channel, const UCHAR *data, ULONG length);
+VOID  cdc_tx_flush(UINT channel);
+ULONG cdc_tx_space(UINT channel);
+UINT  cdc_tx_reserve(UINT channel, CDC_TxReserveTypeDef *reserve, ULONG length);
+VOID  cdc_tx_commit(CDC_TxReserveTypeDef *reserve, ULONG length);
+
+ULONG cdc_rx_available(UINT channel);
+ULONG cdc_rx_read(UINT channel, UCHAR *data, ULONG length);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  /* __CDC_STREAM_H__ */
@@ -23,7 +23,8 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include "cdc_stream.h"
+#include "ux_device_descriptors.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -48,12 +49,12 @@
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN PFP */
-
+static UINT USBD_CDC_ACM_Channel(UX_SLAVE_CLASS_CDC_ACM *cdc_acm_instance);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
-UX_SLAVE_CLASS_CDC_ACM  *cdc_acm;
+UX_SLAVE_CLASS_CDC_ACM  *cdc_acm[USBD_CDC_ACM_INSTANCES];
 /* USER CODE END 0 */
 
 /**
@@ -65,7 +66,13 @@ UX_SLAVE_CLASS_CDC_ACM  *cdc_acm;
 VOID USBD_CDC_ACM_Activate(VOID *cdc_acm_instance)
 {
   /* USER CODE BEGIN USBD_CDC_ACM_Activate */
-  cdc_acm = (UX_SLAVE_CLASS_CDC_ACM*) cdc_acm_instance;
+  UINT channel = USBD_CDC_ACM_Channel((UX_SLAVE_CLASS_CDC_ACM*) cdc_acm_instance);
+
+  if (channel < USBD_CDC_ACM_INSTANCES)
+  {
+    cdc_acm[channel] = (UX_SLAVE_CLASS_CDC_ACM*) cdc_acm_instance;
+    cdc_stream_activate(channel, cdc_acm[channel]);
+  }
   /* USER CODE END USBD_CDC_ACM_Activate */
 
   return;
@@ -80,8 +87,13 @@ VOID USBD_CDC_ACM_Activate(VOID *cdc_acm_instance)
 VOID USBD_CDC_ACM_Deactivate(VOID *cdc_acm_instance)
 {
   /* USER CODE BEGIN USBD_CDC_ACM_Deactivate */
-  UX_PARAMETER_NOT_USED(cdc_acm_instance);
-	cdc_acm = UX_NULL;
+  UINT channel = USBD_CDC_ACM_Channel((UX_SLAVE_CLASS_CDC_ACM*) cdc_acm_instance);
+
+  if (channel < USBD_CDC_ACM_INSTANCES)
+  {
+    cdc_acm[channel] = UX_NULL;
+    cdc_stream_deactivate(channel);
+  }
   /* USER CODE END USBD_CDC_ACM_Deactivate */
 
   return;
@@ -103,5 +115,36 @@ VOID USBD_CDC_ACM_ParameterChange(VOID *cdc_acm_instance)
 }
 
 /* USER CODE BEGIN 1 */
-
+/**
+  * @brief  USBD_CDC_ACM_Channel
+  *         Find the builder instance of a cdc acm class instance from the
+  *         interfaces of its function.
+  * @param  cdc_acm_instance: Pointer to the cdc acm class instance.
+  * @retval instance index, USBD_CDC_ACM_INSTANCES when unknown
+  */
+static UINT USBD_CDC_ACM_Channel(UX_SLAVE_CLASS_CDC_ACM *cdc_acm_instance)
+{
+  ULONG interface;
+  ULONG first;
+  UINT channel;
+
+  if ((cdc_acm_instance == UX_NULL) || (cdc_acm_instance->ux_slave_class_cdc_acm_interface == UX_NULL))
+  {
+    return USBD_CDC_ACM_INSTANCES;
+  }
+
+  /* The class holds the data interface, the function starts with the
+     communication interface */
+  interface = cdc_acm_instance->ux_slave_class_cdc_acm_interface->ux_slave_interface_descriptor.bInterfaceNumber;
+  for (channel = 0U; channel < USBD_CDC_ACM_INSTANCES; channel++)
+  {
+    first = USBD_Get_Interface_Number(CLASS_TYPE_CDC_ACM, (uint8_t)channel);
+    if ((interface == first) || (interface == (first + 1U)))
+    {
+      return channel;
+    }
+  }
+
+  return USBD_CDC_ACM_INSTANCES;
+}
 /* USER CODE END 1 */
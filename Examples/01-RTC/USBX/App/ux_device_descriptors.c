@@ -46,6 +46,12 @@ USBD_DevClassHandleTypeDef  USBD_Device_FS, USBD_Device_HS;
 
 uint8_t UserClassInstance[USBD_MAX_CLASS_INTERFACES] = {
   CLASS_TYPE_CDC_ACM,
+#if USBD_CDC_ACM_INSTANCES > 1U
+  CLASS_TYPE_CDC_ACM,
+#endif
+#if USBD_CDC_ACM_INSTANCES > 2U
+  CLASS_TYPE_CDC_ACM,
+#endif
 };
 
 /* The generic device descriptor buffer that will be filled by builder
@@ -115,6 +121,11 @@ static uint8_t USBD_FrameWork_AddClass(USBD_DevClassHandleTypeDef *pdev,
 
 static uint8_t USBD_FrameWork_FindFreeIFNbr(USBD_DevClassHandleTypeDef *pdev);
 
+static uint8_t USBD_FrameWork_FindFreeEpNbr(USBD_DevClassHandleTypeDef *pdev);
+
+static uint8_t USBD_FrameWork_CountClass(USBD_DevClassHandleTypeDef *pdev,
+                                         USBD_CompositeClassTypeDef class);
+
 static void USBD_FrameWork_AddConfDesc(uint32_t Conf, uint32_t *pSze);
 
 static void USBD_FrameWork_AssignEp(USBD_DevClassHandleTypeDef *pdev, uint8_t Add,
@@ -299,6 +310,65 @@ uint16_t USBD_Get_Configuration_Number(uint8_t class_type, uint8_t interface_typ
   return cfg_num;
 }
 
+/**
+  * @brief  USBD_Get_PMA_Config
+  *         Return the packet memory layout of the full speed framework: the
+  *         buffer descriptor table, then the control endpoint buffers, then
+  *         one buffer per class endpoint in the order the builder assigned
+  *         them.
+  * @param  ep_addr : filled with the endpoint addresses
+  * @param  pma_addr : filled with the packet memory offsets
+  * @param  max_ep : size of both arrays
+  * @retval number of endpoints filled
+  */
+uint32_t USBD_Get_PMA_Config(uint8_t *ep_addr, uint32_t *pma_addr, uint32_t max_ep)
+{
+  USBD_EPTypeDef *ep;
+  uint32_t ep_nbr_max = 0U;
+  uint32_t offset;
+  uint32_t count = 0U;
+  uint32_t idx;
+  uint32_t ep_idx;
+
+  /* The buffer descriptor table has 8 bytes per endpoint number in use */
+  for (idx = 0U; idx < USBD_Device_FS.NumClasses; idx++)
+  {
+    for (ep_idx = 0U; ep_idx < USBD_Device_FS.tclasslist[idx].NumEps; ep_idx++)
+    {
+      ep = &USBD_Device_FS.tclasslist[idx].Eps[ep_idx];
+      if ((ep->add & 0x0FU) > ep_nbr_max)
+      {
+        ep_nbr_max = ep->add & 0x0FU;
+      }
+    }
+  }
+  offset = 8U * (ep_nbr_max + 1U);
+
+  /* Control endpoint, OUT then IN */
+  for (idx = 0U; (idx < 2U) && (count < max_ep); idx++)
+  {
+    ep_addr[count] = (idx == 0U) ? 0x00U : 0x80U;
+    pma_addr[count] = offset;
+    offset += USBD_MAX_EP0_SIZE;
+    count++;
+  }
+
+  /* Class endpoints, buffers rounded up to whole words */
+  for (idx = 0U; idx < USBD_Device_FS.NumClasses; idx++)
+  {
+    for (ep_idx = 0U; (ep_idx < USBD_Device_FS.tclasslist[idx].NumEps) && (count < max_ep); ep_idx++)
+    {
+      ep = &USBD_Device_FS.tclasslist[idx].Eps[ep_idx];
+      ep_addr[count] = ep->add;
+      pma_addr[count] = offset;
+      offset += ((uint32_t)ep->size + 3U) & ~3U;
+      count++;
+    }
+  }
+
+  return count;
+}
+
 /**
   * @brief  USBD_Desc_GetString
   *         Convert ASCII string into Unicode one
@@ -497,6 +567,7 @@ uint8_t  USBD_FrameWork_AddToConfDesc(USBD_DevClassHandleTypeDef *pdev, uint8_t
                                       uint8_t *pCmpstConfDesc)
 {
   uint8_t interface = 0U;
+  uint8_t endpoint = 0U;
 
   /* USER CODE FrameWork_AddToConfDesc_0 */
 
@@ -525,36 +596,42 @@ uint8_t  USBD_FrameWork_AddToConfDesc(USBD_DevClassHandleTypeDef *pdev, uint8_t
       pdev->tclasslist[pdev->classId].Ifs[0] = interface;
       pdev->tclasslist[pdev->classId].Ifs[1] = (uint8_t)(interface + 1U);
 
-      /* Assign endpoint numbers */
+      /* Instances are told apart by their index among the CDC ACM classes */
+      pdev->tclasslist[pdev->classId].InterfaceType = USBD_FrameWork_CountClass(pdev,
+                                                                                CLASS_TYPE_CDC_ACM);
+
+      /* Assign endpoint numbers, data OUT and IN share the first free number,
+         the notification endpoint takes the next one */
+      endpoint = USBD_FrameWork_FindFreeEpNbr(pdev);
       pdev->tclasslist[pdev->classId].NumEps = 3U;  /* EP_IN, EP_OUT, CMD_EP */
 
       /* Check the current speed to assign endpoints */
       if (Speed == USBD_HIGH_SPEED)
       {
         /* Assign OUT Endpoint */
-        USBD_FrameWork_AssignEp(pdev, USBD_CDCACM_EPOUT_ADDR,
+        USBD_FrameWork_AssignEp(pdev, endpoint,
                                 USBD_EP_TYPE_BULK, USBD_CDCACM_EPOUT_HS_MPS);
 
         /* Assign IN Endpoint */
-        USBD_FrameWork_AssignEp(pdev, USBD_CDCACM_EPIN_ADDR,
+        USBD_FrameWork_AssignEp(pdev, (uint8_t)(IN | endpoint),
                                 USBD_EP_TYPE_BULK, USBD_CDCACM_EPIN_HS_MPS);
 
         /* Assign CMD Endpoint */
-        USBD_FrameWork_AssignEp(pdev, USBD_CDCACM_EPINCMD_ADDR,
+        USBD_FrameWork_AssignEp(pdev, (uint8_t)(IN | (endpoint + 1U)),
                                 USBD_EP_TYPE_INTR, USBD_CDCACM_EPINCMD_HS_MPS);
       }
       else
       {
         /* Assign OUT Endpoint */
-        USBD_FrameWork_AssignEp(pdev, USBD_CDCACM_EPOUT_ADDR,
+        USBD_FrameWork_AssignEp(pdev, endpoint,
                                 USBD_EP_TYPE_BULK, USBD_CDCACM_EPOUT_FS_MPS);
 
         /* Assign IN Endpoint */
-        USBD_FrameWork_AssignEp(pdev, USBD_CDCACM_EPIN_ADDR,
+        USBD_FrameWork_AssignEp(pdev, (uint8_t)(IN | endpoint),
                                 USBD_EP_TYPE_BULK, USBD_CDCACM_EPIN_FS_MPS);
 
         /* Assign CMD Endpoint */
-        USBD_FrameWork_AssignEp(pdev, USBD_CDCACM_EPINCMD_ADDR,
+        USBD_FrameWork_AssignEp(pdev, (uint8_t)(IN | (endpoint + 1U)),
                                 USBD_EP_TYPE_INTR, USBD_CDCACM_EPINCMD_FS_MPS);
       }
 
@@ -603,6 +680,56 @@ static uint8_t USBD_FrameWork_FindFreeIFNbr(USBD_DevClassHandleTypeDef *pdev)
   return (uint8_t)idx;
 }
 
+/**
+  * @brief  USBD_FrameWork_FindFreeEpNbr
+  *         Find the first endpoint number above those of the added classes
+  * @param  pdev: device instance
+  * @retval The endpoint number to be used
+  */
+static uint8_t USBD_FrameWork_FindFreeEpNbr(USBD_DevClassHandleTypeDef *pdev)
+{
+  uint8_t ep_nbr = 0U;
+
+  /* Unroll all already activated classes */
+  for (uint32_t i = 0U; i < pdev->NumClasses; i++)
+  {
+    /* Unroll each class endpoints */
+    for (uint32_t j = 0U; j < pdev->tclasslist[i].NumEps; j++)
+    {
+      if ((pdev->tclasslist[i].Eps[j].add & 0x0FU) > ep_nbr)
+      {
+        ep_nbr = pdev->tclasslist[i].Eps[j].add & 0x0FU;
+      }
+    }
+  }
+
+  /* Endpoint 0 is the control endpoint */
+  return (uint8_t)(ep_nbr + 1U);
+}
+
+/**
+  * @brief  USBD_FrameWork_CountClass
+  *         Count the already added classes of a type
+  * @param  pdev: device instance
+  * @param  class: type of the class
+  * @retval Number of classes
+  */
+static uint8_t USBD_FrameWork_CountClass(USBD_DevClassHandleTypeDef *pdev,
+                                         USBD_CompositeClassTypeDef class)
+{
+  uint8_t count = 0U;
+
+  for (uint32_t i = 0U; i < pdev->NumClasses; i++)
+  {
+    if (pdev->tclasslist[i].ClassType == class)
+    {
+      count++;
+    }
+  }
+
+  return count;
+}
+
 /**
   * @brief  USBD_FrameWork_AddConfDesc
   *         Add a new class to the configuration descriptor
@@ -43,11 +43,30 @@ extern "C" {
 
 #define USBD_CDC_ACM_CLASS_ACTIVATED                   1U
 
+/* Number of CDC ACM functions, each gets its own endpoints and PMA buffers */
+#ifndef USBD_CDC_ACM_INSTANCES
+#define USBD_CDC_ACM_INSTANCES                         2U
+#endif
+
 #define USBD_CONFIG_MAXPOWER                           25U
 #define USBD_COMPOSITE_USE_IAD                         1U
 #define USBD_DEVICE_FRAMEWORK_BUILDER_ENABLED          1U
 
-#define USBD_FRAMEWORK_MAX_DESC_SZ                     200U
+/* Device, qualifier and configuration descriptors, then IAD and CDC ACM
+   descriptors of each instance */
+#define USBD_FRAMEWORK_MAX_DESC_SZ                     (18U + 10U + 9U + (66U * USBD_CDC_ACM_INSTANCES))
+
+/* A CDC ACM instance takes a bulk endpoint number and an interrupt one, the
+   DRD controller has one type per endpoint number */
+#if (USBD_CDC_ACM_INSTANCES < 1U) || (USBD_CDC_ACM_INSTANCES > USBD_MAX_SUPPORTED_CLASS)
+#error "USBD_CDC_ACM_INSTANCES must be 1 to USBD_MAX_SUPPORTED_CLASS"
+#endif
+#if USBD_CDC_ACM_INSTANCES > UX_MAX_SLAVE_CLASS_DRIVER
+#error "UX_MAX_SLAVE_CLASS_DRIVER must cover USBD_CDC_ACM_INSTANCES"
+#endif
+#if (2U * USBD_CDC_ACM_INSTANCES) >= UX_DCD_STM32_MAX_ED
+#error "Not enough endpoint numbers for USBD_CDC_ACM_INSTANCES"
+#endif
 /* Exported types ------------------------------------------------------------*/
 /* USER CODE BEGIN ET */
 
@@ -255,6 +274,7 @@ uint8_t *USBD_Get_String_Framework(ULONG *Length);
 uint8_t *USBD_Get_Language_Id_Framework(ULONG *Length);
 uint16_t USBD_Get_Interface_Number(uint8_t class_type, uint8_t interface_type);
 uint16_t USBD_Get_Configuration_Number(uint8_t class_type, uint8_t interface_type);
+uint32_t USBD_Get_PMA_Config(uint8_t *ep_addr, uint32_t *pma_addr, uint32_t max_ep);
 
 /* Private defines -----------------------------------------------------------*/
 /* USER CODE BEGIN Private_defines */
@@ -293,12 +313,9 @@ uint16_t USBD_Get_Configuration_Number(uint8_t class_type, uint8_t interface_typ
 
 #define USBD_STRING_FRAMEWORK_MAX_LENGTH              256U
 
-/* Device CDC-ACM Class */
-#define USBD_CDCACM_EPINCMD_ADDR                      0x82U
+/* Device CDC-ACM Class, endpoint numbers are assigned by the builder */
 #define USBD_CDCACM_EPINCMD_FS_MPS                    8U
 #define USBD_CDCACM_EPINCMD_HS_MPS                    8U
-#define USBD_CDCACM_EPIN_ADDR                         0x81U
-#define USBD_CDCACM_EPOUT_ADDR                        0x01U
 #define USBD_CDCACM_EPIN_FS_MPS                       64U
 #define USBD_CDCACM_EPIN_HS_MPS                       512U
 #define USBD_CDCACM_EPOUT_FS_MPS                      64U
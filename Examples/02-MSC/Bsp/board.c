@@ -66,11 +66,15 @@ void board_sd_detect_init(void)
   /* GPIO Ports Clock Enable */
   SD_DETECT_GPIO_CLK_ENABLE();
   
-  /*Configure GPIO pin : PtPin */
+  /*Configure GPIO pin : PtPin, both edges to catch insertion and removal */
   GPIO_InitStruct.Pin = SD_DETECT_Pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
   GPIO_InitStruct.Pull = GPIO_PULLUP;
   HAL_GPIO_Init(SD_DETECT_GPIO_Port, &GPIO_InitStruct);
+
+  /* EXTI interrupt init */
+  HAL_NVIC_SetPriority(SD_DETECT_EXTI_IRQn, 2, 0);
+  HAL_NVIC_EnableIRQ(SD_DETECT_EXTI_IRQn);
 }
 
 uint8_t board_sd_detect_getstate(void)
@@ -36,6 +36,9 @@ extern "C"
 #endif
 #ifndef SD_DETECT_GPIO_CLK_ENABLE
 #define SD_DETECT_GPIO_CLK_ENABLE __HAL_RCC_GPIOA_CLK_ENABLE
+#endif
+#ifndef SD_DETECT_EXTI_IRQn
+#define SD_DETECT_EXTI_IRQn EXTI8_IRQn
 #endif
 
     void board_button_init(void);
@@ -41,6 +41,9 @@ extern SD_HandleTypeDef hsd1;
 void MX_SDMMC1_SD_Init(void);
 
 /* USER CODE BEGIN Prototypes */
+HAL_StatusTypeDef MX_SDMMC1_SD_PowerOn(void);
+HAL_StatusTypeDef MX_SDMMC1_SD_OpCond(void);
+HAL_StatusTypeDef MX_SDMMC1_SD_InitCard(void);
 
 /* USER CODE END Prototypes */
 
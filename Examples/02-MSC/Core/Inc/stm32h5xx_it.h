@@ -55,9 +55,10 @@ void SVC_Handler(void);
 void DebugMon_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
+void SDMMC1_IRQHandler(void);
 void USB_DRD_FS_IRQHandler(void);
 /* USER CODE BEGIN EFP */
-
+void EXTI8_IRQHandler(void);
 /* USER CODE END EFP */
 
 #ifdef __cplusplus
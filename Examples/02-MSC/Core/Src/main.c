@@ -29,6 +29,8 @@
 #include "board.h"
 #include "app_usbx_device.h"
 #include "sdmmc.h"
+#include "msc_media.h"
+#include "ux_device_audio.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -100,50 +102,34 @@ int main(void)
 	
 	board_sd_detect_init();
 	
-	if(board_sd_detect_getstate())
+	/* Blink twice with a card, three times without. The card is identified
+	   by the MSC media once its detect switch settled, USB comes up anyway
+	   and reports the LUN without medium until then. */
+	uint8_t card = board_sd_detect_getstate();
+	for(uint8_t blink = card ? 2 : 3; blink > 0; blink--)
 	{
 		board_led_set(1);
-		HAL_Delay(50);
+		HAL_Delay(card ? 50 : 200);
 		board_led_set(0);
-		HAL_Delay(50);
-		
-		board_led_set(1);
-		HAL_Delay(50);
-		board_led_set(0);
-		HAL_Delay(50);
-		MX_SDMMC1_SD_Init();
-		MX_USBX_Device_Init();
-		MX_USB_PCD_Init();
-		/* Set Rx and Tx FIFO */
-		HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x00, PCD_SNG_BUF, 0x14);
-		HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x80, PCD_SNG_BUF, 0x54);
-		HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_MSC_EPOUT_ADDR, PCD_SNG_BUF, 0x94);
-		HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_MSC_EPIN_ADDR, PCD_SNG_BUF, 0xD4);
-
-		ux_dcd_stm32_initialize((ULONG)USB_DRD_FS, (ULONG)&hpcd_USB_DRD_FS);
-
-		/* Start the USB device */
-		HAL_PCD_Start(&hpcd_USB_DRD_FS);
-		
-	}
-	else
-	{
-		board_led_set(1);
-		HAL_Delay(200);
-		board_led_set(0);
-		HAL_Delay(200);
-		
-		board_led_set(1);
-		HAL_Delay(200);
-		board_led_set(0);
-		HAL_Delay(200);
-		
-		board_led_set(1);
-		HAL_Delay(200);
-		board_led_set(0);
-		HAL_Delay(200);
+		HAL_Delay(card ? 50 : 200);
 	}
 	
+	MX_USBX_Device_Init();
+	MX_USB_PCD_Init();
+	/* Set Rx and Tx FIFO */
+	HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x00, PCD_SNG_BUF, USBD_PMA_EP0_OUT);
+	HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x80, PCD_SNG_BUF, USBD_PMA_EP0_IN);
+	HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_MSC_EPOUT_ADDR, PCD_SNG_BUF, USBD_PMA_MSC_OUT);
+	HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_MSC_EPIN_ADDR, PCD_SNG_BUF, USBD_PMA_MSC_IN);
+	HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_AUDIO_EPOUT_ADDR, PCD_SNG_BUF, USBD_PMA_AUDIO_OUT);
+	HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_AUDIO_EPFB_ADDR, PCD_SNG_BUF, USBD_PMA_AUDIO_FB);
+	HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_AUDIO_EPIN_ADDR, PCD_SNG_BUF, USBD_PMA_AUDIO_IN);
+
+	ux_dcd_stm32_initialize((ULONG)USB_DRD_FS, (ULONG)&hpcd_USB_DRD_FS);
+
+	/* Start the USB device */
+	HAL_PCD_Start(&hpcd_USB_DRD_FS);
+	
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -157,12 +143,13 @@ int main(void)
 		if(tick >= tick_usb)
 		{
 			tick_usb = tick + 1;
-			if(board_sd_detect_getstate())
-			{
-				ux_system_tasks_run();
-			}
+			ux_system_tasks_run();
+			USBD_STORAGE_Process();
 		}
 		
+		/* ISO endpoints are re-armed within their frame */
+		Audio_Process();
+		
 		if(tick >= tick_button)
 		{
 			if(board_button_getstate())
@@ -270,6 +257,31 @@ void SystemClock_Config(void)
 }
 
 /* USER CODE BEGIN 4 */
+/**
+  * @brief  EXTI line rising detection callback.
+  * @param  GPIO_Pin: Specifies the port pin connected to corresponding EXTI line.
+  * @retval None
+  */
+void HAL_GPIO_EXTI_Rising_Callback(uint16_t GPIO_Pin)
+{
+  if (GPIO_Pin == SD_DETECT_Pin)
+  {
+    MSC_Media_SD_DetectCallback();
+  }
+}
+
+/**
+  * @brief  EXTI line falling detection callback.
+  * @param  GPIO_Pin: Specifies the port pin connected to corresponding EXTI line.
+  * @retval None
+  */
+void HAL_GPIO_EXTI_Falling_Callback(uint16_t GPIO_Pin)
+{
+  if (GPIO_Pin == SD_DETECT_Pin)
+  {
+    MSC_Media_SD_DetectCallback();
+  }
+}
 
 /* USER CODE END 4 */
 
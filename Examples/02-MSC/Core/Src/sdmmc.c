@@ -21,7 +21,7 @@
 #include "sdmmc.h"
 
 /* USER CODE BEGIN 0 */
-
+#define SD_IDENTIFY_FREQ  400000U  /* bus clock until the card is identified */
 /* USER CODE END 0 */
 
 SD_HandleTypeDef hsd1;
@@ -70,7 +70,7 @@ void HAL_SD_MspInit(SD_HandleTypeDef* sdHandle)
     PeriphClkInitStruct.PeriphClockSelection = RCC_PERIPHCLK_SDMMC1;
     PeriphClkInitStruct.PLL2.PLL2Source = RCC_PLL2_SOURCE_CSI;
     PeriphClkInitStruct.PLL2.PLL2M = 2;
-    PeriphClkInitStruct.PLL2.PLL2N = 124;
+    PeriphClkInitStruct.PLL2.PLL2N = 100;
     PeriphClkInitStruct.PLL2.PLL2P = 2;
     PeriphClkInitStruct.PLL2.PLL2Q = 2;
     PeriphClkInitStruct.PLL2.PLL2R = 2;
@@ -112,6 +112,9 @@ void HAL_SD_MspInit(SD_HandleTypeDef* sdHandle)
     GPIO_InitStruct.Alternate = GPIO_AF12_SDMMC1;
     HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
 
+    /* SDMMC1 interrupt Init */
+    HAL_NVIC_SetPriority(SDMMC1_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(SDMMC1_IRQn);
   /* USER CODE BEGIN SDMMC1_MspInit 1 */
 
   /* USER CODE END SDMMC1_MspInit 1 */
@@ -142,6 +145,8 @@ void HAL_SD_MspDeInit(SD_HandleTypeDef* sdHandle)
 
     HAL_GPIO_DeInit(GPIOD, GPIO_PIN_2);
 
+    /* SDMMC1 interrupt Deinit */
+    HAL_NVIC_DisableIRQ(SDMMC1_IRQn);
   /* USER CODE BEGIN SDMMC1_MspDeInit 1 */
 
   /* USER CODE END SDMMC1_MspDeInit 1 */
@@ -149,5 +154,183 @@ void HAL_SD_MspDeInit(SD_HandleTypeDef* sdHandle)
 }
 
 /* USER CODE BEGIN 1 */
+/*
+ * Identification of the card inserted in the SDMMC1 slot, as HAL_SD_Init
+ * does it but in steps the main loop can poll: a card takes up to 1 s to
+ * leave the idle state on ACMD41, which HAL_SD_Init waits for in one go.
+ * An absent or faulty card is reported instead of trapped, as cards come
+ * and go at run time.
+ */
+
+/**
+  * @brief  Power the SDMMC1 slot up at 400 kHz, reset the card (CMD0) and
+  *         check its interface condition (CMD8).
+  * @retval HAL status, hsd1.ErrorCode on error
+  */
+HAL_StatusTypeDef MX_SDMMC1_SD_PowerOn(void)
+{
+  SD_InitTypeDef init;
+  uint32_t sdmmc_clk;
+  uint32_t errorstate;
+
+  if (hsd1.State != HAL_SD_STATE_RESET)
+  {
+    (void)HAL_SD_DeInit(&hsd1);
+  }
+
+  hsd1.Instance = SDMMC1;
+  hsd1.Init.ClockEdge = SDMMC_CLOCK_EDGE_RISING;
+  hsd1.Init.ClockPowerSave = SDMMC_CLOCK_POWER_SAVE_DISABLE;
+  hsd1.Init.BusWide = SDMMC_BUS_WIDE_4B;
+  hsd1.Init.HardwareFlowControl = SDMMC_HARDWARE_FLOW_CONTROL_ENABLE;
+  hsd1.Init.ClockDiv = 8;
+  hsd1.Lock = HAL_UNLOCKED;
+  hsd1.ErrorCode = HAL_SD_ERROR_NONE;
+  HAL_SD_MspInit(&hsd1);
+  hsd1.State = HAL_SD_STATE_PROGRAMMING;
+
+  sdmmc_clk = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SDMMC1);
+  init.ClockEdge = SDMMC_CLOCK_EDGE_RISING;
+  init.ClockPowerSave = SDMMC_CLOCK_POWER_SAVE_DISABLE;
+  init.BusWide = SDMMC_BUS_WIDE_1B;
+  init.HardwareFlowControl = SDMMC_HARDWARE_FLOW_CONTROL_DISABLE;
+  init.ClockDiv = sdmmc_clk / (2U * SD_IDENTIFY_FREQ);
+  (void)SDMMC_Init(hsd1.Instance, init);
+  (void)SDMMC_PowerState_ON(hsd1.Instance);
+
+  /* 74 clocks before the first command */
+  HAL_Delay(1U + ((74U * 1000U) / SD_IDENTIFY_FREQ));
+
+  errorstate = SDMMC_CmdGoIdleState(hsd1.Instance);
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    /* No answer to CMD8: version 1.x card, reset again */
+    errorstate = SDMMC_CmdOperCond(hsd1.Instance);
+    if (errorstate == SDMMC_ERROR_TIMEOUT)
+    {
+      hsd1.SdCard.CardVersion = CARD_V1_X;
+      errorstate = SDMMC_CmdGoIdleState(hsd1.Instance);
+    }
+    else
+    {
+      hsd1.SdCard.CardVersion = CARD_V2_X;
+    }
+  }
+
+  if (errorstate != HAL_SD_ERROR_NONE)
+  {
+    hsd1.ErrorCode |= errorstate;
+    hsd1.State = HAL_SD_STATE_READY;
+    return HAL_ERROR;
+  }
 
+  return HAL_OK;
+}
+
+/**
+  * @brief  Send one ACMD41 (SD_APP_OP_COND). The card is not asked for
+  *         1.8V signalling, the board has no transceiver.
+  * @retval HAL_OK once the card left the idle state, HAL_BUSY while it
+  *         powers up, HAL_ERROR when it does not answer
+  */
+HAL_StatusTypeDef MX_SDMMC1_SD_OpCond(void)
+{
+  uint32_t errorstate;
+  uint32_t response;
+
+  errorstate = SDMMC_CmdAppCommand(hsd1.Instance, 0U);
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    errorstate = SDMMC_CmdAppOperCommand(hsd1.Instance, SDMMC_VOLTAGE_WINDOW_SD | SDMMC_HIGH_CAPACITY);
+  }
+  if (errorstate != HAL_SD_ERROR_NONE)
+  {
+    hsd1.ErrorCode |= errorstate;
+    hsd1.State = HAL_SD_STATE_READY;
+    return HAL_ERROR;
+  }
+
+  response = SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP1);
+  if ((response >> 31U) == 0U)
+  {
+    return HAL_BUSY;
+  }
+
+  hsd1.SdCard.CardType = ((response & SDMMC_HIGH_CAPACITY) != 0U) ? CARD_SDHC_SDXC : CARD_SDSC;
+  hsd1.SdCard.CardSpeed = (hsd1.SdCard.CardType == CARD_SDHC_SDXC) ? CARD_HIGH_SPEED : CARD_NORMAL_SPEED;
+
+  return HAL_OK;
+}
+
+/**
+  * @brief  Finish the identification of a card out of the idle state: CID,
+  *         relative address, CSD, card selection, then the 4 bits bus at
+  *         the ClockDiv clock.
+  * @retval HAL status, hsd1.ErrorCode on error
+  */
+HAL_StatusTypeDef MX_SDMMC1_SD_InitCard(void)
+{
+  HAL_SD_CardCSDTypeDef csd;
+  uint32_t errorstate;
+  uint16_t rca = 0U;
+
+  errorstate = SDMMC_CmdSendCID(hsd1.Instance);
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    hsd1.CID[0U] = SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP1);
+    hsd1.CID[1U] = SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP2);
+    hsd1.CID[2U] = SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP3);
+    hsd1.CID[3U] = SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP4);
+    errorstate = SDMMC_CmdSetRelAdd(hsd1.Instance, &rca);
+  }
+  if ((errorstate == HAL_SD_ERROR_NONE) && (rca == 0U))
+  {
+    /* A card publishes a non zero address */
+    errorstate = SDMMC_CmdSetRelAdd(hsd1.Instance, &rca);
+    if ((errorstate == HAL_SD_ERROR_NONE) && (rca == 0U))
+    {
+      errorstate = HAL_SD_ERROR_REQUEST_NOT_APPLICABLE;
+    }
+  }
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    hsd1.SdCard.RelCardAdd = rca;
+    errorstate = SDMMC_CmdSendCSD(hsd1.Instance, (uint32_t)rca << 16U);
+  }
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    hsd1.CSD[0U] = SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP1);
+    hsd1.CSD[1U] = SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP2);
+    hsd1.CSD[2U] = SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP3);
+    hsd1.CSD[3U] = SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP4);
+    hsd1.SdCard.Class = hsd1.CSD[1U] >> 20U;
+
+    /* Block count and size of the card */
+    if (HAL_SD_GetCardCSD(&hsd1, &csd) != HAL_OK)
+    {
+      errorstate = HAL_SD_ERROR_UNSUPPORTED_FEATURE;
+    }
+  }
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    errorstate = SDMMC_CmdSelDesel(hsd1.Instance, (uint32_t)rca << 16U);
+  }
+  if (errorstate != HAL_SD_ERROR_NONE)
+  {
+    hsd1.ErrorCode |= errorstate;
+    hsd1.State = HAL_SD_STATE_READY;
+    return HAL_ERROR;
+  }
+
+  hsd1.State = HAL_SD_STATE_READY;
+  if (HAL_SD_ConfigWideBusOperation(&hsd1, hsd1.Init.BusWide) != HAL_OK)
+  {
+    return HAL_ERROR;
+  }
+
+  hsd1.ErrorCode = HAL_SD_ERROR_NONE;
+  hsd1.Context = SD_CONTEXT_NONE;
+
+  return HAL_OK;
+}
 /* USER CODE END 1 */
@@ -0,0 +1,200 @@
+/**
+  ******************************************************************************
+  * @file    audio_stats.c
+  * @brief   Host side of the audio statistics vendor requests
+  ******************************************************************************
+  * Decodes the block field by field, so the tool reads the device on any
+  * host byte order and whatever history size the firmware was built with.
+  * The reports give each count since the last clear and what it moved in
+  * the interval, the rates in frames per USB frame and ppm off nominal.
+  ******************************************************************************
+  */
+#include "audio_stats.h"
+#include <string.h>
+
+static uint32_t audio_stats_get(const uint8_t *data, uint32_t *offset)
+{
+  const uint8_t *p = &data[*offset];
+
+  *offset += 4U;
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int audio_stats_decode(AudioStats_BlockTypeDef *stats, const uint8_t *data, uint32_t length)
+{
+  uint32_t offset = 4U;
+  uint32_t history;
+  uint32_t i;
+
+  memset(stats, 0, sizeof(*stats));
+  if (length < 4U)
+  {
+    return -1;
+  }
+  stats->version = (uint16_t)(data[0] | (data[1] << 8));
+  stats->length = (uint16_t)(data[2] | (data[3] << 8));
+  if ((stats->version != AUDIO_STATS_BLOCK_VERSION) || (stats->length > length) ||
+      (stats->length < (AUDIO_STATS_HEAD_SIZE + AUDIO_STATS_TAIL_SIZE)))
+  {
+    return -1;
+  }
+  history = stats->length - AUDIO_STATS_HEAD_SIZE - AUDIO_STATS_TAIL_SIZE;
+  if (((history % 4U) != 0U) || ((history / 4U) > AUDIO_STATS_HISTORY_MAX))
+  {
+    return -1;
+  }
+
+  stats->frequency = audio_stats_get(data, &offset);
+
+  stats->out_packets = audio_stats_get(data, &offset);
+  stats->out_dropped = audio_stats_get(data, &offset);
+  stats->tx_underruns = audio_stats_get(data, &offset);
+  stats->tx_fill_min = (int32_t)audio_stats_get(data, &offset);
+  stats->tx_fill_max = (int32_t)audio_stats_get(data, &offset);
+  stats->out_latency = audio_stats_get(data, &offset);
+
+  stats->in_packets = audio_stats_get(data, &offset);
+  stats->in_empty = audio_stats_get(data, &offset);
+  stats->rx_overruns = audio_stats_get(data, &offset);
+  stats->rx_fill_min = (int32_t)audio_stats_get(data, &offset);
+  stats->rx_fill_max = (int32_t)audio_stats_get(data, &offset);
+  stats->in_latency = audio_stats_get(data, &offset);
+
+  stats->rate = audio_stats_get(data, &offset);
+  stats->feedback = audio_stats_get(data, &offset);
+  stats->feedback_count = audio_stats_get(data, &offset);
+  stats->history_size = history / 4U;
+  for (i = 0U; i < stats->history_size; i++)
+  {
+    stats->feedback_history[i] = audio_stats_get(data, &offset);
+  }
+
+  stats->sai_rx_fifo_errors = audio_stats_get(data, &offset);
+  stats->sai_tx_fifo_errors = audio_stats_get(data, &offset);
+  stats->sai_sync_errors = audio_stats_get(data, &offset);
+  stats->sai_dma_errors = audio_stats_get(data, &offset);
+  return 0;
+}
+
+int audio_stats_read(const AudioStats_TransportTypeDef *transport, AudioStats_BlockTypeDef *stats)
+{
+  uint8_t data[AUDIO_STATS_SIZE_MAX];
+  int length;
+
+  length = transport->control(transport->context, AUDIO_STATS_REQUEST_IN, AUDIO_STATS_GET,
+                              0U, 0U, data, sizeof(data));
+  if (length < 0)
+  {
+    return -1;
+  }
+  return audio_stats_decode(stats, data, (uint32_t)length);
+}
+
+int audio_stats_clear(const AudioStats_TransportTypeDef *transport)
+{
+  return (transport->control(transport->context, AUDIO_STATS_REQUEST_OUT, AUDIO_STATS_CLEAR,
+                             0U, 0U, NULL, 0U) < 0) ? -1 : 0;
+}
+
+/* 16.16 frames per USB frame, and ppm off the nominal rate */
+static void audio_stats_print_rate(FILE *out, const char *name, uint32_t rate, uint32_t frequency)
+{
+  double frames = rate / 65536.0;
+  double nominal = frequency / 1000.0;
+
+  fprintf(out, "%s %.5f", name, frames);
+  if (frequency != 0U)
+  {
+    fprintf(out, " (%+.0f ppm)", 1000000.0 * (frames - nominal) / nominal);
+  }
+}
+
+static void audio_stats_print_fill(FILE *out, int32_t min, int32_t max)
+{
+  if (min > max)
+  {
+    fprintf(out, "fill -");
+  }
+  else
+  {
+    fprintf(out, "fill %ld..%ld", (long)min, (long)max);
+  }
+}
+
+/* A count, and what it moved since the last report */
+static void audio_stats_print_count(FILE *out, const char *name, uint32_t count, const uint32_t *last)
+{
+  fprintf(out, "%lu %s", (unsigned long)count, name);
+  if (last != NULL)
+  {
+    fprintf(out, " (+%lu)", (unsigned long)(count - *last));
+  }
+}
+
+#define AUDIO_STATS_LAST(last, field)   (((last) != NULL) ? &(last)->field : NULL)
+
+void audio_stats_print(FILE *out, const AudioStats_BlockTypeDef *stats,
+                       const AudioStats_BlockTypeDef *last, uint32_t ms)
+{
+  fprintf(out, "[%6lu.%03lu s] %lu Hz, ", (unsigned long)(ms / 1000U), (unsigned long)(ms % 1000U),
+          (unsigned long)stats->frequency);
+  audio_stats_print_rate(out, "rate", stats->rate, stats->frequency);
+  audio_stats_print_rate(out, ", feedback", stats->feedback, stats->frequency);
+  fprintf(out, ", ");
+  audio_stats_print_count(out, "rate windows", stats->feedback_count, AUDIO_STATS_LAST(last, feedback_count));
+  fprintf(out, "\n");
+
+  fprintf(out, "  OUT ");
+  audio_stats_print_count(out, "packets", stats->out_packets, AUDIO_STATS_LAST(last, out_packets));
+  fprintf(out, ", ");
+  audio_stats_print_count(out, "dropped", stats->out_dropped, AUDIO_STATS_LAST(last, out_dropped));
+  fprintf(out, ", ");
+  audio_stats_print_count(out, "underruns", stats->tx_underruns, AUDIO_STATS_LAST(last, tx_underruns));
+  fprintf(out, ", ");
+  audio_stats_print_fill(out, stats->tx_fill_min, stats->tx_fill_max);
+  fprintf(out, ", latency %lu frames\n", (unsigned long)stats->out_latency);
+
+  fprintf(out, "  IN  ");
+  audio_stats_print_count(out, "packets", stats->in_packets, AUDIO_STATS_LAST(last, in_packets));
+  fprintf(out, ", ");
+  audio_stats_print_count(out, "empty", stats->in_empty, AUDIO_STATS_LAST(last, in_empty));
+  fprintf(out, ", ");
+  audio_stats_print_count(out, "overruns", stats->rx_overruns, AUDIO_STATS_LAST(last, rx_overruns));
+  fprintf(out, ", ");
+  audio_stats_print_fill(out, stats->rx_fill_min, stats->rx_fill_max);
+  fprintf(out, ", latency %lu frames\n", (unsigned long)stats->in_latency);
+
+  fprintf(out, "  SAI errors %lu RX FIFO, %lu TX FIFO, %lu frame sync, %lu DMA\n",
+          (unsigned long)stats->sai_rx_fifo_errors, (unsigned long)stats->sai_tx_fifo_errors,
+          (unsigned long)stats->sai_sync_errors, (unsigned long)stats->sai_dma_errors);
+}
+
+int audio_stats_poll(const AudioStats_TransportTypeDef *transport, uint32_t interval_ms,
+                     uint32_t count, int clear, FILE *out)
+{
+  AudioStats_BlockTypeDef stats;
+  AudioStats_BlockTypeDef last;
+  uint32_t ms = 0U;
+  uint32_t i;
+
+  if ((clear && (audio_stats_clear(transport) != 0)) ||
+      (audio_stats_read(transport, &stats) != 0))
+  {
+    return -1;
+  }
+  audio_stats_print(out, &stats, NULL, ms);
+
+  for (i = 0U; (count == 0U) || (i < count); i++)
+  {
+    last = stats;
+    transport->wait(transport->context, interval_ms);
+    ms += interval_ms;
+    if (audio_stats_read(transport, &stats) != 0)
+    {
+      return -1;
+    }
+    audio_stats_print(out, &stats, &last, ms);
+    fflush(out);
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+/**
+  ******************************************************************************
+  * @file    audio_stats.h
+  * @brief   Host side of the audio statistics vendor requests
+  ******************************************************************************
+  * The device returns Audio_StatsTypeDef (USBX/App/ux_device_audio.h) to the
+  * vendor request GET_STATS and clears its counts on CLEAR_STATS, both to
+  * the device. The block is little endian, fields in their order of the
+  * device header; the history holds what is left of 'length' after them.
+  * The control transfers and the wait between two reads come from the
+  * caller: usbdevfs in audio_stats_linux.c, the simulated device in the
+  * host tests.
+  ******************************************************************************
+  */
+#ifndef AUDIO_STATS_H
+#define AUDIO_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Device and requests, as in USBX/App/ux_device_descriptors.h and
+   ux_device_audio.h */
+#define AUDIO_STATS_VID                 0x0483U
+#define AUDIO_STATS_PID                 0x5710U
+#define AUDIO_STATS_GET                 0x01U
+#define AUDIO_STATS_CLEAR               0x02U
+#define AUDIO_STATS_REQUEST_IN          0xC0U   /* vendor, device, IN */
+#define AUDIO_STATS_REQUEST_OUT         0x40U   /* vendor, device, OUT */
+#define AUDIO_STATS_BLOCK_VERSION       1U
+
+/* Block bytes before the history and after it, the history at most */
+#define AUDIO_STATS_HEAD_SIZE           68U
+#define AUDIO_STATS_TAIL_SIZE           16U
+#define AUDIO_STATS_HISTORY_MAX         64U
+#define AUDIO_STATS_SIZE_MAX            (AUDIO_STATS_HEAD_SIZE + (4U * AUDIO_STATS_HISTORY_MAX) + \
+                                         AUDIO_STATS_TAIL_SIZE)
+
+typedef struct
+{
+  uint16_t version;
+  uint16_t length;
+  uint32_t frequency;
+
+  uint32_t out_packets;
+  uint32_t out_dropped;
+  uint32_t tx_underruns;
+  int32_t  tx_fill_min;             /* min > max: no sample */
+  int32_t  tx_fill_max;
+  uint32_t out_latency;
+
+  uint32_t in_packets;
+  uint32_t in_empty;
+  uint32_t rx_overruns;
+  int32_t  rx_fill_min;
+  int32_t  rx_fill_max;
+  uint32_t in_latency;
+
+  uint32_t rate;                    /* 16.16 frames per USB frame */
+  uint32_t feedback;
+  uint32_t feedback_count;
+  uint32_t history_size;            /* entries in feedback_history */
+  uint32_t feedback_history[AUDIO_STATS_HISTORY_MAX];
+
+  uint32_t sai_rx_fifo_errors;
+  uint32_t sai_tx_fifo_errors;
+  uint32_t sai_sync_errors;
+  uint32_t sai_dma_errors;
+} AudioStats_BlockTypeDef;
+
+typedef struct
+{
+  /* Control transfer of 'length' bytes at 'data': the bytes moved, < 0 on
+     an error or a stall */
+  int (*control)(void *context, uint8_t request_type, uint8_t request, uint16_t value,
+                 uint16_t index, uint8_t *data, uint16_t length);
+  /* Time between two reads */
+  void (*wait)(void *context, uint32_t ms);
+  void *context;
+} AudioStats_TransportTypeDef;
+
+/* Block of 'length' bytes from the device: 0, -1 when it is not a version
+   this tool reads or not whole */
+int audio_stats_decode(AudioStats_BlockTypeDef *stats, const uint8_t *data, uint32_t length);
+
+/* GET_STATS: 0, -1 on a transfer error or a block audio_stats_decode()
+   refuses */
+int audio_stats_read(const AudioStats_TransportTypeDef *transport, AudioStats_BlockTypeDef *stats);
+
+/* CLEAR_STATS: 0, -1 on a transfer error */
+int audio_stats_clear(const AudioStats_TransportTypeDef *transport);
+
+/* One report, the counts moved since 'last' when it is not NULL, 'ms' after
+   the first read */
+void audio_stats_print(FILE *out, const AudioStats_BlockTypeDef *stats,
+                       const AudioStats_BlockTypeDef *last, uint32_t ms);
+
+/* Read every 'interval_ms', 'count' times (0: until a read fails), a
+   report each time; cleared first if 'clear'. 0, or -1 when a read
+   failed */
+int audio_stats_poll(const AudioStats_TransportTypeDef *transport, uint32_t interval_ms,
+                     uint32_t count, int clear, FILE *out);
+
+#endif /* AUDIO_STATS_H */
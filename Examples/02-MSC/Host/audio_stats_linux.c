@@ -0,0 +1,168 @@
+/**
+  ******************************************************************************
+  * @file    audio_stats_linux.c
+  * @brief   Polls the audio statistics of the device from a Linux host
+  ******************************************************************************
+  * audio_stats [-i interval_ms] [-n count] [-c] [/dev/bus/usb/BBB/DDD]
+  *   -i  time between two reads, 1000 ms by default
+  *   -n  reads, until interrupted by default
+  *   -c  clear the counts first
+  * Without a path the first device of AUDIO_STATS_VID:AUDIO_STATS_PID is
+  * taken. The vendor requests go to the device through usbdevfs, no
+  * interface is claimed: the audio and storage drivers keep theirs. The
+  * node needs read and write access (root, or a udev rule).
+  ******************************************************************************
+  */
+#include "audio_stats.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/usbdevice_fs.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define AUDIO_STATS_USB_PATH            "/dev/bus/usb"
+#define AUDIO_STATS_TIMEOUT_MS          1000U
+
+static int audio_stats_usbfs_control(void *context, uint8_t request_type, uint8_t request,
+                                     uint16_t value, uint16_t index, uint8_t *data, uint16_t length)
+{
+  struct usbdevfs_ctrltransfer transfer;
+
+  memset(&transfer, 0, sizeof(transfer));
+  transfer.bRequestType = request_type;
+  transfer.bRequest = request;
+  transfer.wValue = value;
+  transfer.wIndex = index;
+  transfer.wLength = length;
+  transfer.timeout = AUDIO_STATS_TIMEOUT_MS;
+  transfer.data = data;
+  return ioctl(*(int *)context, USBDEVFS_CONTROL, &transfer);
+}
+
+static void audio_stats_usbfs_wait(void *context, uint32_t ms)
+{
+  (void)context;
+  usleep(ms * 1000U);
+}
+
+/* The node of the first device with the tool's VID:PID, -1 if none */
+static int audio_stats_find(char *path, size_t size)
+{
+  DIR *buses = opendir(AUDIO_STATS_USB_PATH);
+  struct dirent *bus;
+  int found = -1;
+
+  if (buses == NULL)
+  {
+    return -1;
+  }
+  while ((found < 0) && ((bus = readdir(buses)) != NULL))
+  {
+    char bus_path[512];
+    DIR *devices;
+    struct dirent *device;
+
+    if (bus->d_name[0] == '.')
+    {
+      continue;
+    }
+    snprintf(bus_path, sizeof(bus_path), "%s/%s", AUDIO_STATS_USB_PATH, bus->d_name);
+    devices = opendir(bus_path);
+    if (devices == NULL)
+    {
+      continue;
+    }
+    while ((found < 0) && ((device = readdir(devices)) != NULL))
+    {
+      uint8_t descriptor[18];
+      int fd;
+
+      if (device->d_name[0] == '.')
+      {
+        continue;
+      }
+      snprintf(path, size, "%s/%s", bus_path, device->d_name);
+      fd = open(path, O_RDONLY);
+      if (fd < 0)
+      {
+        continue;
+      }
+      /* The node reads as the device descriptor first */
+      if ((read(fd, descriptor, sizeof(descriptor)) == (ssize_t)sizeof(descriptor)) &&
+          ((descriptor[8] | (descriptor[9] << 8)) == AUDIO_STATS_VID) &&
+          ((descriptor[10] | (descriptor[11] << 8)) == AUDIO_STATS_PID))
+      {
+        found = 0;
+      }
+      close(fd);
+    }
+    closedir(devices);
+  }
+  closedir(buses);
+  return found;
+}
+
+static void audio_stats_usage(void)
+{
+  fprintf(stderr, "usage: audio_stats [-i interval_ms] [-n count] [-c] [/dev/bus/usb/BBB/DDD]\n");
+}
+
+int main(int argc, char **argv)
+{
+  AudioStats_TransportTypeDef transport;
+  char path[1024];
+  uint32_t interval_ms = 1000U;
+  uint32_t count = 0U;
+  int clear = 0;
+  int option;
+  int fd;
+  int status;
+
+  while ((option = getopt(argc, argv, "i:n:c")) != -1)
+  {
+    switch (option)
+    {
+      case 'i':
+        interval_ms = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        count = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        clear = 1;
+        break;
+      default:
+        audio_stats_usage();
+        return 2;
+    }
+  }
+  if (optind < argc)
+  {
+    snprintf(path, sizeof(path), "%s", argv[optind]);
+  }
+  else if (audio_stats_find(path, sizeof(path)) != 0)
+  {
+    fprintf(stderr, "audio_stats: no device %04x:%04x\n", AUDIO_STATS_VID, AUDIO_STATS_PID);
+    return 1;
+  }
+
+  fd = open(path, O_RDWR);
+  if (fd < 0)
+  {
+    perror(path);
+    return 1;
+  }
+  transport.control = audio_stats_usbfs_control;
+  transport.wait = audio_stats_usbfs_wait;
+  transport.context = &fd;
+
+  status = audio_stats_poll(&transport, interval_ms, count, clear, stdout);
+  if (status != 0)
+  {
+    fprintf(stderr, "audio_stats: %s: cannot read a version %u statistics block\n", path, AUDIO_STATS_BLOCK_VERSION);
+  }
+  close(fd);
+  return (status != 0) ? 1 : 0;
+}
@@ -115,12 +115,14 @@ extern   "C" {
 #define UX_SLAVE_CLASS_STORAGE_SCSI_WRITE16                         0x2a
 #define UX_SLAVE_CLASS_STORAGE_SCSI_VERIFY                          0x2f
 #define UX_SLAVE_CLASS_STORAGE_SCSI_SYNCHRONIZE_CACHE               0x35
+#define UX_SLAVE_CLASS_STORAGE_SCSI_UNMAP                           0x42
 #define UX_SLAVE_CLASS_STORAGE_SCSI_READ_TOC                        0x43
 #define UX_SLAVE_CLASS_STORAGE_SCSI_GET_CONFIGURATION               0x46
 #define UX_SLAVE_CLASS_STORAGE_SCSI_GET_STATUS_NOTIFICATION         0x4A
 #define UX_SLAVE_CLASS_STORAGE_SCSI_READ_DISK_INFORMATION           0x51
 #define UX_SLAVE_CLASS_STORAGE_SCSI_MODE_SELECT                     0x55
 #define UX_SLAVE_CLASS_STORAGE_SCSI_MODE_SENSE                      0x5a
+#define UX_SLAVE_CLASS_STORAGE_SCSI_SERVICE_ACTION_IN               0x9e
 #define UX_SLAVE_CLASS_STORAGE_SCSI_READ32                          0xa8
 #define UX_SLAVE_CLASS_STORAGE_SCSI_REPORT_KEY                      0xa4
 #define UX_SLAVE_CLASS_STORAGE_SCSI_WRITE32                         0xaa
@@ -160,6 +162,8 @@ extern   "C" {
 
 #define UX_SLAVE_CLASS_STORAGE_INQUIRY_OPERATION                    0
 #define UX_SLAVE_CLASS_STORAGE_INQUIRY_LUN                          1
+#define UX_SLAVE_CLASS_STORAGE_INQUIRY_FLAGS                        1
+#define UX_SLAVE_CLASS_STORAGE_INQUIRY_FLAGS_EVPD                   0x01
 #define UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE                    2
 #define UX_SLAVE_CLASS_STORAGE_INQUIRY_ALLOCATION_LENGTH            4
 #define UX_SLAVE_CLASS_STORAGE_INQUIRY_COMMAND_LENGTH_UFI           12
@@ -179,6 +183,23 @@ extern   "C" {
 #define UX_SLAVE_CLASS_STORAGE_INQUIRY_RESPONSE_LENGTH_CD_ROM       0x5b
 
 
+/* Define Storage Class SCSI inquiry VPD page response constants.  */
+
+#define UX_SLAVE_CLASS_STORAGE_VPD_PERIPHERAL_TYPE                  0
+#define UX_SLAVE_CLASS_STORAGE_VPD_PAGE_CODE                        1
+#define UX_SLAVE_CLASS_STORAGE_VPD_PAGE_LENGTH                      2
+#define UX_SLAVE_CLASS_STORAGE_VPD_HEADER_LENGTH                    4
+#define UX_SLAVE_CLASS_STORAGE_VPD_SUPPORTED_LENGTH                 8
+#define UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_MAX_UNMAP_LBA_COUNT 20
+#define UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_MAX_UNMAP_DESC      24
+#define UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_UNMAP_GRANULARITY   28
+#define UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_UNMAP_ALIGNMENT     32
+#define UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_LENGTH              64
+#define UX_SLAVE_CLASS_STORAGE_VPD_LBP_FLAGS                        5
+#define UX_SLAVE_CLASS_STORAGE_VPD_LBP_FLAGS_LBPU                   0x80
+#define UX_SLAVE_CLASS_STORAGE_VPD_LBP_LENGTH                       8
+
+
 /* Define Storage Class SCSI start/stop command constants.  */
 
 #define UX_SLAVE_CLASS_STORAGE_START_STOP_OPERATION                 0
@@ -254,6 +275,23 @@ extern   "C" {
 #define UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_BLOCK_SIZE    4
 #define UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LENGTH        8
 
+
+/* Define Storage Class SCSI read capacity (16) command constants.  */
+
+#define UX_SLAVE_CLASS_STORAGE_SERVICE_ACTION                       1
+#define UX_SLAVE_CLASS_STORAGE_SERVICE_ACTION_MASK                  0x1f
+#define UX_SLAVE_CLASS_STORAGE_SERVICE_ACTION_READ_CAPACITY_16      0x10
+#define UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_ALLOCATION_LENGTH   10
+
+
+/* Define Storage Class read capacity (16) response constants.  */
+
+#define UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_LAST_LBA   0
+#define UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_BLOCK_SIZE 8
+#define UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_LBP        14
+#define UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_LBPME      0x80
+#define UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_LENGTH     32
+
 /* Define Storage Class read capacity response constants.  */
 
 #define UX_SLAVE_CLASS_STORAGE_READ_FORMAT_CAPACITY_RESPONSE_SIZE           0
@@ -322,6 +360,10 @@ extern   "C" {
 
 /* Define Storage Class SCSI ASC return codes.  */
 #define UX_SLAVE_CLASS_STORAGE_ASC_KEY_INVALID_COMMAND              0x20
+#define UX_SLAVE_CLASS_STORAGE_ASC_KEY_PARAMETER_LIST_LENGTH        0x1a
+#define UX_SLAVE_CLASS_STORAGE_ASC_KEY_LBA_OUT_OF_RANGE             0x21
+#define UX_SLAVE_CLASS_STORAGE_ASC_KEY_INVALID_FIELD_IN_CDB         0x24
+#define UX_SLAVE_CLASS_STORAGE_ASC_KEY_INVALID_PARAMETER_LIST       0x26
 
 /* Define Storage Class CSW status.  */
 
@@ -334,6 +376,8 @@ extern   "C" {
 #define UX_SLAVE_CLASS_STORAGE_REQUEST_SENSE_RESPONSE_ERROR_CODE_VALUE  0x70
 #define UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_STANDARD               0x00
 #define UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_SERIAL                 0x80
+#define UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_BLOCK_LIMITS           0xb0
+#define UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_LBP                    0xb2
 #define UX_SLAVE_CLASS_STORAGE_INQUIRY_PERIPHERAL_TYPE                  0x00
 #define UX_SLAVE_CLASS_STORAGE_RESET                                    0xff
 #define UX_SLAVE_CLASS_STORAGE_GET_MAX_LUN                              0xfe
@@ -412,7 +456,21 @@ extern   "C" {
 
 /* Define buffer length for IN/OUT pipes.  This should match the size of the endpoint maximum buffer size. */
 
+#ifndef UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE
 #define UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE                              UX_SLAVE_REQUEST_DATA_MAX_LENGTH
+#endif
+
+/* In standalone mode the buffer length may exceed the endpoint buffer size, the class then
+   allocates its own ping-pong buffers so that disk and USB chunks can be larger than
+   UX_SLAVE_REQUEST_DATA_MAX_LENGTH.  */
+
+#if UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE > UX_SLAVE_REQUEST_DATA_MAX_LENGTH
+#if defined(UX_DEVICE_STANDALONE)
+#define UX_DEVICE_CLASS_STORAGE_OWN_BUFFERS
+#else
+#error UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE larger than UX_SLAVE_REQUEST_DATA_MAX_LENGTH needs UX_DEVICE_STANDALONE
+#endif
+#endif
 
 
 /* Define MMC2 CD-ROM / DVD-ROM bit fields */
@@ -435,6 +493,32 @@ extern   "C" {
 
 #define UX_SLAVE_CLASS_STORAGE_SYNCHRONIZE_CACHE_FLAGS_IMMED            0x02
 
+/* Define Storage Class SCSI unmap command constants.  */
+
+#define UX_SLAVE_CLASS_STORAGE_UNMAP_PARAMETER_LIST_LENGTH              7
+
+/* Define Storage Class SCSI unmap parameter list constants.  */
+
+#define UX_SLAVE_CLASS_STORAGE_UNMAP_BLOCK_DESCRIPTOR_DATA_LENGTH       2
+#define UX_SLAVE_CLASS_STORAGE_UNMAP_HEADER_LENGTH                      8
+#define UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LBA                     0
+#define UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_NUMBER_OF_BLOCKS        8
+#define UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LENGTH                  16
+
+/* Define the maximum number of unmap block descriptors in a parameter list.  */
+
+#ifndef UX_SLAVE_CLASS_STORAGE_UNMAP_MAX_DESCRIPTORS
+#define UX_SLAVE_CLASS_STORAGE_UNMAP_MAX_DESCRIPTORS                    32
+#endif
+
+#define UX_SLAVE_CLASS_STORAGE_UNMAP_MAX_PARAMETER_LENGTH               (UX_SLAVE_CLASS_STORAGE_UNMAP_HEADER_LENGTH + \
+                                                                         UX_SLAVE_CLASS_STORAGE_UNMAP_MAX_DESCRIPTORS * \
+                                                                         UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LENGTH)
+
+#if UX_SLAVE_CLASS_STORAGE_UNMAP_MAX_PARAMETER_LENGTH > UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE
+#error UX_SLAVE_CLASS_STORAGE_UNMAP_MAX_DESCRIPTORS too large for UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE
+#endif
+
 
 /* Define MODE SENSE Page Codes.  */
 #define UX_SLAVE_CLASS_STORAGE_MMC2_PAGE_CODE_CDROM                     0x2a
@@ -496,6 +580,8 @@ typedef struct UX_SLAVE_CLASS_STORAGE_LUN_STRUCT
     UINT            (*ux_slave_class_storage_media_flush)(VOID *storage, ULONG lun, ULONG number_blocks, ULONG lba, ULONG *media_status);
     UINT            (*ux_slave_class_storage_media_status)(VOID *storage, ULONG lun, ULONG media_id, ULONG *media_status);
     UINT            (*ux_slave_class_storage_media_notification)(VOID *storage, ULONG lun, ULONG media_id, ULONG notification_class, UCHAR **media_notification, ULONG *media_notification_length);
+    UINT            (*ux_slave_class_storage_media_discard)(VOID *storage, ULONG lun, ULONG number_blocks, ULONG lba, ULONG *media_status);
+    ULONG           ux_slave_class_storage_media_unmap_granularity;
 } UX_SLAVE_CLASS_STORAGE_LUN;
 
 /* Sense status value (key at bit0-7, code at bit8-15 and qualifier at bit16-23).  */
@@ -553,6 +639,13 @@ typedef struct UX_SLAVE_CLASS_STORAGE_STRUCT
     ULONG                       ux_device_class_storage_cmd_n_lb;
     ULONG                       ux_device_class_storage_disk_n_lb;
     ULONG                       ux_device_class_storage_media_status;
+
+    ULONG                       ux_device_class_storage_unmap_offset;
+    ULONG                       ux_device_class_storage_unmap_length;
+#if defined(UX_DEVICE_CLASS_STORAGE_OWN_BUFFERS)
+    UCHAR                       *ux_device_class_storage_buffer_memory;
+    UCHAR                       *ux_device_class_storage_ep_buffer[2];
+#endif
 #endif
 
 } UX_SLAVE_CLASS_STORAGE;
@@ -613,6 +706,8 @@ UINT    _ux_device_class_storage_verify(UX_SLAVE_CLASS_STORAGE *storage, ULONG l
                     UX_SLAVE_ENDPOINT *endpoint_out, UCHAR *cbwcb);
 UINT    _ux_device_class_storage_write(UX_SLAVE_CLASS_STORAGE *storage, ULONG lun, UX_SLAVE_ENDPOINT *endpoint_in,
                     UX_SLAVE_ENDPOINT *endpoint_out, UCHAR *cbwcb, UCHAR scsi_command);
+UINT    _ux_device_class_storage_unmap(UX_SLAVE_CLASS_STORAGE *storage, ULONG lun, UX_SLAVE_ENDPOINT *endpoint_in,
+                    UX_SLAVE_ENDPOINT *endpoint_out, UCHAR *cbwcb);
 UINT    _ux_device_class_storage_synchronize_cache(UX_SLAVE_CLASS_STORAGE *storage, ULONG lun, UX_SLAVE_ENDPOINT *endpoint_in,
                     UX_SLAVE_ENDPOINT *endpoint_out, UCHAR *cbwcb, UCHAR scsi_command);
 UINT    _ux_device_class_storage_read_disk_information(UX_SLAVE_CLASS_STORAGE *storage, ULONG lun,
@@ -641,6 +736,7 @@ UINT    _ux_device_class_storage_read_dvd_structure(UX_SLAVE_CLASS_STORAGE *stor
                                             UX_SLAVE_ENDPOINT *endpoint_out, UCHAR *cbwcb);
 
 UINT    _ux_device_class_storage_tasks_run(VOID *instance);
+UINT    _ux_device_class_storage_unmap_next(UX_SLAVE_CLASS_STORAGE *storage);
 
 /* Define Device Storage Class API prototypes.  */
 
@@ -133,10 +133,26 @@ UX_SLAVE_ENDPOINT                       *endpoint;
     }
 
     /* Reset states.  */
+#if defined(UX_DEVICE_CLASS_STORAGE_OWN_BUFFERS)
+
+    /* Keep endpoint buffers to restore them on deactivate, use class buffers instead.  */
+    storage -> ux_device_class_storage_ep_buffer[0] = storage -> ux_device_class_storage_ep_out ->
+                    ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer;
+    storage -> ux_device_class_storage_ep_buffer[1] = storage -> ux_device_class_storage_ep_in ->
+                    ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer;
+    storage -> ux_device_class_storage_buffer[0] = storage -> ux_device_class_storage_buffer_memory;
+    storage -> ux_device_class_storage_buffer[1] = storage -> ux_device_class_storage_buffer_memory +
+                                                    UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE;
+    storage -> ux_device_class_storage_ep_out -> ux_slave_endpoint_transfer_request.
+                    ux_slave_transfer_request_data_pointer = storage -> ux_device_class_storage_buffer[0];
+    storage -> ux_device_class_storage_ep_in -> ux_slave_endpoint_transfer_request.
+                    ux_slave_transfer_request_data_pointer = storage -> ux_device_class_storage_buffer[1];
+#else
     storage -> ux_device_class_storage_buffer[0] = storage -> ux_device_class_storage_ep_out ->
                     ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer;
     storage -> ux_device_class_storage_buffer[1] = storage -> ux_device_class_storage_ep_in ->
                     ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer;
+#endif
     storage -> ux_device_class_storage_data_buffer = UX_NULL;
     storage -> ux_device_class_storage_state = UX_STATE_RESET;
     storage -> ux_device_class_storage_disk_state = UX_DEVICE_CLASS_STORAGE_DISK_IDLE;
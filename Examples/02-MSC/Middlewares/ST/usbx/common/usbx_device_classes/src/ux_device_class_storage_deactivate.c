@@ -96,10 +96,19 @@ UX_SLAVE_CLASS              *class_ptr;
     endpoint_out = storage -> ux_device_class_storage_ep_out;
     _ux_device_stack_transfer_all_request_abort(endpoint_in, UX_TRANSFER_BUS_RESET);
     _ux_device_stack_transfer_all_request_abort(endpoint_out, UX_TRANSFER_BUS_RESET);
+#if defined(UX_DEVICE_CLASS_STORAGE_OWN_BUFFERS)
+
+    /* Give back the endpoint buffers.  */
+    endpoint_out -> ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer =
+                                storage -> ux_device_class_storage_ep_buffer[0];
+    endpoint_in -> ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer =
+                                storage -> ux_device_class_storage_ep_buffer[1];
+#else
     endpoint_out -> ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer =
                                 storage -> ux_device_class_storage_buffer[0];
     endpoint_in -> ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer =
                                 storage -> ux_device_class_storage_buffer[1];
+#endif
 #else
 
     /* Locate the endpoints.  */
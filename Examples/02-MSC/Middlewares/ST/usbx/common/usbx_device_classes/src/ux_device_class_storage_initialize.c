@@ -136,6 +136,18 @@ ULONG                                   lun_index;
     class_inst -> ux_slave_class_task_function = _ux_device_class_storage_tasks_run;
 
     status = UX_SUCCESS;
+
+#if defined(UX_DEVICE_CLASS_STORAGE_OWN_BUFFERS)
+
+    /* Allocate the ping-pong buffers, they are larger than endpoint buffers.  */
+    storage -> ux_device_class_storage_buffer_memory = _ux_utility_memory_allocate_mulc_safe(UX_SAFE_ALIGN,
+                    UX_CACHE_SAFE_MEMORY, UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE, 2);
+    if (storage -> ux_device_class_storage_buffer_memory == UX_NULL)
+    {
+        _ux_utility_memory_free(storage);
+        return(UX_MEMORY_INSUFFICIENT);
+    }
+#endif
 #endif
 
     /* If thread resources allocated, go on.  */
@@ -170,6 +182,8 @@ ULONG                                   lun_index;
             storage -> ux_slave_class_storage_lun[lun_index].ux_slave_class_storage_media_write          = storage_parameter -> ux_slave_class_storage_parameter_lun[lun_index].ux_slave_class_storage_media_write;
             storage -> ux_slave_class_storage_lun[lun_index].ux_slave_class_storage_media_status         = storage_parameter -> ux_slave_class_storage_parameter_lun[lun_index].ux_slave_class_storage_media_status;
             storage -> ux_slave_class_storage_lun[lun_index].ux_slave_class_storage_media_notification   = storage_parameter -> ux_slave_class_storage_parameter_lun[lun_index].ux_slave_class_storage_media_notification;
+            storage -> ux_slave_class_storage_lun[lun_index].ux_slave_class_storage_media_discard        = storage_parameter -> ux_slave_class_storage_parameter_lun[lun_index].ux_slave_class_storage_media_discard;
+            storage -> ux_slave_class_storage_lun[lun_index].ux_slave_class_storage_media_unmap_granularity = storage_parameter -> ux_slave_class_storage_parameter_lun[lun_index].ux_slave_class_storage_media_unmap_granularity;
         }
 
         /* If it's OK, complete it.  */
@@ -211,6 +225,10 @@ ULONG                                   lun_index;
         _ux_device_thread_delete(&class_inst -> ux_slave_class_thread);
     }
 
+#if defined(UX_DEVICE_CLASS_STORAGE_OWN_BUFFERS)
+    _ux_utility_memory_free(storage -> ux_device_class_storage_buffer_memory);
+#endif
+
 #if !defined(UX_DEVICE_STANDALONE)
     if (class_inst -> ux_slave_class_thread_stack != UX_NULL)
         _ux_utility_memory_free(&class_inst -> ux_slave_class_thread_stack);
@@ -102,6 +102,7 @@ UX_SLAVE_TRANSFER       *transfer_request;
 UCHAR                   inquiry_page_code;
 ULONG                   inquiry_length;
 UCHAR                   *inquiry_buffer;
+ULONG                   page_length;
 
     UX_PARAMETER_NOT_USED(endpoint_out);
 
@@ -132,12 +133,23 @@ UCHAR                   *inquiry_buffer;
     /* Obtain inquiry buffer pointer.  */
     inquiry_buffer = transfer_request -> ux_slave_transfer_request_data_pointer;
 
+    /* Get the length of the page, with EVPD set page 0 is the list of supported VPD pages.  */
+    if (inquiry_page_code == UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_BLOCK_LIMITS)
+        page_length = UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_LENGTH;
+    else if (inquiry_page_code == UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_LBP)
+        page_length = UX_SLAVE_CLASS_STORAGE_VPD_LBP_LENGTH;
+    else if (inquiry_page_code == UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_STANDARD &&
+             (*(cbwcb + UX_SLAVE_CLASS_STORAGE_INQUIRY_FLAGS) & UX_SLAVE_CLASS_STORAGE_INQUIRY_FLAGS_EVPD))
+        page_length = UX_SLAVE_CLASS_STORAGE_VPD_SUPPORTED_LENGTH;
+    else
+        page_length = UX_SLAVE_CLASS_STORAGE_INQUIRY_RESPONSE_LENGTH;
+
     /* Ensure the data buffer is cleaned.  */
-    _ux_utility_memory_set(inquiry_buffer, 0, UX_SLAVE_CLASS_STORAGE_INQUIRY_RESPONSE_LENGTH); /* Use case of memset is verified. */
+    _ux_utility_memory_set(inquiry_buffer, 0, page_length); /* Use case of memset is verified. */
 
     /* Check for the maximum length to be returned. */
-    if (inquiry_length > UX_SLAVE_CLASS_STORAGE_INQUIRY_RESPONSE_LENGTH)
-        inquiry_length = UX_SLAVE_CLASS_STORAGE_INQUIRY_RESPONSE_LENGTH;
+    if (inquiry_length > page_length)
+        inquiry_length = page_length;
 
     /* Default CSW to passed.  */
     storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_PASSED;
@@ -147,6 +159,19 @@ UCHAR                   *inquiry_buffer;
     {
 
     case UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_STANDARD:
+
+        /* List of the supported VPD pages.  */
+        if (page_length == UX_SLAVE_CLASS_STORAGE_VPD_SUPPORTED_LENGTH)
+        {
+            inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_PERIPHERAL_TYPE] =  (UCHAR)storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_type;
+            _ux_utility_short_put_big_endian(inquiry_buffer + UX_SLAVE_CLASS_STORAGE_VPD_PAGE_LENGTH,
+                        UX_SLAVE_CLASS_STORAGE_VPD_SUPPORTED_LENGTH - UX_SLAVE_CLASS_STORAGE_VPD_HEADER_LENGTH);
+            inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_HEADER_LENGTH + 0] =  UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_STANDARD;
+            inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_HEADER_LENGTH + 1] =  UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_SERIAL;
+            inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_HEADER_LENGTH + 2] =  UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_BLOCK_LIMITS;
+            inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_HEADER_LENGTH + 3] =  UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_LBP;
+            break;
+        }
             
         /* Store the product type.  */
         inquiry_buffer[UX_SLAVE_CLASS_STORAGE_INQUIRY_RESPONSE_PERIPHERAL_TYPE] =  (UCHAR)storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_type;
@@ -197,6 +222,38 @@ UCHAR                   *inquiry_buffer;
     
         break;
 
+    case UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_BLOCK_LIMITS:
+
+        /* Initialize the page header in response buffer.  */
+        inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_PERIPHERAL_TYPE] =  (UCHAR)storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_type;
+        inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_PAGE_CODE] =  UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_BLOCK_LIMITS;
+        _ux_utility_short_put_big_endian(inquiry_buffer + UX_SLAVE_CLASS_STORAGE_VPD_PAGE_LENGTH,
+                    UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_LENGTH - UX_SLAVE_CLASS_STORAGE_VPD_HEADER_LENGTH);
+
+        /* Unmap limits, only if the media can discard blocks.  */
+        if (storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_discard != UX_NULL)
+        {
+            _ux_utility_long_put_big_endian(inquiry_buffer + UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_MAX_UNMAP_LBA_COUNT, 0xFFFFFFFF);
+            _ux_utility_long_put_big_endian(inquiry_buffer + UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_MAX_UNMAP_DESC,
+                                            UX_SLAVE_CLASS_STORAGE_UNMAP_MAX_DESCRIPTORS);
+            _ux_utility_long_put_big_endian(inquiry_buffer + UX_SLAVE_CLASS_STORAGE_VPD_BLOCK_LIMITS_UNMAP_GRANULARITY,
+                                            storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_unmap_granularity);
+        }
+        break;
+
+    case UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_LBP:
+
+        /* Initialize the page header in response buffer.  */
+        inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_PERIPHERAL_TYPE] =  (UCHAR)storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_type;
+        inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_PAGE_CODE] =  UX_SLAVE_CLASS_STORAGE_INQUIRY_PAGE_CODE_LBP;
+        _ux_utility_short_put_big_endian(inquiry_buffer + UX_SLAVE_CLASS_STORAGE_VPD_PAGE_LENGTH,
+                    UX_SLAVE_CLASS_STORAGE_VPD_LBP_LENGTH - UX_SLAVE_CLASS_STORAGE_VPD_HEADER_LENGTH);
+
+        /* UNMAP is supported if the media can discard blocks.  */
+        if (storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_discard != UX_NULL)
+            inquiry_buffer[UX_SLAVE_CLASS_STORAGE_VPD_LBP_FLAGS] =  UX_SLAVE_CLASS_STORAGE_VPD_LBP_FLAGS_LBPU;
+        break;
+
     default:
 
 #if !defined(UX_DEVICE_STANDALONE)
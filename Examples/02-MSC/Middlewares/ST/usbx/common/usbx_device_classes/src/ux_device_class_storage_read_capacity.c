@@ -46,7 +46,8 @@
 /*                                                                        */
 /*  DESCRIPTION                                                           */
 /*                                                                        */ 
-/*    This function performs a READ_CAPACITY command.                     */ 
+/*    This function performs a READ_CAPACITY command, or READ CAPACITY    */
+/*    (16) through SERVICE ACTION IN.                                     */
 /*                                                                        */ 
 /*  INPUT                                                                 */ 
 /*                                                                        */ 
@@ -96,8 +97,8 @@ UINT                    status;
 ULONG                   media_status;
 UX_SLAVE_TRANSFER       *transfer_request;
 UCHAR                   *read_capacity_buffer;
+ULONG                   read_capacity_length;
 
-    UX_PARAMETER_NOT_USED(cbwcb);
     UX_PARAMETER_NOT_USED(endpoint_out);
 
     /* If trace is enabled, insert this event into the trace buffer.  */
@@ -133,16 +134,44 @@ UCHAR                   *read_capacity_buffer;
         /* Obtain read capacity response buffer.  */
         read_capacity_buffer = transfer_request -> ux_slave_transfer_request_data_pointer;
     
-        /* Ensure it is cleaned.  */
-        _ux_utility_memory_set(read_capacity_buffer, 0, UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LENGTH); /* Use case of memcpy is verified. */
-    
-        /* Insert the last LBA address in the response.  */
-        _ux_utility_long_put_big_endian(&read_capacity_buffer[UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LAST_LBA],
-                                        storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_last_lba);
-    
-        /* Insert the block length in the response.  */
-        _ux_utility_long_put_big_endian(&read_capacity_buffer[UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_BLOCK_SIZE],
-                                        storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_block_length);
+        if (*cbwcb == UX_SLAVE_CLASS_STORAGE_SCSI_SERVICE_ACTION_IN)
+        {
+
+            /* READ CAPACITY (16), the allocation length limits the response.  */
+            read_capacity_length = UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_LENGTH;
+            if (_ux_utility_long_get_big_endian(cbwcb + UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_ALLOCATION_LENGTH) < read_capacity_length)
+                read_capacity_length = _ux_utility_long_get_big_endian(cbwcb + UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_ALLOCATION_LENGTH);
+
+            /* Ensure it is cleaned.  */
+            _ux_utility_memory_set(read_capacity_buffer, 0, UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_LENGTH); /* Use case of memset is verified. */
+
+            /* Insert the last LBA address in the response, 64-bit with the high part zero.  */
+            _ux_utility_long_put_big_endian(&read_capacity_buffer[UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_LAST_LBA + 4],
+                                            storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_last_lba);
+
+            /* Insert the block length in the response.  */
+            _ux_utility_long_put_big_endian(&read_capacity_buffer[UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_BLOCK_SIZE],
+                                            storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_block_length);
+
+            /* Logical block provisioning is enabled if the media can discard blocks.  */
+            if (storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_discard != UX_NULL)
+                read_capacity_buffer[UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_LBP] = UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_16_RESPONSE_LBPME;
+        }
+        else
+        {
+            read_capacity_length = UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LENGTH;
+
+            /* Ensure it is cleaned.  */
+            _ux_utility_memory_set(read_capacity_buffer, 0, UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LENGTH); /* Use case of memcpy is verified. */
+
+            /* Insert the last LBA address in the response.  */
+            _ux_utility_long_put_big_endian(&read_capacity_buffer[UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LAST_LBA],
+                                            storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_last_lba);
+
+            /* Insert the block length in the response.  */
+            _ux_utility_long_put_big_endian(&read_capacity_buffer[UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_BLOCK_SIZE],
+                                            storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_block_length);
+        }
     
 #if defined(UX_DEVICE_STANDALONE)
 
@@ -151,19 +180,15 @@ UCHAR                   *read_capacity_buffer;
         storage -> ux_device_class_storage_cmd_state = UX_DEVICE_CLASS_STORAGE_CMD_READ;
 
         storage -> ux_device_class_storage_transfer = transfer_request;
-        storage -> ux_device_class_storage_device_length =
-                        UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LENGTH;
-        storage -> ux_device_class_storage_data_length =
-                        UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LENGTH;
+        storage -> ux_device_class_storage_device_length = read_capacity_length;
+        storage -> ux_device_class_storage_data_length = read_capacity_length;
         storage -> ux_device_class_storage_data_count = 0;
         UX_SLAVE_TRANSFER_STATE_RESET(storage -> ux_device_class_storage_transfer);
 
 #else
 
         /* Send a data payload with the read_capacity response buffer.  */
-        _ux_device_stack_transfer_request(transfer_request, 
-                                      UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LENGTH,
-                                      UX_SLAVE_CLASS_STORAGE_READ_CAPACITY_RESPONSE_LENGTH);
+        _ux_device_stack_transfer_request(transfer_request, read_capacity_length, read_capacity_length);
 #endif
 
         /* Now we set the CSW with success.  */
@@ -57,6 +57,7 @@ static inline UINT _ux_device_class_storage_disk_wait(UX_SLAVE_CLASS_STORAGE *st
 static inline VOID _ux_device_class_storage_disk_next(UX_SLAVE_CLASS_STORAGE *storage);
 static inline VOID _ux_device_class_storage_disk_read_next(UX_SLAVE_CLASS_STORAGE *storage);
 static inline VOID _ux_device_class_storage_disk_write_next(UX_SLAVE_CLASS_STORAGE *storage);
+static inline VOID _ux_device_class_storage_disk_unmap_next(UX_SLAVE_CLASS_STORAGE *storage);
 static inline VOID _ux_device_class_storage_disk_error(UX_SLAVE_CLASS_STORAGE *storage);
 
 
@@ -573,6 +574,11 @@ UCHAR               lun;
         _ux_device_class_storage_synchronize_cache(storage, lun, endpoint_in, endpoint_out, cbwcb, *(cbwcb));
         break;
 
+    case UX_SLAVE_CLASS_STORAGE_SCSI_UNMAP:
+
+        _ux_device_class_storage_unmap(storage, lun, endpoint_in, endpoint_out, cbwcb);
+        break;
+
 #ifdef UX_SLAVE_CLASS_STORAGE_INCLUDE_MMC
     case UX_SLAVE_CLASS_STORAGE_SCSI_GET_STATUS_NOTIFICATION:
 
@@ -611,6 +617,17 @@ UCHAR               lun;
 
 #endif
 
+    case UX_SLAVE_CLASS_STORAGE_SCSI_SERVICE_ACTION_IN:
+
+        /* READ CAPACITY (16) is the only service action supported.  */
+        if ((*(cbwcb + UX_SLAVE_CLASS_STORAGE_SERVICE_ACTION) & UX_SLAVE_CLASS_STORAGE_SERVICE_ACTION_MASK) ==
+                                                    UX_SLAVE_CLASS_STORAGE_SERVICE_ACTION_READ_CAPACITY_16)
+        {
+            _ux_device_class_storage_read_capacity(storage, lun, endpoint_in, endpoint_out, cbwcb);
+            break;
+        }
+
+        /* Fall through.  */
     default:
 
         /* The command is unknown or unsupported, fail.  */
@@ -848,6 +865,12 @@ static inline UINT _ux_device_class_storage_data_next(UX_SLAVE_CLASS_STORAGE *st
         }
         break;
 
+    /* Parameter list received, discard the blocks of the first descriptor.  */
+    case UX_SLAVE_CLASS_STORAGE_SCSI_UNMAP:
+
+        _ux_device_class_storage_disk_unmap_next(storage);
+        break;
+
     /* No further data to send.  */
     default:
 
@@ -1013,6 +1036,12 @@ INT                     immediate_state = UX_TRUE;
                 /* Disk idle.  */
                 storage -> ux_device_class_storage_disk_state = UX_DEVICE_CLASS_STORAGE_DISK_IDLE;
 
+                /* The CSW is failed with the sense of the media.  */
+                storage -> ux_slave_class_storage_lun[storage -> ux_slave_class_storage_cbw_lun].
+                            ux_slave_class_storage_request_sense_status =
+                                        storage -> ux_device_class_storage_media_status;
+                storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_FAILED;
+
                 /* USB notified with disk error.  */
                 storage -> ux_device_class_storage_state = UX_DEVICE_CLASS_STORAGE_STATE_DISK_ERROR;
             }
@@ -1053,10 +1082,11 @@ ULONG block_size;
 ULONG max_n_blocks;
 
 
-    if (storage -> ux_device_class_storage_cmd == UX_SLAVE_CLASS_STORAGE_SCSI_SYNCHRONIZE_CACHE)
+    if (storage -> ux_device_class_storage_cmd == UX_SLAVE_CLASS_STORAGE_SCSI_SYNCHRONIZE_CACHE ||
+        storage -> ux_device_class_storage_cmd == UX_SLAVE_CLASS_STORAGE_SCSI_UNMAP)
     {
 
-        /* All things sync in one call.  */
+        /* All things sync or discard in one call.  */
         storage -> ux_device_class_storage_disk_n_lb = storage -> ux_device_class_storage_cmd_n_lb;
         return;
     }
@@ -1114,6 +1144,14 @@ static inline UINT _ux_device_class_storage_disk_wait(UX_SLAVE_CLASS_STORAGE *st
                             storage -> ux_device_class_storage_cmd_lba,
                             &storage -> ux_device_class_storage_media_status);
 
+    case UX_SLAVE_CLASS_STORAGE_SCSI_UNMAP:
+        return storage -> ux_slave_class_storage_lun[storage -> ux_slave_class_storage_cbw_lun].
+                        ux_slave_class_storage_media_discard(storage,
+                            storage -> ux_slave_class_storage_cbw_lun,
+                            storage -> ux_device_class_storage_disk_n_lb,
+                            storage -> ux_device_class_storage_cmd_lba,
+                            &storage -> ux_device_class_storage_media_status);
+
     case UX_SLAVE_CLASS_STORAGE_SCSI_VERIFY: /* No nothing for now.  */
     default:
         break;
@@ -1140,6 +1178,10 @@ static inline VOID _ux_device_class_storage_disk_next(UX_SLAVE_CLASS_STORAGE *st
         _ux_device_class_storage_disk_write_next(storage);
         return;
 
+    case UX_SLAVE_CLASS_STORAGE_SCSI_UNMAP:
+        _ux_device_class_storage_disk_unmap_next(storage);
+        return;
+
     case UX_SLAVE_CLASS_STORAGE_SCSI_SYNCHRONIZE_CACHE:
 
         /* Disk is idle now.  */
@@ -1264,9 +1306,30 @@ static inline VOID _ux_device_class_storage_disk_write_next(UX_SLAVE_CLASS_STORA
         }
     }
 }
+static inline VOID _ux_device_class_storage_disk_unmap_next(UX_SLAVE_CLASS_STORAGE *storage)
+{
+
+    /* Start discarding the next descriptor, if any.  */
+    if (_ux_device_class_storage_unmap_next(storage) == UX_SUCCESS &&
+        storage -> ux_device_class_storage_cmd_n_lb != 0)
+    {
+        storage -> ux_device_class_storage_disk_state = UX_DEVICE_CLASS_STORAGE_DISK_OP_START;
+        storage -> ux_device_class_storage_state = UX_DEVICE_CLASS_STORAGE_STATE_DISK_WAIT;
+        return;
+    }
+
+    /* Disk is idle now.  */
+    storage -> ux_device_class_storage_disk_state = UX_DEVICE_CLASS_STORAGE_DISK_IDLE;
+
+    /* All descriptors done or parameter list error, issue CSW.  */
+    _ux_device_class_storage_csw_send(storage,
+                storage -> ux_slave_class_storage_cbw_lun,
+                storage -> ux_device_class_storage_ep_in,
+                0 /* Not used.  */);
+}
 static inline VOID _ux_device_class_storage_disk_error(UX_SLAVE_CLASS_STORAGE *storage)
 {
-    /* Abort disk operation: read or write with NULL!  */
+    /* Abort disk operation: read or write with NULL, discard with no block!  */
     switch (storage -> ux_device_class_storage_cmd)
     {
     case UX_SLAVE_CLASS_STORAGE_SCSI_READ16:
@@ -1281,6 +1344,11 @@ static inline VOID _ux_device_class_storage_disk_error(UX_SLAVE_CLASS_STORAGE *s
                 ux_slave_class_storage_media_write(storage,
                         storage -> ux_slave_class_storage_cbw_lun, UX_NULL, 0, 0, UX_NULL);
         break;
+    case UX_SLAVE_CLASS_STORAGE_SCSI_UNMAP:
+        storage -> ux_slave_class_storage_lun[storage -> ux_slave_class_storage_cbw_lun].
+                ux_slave_class_storage_media_discard(storage,
+                        storage -> ux_slave_class_storage_cbw_lun, 0, 0, UX_NULL);
+        break;
     default:
         break;
     }
@@ -101,6 +101,11 @@ UX_SLAVE_CLASS                          *class_ptr;
         _ux_utility_memory_free(class_ptr -> ux_slave_class_thread_stack);
 #endif
 
+#if defined(UX_DEVICE_CLASS_STORAGE_OWN_BUFFERS)
+        /* Free the ping-pong buffers.  */
+        _ux_utility_memory_free(storage -> ux_device_class_storage_buffer_memory);
+#endif
+
         /* Free the resources.  */
         _ux_utility_memory_free(storage);
     }
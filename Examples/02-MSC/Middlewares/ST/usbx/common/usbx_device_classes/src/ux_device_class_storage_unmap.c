@@ -0,0 +1,491 @@
+/**************************************************************************/
+/*                                                                        */
+/*       Copyright (c) Microsoft Corporation. All rights reserved.        */
+/*                                                                        */
+/*       This software is licensed under the Microsoft Software License   */
+/*       Terms for Microsoft Azure RTOS. Full text of the license can be  */
+/*       found in the LICENSE file at https://aka.ms/AzureRTOS_EULA       */
+/*       and in the root directory of this software.                      */
+/*                                                                        */
+/**************************************************************************/
+
+
+/**************************************************************************/
+/**************************************************************************/
+/**                                                                       */
+/** USBX Component                                                        */
+/**                                                                       */
+/**   Device Storage Class                                                */
+/**                                                                       */
+/**************************************************************************/
+/**************************************************************************/
+
+
+/* Include necessary system files.  */
+
+#define UX_SOURCE_CODE
+
+#include "ux_api.h"
+#include "ux_device_class_storage.h"
+#include "ux_device_stack.h"
+
+
+static UINT _ux_device_class_storage_unmap_check(UX_SLAVE_CLASS_STORAGE *storage, ULONG lun,
+                                                 UCHAR *parameter_list, ULONG *parameter_length);
+
+
+/**************************************************************************/
+/*                                                                        */
+/*  FUNCTION                                               RELEASE        */
+/*                                                                        */
+/*    _ux_device_class_storage_unmap                      PORTABLE C      */
+/*                                                           6.1.10       */
+/*                                                                        */
+/*  DESCRIPTION                                                           */
+/*                                                                        */
+/*    This function performs an UNMAP command. The parameter list is      */
+/*    received from the host and each block descriptor is passed to the   */
+/*    media discard callback of the LUN. The callback returns             */
+/*    UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR in both modes, a     */
+/*    call with no block aborts the discard in progress.                  */
+/*                                                                        */
+/*  INPUT                                                                 */
+/*                                                                        */
+/*    storage                               Pointer to storage class      */
+/*    lun                                   Logical unit number           */
+/*    endpoint_in                           Pointer to IN endpoint        */
+/*    endpoint_out                          Pointer to OUT endpoint       */
+/*    cbwcb                                 Pointer to the CBWCB          */
+/*                                                                        */
+/*  OUTPUT                                                                */
+/*                                                                        */
+/*    Completion Status                                                   */
+/*                                                                        */
+/*  CALLS                                                                 */
+/*                                                                        */
+/*    (ux_slave_class_storage_media_status) Get media status              */
+/*    (ux_slave_class_storage_media_discard) Discard media blocks         */
+/*    _ux_device_stack_endpoint_stall       Stall endpoint                */
+/*    _ux_device_stack_transfer_request     Transfer request              */
+/*    _ux_utility_long_get_big_endian       Get 32-bit big endian         */
+/*    _ux_utility_short_get_big_endian      Get 16-bit big endian         */
+/*                                                                        */
+/*  CALLED BY                                                             */
+/*                                                                        */
+/*    Device Storage Class                                                */
+/*                                                                        */
+/**************************************************************************/
+UINT  _ux_device_class_storage_unmap(UX_SLAVE_CLASS_STORAGE *storage, ULONG lun,
+                                     UX_SLAVE_ENDPOINT *endpoint_in,
+                                     UX_SLAVE_ENDPOINT *endpoint_out, UCHAR *cbwcb)
+{
+
+UINT                    status;
+UX_SLAVE_TRANSFER       *transfer_request;
+ULONG                   parameter_length;
+ULONG                   media_status;
+
+#if !defined(UX_DEVICE_STANDALONE)
+UCHAR                   *descriptor;
+ULONG                   lba;
+ULONG                   number_blocks;
+ULONG                   offset;
+#endif
+
+
+    UX_PARAMETER_NOT_USED(endpoint_in);
+
+    /* Get the parameter list length from the CBWCB.  */
+    parameter_length =  _ux_utility_short_get_big_endian(cbwcb + UX_SLAVE_CLASS_STORAGE_UNMAP_PARAMETER_LIST_LENGTH);
+
+    /* If trace is enabled, insert this event into the trace buffer.  */
+    UX_TRACE_IN_LINE_INSERT(UX_TRACE_DEVICE_CLASS_STORAGE_OTHER, storage, lun, 0, 0, UX_TRACE_DEVICE_CLASS_EVENTS, 0, 0)
+
+    /* Default CSW to failed.  */
+    storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_FAILED;
+
+    /* The command is not supported if the media can not discard blocks.  */
+    if (storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_discard == UX_NULL)
+    {
+
+        /* Initialize the request sense keys.  */
+        storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status =
+            UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_ILLEGAL_REQUEST,
+                                                UX_SLAVE_CLASS_STORAGE_ASC_KEY_INVALID_COMMAND,0);
+
+#if !defined(UX_DEVICE_STANDALONE)
+        if (storage -> ux_slave_class_storage_host_length)
+            _ux_device_stack_endpoint_stall(endpoint_out);
+#endif
+
+        return(UX_FUNCTION_NOT_SUPPORTED);
+    }
+
+    /* Obtain the status of the device.  */
+    status =  storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_status(storage,
+                            lun, storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_id, &media_status);
+
+    /* Update the request sense.  */
+    storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status = media_status;
+
+    /* If there is a problem, return a failed command.  */
+    if (status != UX_SUCCESS)
+    {
+
+        /* We have a problem, media status error. Return a bad completion and wait for the
+           REQUEST_SENSE command.  */
+#if !defined(UX_DEVICE_STANDALONE)
+        if (storage -> ux_slave_class_storage_host_length)
+            _ux_device_stack_endpoint_stall(endpoint_out);
+#endif
+
+        /* We are done here.  */
+        return(UX_ERROR);
+    }
+
+    /* Check Read Only flag.  */
+    if (storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_read_only_flag == UX_TRUE)
+    {
+
+        /* Update the request sense.  */
+        storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status =
+                UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_DATA_PROTECT,
+                                            UX_SLAVE_CLASS_STORAGE_REQUEST_CODE_MEDIA_PROTECTED,0);
+
+#if !defined(UX_DEVICE_STANDALONE)
+        if (storage -> ux_slave_class_storage_host_length)
+            _ux_device_stack_endpoint_stall(endpoint_out);
+#endif
+
+        /* We are done here.  */
+        return(UX_ERROR);
+    }
+
+    /* The whole parameter list must fit in one buffer.  */
+    if (parameter_length > UX_SLAVE_CLASS_STORAGE_UNMAP_MAX_PARAMETER_LENGTH)
+    {
+
+        /* Update the request sense.  */
+        storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status =
+            UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_ILLEGAL_REQUEST,
+                                                UX_SLAVE_CLASS_STORAGE_ASC_KEY_INVALID_FIELD_IN_CDB,0);
+
+#if !defined(UX_DEVICE_STANDALONE)
+        if (storage -> ux_slave_class_storage_host_length)
+            _ux_device_stack_endpoint_stall(endpoint_out);
+#endif
+
+        /* We are done here.  */
+        return(UX_ERROR);
+    }
+
+    /* Nothing to unmap without parameter list.  */
+    storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_PASSED;
+    if (parameter_length == 0)
+        return(UX_SUCCESS);
+
+    /* Obtain the pointer to the transfer request.  */
+    transfer_request =  &endpoint_out -> ux_slave_endpoint_transfer_request;
+
+#if defined(UX_DEVICE_STANDALONE)
+
+    /* Case (3) Hn < Do.  */
+    if (parameter_length > storage -> ux_slave_class_storage_host_length)
+    {
+        storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_PHASE_ERROR;
+        return(UX_ERROR);
+    }
+
+    /* Case (8). Hi <> Do.  */
+    if ((storage -> ux_slave_class_storage_cbw_flags & 0x80) != 0)
+    {
+        storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_PHASE_ERROR;
+        return(UX_ERROR);
+    }
+
+    /* Case (9), (11). Ho > Do: no discard, the command task stalls the OUT
+       endpoint and sends the failed CSW with the residue.  */
+    if (parameter_length < storage -> ux_slave_class_storage_host_length)
+    {
+        storage -> ux_slave_class_storage_csw_residue =
+                storage -> ux_slave_class_storage_host_length - parameter_length;
+        storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_FAILED;
+        return(UX_ERROR);
+    }
+
+    /* Next: Transfer (DATA) -> Disk discard.  */
+    storage -> ux_device_class_storage_state = UX_DEVICE_CLASS_STORAGE_STATE_TRANS_START;
+    storage -> ux_device_class_storage_cmd_state = UX_DEVICE_CLASS_STORAGE_CMD_WRITE;
+    storage -> ux_device_class_storage_disk_state = UX_DEVICE_CLASS_STORAGE_DISK_IDLE;
+    storage -> ux_device_class_storage_buffer_usb = 0;
+    transfer_request -> ux_slave_transfer_request_data_pointer = storage -> ux_device_class_storage_buffer[0];
+
+    storage -> ux_device_class_storage_transfer = transfer_request;
+    storage -> ux_device_class_storage_device_length = parameter_length;
+    storage -> ux_device_class_storage_data_length = parameter_length;
+    storage -> ux_device_class_storage_data_count = 0;
+
+    storage -> ux_device_class_storage_cmd_lba = 0;
+    storage -> ux_device_class_storage_cmd_n_lb = 0;
+    storage -> ux_device_class_storage_unmap_offset = 0;
+    storage -> ux_device_class_storage_unmap_length = 0;
+
+#else
+
+    /* Case (3) Hn < Do.  */
+    if (parameter_length > storage -> ux_slave_class_storage_host_length)
+    {
+        _ux_device_stack_endpoint_stall(endpoint_out);
+        storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_PHASE_ERROR;
+        return(UX_ERROR);
+    }
+
+    /* Case (8). Hi <> Do.  */
+    if ((storage -> ux_slave_class_storage_cbw_flags & 0x80) != 0)
+    {
+        _ux_device_stack_endpoint_stall(endpoint_in);
+        storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_PHASE_ERROR;
+        return(UX_ERROR);
+    }
+
+    /* Get the parameter list from the host.  */
+    status =  _ux_device_stack_transfer_request(transfer_request, parameter_length, parameter_length);
+    if (status != UX_SUCCESS)
+    {
+
+        /* We have a problem, request error. Return a bad completion and wait for the
+           REQUEST_SENSE command.  */
+        _ux_device_stack_endpoint_stall(endpoint_out);
+        storage -> ux_slave_class_storage_csw_residue = storage -> ux_slave_class_storage_host_length;
+        storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status =
+                                            UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(0x02,0x54,0x00);
+        storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_FAILED;
+        return(UX_ERROR);
+    }
+
+    /* Update residue.  */
+    storage -> ux_slave_class_storage_csw_residue = storage -> ux_slave_class_storage_host_length - parameter_length;
+
+    /* Case (9), (11). If host expects more transfer, stall it.  */
+    if (storage -> ux_slave_class_storage_csw_residue)
+        _ux_device_stack_endpoint_stall(endpoint_out);
+
+    /* Check the block descriptors before discarding any of them.  */
+    parameter_length = transfer_request -> ux_slave_transfer_request_actual_length;
+    status = _ux_device_class_storage_unmap_check(storage, lun,
+                            transfer_request -> ux_slave_transfer_request_data_pointer, &parameter_length);
+    if (status != UX_SUCCESS)
+    {
+        storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_FAILED;
+        return(status);
+    }
+
+    /* Discard the blocks of each descriptor.  */
+    for (offset = UX_SLAVE_CLASS_STORAGE_UNMAP_HEADER_LENGTH;
+         offset + UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LENGTH <= parameter_length;
+         offset += UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LENGTH)
+    {
+        descriptor = transfer_request -> ux_slave_transfer_request_data_pointer + offset;
+        lba = _ux_utility_long_get_big_endian(descriptor + UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LBA + 4);
+        number_blocks = _ux_utility_long_get_big_endian(descriptor + UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_NUMBER_OF_BLOCKS);
+        if (number_blocks == 0)
+            continue;
+
+        /* The discard callback is non-blocking in both modes, run it to the end.  */
+        do
+        {
+            status =  storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_discard(storage, lun,
+                                                                number_blocks, lba, &media_status);
+            if (status == UX_STATE_WAIT)
+                _ux_device_thread_relinquish();
+        } while (status == UX_STATE_WAIT);
+        if (status != UX_STATE_NEXT)
+        {
+
+            /* Update the request sense.  */
+            storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status = media_status;
+            storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_FAILED;
+            return(UX_ERROR);
+        }
+    }
+#endif
+
+    /* Return completion status.  */
+    return(UX_SUCCESS);
+}
+
+
+/**************************************************************************/
+/*                                                                        */
+/*  FUNCTION                                               RELEASE        */
+/*                                                                        */
+/*    _ux_device_class_storage_unmap_check                PORTABLE C      */
+/*                                                           6.1.10       */
+/*                                                                        */
+/*  DESCRIPTION                                                           */
+/*                                                                        */
+/*    This function checks an UNMAP parameter list: its length, the       */
+/*    number of block descriptors and the range of each descriptor. On    */
+/*    error the request sense status of the LUN is updated.               */
+/*                                                                        */
+/*  INPUT                                                                 */
+/*                                                                        */
+/*    storage                               Pointer to storage class      */
+/*    lun                                   Logical unit number           */
+/*    parameter_list                        Pointer to parameter list     */
+/*    parameter_length                      Received length, updated with */
+/*                                            the length used             */
+/*                                                                        */
+/*  OUTPUT                                                                */
+/*                                                                        */
+/*    Completion Status                                                   */
+/*                                                                        */
+/*  CALLS                                                                 */
+/*                                                                        */
+/*    _ux_utility_long_get_big_endian       Get 32-bit big endian         */
+/*    _ux_utility_short_get_big_endian      Get 16-bit big endian         */
+/*                                                                        */
+/*  CALLED BY                                                             */
+/*                                                                        */
+/*    Device Storage Class                                                */
+/*                                                                        */
+/**************************************************************************/
+static UINT _ux_device_class_storage_unmap_check(UX_SLAVE_CLASS_STORAGE *storage, ULONG lun,
+                                                 UCHAR *parameter_list, ULONG *parameter_length)
+{
+
+UCHAR                   *descriptor;
+ULONG                   descriptor_length;
+ULONG                   last_lba;
+ULONG                   lba;
+ULONG                   number_blocks;
+ULONG                   offset;
+
+
+    /* The header must be there.  */
+    if (*parameter_length < UX_SLAVE_CLASS_STORAGE_UNMAP_HEADER_LENGTH)
+    {
+        storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status =
+            UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_ILLEGAL_REQUEST,
+                                                UX_SLAVE_CLASS_STORAGE_ASC_KEY_PARAMETER_LIST_LENGTH,0);
+        return(UX_ERROR);
+    }
+
+    /* Use the lesser of the received and announced descriptor lengths, whole descriptors only.  */
+    descriptor_length = _ux_utility_short_get_big_endian(parameter_list + UX_SLAVE_CLASS_STORAGE_UNMAP_BLOCK_DESCRIPTOR_DATA_LENGTH);
+    if (descriptor_length > *parameter_length - UX_SLAVE_CLASS_STORAGE_UNMAP_HEADER_LENGTH)
+        descriptor_length = *parameter_length - UX_SLAVE_CLASS_STORAGE_UNMAP_HEADER_LENGTH;
+    descriptor_length -= descriptor_length % UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LENGTH;
+    *parameter_length = UX_SLAVE_CLASS_STORAGE_UNMAP_HEADER_LENGTH + descriptor_length;
+
+    /* Check the number of descriptors.  */
+    if (descriptor_length > UX_SLAVE_CLASS_STORAGE_UNMAP_MAX_DESCRIPTORS * UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LENGTH)
+    {
+        storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status =
+            UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_ILLEGAL_REQUEST,
+                                                UX_SLAVE_CLASS_STORAGE_ASC_KEY_INVALID_PARAMETER_LIST,0);
+        return(UX_ERROR);
+    }
+
+    /* Check the range of each descriptor, nothing is discarded if one is wrong.  */
+    last_lba = storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_media_last_lba;
+    for (offset = UX_SLAVE_CLASS_STORAGE_UNMAP_HEADER_LENGTH; offset < *parameter_length;
+         offset += UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LENGTH)
+    {
+        descriptor = parameter_list + offset;
+        lba = _ux_utility_long_get_big_endian(descriptor + UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LBA + 4);
+        number_blocks = _ux_utility_long_get_big_endian(descriptor + UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_NUMBER_OF_BLOCKS);
+        if (number_blocks == 0)
+            continue;
+
+        /* The LBA is 64-bit, the high part must be zero.  */
+        if ((_ux_utility_long_get_big_endian(descriptor + UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LBA) != 0) ||
+            (lba > last_lba) || (number_blocks - 1 > last_lba - lba))
+        {
+            storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status =
+                UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_ILLEGAL_REQUEST,
+                                                    UX_SLAVE_CLASS_STORAGE_ASC_KEY_LBA_OUT_OF_RANGE,0);
+            return(UX_ERROR);
+        }
+    }
+
+    return(UX_SUCCESS);
+}
+
+
+#if defined(UX_DEVICE_STANDALONE)
+/**************************************************************************/
+/*                                                                        */
+/*  FUNCTION                                               RELEASE        */
+/*                                                                        */
+/*    _ux_device_class_storage_unmap_next                 PORTABLE C      */
+/*                                                           6.1.10       */
+/*                                                                        */
+/*  DESCRIPTION                                                           */
+/*                                                                        */
+/*    This function loads the next block descriptor of the UNMAP          */
+/*    parameter list into the command LBA and number of blocks, for the   */
+/*    disk task to discard. The list is checked on the first call. The    */
+/*    number of blocks is left zero once all descriptors are done.        */
+/*                                                                        */
+/*  INPUT                                                                 */
+/*                                                                        */
+/*    storage                               Pointer to storage class      */
+/*                                                                        */
+/*  OUTPUT                                                                */
+/*                                                                        */
+/*    Completion Status                                                   */
+/*                                                                        */
+/*  CALLS                                                                 */
+/*                                                                        */
+/*    _ux_utility_long_get_big_endian       Get 32-bit big endian         */
+/*                                                                        */
+/*  CALLED BY                                                             */
+/*                                                                        */
+/*    Device Storage Class                                                */
+/*                                                                        */
+/**************************************************************************/
+UINT  _ux_device_class_storage_unmap_next(UX_SLAVE_CLASS_STORAGE *storage)
+{
+
+UINT                    status;
+UCHAR                   *parameter_list;
+UCHAR                   *descriptor;
+ULONG                   parameter_length;
+
+
+    /* The parameter list was received in the first buffer.  */
+    parameter_list = storage -> ux_device_class_storage_buffer[0];
+
+    /* First call, check the parameter list.  */
+    if (storage -> ux_device_class_storage_unmap_length == 0)
+    {
+        parameter_length = storage -> ux_device_class_storage_data_count;
+        status = _ux_device_class_storage_unmap_check(storage,
+                                storage -> ux_slave_class_storage_cbw_lun, parameter_list, &parameter_length);
+        if (status != UX_SUCCESS)
+        {
+            storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_FAILED;
+            return(status);
+        }
+
+        storage -> ux_device_class_storage_unmap_offset = UX_SLAVE_CLASS_STORAGE_UNMAP_HEADER_LENGTH;
+        storage -> ux_device_class_storage_unmap_length = parameter_length;
+    }
+
+    /* Load the next descriptor with blocks to discard.  */
+    storage -> ux_device_class_storage_cmd_n_lb = 0;
+    while (storage -> ux_device_class_storage_cmd_n_lb == 0 &&
+           storage -> ux_device_class_storage_unmap_offset < storage -> ux_device_class_storage_unmap_length)
+    {
+        descriptor = parameter_list + storage -> ux_device_class_storage_unmap_offset;
+        storage -> ux_device_class_storage_cmd_lba =
+                _ux_utility_long_get_big_endian(descriptor + UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LBA + 4);
+        storage -> ux_device_class_storage_cmd_n_lb =
+                _ux_utility_long_get_big_endian(descriptor + UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_NUMBER_OF_BLOCKS);
+        storage -> ux_device_class_storage_unmap_offset += UX_SLAVE_CLASS_STORAGE_UNMAP_DESCRIPTOR_LENGTH;
+    }
+
+    return(UX_SUCCESS);
+}
+#endif
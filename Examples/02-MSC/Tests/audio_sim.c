@@ -0,0 +1,575 @@
+/**
+  ******************************************************************************
+  * @file    audio_sim.c
+  * @brief   Simulated SAI, USB host and bus under the audio class, for the
+  *          host benchmarks
+  ******************************************************************************
+  * Time moves in events: the main loop passes, and in each USB frame the
+  * SOF interrupt, the OUT packet, the IN token and the feedback read, in
+  * the order their times put them. Before each event the SAI catches up
+  * with the time, one frame at a time.
+  * A transfer the class arms waits for its bus event, it is done at the
+  * next transfer run after it.
+  ******************************************************************************
+  */
+#include "audio_sim.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Bus events, from the start of the USB frame: the OUT packet at the
+   earliest */
+#define AUDIO_SIM_OUT_US        20U
+#define AUDIO_SIM_IN_US         300U
+#define AUDIO_SIM_FEEDBACK_US   400U
+
+/* Marker sample: the top byte of a half scale sample, in any format, and
+   the 24-bit value the host takes for it */
+#define AUDIO_SIM_MARKER        0x40U
+#define AUDIO_SIM_MARKER_MIN    0x200000
+
+/* Frames between the TX DMA and the RX DMA on the loopback: the FIFO of
+   each block */
+#define AUDIO_SIM_FIFO_FRAMES   (2U * AUDIO_SAI_FIFO_FRAMES)
+
+ULONG64 audio_sim_time;
+Audio_SimStatsTypeDef audio_sim_stats;
+
+static Audio_SimConfigTypeDef audio_sim_config;
+
+/* SAI --------------------------------------------------------------------*/
+Audio_RingTypeDef Audio_RX_Ring;
+Audio_RingTypeDef Audio_TX_Ring;
+__ALIGN_BEGIN uint8_t Audio_RX_Buffer[AUDIO_BUFFER_SIZE] __ALIGN_END;
+__ALIGN_BEGIN uint8_t Audio_TX_Buffer[AUDIO_BUFFER_SIZE] __ALIGN_END;
+
+static uint32_t audio_sim_frequency;
+static uint32_t audio_sim_rate;                 /* 16.16 frames per ms */
+
+uint32_t audio_sim_sai_rate(VOID)
+{
+  return audio_sim_rate;
+}
+static ULONG64 audio_sim_sai_frames;            /* frames the DMA moved */
+static uint32_t audio_sim_fifo[AUDIO_SIM_FIFO_FRAMES][AUDIO_CHANNELS];
+
+static VOID audio_sim_rings(uint32_t frequency)
+{
+  uint32_t frames = AUDIO_RING_FRAMES(frequency);
+
+  Audio_Ring_Init(&Audio_RX_Ring, (uint32_t *)Audio_RX_Buffer, frames,
+                  AUDIO_CHANNELS, 0, AUDIO_RX_LEAD(frames));
+  Audio_Ring_Init(&Audio_TX_Ring, (uint32_t *)Audio_TX_Buffer, frames,
+                  AUDIO_CHANNELS, 1, AUDIO_TX_LEAD(frames));
+}
+
+VOID Audio_SAI_Init(VOID)
+{
+  audio_sim_frequency = AUDIO_FREQUENCY;
+  audio_sim_rings(AUDIO_FREQUENCY);
+}
+
+/* Both DMAs run from audio_sim_connect(), at the buffer start */
+VOID Audio_SAI_Start_RX(VOID) {}
+VOID Audio_SAI_Stop_RX(VOID) {}
+VOID Audio_SAI_Start_TX(VOID) {}
+VOID Audio_SAI_Stop_TX(VOID) {}
+
+VOID Audio_SAI_SetFrequency(uint32_t frequency)
+{
+  audio_sim_frequency = frequency;
+  audio_sim_rings(frequency);
+}
+
+VOID Audio_SAI_GetErrors(Audio_SAI_ErrorsTypeDef *errors)
+{
+  memset(errors, 0, sizeof(*errors));
+}
+
+uint32_t Audio_SAI_Get_TX_Head(VOID)
+{
+  return (uint32_t)(audio_sim_sai_frames % Audio_TX_Ring.frames) * AUDIO_CHANNELS;
+}
+
+uint32_t Audio_SAI_Get_RX_Head(VOID)
+{
+  return (uint32_t)(audio_sim_sai_frames % Audio_RX_Ring.frames) * AUDIO_CHANNELS;
+}
+
+/* The SAI up to the current time: each frame played goes through the
+   FIFOs into the frame recorded, the DMA events at each half ring */
+static VOID audio_sim_sai(VOID)
+{
+  ULONG64 target = ((audio_sim_time * audio_sim_rate) / 1000U) >> 16;
+  uint32_t *tx = (uint32_t *)Audio_TX_Buffer;
+  uint32_t *rx = (uint32_t *)Audio_RX_Buffer;
+
+  while (audio_sim_sai_frames < target)
+  {
+    uint32_t index = (uint32_t)(audio_sim_sai_frames % Audio_TX_Ring.frames);
+    uint32_t *fifo = audio_sim_fifo[audio_sim_sai_frames % AUDIO_SIM_FIFO_FRAMES];
+
+    memcpy(&rx[index * AUDIO_CHANNELS], fifo, sizeof(audio_sim_fifo[0]));
+    memcpy(fifo, &tx[index * AUDIO_CHANNELS], sizeof(audio_sim_fifo[0]));
+    audio_sim_sai_frames++;
+
+    if ((audio_sim_sai_frames % (Audio_TX_Ring.frames / 2U)) == 0U)
+    {
+      Audio_Ring_DMA_Event(&Audio_TX_Ring);
+      Audio_Ring_DMA_Event(&Audio_RX_Ring);
+    }
+  }
+}
+
+/* USBX device stack --------------------------------------------------------*/
+static UX_SYSTEM_SLAVE audio_sim_system;
+UX_SYSTEM_SLAVE *_ux_system_slave = &audio_sim_system;
+
+static UX_SLAVE_INTERFACE audio_sim_control;
+static UX_SLAVE_INTERFACE audio_sim_stream_out;
+static UX_SLAVE_INTERFACE audio_sim_stream_in;
+static UX_SLAVE_ENDPOINT audio_sim_iso_out;
+static UX_SLAVE_ENDPOINT audio_sim_feedback;
+static UX_SLAVE_ENDPOINT audio_sim_iso_in;
+static UCHAR audio_sim_control_buffer[UX_SLAVE_REQUEST_CONTROL_MAX_LENGTH];
+
+/* Standalone: a request starts the transfer, the runs end it */
+UINT _ux_device_stack_transfer_request(UX_SLAVE_TRANSFER *transfer_request,
+                                       ULONG slave_length, ULONG host_length)
+{
+  transfer_request->ux_slave_transfer_request_state = UX_STATE_RESET;
+  (VOID)_ux_device_stack_transfer_run(transfer_request, slave_length, host_length);
+  return UX_SUCCESS;
+}
+
+/* Armed: UX_STATE_WAIT until the bus event moved the packet, which sets
+   UX_STATE_NEXT */
+UINT _ux_device_stack_transfer_run(UX_SLAVE_TRANSFER *transfer_request,
+                                   ULONG slave_length, ULONG host_length)
+{
+  UX_PARAMETER_NOT_USED(host_length);
+
+  switch (transfer_request->ux_slave_transfer_request_state)
+  {
+    case UX_STATE_RESET:
+      transfer_request->ux_slave_transfer_request_requested_length = slave_length;
+      transfer_request->ux_slave_transfer_request_actual_length = 0U;
+      transfer_request->ux_slave_transfer_request_state = UX_STATE_WAIT;
+      return UX_STATE_WAIT;
+
+    case UX_STATE_NEXT:
+      transfer_request->ux_slave_transfer_request_completion_code = UX_SUCCESS;
+      transfer_request->ux_slave_transfer_request_state = UX_STATE_RESET;
+      return UX_STATE_NEXT;
+
+    default:
+      return UX_STATE_WAIT;
+  }
+}
+
+ALIGN_TYPE _ux_utility_interrupt_disable(VOID)
+{
+  return 0U;
+}
+
+VOID _ux_utility_interrupt_restore(ALIGN_TYPE flags)
+{
+  UX_PARAMETER_NOT_USED(flags);
+}
+
+static UINT audio_sim_command(ULONG request, UX_SLAVE_INTERFACE *interface)
+{
+  UX_SLAVE_CLASS_COMMAND command;
+
+  memset(&command, 0, sizeof(command));
+  command.ux_slave_class_command_request = request;
+  command.ux_slave_class_command_interface = interface;
+  return ux_device_class_audio_entry(&command);
+}
+
+static VOID audio_sim_interface(UX_SLAVE_INTERFACE *interface, UCHAR subclass, UCHAR alternate,
+                                UX_SLAVE_ENDPOINT *endpoint, UCHAR address)
+{
+  interface->ux_slave_interface_descriptor.bInterfaceClass = 0x01U;
+  interface->ux_slave_interface_descriptor.bInterfaceSubClass = subclass;
+  interface->ux_slave_interface_descriptor.bAlternateSetting = alternate;
+  interface->ux_slave_interface_first_endpoint = endpoint;
+  if (endpoint != UX_NULL)
+  {
+    endpoint->ux_slave_endpoint_descriptor.bEndpointAddress = address;
+    endpoint->ux_slave_endpoint_transfer_request.ux_slave_transfer_request_endpoint = endpoint;
+  }
+}
+
+/* Host ---------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t feedback;        /* last value read, 16.16 */
+  uint32_t remainder;       /* 16.16 frames owed to the OUT stream */
+  ULONG in_frames;          /* last IN packet, the OUT size with implicit feedback */
+  UCHAR frame_size;         /* bytes per frame of the streams */
+  UCHAR channels;
+  UCHAR subslot;
+  UINT marker_out;          /* a marker went out and is not back */
+  ULONG64 marker_time;      /* its USB frame, in us */
+  ULONG marker_index;       /* its frame in the packet */
+  UCHAR packet[USB_AUDIO_EP_SIZE];
+} Audio_SimHostTypeDef;
+
+static Audio_SimHostTypeDef audio_sim_host;
+
+/* Signed value of the first sample of a frame */
+static int32_t audio_sim_sample(const UCHAR *frame)
+{
+  int32_t value = 0;
+  UCHAR i;
+
+  for (i = 0U; i < audio_sim_host.subslot; i++)
+  {
+    value |= (int32_t)frame[i] << (8U * i);
+  }
+  value <<= 8U * (4U - audio_sim_host.subslot);
+  return value >> 8;
+}
+
+/* A value against the SAI rate, into the sums of its errors */
+static VOID audio_sim_error(uint32_t value, int64_t *sum, ULONG64 *sq_sum, ULONG *max)
+{
+  int32_t error = (int32_t)(value - audio_sim_rate);
+  ULONG magnitude = (ULONG)((error < 0) ? -error : error);
+
+  *sum += error;
+  *sq_sum += (ULONG64)magnitude * magnitude;
+  *max = UX_MAX(*max, magnitude);
+}
+
+/* OUT packet: the frames the feedback asks for, or the last IN packet
+   carried with implicit feedback, silence but for a marker in the first
+   one every AUDIO_SIM_MARKER_MS */
+static VOID audio_sim_host_out(ULONG64 frame_time)
+{
+  Audio_SimHostTypeDef *host = &audio_sim_host;
+  UX_SLAVE_TRANSFER *transfer = &audio_sim_iso_out.ux_slave_endpoint_transfer_request;
+  ULONG frames;
+  ULONG length;
+
+#if AUDIO_FB_SOURCE == AUDIO_FB_IMPLICIT
+  frames = host->in_frames;
+#else
+  host->remainder += host->feedback;
+  frames = host->remainder >> 16;
+  host->remainder &= 0xFFFFU;
+#endif
+  length = frames * host->frame_size;
+
+  memset(host->packet, 0, length);
+  if ((frame_time % (AUDIO_SIM_MARKER_MS * 1000U)) == 0U)
+  {
+    host->packet[host->subslot - 1U] = AUDIO_SIM_MARKER;
+    host->marker_out = UX_TRUE;
+    host->marker_time = frame_time;
+    host->marker_index = 0U;
+    audio_sim_stats.markers++;
+  }
+
+  if ((transfer->ux_slave_transfer_request_state != UX_STATE_WAIT) ||
+      (length > transfer->ux_slave_transfer_request_requested_length))
+  {
+    audio_sim_stats.out_lost++;
+    return;
+  }
+  memcpy(transfer->ux_slave_transfer_request_data_pointer, host->packet, length);
+  transfer->ux_slave_transfer_request_actual_length = length;
+  transfer->ux_slave_transfer_request_state = UX_STATE_NEXT;
+}
+
+/* IN token: the packet armed, the marker looked for in it */
+static VOID audio_sim_host_in(ULONG64 frame_time)
+{
+  Audio_SimHostTypeDef *host = &audio_sim_host;
+  UX_SLAVE_TRANSFER *transfer = &audio_sim_iso_in.ux_slave_endpoint_transfer_request;
+  const UCHAR *data = transfer->ux_slave_transfer_request_data_pointer;
+  ULONG frames;
+  ULONG i;
+
+  if (transfer->ux_slave_transfer_request_state != UX_STATE_WAIT)
+  {
+    audio_sim_stats.in_lost++;
+    return;
+  }
+  frames = transfer->ux_slave_transfer_request_requested_length / host->frame_size;
+  host->in_frames = frames;
+  transfer->ux_slave_transfer_request_actual_length = transfer->ux_slave_transfer_request_requested_length;
+  transfer->ux_slave_transfer_request_state = UX_STATE_NEXT;
+
+  for (i = 0U; (i < frames) && host->marker_out; i++)
+  {
+    if (audio_sim_sample(&data[i * host->frame_size]) >= AUDIO_SIM_MARKER_MIN)
+    {
+      ULONG round_trip = (ULONG)(((frame_time - host->marker_time) * audio_sim_frequency) / 1000000U) +
+                         i - host->marker_index;
+
+      host->marker_out = UX_FALSE;
+      audio_sim_stats.markers_back++;
+      audio_sim_stats.round_trip_sum += round_trip;
+      audio_sim_stats.round_trip_min = UX_MIN(audio_sim_stats.round_trip_min, round_trip);
+      audio_sim_stats.round_trip_max = UX_MAX(audio_sim_stats.round_trip_max, round_trip);
+    }
+  }
+}
+
+/* Feedback endpoint: the value the host paces the OUT stream on */
+static VOID audio_sim_host_feedback(VOID)
+{
+  UX_SLAVE_TRANSFER *transfer = &audio_sim_feedback.ux_slave_endpoint_transfer_request;
+
+  if (transfer->ux_slave_transfer_request_state != UX_STATE_WAIT)
+  {
+    return;
+  }
+  audio_sim_host.feedback = _ux_utility_long_get(transfer->ux_slave_transfer_request_data_pointer);
+  transfer->ux_slave_transfer_request_actual_length = 4U;
+  transfer->ux_slave_transfer_request_state = UX_STATE_NEXT;
+
+  audio_sim_stats.feedback_reads++;
+  audio_sim_error(audio_sim_host.feedback, &audio_sim_stats.feedback_error_sum,
+                  &audio_sim_stats.feedback_error_sq_sum, &audio_sim_stats.feedback_error_max);
+}
+
+/* SOF interrupt of a frame, the frame number as the FNR register has it */
+static VOID audio_sim_sof(ULONG64 frame_time)
+{
+#if AUDIO_FB_SOURCE != AUDIO_FB_PACKET
+  Audio_SOF_Callback((uint32_t)(frame_time / 1000U) & USB_FNR_FN);
+#else
+  UX_PARAMETER_NOT_USED(frame_time);
+#endif
+}
+
+/* Simulation ---------------------------------------------------------------*/
+static ULONG64 audio_sim_loop_next;
+static ULONG64 audio_sim_loop_last;
+static uint32_t audio_sim_rate_windows;         /* feedback_count seen */
+
+/* Events of a USB frame */
+typedef enum
+{
+  AUDIO_SIM_SOF,
+  AUDIO_SIM_OUT,
+  AUDIO_SIM_IN,
+  AUDIO_SIM_FEEDBACK,
+  AUDIO_SIM_EVENTS
+} Audio_SimEventTypeDef;
+
+/* Uniform in 0..'max', without a draw when it is 0 */
+static ULONG audio_sim_random(ULONG max)
+{
+  return (max != 0U) ? (ULONG)rand() % (max + 1U) : 0U;
+}
+
+/* 'per_s' times a second on average, drawn once per USB frame */
+static UINT audio_sim_chance(ULONG per_s)
+{
+  return (per_s != 0U) && ((ULONG)(rand() % 1000) < per_s);
+}
+
+/* Main loop pass, then the next one: a period later, or held by another
+   task */
+static VOID audio_sim_loop(VOID)
+{
+  ULONG64 gap = audio_sim_time - audio_sim_loop_last;
+
+  audio_sim_stats.loop_max_us = UX_MAX(audio_sim_stats.loop_max_us, (ULONG)gap);
+  audio_sim_loop_last = audio_sim_time;
+  Audio_Process();
+
+  audio_sim_loop_next = audio_sim_time + AUDIO_SIM_LOOP_US;
+  if ((audio_sim_config.stalls_per_s != 0U) &&
+      ((ULONG)(rand() % (1000000 / AUDIO_SIM_LOOP_US)) < audio_sim_config.stalls_per_s))
+  {
+    audio_sim_loop_next += (ULONG)rand() % (audio_sim_config.stall_max_us + 1U);
+  }
+}
+
+/* Main loop passes up to 'time', then the time moved to it */
+static VOID audio_sim_until(ULONG64 time)
+{
+  while (audio_sim_loop_next < time)
+  {
+    audio_sim_time = audio_sim_loop_next;
+    audio_sim_sai();
+    audio_sim_loop();
+  }
+  audio_sim_time = time;
+  audio_sim_sai();
+}
+
+VOID audio_sim_connect(const Audio_SimConfigTypeDef *config, UCHAR alternate)
+{
+  Audio_SimHostTypeDef *host = &audio_sim_host;
+
+  /* A new run: the streams of the last one closed, the DMAs restarted */
+  (VOID)audio_sim_command(UX_SLAVE_CLASS_COMMAND_DEACTIVATE, &audio_sim_stream_out);
+  (VOID)audio_sim_command(UX_SLAVE_CLASS_COMMAND_DEACTIVATE, &audio_sim_stream_in);
+  audio_sim_config = *config;
+  audio_sim_time = 0U;
+  audio_sim_sai_frames = 0U;
+  audio_sim_loop_next = 0U;
+  audio_sim_loop_last = 0U;
+  memset(audio_sim_fifo, 0, sizeof(audio_sim_fifo));
+  memset(Audio_TX_Buffer, 0, sizeof(Audio_TX_Buffer));
+  memset(Audio_RX_Buffer, 0, sizeof(Audio_RX_Buffer));
+  srand(1U);
+
+  _ux_system_slave->ux_system_slave_device.ux_slave_device_control_endpoint.
+    ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer = audio_sim_control_buffer;
+  (VOID)audio_sim_command(UX_SLAVE_CLASS_COMMAND_INITIALIZE, UX_NULL);
+  audio_sim_rings(audio_sim_frequency);
+  audio_sim_rate = (uint32_t)(((ULONG64)AUDIO_FB_NOMINAL(audio_sim_frequency) *
+                               (ULONG64)(1000000 + config->sai_ppm)) / 1000000U);
+
+  audio_sim_interface(&audio_sim_control, 0x01U, 0U, UX_NULL, 0U);
+  audio_sim_interface(&audio_sim_stream_out, 0x02U, alternate, &audio_sim_iso_out, 0x01U);
+#if AUDIO_FB_SOURCE != AUDIO_FB_IMPLICIT
+  audio_sim_iso_out.ux_slave_endpoint_next_endpoint = &audio_sim_feedback;
+#endif
+  audio_sim_feedback.ux_slave_endpoint_descriptor.bEndpointAddress = 0x81U;
+  audio_sim_feedback.ux_slave_endpoint_transfer_request.ux_slave_transfer_request_endpoint = &audio_sim_feedback;
+  audio_sim_interface(&audio_sim_stream_in, 0x02U, alternate, &audio_sim_iso_in, 0x82U);
+
+  memset(host, 0, sizeof(*host));
+  host->feedback = AUDIO_FB_NOMINAL(audio_sim_frequency);
+  host->in_frames = audio_sim_frequency / 1000U;
+  host->channels = (alternate == AUDIO_ALT_TDM_16) ? AUDIO_CHANNELS : 2U;
+  host->subslot = (alternate == AUDIO_ALT_STEREO_24) ? 3U : (alternate == AUDIO_ALT_STEREO_32) ? 4U : 2U;
+  host->frame_size = host->channels * host->subslot;
+
+  (VOID)audio_sim_command(UX_SLAVE_CLASS_COMMAND_ACTIVATE, &audio_sim_control);
+  (VOID)audio_sim_command(UX_SLAVE_CLASS_COMMAND_ACTIVATE, &audio_sim_stream_out);
+  (VOID)audio_sim_command(UX_SLAVE_CLASS_COMMAND_ACTIVATE, &audio_sim_stream_in);
+  audio_sim_clear();
+}
+
+LONG audio_sim_request(UCHAR request_type, UCHAR request, USHORT value, USHORT index,
+                       UCHAR *data, USHORT length)
+{
+  UX_SLAVE_TRANSFER *transfer = &_ux_system_slave->ux_system_slave_device.ux_slave_device_control_endpoint.
+                                 ux_slave_endpoint_transfer_request;
+  UCHAR *setup = transfer->ux_slave_transfer_request_setup;
+  ULONG moved = 0U;
+
+  setup[UX_SETUP_REQUEST_TYPE] = request_type;
+  setup[UX_SETUP_REQUEST] = request;
+  _ux_utility_short_put(setup + UX_SETUP_VALUE, value);
+  _ux_utility_short_put(setup + UX_SETUP_INDEX, index);
+  _ux_utility_short_put(setup + UX_SETUP_LENGTH, length);
+  transfer->ux_slave_transfer_request_state = UX_STATE_RESET;
+  transfer->ux_slave_transfer_request_requested_length = 0U;
+  if (!(request_type & UX_REQUEST_IN))
+  {
+    length = UX_MIN(length, sizeof(audio_sim_control_buffer));
+    memcpy(audio_sim_control_buffer, data, length);
+    moved = length;
+  }
+
+  /* The class takes the request as the device stack passes it, a status
+     other than UX_SUCCESS stalls EP0 */
+  if (audio_sim_command(UX_SLAVE_CLASS_COMMAND_REQUEST, &audio_sim_control) != UX_SUCCESS)
+  {
+    return -1;
+  }
+  if (request_type & UX_REQUEST_IN)
+  {
+    moved = UX_MIN(transfer->ux_slave_transfer_request_requested_length, length);
+    memcpy(data, transfer->ux_slave_transfer_request_data_pointer, moved);
+  }
+  transfer->ux_slave_transfer_request_state = UX_STATE_RESET;
+  return (LONG)moved;
+}
+
+VOID audio_sim_clear(VOID)
+{
+  memset(&audio_sim_stats, 0, sizeof(audio_sim_stats));
+  audio_sim_stats.round_trip_min = 0xFFFFFFFFU;
+  audio_sim_loop_last = audio_sim_time;
+  audio_sim_rate_windows = 0U;
+  Audio_ClearStats();
+}
+
+/* The rate windows the device ended since the last look, against the SAI
+   rate */
+static VOID audio_sim_rate_check(VOID)
+{
+  Audio_StatsTypeDef stats;
+
+  Audio_GetStats(&stats);
+  if (stats.feedback_count != audio_sim_rate_windows)
+  {
+    audio_sim_rate_windows = stats.feedback_count;
+    audio_sim_stats.rate_windows++;
+    audio_sim_error(stats.rate, &audio_sim_stats.rate_error_sum,
+                    &audio_sim_stats.rate_error_sq_sum, &audio_sim_stats.rate_error_max);
+  }
+}
+
+VOID audio_sim_run(ULONG ms)
+{
+  Audio_LatencyTypeDef latency;
+  ULONG64 frame_time;
+  ULONG64 time[AUDIO_SIM_EVENTS];
+  UINT done[AUDIO_SIM_EVENTS];
+  UINT event;
+  UINT i;
+
+  while (ms--)
+  {
+    /* Next USB frame */
+    frame_time = ((audio_sim_time + 999U) / 1000U) * 1000U;
+    time[AUDIO_SIM_SOF] = frame_time + audio_sim_random(audio_sim_config.sof_jitter_us);
+    time[AUDIO_SIM_OUT] = frame_time + AUDIO_SIM_OUT_US + audio_sim_random(audio_sim_config.out_jitter_us);
+    time[AUDIO_SIM_IN] = frame_time + AUDIO_SIM_IN_US;
+    time[AUDIO_SIM_FEEDBACK] = frame_time + AUDIO_SIM_FEEDBACK_US;
+    memset(done, 0, sizeof(done));
+    done[AUDIO_SIM_SOF] = audio_sim_chance(audio_sim_config.sofs_missed_per_s);
+
+    /* The events in time order, the earliest first */
+    for (;;)
+    {
+      event = AUDIO_SIM_EVENTS;
+      for (i = 0U; i < AUDIO_SIM_EVENTS; i++)
+      {
+        if (!done[i] && ((event == AUDIO_SIM_EVENTS) || (time[i] < time[event])))
+        {
+          event = i;
+        }
+      }
+      if (event == AUDIO_SIM_EVENTS)
+      {
+        break;
+      }
+      done[event] = UX_TRUE;
+
+      audio_sim_until(time[event]);
+      switch (event)
+      {
+        case AUDIO_SIM_SOF:
+          audio_sim_sof(frame_time);
+          break;
+        case AUDIO_SIM_OUT:
+          audio_sim_host_out(frame_time);
+          break;
+        case AUDIO_SIM_IN:
+          audio_sim_host_in(frame_time);
+          break;
+        default:
+          audio_sim_host_feedback();
+          break;
+      }
+    }
+    audio_sim_until(frame_time + 1000U);
+
+    Audio_GetLatency(&latency);
+    audio_sim_stats.device_round_trip_sum += latency.round_trip;
+    audio_sim_stats.frames++;
+    audio_sim_rate_check();
+  }
+}
@@ -0,0 +1,97 @@
+/**
+  ******************************************************************************
+  * @file    audio_sim.h
+  * @brief   Simulated SAI, USB host and bus under the audio class, for the
+  *          host benchmarks
+  ******************************************************************************
+  * audio_sim.c stands in for the SAI driver and the USBX device stack under
+  * ux_device_audio.c. The SAI runs from its own clock, off the USB frames by
+  * a chosen ppm: its DMA reads the TX ring and writes the RX ring, its
+  * output looped back to its input through the FIFOs of both blocks, and
+  * the half/full events move the DMA side of the rings.
+  *
+  * Each 1 ms USB frame starts with a SOF, whose interrupt runs
+  * Audio_SOF_Callback() in the SOF feedback modes, late by up to a chosen
+  * latency or now and then not at all. The host sends one OUT packet of the
+  * size the last feedback value asks for (of the last IN packet with
+  * implicit feedback), wherever its schedule puts it in the frame, takes
+  * the IN packet the device has ready and reads the feedback endpoint. A
+  * packet the device has no transfer armed for is lost, as on an
+  * isochronous endpoint. The main loop calls Audio_Process() every
+  * AUDIO_SIM_LOOP_US, other tasks hold it now and then for up to a chosen
+  * time.
+  *
+  * The host sends silence with a marker frame every AUDIO_SIM_MARKER_MS and
+  * looks for it in the IN stream: the round trip it measures is the one a
+  * monitoring application sees, from the frame it hands to the bus to the
+  * frame it gets back.
+  ******************************************************************************
+  */
+#ifndef AUDIO_SIM_H
+#define AUDIO_SIM_H
+
+#include "ux_device_audio.h"
+#include "audio_sai_slave.h"
+
+/* Main loop period while the device has nothing else to do */
+#define AUDIO_SIM_LOOP_US       100U
+
+/* Marker period, longer than any round trip */
+#define AUDIO_SIM_MARKER_MS     100U
+
+typedef struct
+{
+  int32_t sai_ppm;          /* SAI clock against the USB frames */
+  ULONG stalls_per_s;       /* main loop passes held by other tasks */
+  ULONG stall_max_us;       /* each one for up to this long, uniformly */
+  ULONG out_jitter_us;      /* OUT packet up to this late in its frame */
+  ULONG sof_jitter_us;      /* SOF interrupt up to this late */
+  ULONG sofs_missed_per_s;  /* SOF interrupts that do not run */
+} Audio_SimConfigTypeDef;
+
+typedef struct
+{
+  ULONG frames;             /* USB frames run */
+  ULONG out_lost;           /* OUT packets without a transfer armed */
+  ULONG in_lost;            /* IN tokens without a packet armed */
+  ULONG markers;            /* markers sent */
+  ULONG markers_back;       /* markers found in the IN stream */
+  ULONG round_trip_min;     /* host OUT frame to host IN frame, in frames */
+  ULONG round_trip_max;
+  ULONG64 round_trip_sum;
+  ULONG64 device_round_trip_sum; /* Audio_GetLatency, once per USB frame */
+  ULONG loop_max_us;        /* longest time between two Audio_Process() */
+  ULONG feedback_reads;     /* feedback values read by the host */
+  int64_t feedback_error_sum; /* each one off the SAI rate, 16.16 */
+  ULONG64 feedback_error_sq_sum;
+  ULONG feedback_error_max;
+  ULONG rate_windows;       /* rate windows the device ended */
+  int64_t rate_error_sum;   /* its measured rate off the SAI rate, 16.16 */
+  ULONG64 rate_error_sq_sum;
+  ULONG rate_error_max;
+} Audio_SimStatsTypeDef;
+
+/* Time in us since audio_sim_connect() */
+extern ULONG64 audio_sim_time;
+
+extern Audio_SimStatsTypeDef audio_sim_stats;
+
+/* SAI rate, 16.16 frames per USB frame */
+uint32_t audio_sim_sai_rate(VOID);
+
+/* Initialize the class and start both streams in 'alternate', as the host
+   does when it opens playback and record */
+VOID audio_sim_connect(const Audio_SimConfigTypeDef *config, UCHAR alternate);
+
+/* Run 'ms' USB frames */
+VOID audio_sim_run(ULONG ms);
+
+/* Control request on EP0, from the host to the class: the bytes of the
+   data stage, -1 when EP0 stalls */
+LONG audio_sim_request(UCHAR request_type, UCHAR request, USHORT value, USHORT index,
+                       UCHAR *data, USHORT length);
+
+/* Clear audio_sim_stats and the device statistics */
+VOID audio_sim_clear(VOID);
+
+#endif /* AUDIO_SIM_H */
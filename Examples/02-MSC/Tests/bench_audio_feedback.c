@@ -0,0 +1,101 @@
+/**
+  ******************************************************************************
+  * @file    bench_audio_feedback.c
+  * @brief   SAI rate measured on the ISO OUT completions against the SOFs,
+  *          under host and interrupt jitter
+  ******************************************************************************
+  * Playback and record run over audio_sim.c for a minute of simulated time,
+  * in 24-bit stereo at 48 kHz with the SAI clock 100 ppm fast, once per
+  * source of the rate: built with AUDIO_FB_SOURCE AUDIO_FB_PACKET (the
+  * default), AUDIO_FB_SOF and AUDIO_FB_IMPLICIT.
+  * The timing gets worse scenario after scenario: none, the SOF interrupt
+  * late by up to 50 us and two SOFs a second not seen, the host placing
+  * the OUT packet anywhere in its frame with the main loop held up to 1 ms
+  * 20 times a second, then both.
+  * For each the error of the rate the device measures at the end of its
+  * windows and of the feedback values the host reads, against the SAI
+  * rate, in ppm; the TX ring fill range and the xruns.
+  * With implicit feedback nothing holds the TX fill at its lead, an OUT
+  * packet lost moves it for good; a minimum below 0 ran dry between two
+  * DMA events, which do not count it.
+  ******************************************************************************
+  */
+#include "audio_sim.h"
+#include <math.h>
+#include <stdio.h>
+
+#define BENCH_WARMUP_MS         2000U
+#define BENCH_RUN_MS            60000U
+
+typedef struct
+{
+  const char *name;
+  ULONG sof_jitter_us;
+  ULONG sofs_missed_per_s;
+  ULONG out_jitter_us;
+  ULONG stalls_per_s;
+  ULONG stall_max_us;
+} BENCH_JitterTypeDef;
+
+static const BENCH_JitterTypeDef bench_jitters[] =
+{
+  { "none", 0U,  0U, 0U,   0U,  0U },
+  { "sof",  50U, 2U, 0U,   0U,  0U },
+  { "host", 0U,  0U, 900U, 20U, 1000U },
+  { "both", 50U, 2U, 900U, 20U, 1000U },
+};
+
+/* Mean, RMS and largest of the errors, 16.16 frames per USB frame, in ppm */
+static VOID bench_errors(const char *name, ULONG count, int64_t sum, ULONG64 sq_sum, ULONG max)
+{
+  double ppm = 1000000.0 / audio_sim_sai_rate();
+
+  if (count == 0U)
+  {
+    printf("%s -", name);
+    return;
+  }
+  printf("%s %+.0f / %.0f / %.0f ppm", name, ppm * (double)sum / count,
+         ppm * sqrt((double)sq_sum / count), ppm * max);
+}
+
+static VOID bench_jitter(const BENCH_JitterTypeDef *jitter)
+{
+  Audio_SimConfigTypeDef config = { 100, jitter->stalls_per_s, jitter->stall_max_us,
+                                    jitter->out_jitter_us, jitter->sof_jitter_us,
+                                    jitter->sofs_missed_per_s };
+  Audio_StatsTypeDef stats;
+
+  audio_sim_connect(&config, AUDIO_ALT_STEREO_24);
+  audio_sim_run(BENCH_WARMUP_MS);
+  audio_sim_clear();
+  audio_sim_run(BENCH_RUN_MS);
+  Audio_GetStats(&stats);
+
+  printf("  %-5s", jitter->name);
+  bench_errors("rate", audio_sim_stats.rate_windows, audio_sim_stats.rate_error_sum,
+               audio_sim_stats.rate_error_sq_sum, audio_sim_stats.rate_error_max);
+  bench_errors(", feedback", audio_sim_stats.feedback_reads, audio_sim_stats.feedback_error_sum,
+               audio_sim_stats.feedback_error_sq_sum, audio_sim_stats.feedback_error_max);
+  printf(" (mean / RMS / max)\n");
+  printf("  %-5s TX fill %ld..%ld frames (lead %lu); %lu TX underruns, %lu RX overruns, "
+         "%lu OUT dropped, %lu IN empty; packets lost %lu OUT, %lu IN\n", "",
+         (long)stats.tx_fill_min, (long)stats.tx_fill_max, (ULONG)Audio_TX_Ring.lead,
+         (ULONG)stats.tx_underruns, (ULONG)stats.rx_overruns, (ULONG)stats.out_dropped,
+         (ULONG)stats.in_empty, audio_sim_stats.out_lost, audio_sim_stats.in_lost);
+}
+
+int main(void)
+{
+  static const char *const sources[] = { "packet", "SOF", "implicit" };
+  ULONG i;
+
+  printf("bench_audio_feedback: rate measured on %s, window %u, ring %u ms\n",
+         sources[AUDIO_FB_SOURCE], AUDIO_FB_WINDOW, AUDIO_RING_MS);
+  for (i = 0U; i < sizeof(bench_jitters) / sizeof(bench_jitters[0]); i++)
+  {
+    bench_jitter(&bench_jitters[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,134 @@
+/**
+  ******************************************************************************
+  * @file    bench_msc_sd_reads.c
+  * @brief   Read-ahead hit rate and read latency over a host read trace
+  ******************************************************************************
+  * The trace (traces/fat_read.trace by default, or the file given on the
+  * command line, in the format of msc_sim_trace_load()) is replayed on
+  * LUN 0 through the storage class of msc_sim.c, over the simulated card of
+  * sd_sim.c: once on a class 10 card, once on a slow card with long access
+  * times. The media read statistics give the hits and the card read
+  * latency, the host side gives the time of each command.
+  * Built with MSC_SD_READ_AHEAD=0 the media reads only what the host asks,
+  * the figures before the read-ahead.
+  ******************************************************************************
+  */
+#include "msc_sim.h"
+#include <stdio.h>
+
+#define BENCH_BLOCKS            (1024U * 1024U)  /* 512 MB card */
+#define BENCH_MAX_COMMANDS      4096U
+#define BENCH_MAX_BLOCKS        128U             /* per READ(10) of the trace */
+
+/* Default of msc_media_sd.c */
+#ifndef MSC_SD_READ_AHEAD
+#define MSC_SD_READ_AHEAD       1U
+#endif
+
+static MSC_SimTraceTypeDef bench_trace[BENCH_MAX_COMMANDS];
+static ULONG bench_commands;
+static UCHAR bench_data[BENCH_MAX_BLOCKS * 512U];
+
+/* Replay the trace on a new card, prints the figures */
+static int bench_card(const char *name, const SD_SimCardTypeDef *card)
+{
+  MSC_MediaReadStatsTypeDef before;
+  MSC_MediaReadStatsTypeDef after;
+  ULONG64 start;
+  ULONG64 command_start;
+  ULONG64 command_us;
+  ULONG64 command_max = 0U;
+  ULONG64 bytes = 0U;
+  ULONG reads = 0U;
+  ULONG hits;
+  ULONG misses;
+  ULONG i;
+  UCHAR status;
+
+  /* Out with the last card, long enough for the media to see it */
+  sd_sim_remove();
+  msc_sim_idle(100000U);
+  sd_sim_insert(card);
+  if (!msc_sim_wait_ready(0U, 2000U))
+  {
+    printf("bench_msc_sd_reads: card not ready\n");
+    return 1;
+  }
+
+  MSC_Media_SD_GetReadStats(&before);
+  start = sd_sim_time;
+  for (i = 0U; i < bench_commands; i++)
+  {
+    command_start = sd_sim_time;
+    switch (bench_trace[i].op)
+    {
+      case 'R':
+        status = msc_sim_read(0U, bench_trace[i].lba, bench_trace[i].blocks, bench_data);
+        reads++;
+        bytes += bench_trace[i].blocks * 512U;
+        break;
+      case 'W':
+        status = msc_sim_write(0U, bench_trace[i].lba, bench_trace[i].blocks, bench_data);
+        break;
+      default:
+        status = msc_sim_synchronize_cache(0U);
+        break;
+    }
+    if (status != UX_SLAVE_CLASS_STORAGE_CSW_PASSED)
+    {
+      printf("bench_msc_sd_reads: command %lu failed\n", i);
+      return 1;
+    }
+
+    command_us = sd_sim_time - command_start;
+    command_max = (command_us > command_max) ? command_us : command_max;
+  }
+  MSC_Media_SD_GetReadStats(&after);
+
+  hits = after.hits - before.hits;
+  misses = after.misses - before.misses;
+  printf("  %-14s hits %5.1f %% (%lu of %lu), %lu lines fetched ahead\n", name,
+         (100.0 * hits) / (hits + misses), hits, hits + misses,
+         after.prefetches - before.prefetches);
+  printf("  %-14s card reads %.2f ms, max %lu ms; command %.0f us, max %.0f us; %.3f MB/s\n", "",
+         (misses != 0U) ? ((double)(after.miss_latency_total - before.miss_latency_total) / misses) : 0.0,
+         after.miss_latency_max, (double)(sd_sim_time - start) / reads, (double)command_max,
+         (double)bytes / (double)(sd_sim_time - start));
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  SD_SimCardTypeDef card;
+  const char *path = (argc > 1) ? argv[1] : "traces/fat_read.trace";
+  ULONG i;
+  int failed = 0;
+
+  bench_commands = msc_sim_trace_load(path, bench_trace, BENCH_MAX_COMMANDS, BENCH_MAX_BLOCKS);
+  if (bench_commands == 0U)
+  {
+    return 1;
+  }
+  for (i = 0U; i < bench_commands; i++)
+  {
+    if ((bench_trace[i].lba + bench_trace[i].blocks) > BENCH_BLOCKS)
+    {
+      printf("bench_msc_sd_reads: %s goes past the card\n", path);
+      return 1;
+    }
+  }
+
+  printf("bench_msc_sd_reads (%s): %s, %lu commands\n",
+         (MSC_SD_READ_AHEAD != 0U) ? "read-ahead" : "no read-ahead", path, bench_commands);
+
+  msc_sim_connect();
+  sd_sim_card_default(&card, BENCH_BLOCKS);
+  failed |= bench_card("class 10 card", &card);
+
+  /* A slow card: long access times */
+  card.access_us = 2000U;
+  card.program_us = 6000U;
+  failed |= bench_card("slow card", &card);
+
+  return failed;
+}
@@ -0,0 +1,187 @@
+/**
+  ******************************************************************************
+  * @file    bench_msc_sd_writes.c
+  * @brief   SD commands a host write trace costs, with and without the
+  *          write-back cache of the SD media
+  ******************************************************************************
+  * The trace (traces/fat_copy.trace by default, or the file given on the
+  * command line) lists the WRITE(10) and SYNCHRONIZE CACHE commands of a
+  * host, in the format of msc_sim_trace_load().
+  * It is replayed on LUN 0 through the storage class of msc_sim.c, over the
+  * simulated card of sd_sim.c, then read back and checked on the card.
+  * Built with MSC_SD_WCACHE=0 the media writes each command through, the
+  * figures before coalescing.
+  ******************************************************************************
+  */
+#include "msc_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_BLOCKS            (1024U * 1024U)  /* 512 MB card */
+#define BENCH_MAX_COMMANDS      4096U
+#define BENCH_MAX_BLOCKS        128U             /* per WRITE(10) of the trace */
+
+/* Default of msc_media_sd.c */
+#ifndef MSC_SD_WCACHE
+#define MSC_SD_WCACHE           1U
+#endif
+
+static MSC_SimTraceTypeDef bench_trace[BENCH_MAX_COMMANDS];
+static ULONG bench_commands;
+static ULONG bench_first;
+static ULONG bench_end;
+
+/* What the card must hold once the trace ran */
+static UCHAR *bench_image;
+static UCHAR bench_data[BENCH_MAX_BLOCKS * 512U];
+
+static int bench_load(const char *path)
+{
+  ULONG i;
+
+  bench_commands = msc_sim_trace_load(path, bench_trace, BENCH_MAX_COMMANDS, BENCH_MAX_BLOCKS);
+
+  bench_first = BENCH_BLOCKS;
+  for (i = 0U; i < bench_commands; i++)
+  {
+    if ((bench_trace[i].op == 'R') || ((bench_trace[i].lba + bench_trace[i].blocks) > BENCH_BLOCKS))
+    {
+      printf("bench_msc_sd_writes: %s has a read or a write past the card\n", path);
+      return 1;
+    }
+    if (bench_trace[i].op == 'W')
+    {
+      bench_first = (bench_trace[i].lba < bench_first) ? bench_trace[i].lba : bench_first;
+      bench_end = ((bench_trace[i].lba + bench_trace[i].blocks) > bench_end) ?
+                  (bench_trace[i].lba + bench_trace[i].blocks) : bench_end;
+    }
+  }
+
+  if (bench_end == 0U)
+  {
+    printf("bench_msc_sd_writes: no write in %s\n", path);
+    return 1;
+  }
+  bench_image = calloc(bench_end - bench_first, 512U);
+  return (bench_image == NULL) ? 1 : 0;
+}
+
+/* Replay the trace, each write with new data */
+static int bench_replay(VOID)
+{
+  ULONG i;
+  ULONG j;
+  UCHAR status;
+
+  for (i = 0U; i < bench_commands; i++)
+  {
+    if (bench_trace[i].op == 'F')
+    {
+      status = msc_sim_synchronize_cache(0U);
+    }
+    else
+    {
+      for (j = 0U; j < (bench_trace[i].blocks * 512U); j++)
+      {
+        bench_data[j] = (UCHAR)(i + (j * 13U) + (j >> 9));
+      }
+      status = msc_sim_write(0U, bench_trace[i].lba, bench_trace[i].blocks, bench_data);
+      memcpy(&bench_image[(bench_trace[i].lba - bench_first) * 512U], bench_data,
+             bench_trace[i].blocks * 512U);
+    }
+
+    if (status != UX_SLAVE_CLASS_STORAGE_CSW_PASSED)
+    {
+      printf("bench_msc_sd_writes: command %lu failed\n", i);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* The blocks the trace wrote, on the card and as the host reads them */
+static int bench_check(VOID)
+{
+  ULONG lba;
+
+  if (msc_sim_synchronize_cache(0U) != UX_SLAVE_CLASS_STORAGE_CSW_PASSED)
+  {
+    printf("bench_msc_sd_writes: synchronize cache failed\n");
+    return 1;
+  }
+
+  for (lba = bench_first; lba < bench_end; lba++)
+  {
+    if (!sd_sim_mapped(lba))
+    {
+      continue;
+    }
+    if ((memcmp(sd_sim_block(lba), &bench_image[(lba - bench_first) * 512U], 512U) != 0) ||
+        (msc_sim_read(0U, lba, 1U, bench_data) != UX_SLAVE_CLASS_STORAGE_CSW_PASSED) ||
+        (memcmp(bench_data, &bench_image[(lba - bench_first) * 512U], 512U) != 0))
+    {
+      printf("bench_msc_sd_writes: block %lu differs\n", lba);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  SD_SimCardTypeDef card;
+  MSC_MediaCmdStatsTypeDef before;
+  MSC_MediaCmdStatsTypeDef after;
+  SD_SimStatsTypeDef card_stats;
+  ULONG host_writes = 0U;
+  ULONG host_blocks = 0U;
+  ULONG sd_commands;
+  ULONG i;
+  ULONG64 start;
+
+  if (bench_load((argc > 1) ? argv[1] : "traces/fat_copy.trace") != 0)
+  {
+    return 1;
+  }
+  for (i = 0U; i < bench_commands; i++)
+  {
+    host_writes += (bench_trace[i].op == 'W') ? 1U : 0U;
+    host_blocks += bench_trace[i].blocks;
+  }
+
+  msc_sim_connect();
+  sd_sim_card_default(&card, BENCH_BLOCKS);
+  sd_sim_insert(&card);
+  if (!msc_sim_wait_ready(0U, 2000U))
+  {
+    printf("bench_msc_sd_writes: card not ready\n");
+    return 1;
+  }
+
+  MSC_Media_SD_GetCmdStats(&before);
+  card_stats = sd_sim_stats;
+  start = sd_sim_time;
+  if (bench_replay() != 0)
+  {
+    return 1;
+  }
+  MSC_Media_SD_GetCmdStats(&after);
+
+  printf("bench_msc_sd_writes (%s): %lu host writes, %lu blocks\n",
+         (MSC_SD_WCACHE != 0U) ? "write-back cache" : "write-through", host_writes, host_blocks);
+  printf("  SD write commands %lu, blocks written %lu, CMD12 %lu, CMD13 %lu\n",
+         sd_sim_stats.write_commands - card_stats.write_commands,
+         sd_sim_stats.blocks_written - card_stats.blocks_written,
+         after.stop_commands - before.stop_commands,
+         after.status_polls - before.status_polls);
+  sd_commands = (after.data_commands - before.data_commands) +
+                (after.stop_commands - before.stop_commands) +
+                (after.status_polls - before.status_polls);
+  printf("  SD commands %lu, %.2f per host write, %.1f ms\n", sd_commands,
+         (double)sd_commands / host_writes, (double)(sd_sim_time - start) / 1000.0);
+
+  return bench_check();
+}
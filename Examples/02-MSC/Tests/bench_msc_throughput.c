@@ -0,0 +1,185 @@
+/**
+  ******************************************************************************
+  * @file    bench_msc_throughput.c
+  * @brief   Simulated MB/s of sequential SCSI reads and writes on the SD LUN
+  ******************************************************************************
+  * The storage class runs over msc_sim.c, the SD media over the card of
+  * sd_sim.c: full speed packet timing on one side, the access, transfer and
+  * programming times of a class 10 card on the other, both in simulated
+  * time. A host writes then reads back BENCH_BYTES in commands of
+  * BENCH_COMMAND_BLOCKS blocks, as the Windows and Linux hosts do.
+  *
+  * Built with BENCH_SYNC_MEDIA, the media callbacks run each chunk to its
+  * end before returning: the USB transfer of one buffer no longer overlaps
+  * the SD transfer of the other, the figures before the overlap.
+  ******************************************************************************
+  */
+#include "msc_sim.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_BLOCKS            (1024U * 1024U)  /* 512 MB card */
+#define BENCH_BYTES             (4U * 1024U * 1024U)
+#define BENCH_COMMAND_BLOCKS    128U             /* 64 KB per command */
+#define BENCH_LBA               8192U
+
+static UCHAR bench_data[BENCH_BYTES];
+static UCHAR bench_read[BENCH_BYTES];
+
+#ifdef BENCH_SYNC_MEDIA
+/* The callbacks of the storage class block until the media is done, time
+   moving on meanwhile as the main loop stalls */
+static UINT bench_wait(UINT (*op)(UCHAR *, ULONG, ULONG, ULONG *), UCHAR *data_pointer,
+                       ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  UINT status;
+
+  while ((status = op(data_pointer, number_blocks, lba, media_status)) == UX_STATE_WAIT)
+  {
+    sd_sim_advance(MSC_SIM_LOOP_US);
+  }
+  return status;
+}
+
+static UINT bench_wait_flush(const MSC_MediaTypeDef *media, ULONG *media_status)
+{
+  UINT status;
+
+  while ((status = media->FlushAsync(media_status)) == UX_STATE_WAIT)
+  {
+    sd_sim_advance(MSC_SIM_LOOP_US);
+  }
+  return status;
+}
+
+static UINT bench_to_state(UINT status)
+{
+  return (status == UX_SUCCESS) ? UX_STATE_NEXT : UX_STATE_ERROR;
+}
+
+UINT MSC_Media_Read(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                    ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  if ((data_pointer == UX_NULL) || (number_blocks == 0U))
+  {
+    return UX_STATE_NEXT;
+  }
+  if (media->ReadAsync == UX_NULL)
+  {
+    return bench_to_state(media->Read(data_pointer, number_blocks, lba, media_status));
+  }
+  return bench_wait(media->ReadAsync, data_pointer, number_blocks, lba, media_status);
+}
+
+UINT MSC_Media_Write(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                     ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  if ((data_pointer == UX_NULL) || (number_blocks == 0U))
+  {
+    return UX_STATE_NEXT;
+  }
+  if (media->WriteAsync == UX_NULL)
+  {
+    return bench_to_state(media->Write(data_pointer, number_blocks, lba, media_status));
+  }
+  return bench_wait(media->WriteAsync, data_pointer, number_blocks, lba, media_status);
+}
+
+UINT MSC_Media_Flush(const MSC_MediaTypeDef *media, ULONG *media_status)
+{
+  if (media->FlushAsync == UX_NULL)
+  {
+    return (media->Flush == UX_NULL) ? UX_STATE_NEXT : bench_to_state(media->Flush(media_status));
+  }
+  return bench_wait_flush(media, media_status);
+}
+#endif /* BENCH_SYNC_MEDIA */
+
+/* Sequential transfer of BENCH_BYTES, returns the MB/s */
+static double bench_transfer(UINT write)
+{
+  ULONG64 start = sd_sim_time;
+  ULONG lba;
+  ULONG offset;
+  UCHAR status;
+
+  for (offset = 0U; offset < BENCH_BYTES; offset += BENCH_COMMAND_BLOCKS * 512U)
+  {
+    lba = BENCH_LBA + (offset / 512U);
+    status = write ? msc_sim_write(0U, lba, BENCH_COMMAND_BLOCKS, &bench_data[offset])
+                   : msc_sim_read(0U, lba, BENCH_COMMAND_BLOCKS, &bench_read[offset]);
+    if (status != UX_SLAVE_CLASS_STORAGE_CSW_PASSED)
+    {
+      printf("bench_msc_throughput: %s at %lu failed\n", write ? "write" : "read", lba);
+      return 0.0;
+    }
+  }
+  if (write && (msc_sim_synchronize_cache(0U) != UX_SLAVE_CLASS_STORAGE_CSW_PASSED))
+  {
+    printf("bench_msc_throughput: synchronize cache failed\n");
+    return 0.0;
+  }
+
+  return (double)BENCH_BYTES / (double)(sd_sim_time - start);
+}
+
+/* Write then read back on a new card, prints the MB/s */
+static int bench_card(const char *name, const SD_SimCardTypeDef *card)
+{
+  double write;
+  double read;
+
+  /* Out with the last card, long enough for the media to see it */
+  sd_sim_remove();
+  msc_sim_idle(100000U);
+  sd_sim_insert(card);
+  if (!msc_sim_wait_ready(0U, 2000U))
+  {
+    printf("bench_msc_throughput: card not ready\n");
+    return 1;
+  }
+
+  write = bench_transfer(UX_TRUE);
+  memset(bench_read, 0, sizeof(bench_read));
+  read = bench_transfer(UX_FALSE);
+  if (memcmp(bench_read, bench_data, BENCH_BYTES) != 0)
+  {
+    printf("bench_msc_throughput: read back differs\n");
+    return 1;
+  }
+
+  printf("  %-28s write %.3f MB/s  read %.3f MB/s\n", name, write, read);
+  return 0;
+}
+
+int main(void)
+{
+  SD_SimCardTypeDef card;
+  ULONG i;
+  int failed = 0;
+
+  for (i = 0U; i < BENCH_BYTES; i++)
+  {
+    bench_data[i] = (UCHAR)((i * 7U) ^ (i >> 9));
+  }
+
+  printf("bench_msc_throughput (%s): %u KB commands, %.1f us/packet, bus limit %.3f MB/s\n",
+#ifdef BENCH_SYNC_MEDIA
+         "no overlap",
+#else
+         "overlap",
+#endif
+         BENCH_COMMAND_BLOCKS / 2U, (double)msc_sim_packet_us,
+         (double)MSC_SIM_PACKET_SIZE / msc_sim_packet_us);
+
+  msc_sim_connect();
+  sd_sim_card_default(&card, BENCH_BLOCKS);
+  failed |= bench_card("class 10 card", &card);
+
+  /* A slow card: long access and programming times */
+  card.access_us = 2000U;
+  card.program_us = 6000U;
+  failed |= bench_card("slow card", &card);
+
+  return failed;
+}
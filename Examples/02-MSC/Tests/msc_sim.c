@@ -0,0 +1,587 @@
+/**
+  ******************************************************************************
+  * @file    msc_sim.c
+  * @brief   Simulated USB host and bus under the storage class, for the host
+  *          tests and benchmarks
+  ******************************************************************************
+  * A transfer the class starts takes the bus once the host is ready for it,
+  * for as many packets as it moves, and ends when that bus time is over.
+  * The bus carries one packet at a time: an IN transfer started while an OUT
+  * one runs waits for it. The data moves when the transfer ends.
+  ******************************************************************************
+  */
+#include "msc_sim.h"
+#include "ux_device_msc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Host phases of a Bulk-Only command */
+typedef enum
+{
+  HOST_IDLE,
+  HOST_CBW,
+  HOST_DATA_OUT,
+  HOST_DATA_IN,
+  HOST_CSW,
+} MSC_SimHostPhaseTypeDef;
+
+typedef struct
+{
+  MSC_SimHostPhaseTypeDef phase;
+  UCHAR cbw[UX_SLAVE_CLASS_STORAGE_CBW_LENGTH];
+  UCHAR *data;
+  ULONG length;
+  ULONG offset;
+  ULONG tag;
+  UCHAR csw_status;
+} MSC_SimHostTypeDef;
+
+static MSC_SimHostTypeDef msc_sim_host;
+
+static UX_SYSTEM_SLAVE msc_sim_system;
+static UX_SLAVE_CLASS msc_sim_class;
+static UX_SLAVE_INTERFACE msc_sim_interface;
+static UX_SLAVE_ENDPOINT msc_sim_ep_in;
+static UX_SLAVE_ENDPOINT msc_sim_ep_out;
+static UX_SLAVE_CLASS_STORAGE_PARAMETER msc_sim_parameter;
+static UCHAR msc_sim_ep_in_buffer[UX_SLAVE_REQUEST_DATA_MAX_LENGTH];
+static UCHAR msc_sim_ep_out_buffer[UX_SLAVE_REQUEST_DATA_MAX_LENGTH];
+
+/* End of the transfer in progress on each endpoint, of the bus time used */
+static ULONG64 msc_sim_end_in;
+static ULONG64 msc_sim_end_out;
+static ULONG64 msc_sim_bus_free;
+
+UX_SYSTEM_SLAVE *_ux_system_slave;
+MSC_SimStatsTypeDef msc_sim_stats;
+ULONG msc_sim_packet_us = MSC_SIM_PACKET_US;
+UX_SLAVE_CLASS_STORAGE *msc_sim_storage;
+
+/* Stubs of the USBX utilities ----------------------------------------------*/
+VOID *_ux_utility_memory_allocate(ULONG memory_alignment, ULONG memory_cache_flag,
+                                  ULONG memory_size_requested)
+{
+  UX_PARAMETER_NOT_USED(memory_alignment);
+  UX_PARAMETER_NOT_USED(memory_cache_flag);
+  return calloc(1U, memory_size_requested);
+}
+
+VOID *_ux_utility_memory_allocate_mulc_safe(ULONG align, ULONG cache, ULONG size_mul_v,
+                                            ULONG size_mul_c)
+{
+  return _ux_utility_memory_allocate(align, cache, size_mul_v * size_mul_c);
+}
+
+VOID _ux_utility_memory_free(VOID *memory)
+{
+  free(memory);
+}
+
+ALIGN_TYPE _ux_utility_interrupt_disable(VOID)
+{
+  return 0U;
+}
+
+VOID _ux_utility_interrupt_restore(ALIGN_TYPE flags)
+{
+  UX_PARAMETER_NOT_USED(flags);
+}
+
+VOID _ux_system_error_handler(UINT system_level, UINT system_context, UINT error_code)
+{
+  UX_PARAMETER_NOT_USED(system_level);
+  UX_PARAMETER_NOT_USED(system_context);
+  UX_PARAMETER_NOT_USED(error_code);
+}
+
+UINT _ux_device_stack_endpoint_stall(UX_SLAVE_ENDPOINT *endpoint)
+{
+  endpoint->ux_slave_endpoint_state = UX_ENDPOINT_HALTED;
+  return UX_SUCCESS;
+}
+
+/* Stand-in for the internal flash LUN: msc_media_flash.c programs the
+   flash of the board, the same disk is kept in RAM here ---------------------*/
+#define MSC_SIM_FLASH_BLOCKS    256U
+
+static UCHAR msc_sim_flash[MSC_SIM_FLASH_BLOCKS * 512U];
+
+static UINT msc_sim_flash_read(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                               ULONG *media_status)
+{
+  UX_PARAMETER_NOT_USED(media_status);
+  memcpy(data_pointer, &msc_sim_flash[lba * 512U], number_blocks * 512U);
+  return UX_SUCCESS;
+}
+
+static UINT msc_sim_flash_write(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                                ULONG *media_status)
+{
+  UX_PARAMETER_NOT_USED(media_status);
+  memcpy(&msc_sim_flash[lba * 512U], data_pointer, number_blocks * 512U);
+  return UX_SUCCESS;
+}
+
+static UINT msc_sim_flash_status(ULONG *media_status)
+{
+  UX_PARAMETER_NOT_USED(media_status);
+  return UX_SUCCESS;
+}
+
+static ULONG msc_sim_flash_get_last_lba(VOID)
+{
+  return MSC_SIM_FLASH_BLOCKS - 1U;
+}
+
+static ULONG msc_sim_flash_get_block_length(VOID)
+{
+  return 512U;
+}
+
+const MSC_MediaTypeDef MSC_Media_Flash =
+{
+  msc_sim_flash_read,
+  msc_sim_flash_write,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  msc_sim_flash_status,
+  msc_sim_flash_get_last_lba,
+  msc_sim_flash_get_block_length,
+  UX_NULL,
+  UX_FALSE,
+  UX_FALSE,
+};
+
+/* Bus ----------------------------------------------------------------------*/
+static ULONG msc_sim_packets(ULONG length, UINT zlp)
+{
+  ULONG packets = (length + MSC_SIM_PACKET_SIZE - 1U) / MSC_SIM_PACKET_SIZE;
+
+  return ((packets == 0U) || zlp) ? (packets + 1U) : packets;
+}
+
+/* Take the bus for 'packets' from now or once it is free, returns the end */
+static ULONG64 msc_sim_bus(ULONG packets)
+{
+  ULONG64 start = (msc_sim_bus_free > sd_sim_time) ? msc_sim_bus_free : sd_sim_time;
+
+  msc_sim_bus_free = start + ((ULONG64)packets * msc_sim_packet_us);
+  return msc_sim_bus_free;
+}
+
+/* Host side of an OUT transfer: how much it sends, UX_FALSE for a NAK */
+static UINT msc_sim_host_out(ULONG slave_length, ULONG *length)
+{
+  MSC_SimHostTypeDef *host = &msc_sim_host;
+
+  if (host->phase == HOST_CBW)
+  {
+    *length = UX_SLAVE_CLASS_STORAGE_CBW_LENGTH;
+    return UX_TRUE;
+  }
+  if (host->phase == HOST_DATA_OUT)
+  {
+    *length = host->length - host->offset;
+    if (*length > slave_length)
+    {
+      *length = slave_length;
+    }
+    return UX_TRUE;
+  }
+  return UX_FALSE;
+}
+
+static VOID msc_sim_host_out_done(UCHAR *buffer, ULONG length)
+{
+  MSC_SimHostTypeDef *host = &msc_sim_host;
+
+  if (host->phase == HOST_CBW)
+  {
+    memcpy(buffer, host->cbw, length);
+    msc_sim_stats.commands++;
+    if (host->length == 0U)
+    {
+      host->phase = HOST_CSW;
+    }
+    else
+    {
+      host->phase = (host->cbw[UX_SLAVE_CLASS_STORAGE_CBW_FLAGS] & 0x80U) ? HOST_DATA_IN : HOST_DATA_OUT;
+    }
+    return;
+  }
+
+  memcpy(buffer, &host->data[host->offset], length);
+  host->offset += length;
+  msc_sim_stats.bytes_out += length;
+  if (host->offset >= host->length)
+  {
+    host->phase = HOST_CSW;
+  }
+}
+
+static VOID msc_sim_host_in_done(const UCHAR *buffer, ULONG length, UINT short_packet)
+{
+  MSC_SimHostTypeDef *host = &msc_sim_host;
+  ULONG copy;
+
+  if (host->phase == HOST_DATA_IN)
+  {
+    copy = host->length - host->offset;
+    if (copy > length)
+    {
+      copy = length;
+    }
+    memcpy(&host->data[host->offset], buffer, copy);
+    host->offset += copy;
+    msc_sim_stats.bytes_in += copy;
+    if ((host->offset >= host->length) || short_packet)
+    {
+      host->phase = HOST_CSW;
+    }
+    return;
+  }
+
+  /* CSW: a wrong one is taken as a phase error, as the host would reset */
+  if ((length == UX_SLAVE_CLASS_STORAGE_CSW_LENGTH) &&
+      (_ux_utility_long_get((UCHAR *)buffer) == UX_SLAVE_CLASS_STORAGE_CSW_SIGNATURE_MASK) &&
+      (_ux_utility_long_get((UCHAR *)&buffer[UX_SLAVE_CLASS_STORAGE_CSW_TAG]) == host->tag))
+  {
+    host->csw_status = buffer[UX_SLAVE_CLASS_STORAGE_CSW_STATUS];
+    msc_sim_stats.residue = _ux_utility_long_get((UCHAR *)&buffer[UX_SLAVE_CLASS_STORAGE_CSW_DATA_RESIDUE]);
+  }
+  else
+  {
+    host->csw_status = UX_SLAVE_CLASS_STORAGE_CSW_PHASE_ERROR;
+  }
+  msc_sim_stats.data_length = host->offset;
+  host->phase = HOST_IDLE;
+}
+
+UINT _ux_device_stack_transfer_run(UX_SLAVE_TRANSFER *transfer_request, ULONG slave_length,
+                                   ULONG host_length)
+{
+  UX_SLAVE_ENDPOINT *endpoint = transfer_request->ux_slave_transfer_request_endpoint;
+  UINT in = (endpoint == &msc_sim_ep_in);
+  ULONG64 *end = in ? &msc_sim_end_in : &msc_sim_end_out;
+  ULONG length;
+  UINT zlp;
+
+  if (transfer_request->ux_slave_transfer_request_state == UX_STATE_RESET)
+  {
+    /* Nothing moves on a halted endpoint until the host clears it */
+    if (endpoint->ux_slave_endpoint_state == UX_ENDPOINT_HALTED)
+    {
+      return UX_STATE_WAIT;
+    }
+
+    if (in)
+    {
+      if ((msc_sim_host.phase != HOST_DATA_IN) && (msc_sim_host.phase != HOST_CSW))
+      {
+        return UX_STATE_WAIT;
+      }
+      length = slave_length;
+      zlp = (length != 0U) && (host_length != length) && ((length % MSC_SIM_PACKET_SIZE) == 0U);
+      transfer_request->ux_slave_transfer_request_force_zlp = zlp;
+      *end = msc_sim_bus(msc_sim_packets(length, zlp));
+    }
+    else
+    {
+      if (!msc_sim_host_out(slave_length, &length))
+      {
+        return UX_STATE_WAIT;
+      }
+      *end = msc_sim_bus(msc_sim_packets(length, UX_FALSE));
+    }
+    transfer_request->ux_slave_transfer_request_requested_length = length;
+    transfer_request->ux_slave_transfer_request_actual_length = 0U;
+    transfer_request->ux_slave_transfer_request_state = UX_STATE_WAIT;
+  }
+
+  if (sd_sim_time < *end)
+  {
+    return UX_STATE_WAIT;
+  }
+
+  length = transfer_request->ux_slave_transfer_request_requested_length;
+  if (in)
+  {
+    msc_sim_host_in_done(transfer_request->ux_slave_transfer_request_data_pointer, length,
+                         ((length % MSC_SIM_PACKET_SIZE) != 0U) ||
+                         (length == 0U) || transfer_request->ux_slave_transfer_request_force_zlp);
+  }
+  else
+  {
+    msc_sim_host_out_done(transfer_request->ux_slave_transfer_request_data_pointer, length);
+  }
+  transfer_request->ux_slave_transfer_request_actual_length = length;
+  transfer_request->ux_slave_transfer_request_completion_code = UX_SUCCESS;
+  transfer_request->ux_slave_transfer_request_state = UX_STATE_RESET;
+  return UX_STATE_NEXT;
+}
+
+/* The host clears a halt it meets in the data phase, or on the CSW once */
+static VOID msc_sim_host_halts(VOID)
+{
+  MSC_SimHostTypeDef *host = &msc_sim_host;
+
+  if ((host->phase == HOST_DATA_OUT) && (msc_sim_ep_out.ux_slave_endpoint_state == UX_ENDPOINT_HALTED))
+  {
+    msc_sim_ep_out.ux_slave_endpoint_state = UX_ENDPOINT_RESET;
+    msc_sim_stats.stalls_out++;
+    host->phase = HOST_CSW;
+  }
+  if (((host->phase == HOST_DATA_IN) || (host->phase == HOST_CSW)) &&
+      (msc_sim_ep_in.ux_slave_endpoint_state == UX_ENDPOINT_HALTED))
+  {
+    msc_sim_ep_in.ux_slave_endpoint_state = UX_ENDPOINT_RESET;
+    msc_sim_stats.stalls_in++;
+    host->phase = HOST_CSW;
+  }
+}
+
+static VOID msc_sim_endpoint(UX_SLAVE_ENDPOINT *endpoint, UCHAR address, UCHAR *buffer)
+{
+  endpoint->ux_slave_endpoint_descriptor.bEndpointAddress = address;
+  endpoint->ux_slave_endpoint_descriptor.bmAttributes = UX_BULK_ENDPOINT;
+  endpoint->ux_slave_endpoint_descriptor.wMaxPacketSize = MSC_SIM_PACKET_SIZE;
+  endpoint->ux_slave_endpoint_interface = &msc_sim_interface;
+  endpoint->ux_slave_endpoint_transfer_request.ux_slave_transfer_request_endpoint = endpoint;
+  endpoint->ux_slave_endpoint_transfer_request.ux_slave_transfer_request_data_pointer = buffer;
+}
+
+VOID msc_sim_connect(VOID)
+{
+  UX_SLAVE_CLASS_COMMAND command;
+
+  _ux_system_slave = &msc_sim_system;
+  msc_sim_system.ux_system_slave_device.ux_slave_device_state = UX_DEVICE_CONFIGURED;
+
+  /* As MX_USBX_Device_Init() registers the class */
+  USBD_STORAGE_SetLunParameters(&msc_sim_parameter);
+  memset(&command, 0, sizeof(command));
+  command.ux_slave_class_command_class_ptr = &msc_sim_class;
+  command.ux_slave_class_command_parameter = &msc_sim_parameter;
+  if (_ux_device_class_storage_initialize(&command) != UX_SUCCESS)
+  {
+    abort();
+  }
+  msc_sim_storage = msc_sim_class.ux_slave_class_instance;
+
+  /* OUT first, the class must find the IN endpoint either way */
+  msc_sim_endpoint(&msc_sim_ep_out, 0x01U, msc_sim_ep_out_buffer);
+  msc_sim_endpoint(&msc_sim_ep_in, 0x81U, msc_sim_ep_in_buffer);
+  msc_sim_interface.ux_slave_interface_first_endpoint = &msc_sim_ep_out;
+  msc_sim_ep_out.ux_slave_endpoint_next_endpoint = &msc_sim_ep_in;
+  command.ux_slave_class_command_interface = &msc_sim_interface;
+  if (_ux_device_class_storage_activate(&command) != UX_SUCCESS)
+  {
+    abort();
+  }
+
+  memset(&msc_sim_host, 0, sizeof(msc_sim_host));
+  msc_sim_host.csw_status = MSC_SIM_HANG;
+  msc_sim_end_in = 0U;
+  msc_sim_end_out = 0U;
+  msc_sim_bus_free = 0U;
+}
+
+/* Host ---------------------------------------------------------------------*/
+VOID msc_sim_submit(UCHAR lun, const UCHAR *cdb, UCHAR cdb_length,
+                    UINT direction, UCHAR *data, ULONG length)
+{
+  MSC_SimHostTypeDef *host = &msc_sim_host;
+
+  memset(host->cbw, 0, sizeof(host->cbw));
+  host->tag++;
+  _ux_utility_long_put(&host->cbw[UX_SLAVE_CLASS_STORAGE_CBW_SIGNATURE], UX_SLAVE_CLASS_STORAGE_CBW_SIGNATURE_MASK);
+  _ux_utility_long_put(&host->cbw[UX_SLAVE_CLASS_STORAGE_CBW_TAG], host->tag);
+  _ux_utility_long_put(&host->cbw[UX_SLAVE_CLASS_STORAGE_CBW_DATA_LENGTH], length);
+  host->cbw[UX_SLAVE_CLASS_STORAGE_CBW_FLAGS] = (direction == MSC_SIM_IN) ? 0x80U : 0x00U;
+  host->cbw[UX_SLAVE_CLASS_STORAGE_CBW_LUN] = lun;
+  host->cbw[UX_SLAVE_CLASS_STORAGE_CBW_CB_LENGTH] = cdb_length;
+  memcpy(&host->cbw[UX_SLAVE_CLASS_STORAGE_CBW_CB], cdb, cdb_length);
+
+  host->data = data;
+  host->length = length;
+  host->offset = 0U;
+  host->csw_status = MSC_SIM_HANG;
+  host->phase = HOST_CBW;
+  msc_sim_stats.residue = 0U;
+  msc_sim_stats.data_length = 0U;
+}
+
+/* One pass of the main loop */
+static VOID msc_sim_loop(VOID)
+{
+  ULONG64 start = sd_sim_time;
+
+  msc_sim_host_halts();
+  _ux_device_class_storage_tasks_run(msc_sim_storage);
+  USBD_STORAGE_Process();
+  if ((sd_sim_time - start) > msc_sim_stats.loop_max_us)
+  {
+    msc_sim_stats.loop_max_us = (ULONG)(sd_sim_time - start);
+  }
+}
+
+UINT msc_sim_run(ULONG us)
+{
+  ULONG64 end = sd_sim_time + us;
+
+  do
+  {
+    msc_sim_loop();
+    if (msc_sim_host.phase == HOST_IDLE)
+    {
+      return UX_TRUE;
+    }
+    sd_sim_advance(MSC_SIM_LOOP_US);
+  } while (sd_sim_time < end);
+
+  return UX_FALSE;
+}
+
+VOID msc_sim_idle(ULONG us)
+{
+  ULONG64 end = sd_sim_time + us;
+
+  while (sd_sim_time < end)
+  {
+    msc_sim_loop();
+    sd_sim_advance(MSC_SIM_LOOP_US);
+  }
+}
+
+UCHAR msc_sim_csw_status(VOID)
+{
+  return (msc_sim_host.phase == HOST_IDLE) ? msc_sim_host.csw_status : MSC_SIM_HANG;
+}
+
+UCHAR msc_sim_command(UCHAR lun, const UCHAR *cdb, UCHAR cdb_length,
+                      UINT direction, UCHAR *data, ULONG length)
+{
+  msc_sim_submit(lun, cdb, cdb_length, direction, data, length);
+  msc_sim_run(5U * 1000U * 1000U);
+  return msc_sim_csw_status();
+}
+
+/* SCSI commands ------------------------------------------------------------*/
+static VOID msc_sim_cdb10(UCHAR *cdb, UCHAR opcode, ULONG lba, ULONG blocks)
+{
+  memset(cdb, 0, 10U);
+  cdb[0] = opcode;
+  _ux_utility_long_put_big_endian(&cdb[2], lba);
+  _ux_utility_short_put_big_endian(&cdb[7], (USHORT)blocks);
+}
+
+UCHAR msc_sim_read(UCHAR lun, ULONG lba, ULONG blocks, UCHAR *data)
+{
+  UCHAR cdb[10];
+
+  msc_sim_cdb10(cdb, UX_SLAVE_CLASS_STORAGE_SCSI_READ16, lba, blocks);
+  return msc_sim_command(lun, cdb, sizeof(cdb), MSC_SIM_IN, data, blocks * 512U);
+}
+
+UCHAR msc_sim_write(UCHAR lun, ULONG lba, ULONG blocks, const UCHAR *data)
+{
+  UCHAR cdb[10];
+
+  msc_sim_cdb10(cdb, UX_SLAVE_CLASS_STORAGE_SCSI_WRITE16, lba, blocks);
+  return msc_sim_command(lun, cdb, sizeof(cdb), MSC_SIM_OUT, (UCHAR *)data, blocks * 512U);
+}
+
+UCHAR msc_sim_test_unit_ready(UCHAR lun)
+{
+  UCHAR cdb[6] = { UX_SLAVE_CLASS_STORAGE_SCSI_TEST_READY };
+
+  return msc_sim_command(lun, cdb, sizeof(cdb), MSC_SIM_NONE, UX_NULL, 0U);
+}
+
+UCHAR msc_sim_synchronize_cache(UCHAR lun)
+{
+  UCHAR cdb[10];
+
+  msc_sim_cdb10(cdb, UX_SLAVE_CLASS_STORAGE_SCSI_SYNCHRONIZE_CACHE, 0U, 0U);
+  return msc_sim_command(lun, cdb, sizeof(cdb), MSC_SIM_NONE, UX_NULL, 0U);
+}
+
+UINT msc_sim_wait_ready(UCHAR lun, ULONG ms)
+{
+  ULONG64 end = sd_sim_time + ((ULONG64)ms * 1000U);
+
+  while (msc_sim_test_unit_ready(lun) != UX_SLAVE_CLASS_STORAGE_CSW_PASSED)
+  {
+    msc_sim_request_sense(lun);
+    if (sd_sim_time >= end)
+    {
+      return UX_FALSE;
+    }
+    msc_sim_idle(10000U);
+  }
+  return UX_TRUE;
+}
+
+ULONG msc_sim_request_sense(UCHAR lun)
+{
+  UCHAR cdb[6] = { UX_SLAVE_CLASS_STORAGE_SCSI_REQUEST_SENSE, 0U, 0U, 0U, 18U, 0U };
+  UCHAR sense[18];
+
+  memset(sense, 0, sizeof(sense));
+  if (msc_sim_command(lun, cdb, sizeof(cdb), MSC_SIM_IN, sense, sizeof(sense)) != 0U)
+  {
+    return 0xFFFFFFFFU;
+  }
+  return UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(sense[2] & 0x0FU, sense[12], sense[13]);
+}
+
+ULONG msc_sim_trace_load(const char *path, MSC_SimTraceTypeDef *trace, ULONG max_commands,
+                         ULONG max_blocks)
+{
+  char line[128];
+  char op;
+  ULONG count = 0U;
+  FILE *file = fopen(path, "r");
+
+  if (file == NULL)
+  {
+    printf("%s: cannot open\n", path);
+    return 0U;
+  }
+
+  while ((count < max_commands) && (fgets(line, sizeof(line), file) != NULL))
+  {
+    if ((line[0] == '#') || (line[0] == '\n'))
+    {
+      continue;
+    }
+
+    trace[count].lba = 0U;
+    trace[count].blocks = 0U;
+    op = line[0];
+    if ((op == 'R') || (op == 'W'))
+    {
+      if ((sscanf(&line[1], "%lu %lu", &trace[count].lba, &trace[count].blocks) != 2) ||
+          (trace[count].blocks == 0U) || (trace[count].blocks > max_blocks))
+      {
+        op = 0;
+      }
+    }
+    if ((op != 'R') && (op != 'W') && (op != 'F'))
+    {
+      printf("%s: bad line %s", path, line);
+      fclose(file);
+      return 0U;
+    }
+    trace[count].op = (UCHAR)op;
+    count++;
+  }
+
+  fclose(file);
+  return count;
+}
@@ -0,0 +1,120 @@
+/**
+  ******************************************************************************
+  * @file    msc_sim.h
+  * @brief   Simulated USB host and bus under the storage class, for the host
+  *          tests and benchmarks
+  ******************************************************************************
+  * msc_sim.c stands in for the USBX device stack under the standalone
+  * storage class: the class is initialized and activated with the LUNs of
+  * ux_device_msc.c, its bulk IN and OUT endpoints move CSW, CBW and data
+  * packets on a simulated full speed bus. A packet takes msc_sim_packet_us
+  * of the bus whatever the main loop does, as the DCD moves them under
+  * interrupt on the board. The main loop runs _ux_device_class_storage_
+  * tasks_run() and USBD_STORAGE_Process() every MSC_SIM_LOOP_US.
+  *
+  * The simulated host speaks Bulk-Only Transport: it sends the CBW, the
+  * data, clears a halted endpoint in the data phase as a host does and
+  * reads the CSW. Time is the one of sd_sim.c, the SD card sits on LUN 0.
+  ******************************************************************************
+  */
+#ifndef MSC_SIM_H
+#define MSC_SIM_H
+
+#include "sd_sim.h"
+#include "ux_device_class_storage.h"
+
+/* Full speed bulk endpoints */
+#define MSC_SIM_PACKET_SIZE     64U
+
+/* Bus time of one packet by default: about 1.2 MB/s, a good full speed
+   host with the bus to itself */
+#define MSC_SIM_PACKET_US       53U
+
+/* Main loop period while the device has nothing else to do */
+#define MSC_SIM_LOOP_US         10U
+
+/* Data phase of a command, seen from the host */
+#define MSC_SIM_NONE            0U
+#define MSC_SIM_IN              1U
+#define MSC_SIM_OUT             2U
+
+/* msc_sim_command() result when no CSW came before the timeout */
+#define MSC_SIM_HANG            0xFFU
+
+/* Command of a host trace */
+typedef struct
+{
+  UCHAR op;                 /* 'R' READ(10), 'W' WRITE(10), 'F' SYNCHRONIZE CACHE */
+  ULONG lba;
+  ULONG blocks;
+} MSC_SimTraceTypeDef;
+
+typedef struct
+{
+  ULONG commands;           /* CBWs sent */
+  ULONG bytes_in;           /* data phase bytes, CBW and CSW not counted */
+  ULONG bytes_out;
+  ULONG stalls_in;          /* halts the host had to clear */
+  ULONG stalls_out;
+  ULONG residue;            /* dCSWDataResidue of the last command */
+  ULONG data_length;        /* data phase bytes of the last command */
+  ULONG loop_max_us;        /* longest pass of the main loop, the time the
+                               media blocks the other tasks */
+} MSC_SimStatsTypeDef;
+
+extern MSC_SimStatsTypeDef msc_sim_stats;
+
+/* Bus time of one packet, in us */
+extern ULONG msc_sim_packet_us;
+
+/* The storage class instance, for the checks of its state */
+extern UX_SLAVE_CLASS_STORAGE *msc_sim_storage;
+
+/* Initialize the class with the LUNs of ux_device_msc.c and activate it,
+   as on a SET_CONFIGURATION */
+VOID msc_sim_connect(VOID);
+
+/* Queue a command, the host sends it once the device takes a CBW. 'data'
+   is sent or filled in the data phase, 'length' is dCBWDataTransferLength */
+VOID msc_sim_submit(UCHAR lun, const UCHAR *cdb, UCHAR cdb_length,
+                    UINT direction, UCHAR *data, ULONG length);
+
+/* Run the main loop for up to 'us', until the CSW of the submitted command
+   is in. Returns UX_TRUE once it is. */
+UINT msc_sim_run(ULONG us);
+
+/* Run the main loop for 'us' whatever the host does */
+VOID msc_sim_idle(ULONG us);
+
+/* Submit and run for up to 5 s. Returns bCSWStatus or MSC_SIM_HANG. */
+UCHAR msc_sim_command(UCHAR lun, const UCHAR *cdb, UCHAR cdb_length,
+                      UINT direction, UCHAR *data, ULONG length);
+
+/* bCSWStatus of the last command, MSC_SIM_HANG while it runs */
+UCHAR msc_sim_csw_status(VOID);
+
+/* SCSI commands the tests use most */
+UCHAR msc_sim_read(UCHAR lun, ULONG lba, ULONG blocks, UCHAR *data);
+UCHAR msc_sim_write(UCHAR lun, ULONG lba, ULONG blocks, const UCHAR *data);
+UCHAR msc_sim_test_unit_ready(UCHAR lun);
+UCHAR msc_sim_synchronize_cache(UCHAR lun);
+
+/* TEST UNIT READY, with a REQUEST SENSE after each failure as a host
+   does, every 10 ms until the LUN is ready or 'ms' went by. Returns
+   UX_TRUE once it is ready. */
+UINT msc_sim_wait_ready(UCHAR lun, ULONG ms);
+
+/* REQUEST SENSE, returned as key | ASC << 8 | ASCQ << 16 like the class
+   keeps it */
+ULONG msc_sim_request_sense(UCHAR lun);
+
+/* Load a host trace, one command per line, '#' starts a comment:
+     R <lba> <blocks>
+     W <lba> <blocks>
+     F
+   Returns the number of commands, 0 when the file cannot be read or has a
+   bad line or a command of more than 'max_blocks'. */
+ULONG msc_sim_trace_load(const char *path, MSC_SimTraceTypeDef *trace, ULONG max_commands,
+                         ULONG max_blocks);
+
+#endif /* MSC_SIM_H */
@@ -0,0 +1,778 @@
+/**
+  ******************************************************************************
+  * @file    sd_sim.c
+  * @brief   Simulated SD card under msc_media_sd.c, for the host tests
+  ******************************************************************************
+  * A data transfer takes the card access time, then two bus clocks per byte
+  * plus the CRC and the gaps of each block, at the clock set in CLKCR.
+  * Its data moves when it ends: a buffer the media touches meanwhile shows
+  * up as a data mismatch. The IDMA linked list is run the way the SDMMC
+  * does it, from the head node then by the offsets of the link registers;
+  * a list the IDMA would not run as the HAL built it fails the transfer.
+  * A card asked for a data command while it programs does not answer, as
+  * a card in the programming state does.
+  ******************************************************************************
+  */
+#include "sd_sim.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SD_SIM_BLOCK_SIZE       512U
+#define SD_SIM_BLOCK_CLOCKS     1050U       /* 4 bits data, CRC16 and gaps */
+#define SD_SIM_DS_MAX_CLOCK     25000000U
+#define SD_SIM_HS_MAX_CLOCK     50000000U
+#define SD_SIM_INIT_CLOCKDIV    8U          /* hsd1.Init.ClockDiv */
+#define SD_SIM_IDENTIFY_CLOCK   400000U
+#define SD_SIM_IDENTIFY_CMD_US  250U        /* command and response at 400 kHz */
+#define SD_SIM_STATUS_WORDS     16U         /* CMD6 status, 64 bytes */
+#define SD_SIM_NEVER            (~(ULONG64)0U)
+
+typedef struct
+{
+  UINT active;
+  UINT write;
+  ULONG lba;
+  ULONG blocks;
+  UCHAR *buffer;                    /* single buffer transfers */
+  SD_DMALinkNodeTypeDef *head;      /* linked list transfers */
+  ULONG error;                      /* HAL_SD_ERROR_xxx at the end, 0 if none */
+  ULONG64 end;
+} SD_SimXferTypeDef;
+
+ULONG64 sd_sim_time;
+SD_SimStatsTypeDef sd_sim_stats;
+
+SD_HandleTypeDef hsd1;
+
+static SDMMC_TypeDef sd_sim_regs;
+static SD_SimCardTypeDef sd_sim_card;
+static UCHAR *sd_sim_data;
+static UCHAR *sd_sim_map;
+static UINT sd_sim_present;
+static UINT sd_sim_identified;
+static ULONG64 sd_sim_power_up;
+static UINT sd_sim_hs;
+static ULONG64 sd_sim_busy_until;
+static SD_SimXferTypeDef sd_sim_xfer;
+static ULONG sd_sim_fail_code;
+static ULONG sd_sim_fail_count;
+static uint32_t sd_sim_fifo[SD_SIM_STATUS_WORDS];
+static ULONG sd_sim_fifo_index = SD_SIM_STATUS_WORDS;
+
+/* Card ---------------------------------------------------------------------*/
+VOID sd_sim_card_default(SD_SimCardTypeDef *card, ULONG blocks)
+{
+  memset(card, 0, sizeof(*card));
+  card->blocks = blocks;
+  card->high_speed = UX_TRUE;
+  card->au_size = 9U;               /* 4 MB */
+  card->access_us = 300U;
+  card->program_us = 800U;
+  card->erase_us = 2000U;
+  card->identify_us = 200000U;
+}
+
+VOID sd_sim_insert(const SD_SimCardTypeDef *card)
+{
+  free(sd_sim_data);
+  free(sd_sim_map);
+
+  sd_sim_card = *card;
+  sd_sim_data = calloc(card->blocks, SD_SIM_BLOCK_SIZE);
+  sd_sim_map = calloc(card->blocks, 1U);
+  sd_sim_present = UX_TRUE;
+  sd_sim_identified = UX_FALSE;
+  sd_sim_hs = UX_FALSE;
+  sd_sim_busy_until = 0U;
+  memset(&sd_sim_xfer, 0, sizeof(sd_sim_xfer));
+
+  MSC_Media_SD_DetectCallback();
+}
+
+VOID sd_sim_remove(VOID)
+{
+  sd_sim_present = UX_FALSE;
+  sd_sim_identified = UX_FALSE;
+
+  /* The transfer in progress runs out of time */
+  if (sd_sim_xfer.active)
+  {
+    sd_sim_xfer.error = HAL_SD_ERROR_DATA_TIMEOUT;
+    sd_sim_xfer.end = sd_sim_time;
+  }
+
+  MSC_Media_SD_DetectCallback();
+}
+
+UCHAR *sd_sim_block(ULONG lba)
+{
+  return &sd_sim_data[(size_t)lba * SD_SIM_BLOCK_SIZE];
+}
+
+UINT sd_sim_mapped(ULONG lba)
+{
+  return sd_sim_map[lba];
+}
+
+ULONG sd_sim_clock(VOID)
+{
+  ULONG divider = sd_sim_regs.CLKCR & SDMMC_CLKCR_CLKDIV;
+
+  return (divider == 0U) ? SD_SIM_KERNEL_CLOCK : (SD_SIM_KERNEL_CLOCK / (2U * divider));
+}
+
+UINT sd_sim_high_speed(VOID)
+{
+  return sd_sim_hs;
+}
+
+VOID sd_sim_fail(ULONG error_code, ULONG count)
+{
+  sd_sim_fail_code = error_code;
+  sd_sim_fail_count = count;
+}
+
+VOID sd_sim_hold_busy(ULONG us)
+{
+  ULONG64 until = sd_sim_time + us;
+
+  if (until > sd_sim_busy_until)
+  {
+    sd_sim_busy_until = until;
+  }
+}
+
+UINT sd_sim_dma_busy(VOID)
+{
+  return sd_sim_xfer.active;
+}
+
+/* Error of the next data transfer: injected, or CRC errors when the clock
+   is too fast for the card or for its bus mode */
+static ULONG sd_sim_data_error(VOID)
+{
+  ULONG clock = sd_sim_clock();
+
+  if (sd_sim_fail_count != 0U)
+  {
+    sd_sim_fail_count--;
+    return sd_sim_fail_code;
+  }
+
+  if ((clock > (sd_sim_hs ? SD_SIM_HS_MAX_CLOCK : SD_SIM_DS_MAX_CLOCK)) ||
+      ((sd_sim_card.max_clock != 0U) && (clock > sd_sim_card.max_clock)))
+  {
+    return HAL_SD_ERROR_DATA_CRC_FAIL;
+  }
+
+  return HAL_SD_ERROR_NONE;
+}
+
+static ULONG64 sd_sim_duration(ULONG blocks)
+{
+  return sd_sim_card.access_us +
+         ((ULONG64)blocks * SD_SIM_BLOCK_CLOCKS * 1000000U) / sd_sim_clock();
+}
+
+/* A command the card can take: present, identified and not programming */
+static UINT sd_sim_command(SD_HandleTypeDef *hsd)
+{
+  if (hsd->State != HAL_SD_STATE_READY)
+  {
+    hsd->ErrorCode |= HAL_SD_ERROR_BUSY;
+    return UX_FALSE;
+  }
+
+  if (!sd_sim_present || !sd_sim_identified)
+  {
+    hsd->ErrorCode |= HAL_SD_ERROR_CMD_RSP_TIMEOUT;
+    return UX_FALSE;
+  }
+
+  if (sd_sim_time < sd_sim_busy_until)
+  {
+    sd_sim_stats.busy_violations++;
+    hsd->ErrorCode |= HAL_SD_ERROR_CMD_RSP_TIMEOUT;
+    return UX_FALSE;
+  }
+
+  return UX_TRUE;
+}
+
+/* IDMA -----------------------------------------------------------------------*/
+/* Each node gives a word aligned buffer of a multiple of 32 bytes, the
+   next node is found at its offset from the head node */
+ULONG sd_sim_idma_list(SD_DMALinkNodeTypeDef *head, ULONG length, UCHAR *card, UINT write)
+{
+  SD_DMALinkNodeTypeDef *node = head;
+  ULONG done = 0U;
+  ULONG nodes = 0U;
+  ULONG size;
+  UCHAR *buffer;
+
+  while (done < length)
+  {
+    buffer = (UCHAR *)(uintptr_t)node->IDMABASER;
+    size = node->IDMABSIZE;
+    if ((size == 0U) || ((size & ~SDMMC_IDMABSIZE_IDMABNDT) != 0U) ||
+        ((node->IDMABASER & 3U) != 0U))
+    {
+      return 0U;
+    }
+
+    /* The data path ends the transfer, the rest of the buffer is unused */
+    if (size > (length - done))
+    {
+      size = length - done;
+    }
+    if (card != UX_NULL)
+    {
+      if (write)
+      {
+        memcpy(&card[done], buffer, size);
+      }
+      else
+      {
+        memcpy(buffer, &card[done], size);
+      }
+    }
+    done += size;
+    nodes++;
+
+    if (done < length)
+    {
+      /* Buffer underrun without a next node */
+      if ((node->IDMALAR & SDMMC_IDMALAR_ULA) == 0U)
+      {
+        return 0U;
+      }
+      node = (SD_DMALinkNodeTypeDef *)((uintptr_t)head + (node->IDMALAR & SDMMC_IDMALAR_IDMALA));
+    }
+  }
+
+  return nodes;
+}
+
+static HAL_StatusTypeDef sd_sim_start(SD_HandleTypeDef *hsd, UINT write, UCHAR *buffer,
+                                      SD_DMALinkNodeTypeDef *head, ULONG lba, ULONG blocks)
+{
+  SD_SimXferTypeDef *xfer = &sd_sim_xfer;
+  ULONG nodes;
+
+  hsd->ErrorCode = HAL_SD_ERROR_NONE;
+  if (!sd_sim_command(hsd))
+  {
+    return HAL_ERROR;
+  }
+
+  if ((blocks == 0U) || ((lba + blocks) > sd_sim_card.blocks))
+  {
+    hsd->ErrorCode |= HAL_SD_ERROR_ADDR_OUT_OF_RANGE;
+    return HAL_ERROR;
+  }
+
+  memset(xfer, 0, sizeof(*xfer));
+  xfer->active = UX_TRUE;
+  xfer->write = write;
+  xfer->lba = lba;
+  xfer->blocks = blocks;
+  xfer->buffer = buffer;
+  xfer->head = head;
+  xfer->error = sd_sim_data_error();
+  xfer->end = (xfer->error == SD_SIM_STALL) ? SD_SIM_NEVER : (sd_sim_time + sd_sim_duration(blocks));
+
+  if (head != UX_NULL)
+  {
+    sd_sim_stats.linked_lists++;
+    nodes = sd_sim_idma_list(head, blocks * SD_SIM_BLOCK_SIZE, UX_NULL, write);
+    if (nodes == 0U)
+    {
+      sd_sim_stats.list_errors++;
+      xfer->error = HAL_SD_ERROR_DMA;
+    }
+    sd_sim_stats.linked_nodes += nodes;
+  }
+
+  if (write)
+  {
+    sd_sim_stats.write_commands++;
+  }
+  else
+  {
+    sd_sim_stats.read_commands++;
+  }
+
+  hsd->State = HAL_SD_STATE_BUSY;
+  return HAL_OK;
+}
+
+static VOID sd_sim_end(VOID)
+{
+  SD_SimXferTypeDef *xfer = &sd_sim_xfer;
+  UCHAR *card = sd_sim_block(xfer->lba);
+  ULONG length = xfer->blocks * SD_SIM_BLOCK_SIZE;
+
+  xfer->active = UX_FALSE;
+  hsd1.State = HAL_SD_STATE_READY;
+
+  if (xfer->error != HAL_SD_ERROR_NONE)
+  {
+    hsd1.ErrorCode |= xfer->error;
+    HAL_SD_ErrorCallback(&hsd1);
+    return;
+  }
+
+  if (xfer->head != UX_NULL)
+  {
+    (void)sd_sim_idma_list(xfer->head, length, card, xfer->write);
+  }
+  else if (xfer->write)
+  {
+    memcpy(card, xfer->buffer, length);
+  }
+  else
+  {
+    memcpy(xfer->buffer, card, length);
+  }
+
+  if (xfer->write)
+  {
+    memset(&sd_sim_map[xfer->lba], 1, xfer->blocks);
+    sd_sim_stats.blocks_written += xfer->blocks;
+    sd_sim_busy_until = sd_sim_time + sd_sim_card.program_us;
+    HAL_SD_TxCpltCallback(&hsd1);
+  }
+  else
+  {
+    sd_sim_stats.blocks_read += xfer->blocks;
+    HAL_SD_RxCpltCallback(&hsd1);
+  }
+}
+
+VOID sd_sim_advance(ULONG us)
+{
+  ULONG64 target = sd_sim_time + us;
+
+  while (sd_sim_xfer.active && (sd_sim_xfer.end <= target))
+  {
+    if (sd_sim_xfer.end > sd_sim_time)
+    {
+      sd_sim_time = sd_sim_xfer.end;
+    }
+    sd_sim_end();
+  }
+
+  sd_sim_time = target;
+}
+
+/* Board and clocks -----------------------------------------------------------*/
+uint32_t HAL_GetTick(void)
+{
+  return (uint32_t)(sd_sim_time / 1000U);
+}
+
+uint32_t HAL_RCCEx_GetPeriphCLKFreq(uint64_t PeriphClk)
+{
+  (void)PeriphClk;
+  return SD_SIM_KERNEL_CLOCK;
+}
+
+uint8_t board_sd_detect_getstate(void)
+{
+  return (uint8_t)sd_sim_present;
+}
+
+/* Identification, in the steps of sdmmc.c: power up at 400 kHz, ACMD41
+   until the card is ready identify_us after power up, then CID/CSD and the
+   4 bits bus at the ClockDiv clock. Commands at 400 kHz take about 250 us. */
+HAL_StatusTypeDef MX_SDMMC1_SD_PowerOn(void)
+{
+  memset(&sd_sim_regs, 0, sizeof(sd_sim_regs));
+  memset(&hsd1, 0, sizeof(hsd1));
+  hsd1.Instance = &sd_sim_regs;
+  sd_sim_stats.identifications++;
+  sd_sim_identified = UX_FALSE;
+  sd_sim_hs = UX_FALSE;
+  sd_sim_regs.CLKCR = SD_SIM_KERNEL_CLOCK / (2U * SD_SIM_IDENTIFY_CLOCK);
+
+  /* 74 clocks, CMD0 and CMD8 */
+  sd_sim_time += 1000U + (2U * SD_SIM_IDENTIFY_CMD_US);
+  if (!sd_sim_present)
+  {
+    hsd1.ErrorCode = HAL_SD_ERROR_CMD_RSP_TIMEOUT;
+    return HAL_ERROR;
+  }
+
+  sd_sim_power_up = sd_sim_time;
+  hsd1.SdCard.CardVersion = CARD_V2_X;
+  hsd1.State = HAL_SD_STATE_PROGRAMMING;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef MX_SDMMC1_SD_OpCond(void)
+{
+  /* CMD55 and ACMD41 */
+  sd_sim_stats.op_conds++;
+  sd_sim_time += 2U * SD_SIM_IDENTIFY_CMD_US;
+  if (!sd_sim_present)
+  {
+    hsd1.ErrorCode |= HAL_SD_ERROR_CMD_RSP_TIMEOUT;
+    hsd1.State = HAL_SD_STATE_READY;
+    return HAL_ERROR;
+  }
+  if ((sd_sim_time - sd_sim_power_up) < sd_sim_card.identify_us)
+  {
+    return HAL_BUSY;
+  }
+
+  hsd1.SdCard.CardType = CARD_SDHC_SDXC;
+  hsd1.SdCard.CardSpeed = CARD_HIGH_SPEED;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef MX_SDMMC1_SD_InitCard(void)
+{
+  /* CMD2, CMD3, CMD9, CMD7, CMD55 and ACMD6 */
+  sd_sim_time += 6U * SD_SIM_IDENTIFY_CMD_US;
+  hsd1.State = HAL_SD_STATE_READY;
+  if (!sd_sim_present)
+  {
+    hsd1.ErrorCode |= HAL_SD_ERROR_CMD_RSP_TIMEOUT;
+    return HAL_ERROR;
+  }
+
+  sd_sim_regs.CLKCR = SD_SIM_INIT_CLOCKDIV;
+  hsd1.SdCard.Class = 0x5B5U;
+  hsd1.SdCard.RelCardAdd = 1U;
+  hsd1.SdCard.BlockNbr = sd_sim_card.blocks;
+  hsd1.SdCard.BlockSize = SD_SIM_BLOCK_SIZE;
+  hsd1.SdCard.LogBlockNbr = sd_sim_card.blocks;
+  hsd1.SdCard.LogBlockSize = SD_SIM_BLOCK_SIZE;
+  sd_sim_identified = UX_TRUE;
+
+  return HAL_OK;
+}
+
+/* SD HAL -------------------------------------------------------------------*/
+HAL_StatusTypeDef HAL_SD_GetCardInfo(SD_HandleTypeDef *hsd, HAL_SD_CardInfoTypeDef *pCardInfo)
+{
+  *pCardInfo = hsd->SdCard;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_GetCardCSD(SD_HandleTypeDef *hsd, HAL_SD_CardCSDTypeDef *pCSD)
+{
+  memset(pCSD, 0, sizeof(*pCSD));
+  pCSD->CSDStruct = 1U;
+  pCSD->CardComdClasses = (uint16_t)hsd->SdCard.Class;
+  pCSD->RdBlockLen = 9U;
+  pCSD->DeviceSize = (sd_sim_card.blocks / 1024U) - 1U;
+  pCSD->EraseGrSize = 1U;           /* ERASE_BLK_EN */
+  pCSD->EraseGrMul = 0x7FU;         /* SECTOR_SIZE */
+  pCSD->MaxWrBlockLen = 9U;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_GetCardStatus(SD_HandleTypeDef *hsd, HAL_SD_CardStatusTypeDef *pStatus)
+{
+  if (!sd_sim_command(hsd))
+  {
+    return HAL_ERROR;
+  }
+
+  memset(pStatus, 0, sizeof(*pStatus));
+  pStatus->DataBusWidth = 2U;
+  pStatus->CardType = 0U;
+  pStatus->SpeedClass = 4U;         /* class 10 */
+  pStatus->AllocationUnitSize = sd_sim_card.au_size;
+  pStatus->EraseSize = 1U;
+  pStatus->EraseTimeout = 1U;
+  pStatus->EraseOffset = 1U;
+  pStatus->UhsSpeedGrade = 1U;
+  pStatus->VideoSpeedClass = 10U;
+  sd_sim_time += sd_sim_duration(1U) / 8U;
+  return HAL_OK;
+}
+
+HAL_SD_CardStateTypeDef HAL_SD_GetCardState(SD_HandleTypeDef *hsd)
+{
+  sd_sim_stats.status_polls++;
+
+  if (!sd_sim_present || !sd_sim_identified)
+  {
+    hsd->ErrorCode |= HAL_SD_ERROR_CMD_RSP_TIMEOUT;
+    return 0U;
+  }
+
+  if (sd_sim_xfer.active)
+  {
+    return sd_sim_xfer.write ? HAL_SD_CARD_RECEIVING : HAL_SD_CARD_SENDING;
+  }
+
+  return (sd_sim_time < sd_sim_busy_until) ? HAL_SD_CARD_PROGRAMMING : HAL_SD_CARD_TRANSFER;
+}
+
+HAL_StatusTypeDef HAL_SD_ConfigSpeedBusOperation(SD_HandleTypeDef *hsd, uint32_t SpeedMode)
+{
+  hsd->ErrorCode = HAL_SD_ERROR_NONE;
+  if (!sd_sim_command(hsd))
+  {
+    return HAL_ERROR;
+  }
+  sd_sim_stats.switch_commands++;
+
+  if (SpeedMode == SDMMC_SPEED_MODE_HIGH)
+  {
+    if (((hsd->SdCard.CardSpeed != CARD_HIGH_SPEED) && (hsd->SdCard.CardType != CARD_SDHC_SDXC)) ||
+        !sd_sim_card.high_speed)
+    {
+      hsd->ErrorCode |= HAL_SD_ERROR_UNSUPPORTED_FEATURE;
+      return HAL_ERROR;
+    }
+    sd_sim_hs = UX_TRUE;
+  }
+  else if (SpeedMode == SDMMC_SPEED_MODE_DEFAULT)
+  {
+    sd_sim_hs = UX_FALSE;
+  }
+  else
+  {
+    hsd->ErrorCode |= HAL_SD_ERROR_PARAM;
+    return HAL_ERROR;
+  }
+
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_ReadBlocks(SD_HandleTypeDef *hsd, uint8_t *pData, uint32_t BlockAdd,
+                                    uint32_t NumberOfBlocks, uint32_t Timeout)
+{
+  ULONG error;
+
+  hsd->ErrorCode = HAL_SD_ERROR_NONE;
+  if (!sd_sim_command(hsd))
+  {
+    return HAL_ERROR;
+  }
+
+  sd_sim_stats.read_commands++;
+  error = sd_sim_data_error();
+  if (error == SD_SIM_STALL)
+  {
+    sd_sim_time += (ULONG64)Timeout * 1000U;
+    hsd->ErrorCode |= HAL_SD_ERROR_TIMEOUT;
+    return HAL_TIMEOUT;
+  }
+
+  sd_sim_time += sd_sim_duration(NumberOfBlocks);
+  if (error != HAL_SD_ERROR_NONE)
+  {
+    hsd->ErrorCode |= error;
+    return HAL_ERROR;
+  }
+
+  memcpy(pData, sd_sim_block(BlockAdd), NumberOfBlocks * SD_SIM_BLOCK_SIZE);
+  sd_sim_stats.blocks_read += NumberOfBlocks;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_ReadBlocks_DMA(SD_HandleTypeDef *hsd, uint8_t *pData, uint32_t BlockAdd,
+                                        uint32_t NumberOfBlocks)
+{
+  return sd_sim_start(hsd, UX_FALSE, pData, UX_NULL, BlockAdd, NumberOfBlocks);
+}
+
+HAL_StatusTypeDef HAL_SD_WriteBlocks_DMA(SD_HandleTypeDef *hsd, const uint8_t *pData, uint32_t BlockAdd,
+                                         uint32_t NumberOfBlocks)
+{
+  return sd_sim_start(hsd, UX_TRUE, (UCHAR *)pData, UX_NULL, BlockAdd, NumberOfBlocks);
+}
+
+HAL_StatusTypeDef HAL_SD_Abort(SD_HandleTypeDef *hsd)
+{
+  if (sd_sim_xfer.active)
+  {
+    sd_sim_stats.aborts++;
+    sd_sim_xfer.active = UX_FALSE;
+
+    /* CMD12, the card programs the blocks it already received */
+    if (sd_sim_xfer.write && sd_sim_present)
+    {
+      sd_sim_busy_until = sd_sim_time + sd_sim_card.program_us;
+    }
+  }
+
+  hsd->State = HAL_SD_STATE_READY;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_Erase(SD_HandleTypeDef *hsd, uint32_t BlockStartAdd, uint32_t BlockEndAdd)
+{
+  ULONG blocks;
+  ULONG groups;
+  ULONG group_blocks;
+
+  hsd->ErrorCode = HAL_SD_ERROR_NONE;
+  if (!sd_sim_command(hsd))
+  {
+    return HAL_ERROR;
+  }
+
+  if ((BlockEndAdd < BlockStartAdd) || (BlockEndAdd >= sd_sim_card.blocks))
+  {
+    hsd->ErrorCode |= HAL_SD_ERROR_ADDR_OUT_OF_RANGE;
+    return HAL_ERROR;
+  }
+
+  /* CMD32/33/38, the card erases in the background */
+  blocks = BlockEndAdd - BlockStartAdd + 1U;
+  memset(sd_sim_block(BlockStartAdd), 0, (size_t)blocks * SD_SIM_BLOCK_SIZE);
+  memset(&sd_sim_map[BlockStartAdd], 0, blocks);
+  sd_sim_stats.erase_commands++;
+  sd_sim_stats.erased_blocks += blocks;
+
+  group_blocks = (sd_sim_card.au_size != 0U) ? (16U << sd_sim_card.au_size) : 1U;
+  groups = (blocks + group_blocks - 1U) / group_blocks;
+  sd_sim_busy_until = sd_sim_time + (ULONG64)groups * sd_sim_card.erase_us;
+  return HAL_OK;
+}
+
+/* IDMA linked list, as the LL SDMMC driver builds it */
+HAL_StatusTypeDef HAL_SDEx_DMALinkedList_BuildNode(SD_DMALinkNodeTypeDef *pNode,
+                                                   SD_DMALinkNodeConfTypeDef *pNodeConf)
+{
+  pNode->IDMABASER = pNodeConf->BufferAddress;
+  pNode->IDMABSIZE = pNodeConf->BufferSize;
+  pNode->IDMALAR = SDMMC_IDMALAR_ULS | SDMMC_IDMALAR_ABR;
+  return HAL_OK;
+}
+
+/* The HAL reports HAL_OK whatever the LL driver answers, a refused node is
+   counted as a list error here */
+HAL_StatusTypeDef HAL_SDEx_DMALinkedList_InsertNode(SD_DMALinkedListTypeDef *pLinkedList,
+                                                    SD_DMALinkNodeTypeDef *pPrevNode,
+                                                    SD_DMALinkNodeTypeDef *pNewNode)
+{
+  uint32_t offset = (uint32_t)((uintptr_t)pNewNode - (uintptr_t)pLinkedList->pHeadNode);
+
+  if (pLinkedList->NodesCounter == 0U)
+  {
+    pLinkedList->pHeadNode = pNewNode;
+    pLinkedList->pTailNode = pNewNode;
+    pLinkedList->NodesCounter = 1U;
+  }
+  else if (pNewNode <= pLinkedList->pHeadNode)
+  {
+    sd_sim_stats.list_errors++;
+  }
+  else
+  {
+    if (pPrevNode != pLinkedList->pTailNode)
+    {
+      MODIFY_REG(pPrevNode->IDMALAR, SDMMC_IDMALAR_IDMALA, pNewNode->IDMALAR);
+    }
+    else
+    {
+      pLinkedList->pTailNode = pNewNode;
+    }
+    MODIFY_REG(pPrevNode->IDMALAR, SDMMC_IDMALAR_ULA, SDMMC_IDMALAR_ULA);
+    MODIFY_REG(pPrevNode->IDMALAR, SDMMC_IDMALAR_IDMALA, offset);
+    pLinkedList->NodesCounter++;
+  }
+
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SDEx_DMALinkedList_ReadBlocks(SD_HandleTypeDef *hsd, SD_DMALinkedListTypeDef *pLinkedList,
+                                                    uint32_t BlockAdd, uint32_t NumberOfBlocks)
+{
+  return sd_sim_start(hsd, UX_FALSE, UX_NULL, pLinkedList->pHeadNode, BlockAdd, NumberOfBlocks);
+}
+
+HAL_StatusTypeDef HAL_SDEx_DMALinkedList_WriteBlocks(SD_HandleTypeDef *hsd, SD_DMALinkedListTypeDef *pLinkedList,
+                                                     uint32_t BlockAdd, uint32_t NumberOfBlocks)
+{
+  return sd_sim_start(hsd, UX_TRUE, UX_NULL, pLinkedList->pHeadNode, BlockAdd, NumberOfBlocks);
+}
+
+/* SDMMC LL, the CMD6 switch function status read by polling ----------------*/
+static VOID sd_sim_fifo_flags(VOID)
+{
+  ULONG left = SD_SIM_STATUS_WORDS - sd_sim_fifo_index;
+  uint32_t sta = 0U;
+
+  if (left >= 8U)
+  {
+    sta |= SDMMC_FLAG_RXFIFOHF;
+  }
+  /* The block is in once its last half sits in the FIFO */
+  if (left <= 8U)
+  {
+    sta |= SDMMC_FLAG_DATAEND | SDMMC_FLAG_DBCKEND;
+  }
+  if (left == 0U)
+  {
+    sta |= SDMMC_FLAG_RXFIFOE;
+  }
+  *(volatile uint32_t *)&sd_sim_regs.STA = sta;
+}
+
+uint32_t SDMMC_CmdBlockLength(SDMMC_TypeDef *SDMMCx, uint32_t BlockSize)
+{
+  (void)SDMMCx;
+  (void)BlockSize;
+  return (sd_sim_present && sd_sim_identified) ? SDMMC_ERROR_NONE : SDMMC_ERROR_CMD_RSP_TIMEOUT;
+}
+
+HAL_StatusTypeDef SDMMC_ConfigData(SDMMC_TypeDef *SDMMCx, SDMMC_DataInitTypeDef *Data)
+{
+  SDMMCx->DLEN = Data->DataLength;
+  return HAL_OK;
+}
+
+uint32_t SDMMC_CmdSwitch(SDMMC_TypeDef *SDMMCx, uint32_t Argument)
+{
+  UCHAR status[SD_SIM_STATUS_WORDS * 4U];
+
+  (void)SDMMCx;
+  if (!sd_sim_present || !sd_sim_identified)
+  {
+    return SDMMC_ERROR_CMD_RSP_TIMEOUT;
+  }
+  sd_sim_stats.switch_commands++;
+
+  if (sd_sim_card.switch_status != UX_NULL)
+  {
+    memcpy(status, sd_sim_card.switch_status, sizeof(status));
+  }
+  else
+  {
+    /* Version 1 structure: 100 mA, group 1 offers default and maybe high
+       speed, the function a mode 0 query of 'Argument' would select */
+    memset(status, 0, sizeof(status));
+    status[1] = 100U;
+    status[13] = sd_sim_card.high_speed ? 0x03U : 0x01U;
+    status[16] = ((Argument & 0x0FU) == 0x01U) ? (sd_sim_card.high_speed ? 0x01U : 0x0FU) :
+                 (UCHAR)(Argument & 0x0FU);
+    status[17] = 1U;
+  }
+
+  /* Bytes in the order the card sends them */
+  memcpy(sd_sim_fifo, status, sizeof(status));
+  sd_sim_fifo_index = 0U;
+  sd_sim_fifo_flags();
+  return SDMMC_ERROR_NONE;
+}
+
+uint32_t SDMMC_ReadFIFO(const SDMMC_TypeDef *SDMMCx)
+{
+  uint32_t word = 0U;
+
+  (void)SDMMCx;
+  if (sd_sim_fifo_index < SD_SIM_STATUS_WORDS)
+  {
+    word = sd_sim_fifo[sd_sim_fifo_index++];
+  }
+  sd_sim_fifo_flags();
+  return word;
+}
@@ -0,0 +1,98 @@
+/**
+  ******************************************************************************
+  * @file    sd_sim.h
+  * @brief   Simulated SD card under msc_media_sd.c, for the host tests
+  ******************************************************************************
+  * sd_sim.c stands in for the SDMMC1 HAL calls the SD media makes. The card
+  * content is kept in RAM, time is simulated: a DMA transfer started by the
+  * media ends once sd_sim_advance() moved time past its duration, through
+  * the same completion callbacks the SDMMC interrupt calls on the board.
+  * The card stays busy programming after writes and erases, transfers can
+  * be made to fail and the card can be pulled out at any time.
+  ******************************************************************************
+  */
+#ifndef SD_SIM_H
+#define SD_SIM_H
+
+#include "msc_media.h"
+#include "main.h"
+#include "sdmmc.h"
+
+/* SDMMC kernel clock of the board, PLL2R */
+#define SD_SIM_KERNEL_CLOCK     100000000U
+
+/* sd_sim_fail() error: the transfer never ends, the media has to time out */
+#define SD_SIM_STALL            0xFFFFFFFFU
+
+typedef struct
+{
+  ULONG blocks;             /* capacity, in 512 bytes blocks */
+  UINT  high_speed;         /* CMD6 offers high speed */
+  const UCHAR *switch_status; /* CMD6 status, NULL for one built from high_speed */
+  ULONG max_clock;          /* data CRC errors above this bus clock, 0 for none */
+  UCHAR au_size;            /* AU_SIZE code of the SD status */
+  ULONG access_us;          /* before the first block of a transfer */
+  ULONG program_us;         /* busy after a write command */
+  ULONG erase_us;           /* busy per erased group */
+  ULONG identify_us;        /* power up to the end of ACMD41 busy */
+} SD_SimCardTypeDef;
+
+typedef struct
+{
+  ULONG read_commands;      /* CMD17/18 */
+  ULONG write_commands;     /* CMD24/25 */
+  ULONG blocks_read;
+  ULONG blocks_written;
+  ULONG status_polls;       /* CMD13 */
+  ULONG erase_commands;     /* CMD38 */
+  ULONG erased_blocks;
+  ULONG switch_commands;    /* CMD6 */
+  ULONG identifications;    /* power ups */
+  ULONG op_conds;           /* ACMD41 */
+  ULONG aborts;             /* CMD12 on an abort */
+  ULONG linked_lists;       /* transfers run from an IDMA linked list */
+  ULONG linked_nodes;       /* nodes those transfers went through */
+  ULONG list_errors;        /* lists the IDMA could not run as the HAL built them */
+  ULONG busy_violations;    /* data commands sent while the card was programming */
+} SD_SimStatsTypeDef;
+
+/* Time in us, HAL_GetTick() returns it in ms */
+extern ULONG64 sd_sim_time;
+extern SD_SimStatsTypeDef sd_sim_stats;
+
+/* A card of 'blocks' blocks with the typical timings of a class 10 card */
+VOID sd_sim_card_default(SD_SimCardTypeDef *card, ULONG blocks);
+
+/* Insert a card, all its blocks erased, or pull it out. Both move the
+   detect switch and call the EXTI callback of the media. */
+VOID sd_sim_insert(const SD_SimCardTypeDef *card);
+VOID sd_sim_remove(VOID);
+
+/* Move time on, ending the transfers and the busy periods due meanwhile */
+VOID sd_sim_advance(ULONG us);
+
+/* UX_TRUE while a DMA transfer is in progress */
+UINT sd_sim_dma_busy(VOID);
+
+/* The next 'count' data transfers end with 'error_code', a HAL_SD_ERROR_xxx
+   or SD_SIM_STALL */
+VOID sd_sim_fail(ULONG error_code, ULONG count);
+
+/* The card stays busy programming for 'us' more */
+VOID sd_sim_hold_busy(ULONG us);
+
+/* Card content, and whether a block holds data or was erased */
+UCHAR *sd_sim_block(ULONG lba);
+UINT sd_sim_mapped(ULONG lba);
+
+/* Bus clock and mode the media set up */
+ULONG sd_sim_clock(VOID);
+UINT sd_sim_high_speed(VOID);
+
+/* The IDMA running the linked list from 'head' over 'length' bytes of the
+   card at 'card', into the node buffers or out of them for a write, 'card'
+   NULL to only walk the list. Returns the number of nodes used, 0 when the
+   IDMA would stop with a transfer error. */
+ULONG sd_sim_idma_list(SD_DMALinkNodeTypeDef *head, ULONG length, UCHAR *card, UINT write);
+
+#endif /* SD_SIM_H */
@@ -0,0 +1,508 @@
+/**
+  ******************************************************************************
+  * @file    test_audio_class.c
+  * @brief   Host checks of the audio class entry and its clock source
+  ******************************************************************************
+  * ux_device_audio.c is driven through ux_device_class_audio_entry as the
+  * device stack does: class requests on the control endpoint, alternate
+  * settings activated and deactivated on the streaming interfaces. The SAI
+  * driver is a stub that records the calls it gets.
+  * The clock source answers CUR, RANGE and VALID, and refuses a rate it
+  * does not offer or that the active streaming formats cannot carry.
+  * Playback and record start and stop on their own: the host closing one
+  * direction, or changing its format, leaves the other one streaming.
+  ******************************************************************************
+  */
+#include "ux_device_audio.h"
+#include "audio_sai_slave.h"
+#include "test.h"
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define TEST_REQUEST_IN     0xA1U       /* class, interface, device to host */
+#define TEST_REQUEST_OUT    0x21U
+
+#define CLASS_STR(x)        #x
+#define CLASS_XSTR(x)       CLASS_STR(x)
+
+static const uint32_t test_frequencies[AUDIO_FREQUENCY_COUNT] = AUDIO_FREQUENCIES;
+
+/* Stubs of the SAI driver --------------------------------------------------*/
+Audio_RingTypeDef Audio_RX_Ring;
+Audio_RingTypeDef Audio_TX_Ring;
+static uint32_t test_rx_buffer[AUDIO_BUFFER_FRAMES * AUDIO_CHANNELS];
+static uint32_t test_tx_buffer[AUDIO_BUFFER_FRAMES * AUDIO_CHANNELS];
+
+/* Calls to the driver */
+typedef struct
+{
+  uint32_t start_rx;
+  uint32_t stop_rx;
+  uint32_t start_tx;
+  uint32_t stop_tx;
+  uint32_t set_frequency;
+  uint32_t frequency;
+} TEST_SAITypeDef;
+
+static TEST_SAITypeDef test_sai;
+
+static void test_rings(uint32_t frequency)
+{
+  uint32_t frames = AUDIO_RING_FRAMES(frequency);
+
+  Audio_Ring_Init(&Audio_RX_Ring, test_rx_buffer, frames, AUDIO_CHANNELS, 0U, AUDIO_RX_LEAD(frames));
+  Audio_Ring_Init(&Audio_TX_Ring, test_tx_buffer, frames, AUDIO_CHANNELS, 1U, AUDIO_TX_LEAD(frames));
+}
+
+void Audio_SAI_Init(void)
+{
+  test_sai.frequency = AUDIO_FREQUENCY;
+  test_rings(AUDIO_FREQUENCY);
+}
+
+void Audio_SAI_Start_RX(void) { test_sai.start_rx++; }
+void Audio_SAI_Stop_RX(void) { test_sai.stop_rx++; }
+void Audio_SAI_Start_TX(void) { test_sai.start_tx++; }
+void Audio_SAI_Stop_TX(void) { test_sai.stop_tx++; }
+
+void Audio_SAI_SetFrequency(uint32_t frequency)
+{
+  test_sai.set_frequency++;
+  test_sai.frequency = frequency;
+  test_rings(frequency);
+}
+
+void Audio_SAI_GetErrors(Audio_SAI_ErrorsTypeDef *errors)
+{
+  memset(errors, 0, sizeof(*errors));
+}
+
+uint32_t Audio_SAI_Get_TX_Head(void)
+{
+  return 0U;
+}
+
+uint32_t Audio_SAI_Get_RX_Head(void)
+{
+  return 0U;
+}
+
+/* Stubs of the USBX device stack: a transfer request only records its
+   length, the data stays in the buffer of the transfer. Every transfer
+   run ends with test_run_status. */
+static UX_SYSTEM_SLAVE test_system;
+UX_SYSTEM_SLAVE *_ux_system_slave = &test_system;
+
+static UX_SLAVE_TRANSFER *test_transfer;
+static ULONG test_length;
+static UINT test_run_status = UX_STATE_WAIT;
+
+/* Transfers armed on each streaming endpoint */
+typedef struct
+{
+  ULONG iso_out;
+  ULONG feedback;
+  ULONG iso_in;
+} TEST_ArmedTypeDef;
+
+static TEST_ArmedTypeDef test_armed;
+
+static UX_SLAVE_ENDPOINT test_iso_out;
+static UX_SLAVE_ENDPOINT test_feedback;
+static UX_SLAVE_ENDPOINT test_iso_in;
+
+UINT _ux_device_stack_transfer_request(UX_SLAVE_TRANSFER *transfer_request,
+                                       ULONG slave_length, ULONG host_length)
+{
+  (void)host_length;
+  test_transfer = transfer_request;
+  test_length = slave_length;
+  test_armed.iso_out += (transfer_request == &test_iso_out.ux_slave_endpoint_transfer_request) ? 1U : 0U;
+  test_armed.feedback += (transfer_request == &test_feedback.ux_slave_endpoint_transfer_request) ? 1U : 0U;
+  test_armed.iso_in += (transfer_request == &test_iso_in.ux_slave_endpoint_transfer_request) ? 1U : 0U;
+  return UX_SUCCESS;
+}
+
+UINT _ux_device_stack_transfer_run(UX_SLAVE_TRANSFER *transfer_request,
+                                   ULONG slave_length, ULONG host_length)
+{
+  (void)transfer_request;
+  (void)slave_length;
+  (void)host_length;
+  return test_run_status;
+}
+
+ALIGN_TYPE _ux_utility_interrupt_disable(VOID)
+{
+  return 0U;
+}
+
+VOID _ux_utility_interrupt_restore(ALIGN_TYPE flags)
+{
+  (void)flags;
+}
+
+/* Device stack -------------------------------------------------------------*/
+static UCHAR test_data[UX_SLAVE_REQUEST_CONTROL_MAX_LENGTH];
+
+/* Streaming interfaces: playback with its data and feedback endpoints,
+   record with its data endpoint */
+static UX_SLAVE_INTERFACE test_stream_out;
+static UX_SLAVE_INTERFACE test_stream_in;
+static UX_SLAVE_INTERFACE test_control;
+
+static UINT test_command(ULONG request, UX_SLAVE_INTERFACE *interface)
+{
+  UX_SLAVE_CLASS_COMMAND command;
+
+  memset(&command, 0, sizeof(command));
+  command.ux_slave_class_command_request = request;
+  command.ux_slave_class_command_interface = interface;
+  return ux_device_class_audio_entry(&command);
+}
+
+/* The host selects 'alternate' on a streaming interface, 0 stops it */
+static UINT test_alternate(UX_SLAVE_INTERFACE *interface, UCHAR alternate)
+{
+  (void)test_command(UX_SLAVE_CLASS_COMMAND_DEACTIVATE, interface);
+  interface->ux_slave_interface_descriptor.bAlternateSetting = alternate;
+  if (alternate == 0U)
+  {
+    return UX_SUCCESS;
+  }
+  return test_command(UX_SLAVE_CLASS_COMMAND_ACTIVATE, interface);
+}
+
+/* A class request to the control interface. IN: the bytes the device sent
+   in test_length. OUT: the 'length' bytes of test_data as data stage. */
+static UINT test_request(UCHAR type, UCHAR request, UCHAR control, UCHAR entity, ULONG length)
+{
+  UX_SLAVE_TRANSFER *transfer =
+      &_ux_system_slave->ux_system_slave_device.ux_slave_device_control_endpoint.ux_slave_endpoint_transfer_request;
+  UCHAR *setup = transfer->ux_slave_transfer_request_setup;
+
+  setup[UX_SETUP_REQUEST_TYPE] = type;
+  setup[UX_SETUP_REQUEST] = request;
+  _ux_utility_short_put(setup + UX_SETUP_VALUE, (USHORT)(control << 8));
+  _ux_utility_short_put(setup + UX_SETUP_INDEX, (USHORT)(entity << 8));
+  _ux_utility_short_put(setup + UX_SETUP_LENGTH, (USHORT)length);
+  transfer->ux_slave_transfer_request_data_pointer = test_data;
+  transfer->ux_slave_transfer_request_actual_length = (type & UX_REQUEST_IN) ? 0U : length;
+  test_transfer = UX_NULL;
+  test_length = 0U;
+  return test_command(UX_SLAVE_CLASS_COMMAND_REQUEST, UX_NULL);
+}
+
+/* The rate of the clock source, as the host reads it */
+static ULONG test_get_frequency(void)
+{
+  memset(test_data, 0, sizeof(test_data));
+  CHECK_EQ(test_request(TEST_REQUEST_IN, UX_DEVICE_CLASS_AUDIO_REQUEST_CUR,
+                        UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL,
+                        UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID, 4U), UX_SUCCESS);
+  CHECK_EQ(test_length, 4U);
+  return _ux_utility_long_get(test_data);
+}
+
+static UINT test_set_frequency(ULONG frequency)
+{
+  _ux_utility_long_put(test_data, frequency);
+  return test_request(TEST_REQUEST_OUT, UX_DEVICE_CLASS_AUDIO_REQUEST_CUR,
+                      UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL,
+                      UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID, 4U);
+}
+
+static void test_stream_init(UX_SLAVE_INTERFACE *interface, UX_SLAVE_ENDPOINT *data,
+                             UCHAR address, UX_SLAVE_ENDPOINT *feedback)
+{
+  interface->ux_slave_interface_descriptor.bInterfaceClass = 0x01U;
+  interface->ux_slave_interface_descriptor.bInterfaceSubClass = 0x02U;
+  interface->ux_slave_interface_first_endpoint = data;
+  data->ux_slave_endpoint_descriptor.bEndpointAddress = address;
+  data->ux_slave_endpoint_next_endpoint = feedback;
+}
+
+/* Clock source reads ------------------------------------------------------*/
+static void test_clock_get(void)
+{
+  ULONG i;
+
+  CHECK_EQ(test_get_frequency(), AUDIO_FREQUENCY);
+
+  /* RANGE: the host reads wNumSubRanges first, then the whole block */
+  CHECK_EQ(test_request(TEST_REQUEST_IN, UX_DEVICE_CLASS_AUDIO_REQUEST_RANGE,
+                        UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL,
+                        UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID, 2U), UX_SUCCESS);
+  CHECK_EQ(test_length, 2U);
+  CHECK_EQ(_ux_utility_short_get(test_data), AUDIO_FREQUENCY_COUNT);
+
+  memset(test_data, 0xFF, sizeof(test_data));
+  CHECK_EQ(test_request(TEST_REQUEST_IN, UX_DEVICE_CLASS_AUDIO_REQUEST_RANGE,
+                        UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL,
+                        UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID, 256U), UX_SUCCESS);
+  CHECK_EQ(test_length, 2U + AUDIO_FREQUENCY_COUNT * 12U);
+  CHECK_EQ(_ux_utility_short_get(test_data), AUDIO_FREQUENCY_COUNT);
+  for (i = 0U; i < AUDIO_FREQUENCY_COUNT; i++)
+  {
+    /* Discrete rates: dMIN = dMAX, dRES = 0, in increasing order */
+    CHECK_EQ(_ux_utility_long_get(test_data + 2U + i * 12U), test_frequencies[i]);
+    CHECK_EQ(_ux_utility_long_get(test_data + 2U + i * 12U + 4U), test_frequencies[i]);
+    CHECK_EQ(_ux_utility_long_get(test_data + 2U + i * 12U + 8U), 0U);
+    if (i > 0U)
+    {
+      CHECK(test_frequencies[i] > test_frequencies[i - 1U]);
+    }
+  }
+
+  /* VALID: one byte, always valid */
+  test_data[0] = 0U;
+  CHECK_EQ(test_request(TEST_REQUEST_IN, UX_DEVICE_CLASS_AUDIO_REQUEST_CUR,
+                        UX_DEVICE_CLASS_AUDIO_CS_CLOCK_VALID_CONTROL,
+                        UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID, 1U), UX_SUCCESS);
+  CHECK_EQ(test_length, 1U);
+  CHECK_EQ(test_data[0], 1U);
+
+  /* Not implemented: RANGE of VALID, another control, another entity.
+     The error stalls EP0, nothing is sent. */
+  CHECK_EQ(test_request(TEST_REQUEST_IN, UX_DEVICE_CLASS_AUDIO_REQUEST_RANGE,
+                        UX_DEVICE_CLASS_AUDIO_CS_CLOCK_VALID_CONTROL,
+                        UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID, 2U), UX_ERROR);
+  CHECK_EQ(test_request(TEST_REQUEST_IN, UX_DEVICE_CLASS_AUDIO_REQUEST_CUR, 0x03U,
+                        UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID, 1U), UX_ERROR);
+  CHECK_EQ(test_request(TEST_REQUEST_IN, UX_DEVICE_CLASS_AUDIO_REQUEST_CUR,
+                        UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL, 0x09U, 4U), UX_ERROR);
+  CHECK(test_transfer == UX_NULL);
+}
+
+/* Clock source writes -----------------------------------------------------*/
+static void test_clock_set(void)
+{
+  Audio_StatsTypeDef stats;
+  ULONG i;
+
+  /* Rates the clock source does not offer leave everything as it is */
+  CHECK_EQ(test_set_frequency(32000U), UX_ERROR);
+  CHECK_EQ(test_set_frequency(48001U), UX_ERROR);
+  CHECK_EQ(test_set_frequency(0U), UX_ERROR);
+  CHECK_EQ(test_set_frequency(AUDIO_FREQUENCY_MAX * 2U), UX_ERROR);
+  CHECK_EQ(test_sai.set_frequency, 0U);
+  CHECK_EQ(test_get_frequency(), AUDIO_FREQUENCY);
+
+  /* dCUR is four bytes */
+  _ux_utility_long_put(test_data, 44100U);
+  CHECK_EQ(test_request(TEST_REQUEST_OUT, UX_DEVICE_CLASS_AUDIO_REQUEST_CUR,
+                        UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL,
+                        UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID, 3U), UX_ERROR);
+  CHECK_EQ(test_sai.set_frequency, 0U);
+
+  /* Each offered rate reaches the SAI, the feedback restarts from its nominal */
+  for (i = 0U; i < AUDIO_FREQUENCY_COUNT; i++)
+  {
+    ULONG calls = test_sai.set_frequency;
+
+    CHECK_EQ(test_set_frequency(test_frequencies[i]), UX_SUCCESS);
+    CHECK_EQ(test_get_frequency(), test_frequencies[i]);
+    if (test_frequencies[i] != AUDIO_FREQUENCY)
+    {
+      CHECK_EQ(test_sai.set_frequency, calls + 1U);
+      CHECK_EQ(test_sai.frequency, test_frequencies[i]);
+    }
+    Audio_GetStats(&stats);
+    CHECK_EQ(stats.feedback, AUDIO_FB_NOMINAL(test_sai.frequency));
+  }
+
+  /* The same rate again does not restart the SAI */
+  i = test_sai.set_frequency;
+  CHECK_EQ(test_set_frequency(test_sai.frequency), UX_SUCCESS);
+  CHECK_EQ(test_sai.set_frequency, i);
+
+  CHECK_EQ(test_set_frequency(AUDIO_FREQUENCY), UX_SUCCESS);
+}
+
+/* Rates and formats -------------------------------------------------------*/
+static void test_clock_formats(void)
+{
+  ULONG i;
+
+  /* Stereo formats are sized for the highest rate: every rate is taken
+     while both directions stream, in every stereo format */
+  for (i = AUDIO_ALT_STEREO_24; i <= AUDIO_ALT_STEREO_32; i++)
+  {
+    ULONG j;
+
+    CHECK_EQ(test_alternate(&test_stream_out, (UCHAR)i), UX_SUCCESS);
+    CHECK_EQ(test_alternate(&test_stream_in, (UCHAR)i), UX_SUCCESS);
+    for (j = 0U; j < AUDIO_FREQUENCY_COUNT; j++)
+    {
+      CHECK_EQ(test_set_frequency(test_frequencies[j]), UX_SUCCESS);
+      CHECK_EQ(test_get_frequency(), test_frequencies[j]);
+    }
+    CHECK_EQ(test_set_frequency(AUDIO_FREQUENCY), UX_SUCCESS);
+  }
+  CHECK_EQ(test_alternate(&test_stream_out, 0U), UX_SUCCESS);
+  CHECK_EQ(test_alternate(&test_stream_in, 0U), UX_SUCCESS);
+
+#if AUDIO_CHANNELS > 2
+  for (i = 0U; i < AUDIO_FREQUENCY_COUNT; i++)
+  {
+    ULONG frequency = test_frequencies[i];
+    UINT fits = (USB_AUDIO_EP_SIZE_FOR(frequency, AUDIO_CHANNELS, 2U) <= USB_AUDIO_EP_SIZE_TDM_16);
+    ULONG calls;
+
+    /* The TDM format at 48 kHz on one direction, then the host asks for
+       another rate: refused when a packet cannot carry it */
+    CHECK_EQ(test_set_frequency(AUDIO_FREQUENCY), UX_SUCCESS);
+    CHECK_EQ(test_alternate(&test_stream_in, AUDIO_ALT_TDM_16), UX_SUCCESS);
+    calls = test_sai.set_frequency;
+    CHECK_EQ(test_set_frequency(frequency), fits ? UX_SUCCESS : UX_ERROR);
+    CHECK_EQ(test_get_frequency(), fits ? frequency : AUDIO_FREQUENCY);
+    if (!fits)
+    {
+      CHECK_EQ(test_sai.set_frequency, calls);
+    }
+    CHECK_EQ(test_alternate(&test_stream_in, 0U), UX_SUCCESS);
+
+    /* The same on the playback side, with record in stereo meanwhile */
+    CHECK_EQ(test_set_frequency(AUDIO_FREQUENCY), UX_SUCCESS);
+    CHECK_EQ(test_alternate(&test_stream_in, AUDIO_ALT_STEREO_16), UX_SUCCESS);
+    CHECK_EQ(test_alternate(&test_stream_out, AUDIO_ALT_TDM_16), UX_SUCCESS);
+    CHECK_EQ(test_set_frequency(frequency), fits ? UX_SUCCESS : UX_ERROR);
+    CHECK_EQ(test_get_frequency(), fits ? frequency : AUDIO_FREQUENCY);
+    CHECK_EQ(test_alternate(&test_stream_out, 0U), UX_SUCCESS);
+    CHECK_EQ(test_alternate(&test_stream_in, 0U), UX_SUCCESS);
+
+    /* Once stopped the rate is free, the TDM format is then refused */
+    CHECK_EQ(test_set_frequency(frequency), UX_SUCCESS);
+    CHECK_EQ(test_alternate(&test_stream_out, AUDIO_ALT_TDM_16), fits ? UX_SUCCESS : UX_ERROR);
+    CHECK_EQ(test_alternate(&test_stream_in, AUDIO_ALT_TDM_16), fits ? UX_SUCCESS : UX_ERROR);
+    CHECK_EQ(test_alternate(&test_stream_out, 0U), UX_SUCCESS);
+    CHECK_EQ(test_alternate(&test_stream_in, 0U), UX_SUCCESS);
+  }
+  CHECK_EQ(test_set_frequency(AUDIO_FREQUENCY), UX_SUCCESS);
+#endif
+}
+
+/* Directions ---------------------------------------------------------------*/
+/* 'frames' USB frames in which every streaming transfer completes: the
+   packets each direction moved, and the transfers armed again */
+static void test_frames(ULONG frames, ULONG *out_packets, ULONG *in_packets, TEST_ArmedTypeDef *armed)
+{
+  Audio_StatsTypeDef before;
+  Audio_StatsTypeDef after;
+
+  Audio_GetStats(&before);
+  memset(&test_armed, 0, sizeof(test_armed));
+  test_run_status = UX_STATE_NEXT;
+  while (frames--)
+  {
+    Audio_Process();
+  }
+  test_run_status = UX_STATE_WAIT;
+  Audio_GetStats(&after);
+  *out_packets = after.out_packets - before.out_packets;
+  *in_packets = after.in_packets - before.in_packets;
+  *armed = test_armed;
+}
+
+/* Both directions stream, either stopped or restarted in another format:
+   the SAI block and the endpoints of the other one are not touched */
+static void test_directions(void)
+{
+  TEST_SAITypeDef sai;
+  TEST_ArmedTypeDef armed;
+  ULONG out_packets;
+  ULONG in_packets;
+
+  CHECK_EQ(test_command(UX_SLAVE_CLASS_COMMAND_ACTIVATE, &test_control), UX_SUCCESS);
+  sai = test_sai;
+  CHECK_EQ(test_alternate(&test_stream_out, AUDIO_ALT_STEREO_24), UX_SUCCESS);
+  CHECK_EQ(test_alternate(&test_stream_in, AUDIO_ALT_STEREO_24), UX_SUCCESS);
+  CHECK_EQ(test_sai.start_tx - sai.start_tx, 1U);
+  CHECK_EQ(test_sai.start_rx - sai.start_rx, 1U);
+  test_frames(10U, &out_packets, &in_packets, &armed);
+  CHECK_EQ(out_packets, 10U);
+  CHECK_EQ(in_packets, 10U);
+  CHECK_EQ(armed.iso_out, 10U);
+  CHECK_EQ(armed.feedback, 10U);
+  CHECK_EQ(armed.iso_in, 10U);
+
+  /* Playback stopped: only its block stops, record goes on */
+  sai = test_sai;
+  CHECK_EQ(test_alternate(&test_stream_out, 0U), UX_SUCCESS);
+  CHECK_EQ(test_sai.stop_tx - sai.stop_tx, 1U);
+  CHECK_EQ(test_sai.stop_rx, sai.stop_rx);
+  test_frames(10U, &out_packets, &in_packets, &armed);
+  CHECK_EQ(out_packets, 0U);
+  CHECK_EQ(in_packets, 10U);
+  CHECK_EQ(armed.iso_out + armed.feedback, 0U);
+  CHECK_EQ(armed.iso_in, 10U);
+
+  /* Closed again, or the control interface reset: nothing more stops */
+  CHECK_EQ(test_command(UX_SLAVE_CLASS_COMMAND_DEACTIVATE, &test_stream_out), UX_SUCCESS);
+  CHECK_EQ(test_command(UX_SLAVE_CLASS_COMMAND_DEACTIVATE, &test_control), UX_SUCCESS);
+  CHECK_EQ(test_sai.stop_tx - sai.stop_tx, 1U);
+  CHECK_EQ(test_sai.stop_rx, sai.stop_rx);
+
+  /* Playback back in 16 bits, record is not restarted */
+  sai = test_sai;
+  CHECK_EQ(test_alternate(&test_stream_out, AUDIO_ALT_STEREO_16), UX_SUCCESS);
+  CHECK_EQ(test_sai.start_tx - sai.start_tx, 1U);
+  CHECK_EQ(test_sai.start_rx, sai.start_rx);
+  test_frames(10U, &out_packets, &in_packets, &armed);
+  CHECK_EQ(out_packets, 10U);
+  CHECK_EQ(in_packets, 10U);
+
+  /* Record switched to 32 bits then stopped, playback goes on */
+  sai = test_sai;
+  CHECK_EQ(test_alternate(&test_stream_in, AUDIO_ALT_STEREO_32), UX_SUCCESS);
+  CHECK_EQ(test_sai.stop_rx - sai.stop_rx, 1U);
+  CHECK_EQ(test_sai.start_rx - sai.start_rx, 1U);
+  CHECK_EQ(test_alternate(&test_stream_in, 0U), UX_SUCCESS);
+  CHECK_EQ(test_sai.stop_rx - sai.stop_rx, 2U);
+  CHECK_EQ(test_sai.stop_tx, sai.stop_tx);
+  CHECK_EQ(test_sai.start_tx, sai.start_tx);
+  test_frames(10U, &out_packets, &in_packets, &armed);
+  CHECK_EQ(out_packets, 10U);
+  CHECK_EQ(in_packets, 0U);
+  CHECK_EQ(armed.iso_out, 10U);
+  CHECK_EQ(armed.feedback, 10U);
+  CHECK_EQ(armed.iso_in, 0U);
+
+  /* A format refused on record leaves it stopped, playback untouched */
+#if AUDIO_CHANNELS > 4
+  CHECK_EQ(test_set_frequency(AUDIO_FREQUENCY_MAX), UX_SUCCESS);
+  sai = test_sai;
+  CHECK_EQ(test_alternate(&test_stream_in, AUDIO_ALT_TDM_16), UX_ERROR);
+  CHECK_EQ(test_sai.start_rx, sai.start_rx);
+  test_frames(10U, &out_packets, &in_packets, &armed);
+  CHECK_EQ(out_packets, 10U);
+  CHECK_EQ(in_packets, 0U);
+#endif
+
+  /* Both stopped */
+  sai = test_sai;
+  CHECK_EQ(test_alternate(&test_stream_out, 0U), UX_SUCCESS);
+  CHECK_EQ(test_sai.stop_tx - sai.stop_tx, 1U);
+  CHECK_EQ(test_sai.stop_rx, sai.stop_rx);
+  test_frames(10U, &out_packets, &in_packets, &armed);
+  CHECK_EQ(out_packets + in_packets, 0U);
+  CHECK_EQ(armed.iso_out + armed.feedback + armed.iso_in, 0U);
+}
+
+int main(void)
+{
+  CHECK_EQ(test_command(UX_SLAVE_CLASS_COMMAND_INITIALIZE, UX_NULL), UX_SUCCESS);
+  test_stream_init(&test_stream_out, &test_iso_out, 0x01U, &test_feedback);
+  test_stream_init(&test_stream_in, &test_iso_in, 0x82U, UX_NULL);
+  test_feedback.ux_slave_endpoint_descriptor.bEndpointAddress = 0x81U;
+  test_control.ux_slave_interface_descriptor.bInterfaceClass = 0x01U;
+  test_control.ux_slave_interface_descriptor.bInterfaceSubClass = 0x01U;
+
+  test_clock_get();
+  test_clock_set();
+  test_clock_formats();
+  test_directions();
+
+  return test_report("test_audio_class, " CLASS_XSTR(AUDIO_CHANNELS) " slots");
+}
@@ -0,0 +1,234 @@
+/**
+  ******************************************************************************
+  * @file    test_audio_descriptors.c
+  * @brief   Host checks of the device framework and the packet memory layout
+  ******************************************************************************
+  * The framework USBX is given is walked as a host would parse it: lengths,
+  * interfaces, alternate settings and endpoints, and the packet size of each
+  * audio format against its channel count and sample size. The Makefile
+  * also builds this test for 4 and 8 SAI slots.
+  ******************************************************************************
+  */
+#include "ux_device_descriptors.h"
+#include "audio_config.h"
+#include "test.h"
+
+TEST_MAIN_DEFINE
+
+#define DESC_STR(x)         #x
+#define DESC_XSTR(x)        DESC_STR(x)
+
+#define DESC_DEVICE         0x01U
+#define DESC_CONFIGURATION  0x02U
+#define DESC_INTERFACE      0x04U
+#define DESC_ENDPOINT       0x05U
+#define DESC_IAD            0x0BU
+#define DESC_CS_INTERFACE   0x24U
+
+/* Owner interface of each endpoint address, 0xFF when unused */
+static uint8_t ep_owner[256];
+
+static uint32_t desc_word(const uint8_t *desc)
+{
+  return (uint32_t)desc[0] | ((uint32_t)desc[1] << 8);
+}
+
+static void test_device(const uint8_t *device)
+{
+  CHECK_EQ(device[0], 18U);
+  CHECK_EQ(device[1], DESC_DEVICE);
+  CHECK_EQ(device[7], USBD_MAX_EP0_SIZE);
+  CHECK_EQ(device[17], 1U);
+}
+
+static void test_configuration(const uint8_t *config, uint32_t length)
+{
+  uint32_t interfaces = 0U;
+  uint32_t alternates[8] = { 0U };
+  uint32_t endpoints_left = 0U;
+  const uint8_t *interface = NULL;
+  const uint8_t *ac_header = NULL;
+  uint32_t ac_length = 0U;
+  uint32_t channels = 0U;
+  uint32_t subslot = 0U;
+  uint32_t at = 0U;
+
+  CHECK_EQ(config[0], 9U);
+  CHECK_EQ(config[1], DESC_CONFIGURATION);
+  CHECK_EQ(desc_word(&config[2]), length);
+  CHECK_EQ(config[4], 4U);
+
+  for (uint32_t i = 0U; i < sizeof(ep_owner); i++)
+  {
+    ep_owner[i] = 0xFFU;
+  }
+
+  while (at < length)
+  {
+    const uint8_t *desc = &config[at];
+
+    /* Each descriptor lies within wTotalLength */
+    CHECK(desc[0] >= 2U);
+    CHECK(at + desc[0] <= length);
+    if ((desc[0] < 2U) || (at + desc[0] > length))
+    {
+      return;
+    }
+
+    switch (desc[1])
+    {
+      case DESC_INTERFACE:
+        /* The previous interface declared all its endpoints */
+        CHECK_EQ(endpoints_left, 0U);
+        CHECK(desc[2] < 8U);
+        if (desc[3] == 0U)
+        {
+          interfaces++;
+          CHECK_EQ(alternates[desc[2] & 7U], 0U);
+        }
+        else
+        {
+          /* Alternate settings in order */
+          CHECK_EQ(desc[3], alternates[desc[2] & 7U]);
+        }
+        alternates[desc[2] & 7U] = desc[3] + 1U;
+        interface = desc;
+        endpoints_left = desc[4];
+        ac_header = NULL;
+        break;
+
+      case DESC_CS_INTERFACE:
+        CHECK(interface != NULL);
+        if ((interface != NULL) && (interface[5] == 0x01U) && (interface[6] == 0x01U))
+        {
+          /* Audio control: the header counts the class descriptors */
+          if (desc[2] == 0x01U)
+          {
+            ac_header = desc;
+            ac_length = 0U;
+          }
+          ac_length += desc[0];
+          if (ac_header != NULL)
+          {
+            CHECK(ac_length <= desc_word(&ac_header[6]));
+          }
+        }
+        else if (desc[2] == 0x01U)
+        {
+          /* AS General */
+          channels = desc[10];
+        }
+        else if (desc[2] == 0x02U)
+        {
+          /* Format Type I */
+          subslot = desc[4];
+          CHECK((subslot == 2U) || (subslot == 3U) || (subslot == 4U));
+          CHECK_EQ(desc[5], (subslot == 2U) ? 16U : 24U);
+        }
+        break;
+
+      case DESC_ENDPOINT:
+      {
+        uint32_t size = desc_word(&desc[4]);
+
+        CHECK(interface != NULL);
+        CHECK(endpoints_left > 0U);
+        if ((interface == NULL) || (endpoints_left == 0U))
+        {
+          return;
+        }
+        endpoints_left--;
+
+        /* An address belongs to one interface, whatever the alternate */
+        CHECK((ep_owner[desc[2]] == 0xFFU) || (ep_owner[desc[2]] == interface[2]));
+        ep_owner[desc[2]] = interface[2];
+
+        if ((desc[3] & 0x03U) == USBD_EP_TYPE_ISOC)
+        {
+          if (desc[2] == USBD_AUDIO_EPFB_ADDR)
+          {
+            CHECK_EQ(size, USBD_AUDIO_EPFB_SIZE);
+          }
+          else
+          {
+            uint32_t frequency = (interface[3] == AUDIO_ALT_TDM_16) ? AUDIO_TDM_FREQUENCY_MAX
+                                                                      : AUDIO_FREQUENCY_MAX;
+
+            CHECK_EQ(size, USB_AUDIO_EP_SIZE_FOR(frequency, channels, subslot));
+            CHECK(size <= USBD_PMA_AUDIO_SIZE);
+            CHECK(size <= USB_AUDIO_EP_SIZE_MAX);
+          }
+        }
+        else
+        {
+          CHECK_EQ(desc[3] & 0x03U, USBD_EP_TYPE_BULK);
+          CHECK_EQ(size, USBD_MSC_EPIN_FS_MPS);
+        }
+        break;
+      }
+
+      case DESC_CONFIGURATION:
+        CHECK_EQ(at, 0U);
+        break;
+
+      case DESC_IAD:
+        CHECK_EQ(desc[2], 0U);
+        CHECK_EQ(desc[3], 3U);
+        break;
+
+      default:
+        /* Class specific endpoint descriptors */
+        CHECK_EQ(desc[1], 0x25U);
+        break;
+    }
+
+    /* The audio control class descriptors end where the header says */
+    if ((ac_header != NULL) && (ac_length == desc_word(&ac_header[6])))
+    {
+      ac_header = NULL;
+    }
+
+    at += desc[0];
+  }
+
+  CHECK_EQ(at, length);
+  CHECK_EQ(endpoints_left, 0U);
+  CHECK(ac_header == NULL);
+  CHECK_EQ(interfaces, 4U);
+  /* Zero bandwidth and one alternate per format on both streams */
+  CHECK_EQ(alternates[1], AUDIO_ALT_COUNT + 1U);
+  CHECK_EQ(alternates[2], AUDIO_ALT_COUNT + 1U);
+  CHECK_EQ(ep_owner[USBD_MSC_EPOUT_ADDR], USBD_MSC_INTERFACE_NUMBER);
+  CHECK_EQ(ep_owner[USBD_MSC_EPIN_ADDR], USBD_MSC_INTERFACE_NUMBER);
+}
+
+static void test_packet_memory(void)
+{
+  static const uint32_t buffers[] =
+  {
+    USBD_PMA_EP0_OUT, USBD_PMA_EP0_IN, USBD_PMA_MSC_OUT, USBD_PMA_MSC_IN,
+    USBD_PMA_AUDIO_OUT, USBD_PMA_AUDIO_FB, USBD_PMA_AUDIO_IN, USBD_PMA_END
+  };
+
+  /* Word aligned buffers, one after the other, within the 2 KB */
+  for (uint32_t i = 0U; i < sizeof(buffers) / sizeof(buffers[0]); i++)
+  {
+    CHECK_EQ(buffers[i] % 4U, 0U);
+    CHECK((i == 0U) || (buffers[i] > buffers[i - 1U]));
+  }
+  CHECK(USBD_PMA_END <= USBD_PMA_SIZE);
+  CHECK(USBD_PMA_AUDIO_SIZE >= USB_AUDIO_EP_SIZE_LARGEST);
+}
+
+int main(void)
+{
+  ULONG length;
+  uint8_t *framework = USBD_Get_Device_Framework_Speed(0U, &length);
+
+  CHECK(length > 18U);
+  test_device(framework);
+  test_configuration(framework + 18U, length - 18U);
+  test_packet_memory();
+
+  return test_report("test_audio_descriptors, " DESC_XSTR(AUDIO_CHANNELS) " slots");
+}
@@ -0,0 +1,226 @@
+/**
+  ******************************************************************************
+  * @file    test_audio_feedback.c
+  * @brief   Host checks of the 16.16 feedback computation
+  ******************************************************************************
+  * ux_device_audio.c runs against a simulated SAI: its DMA position moves at
+  * a chosen rate, in 16.16 frames per ms, and a simulated host sends each
+  * 1 ms packet the frames the last feedback value asks for. The measured
+  * rate, the value sent and the TX ring level are checked once settled.
+  ******************************************************************************
+  */
+#include "ux_device_audio.h"
+#include "audio_sai_slave.h"
+#include "test.h"
+#include <stdlib.h>
+
+TEST_MAIN_DEFINE
+
+#define FB_RING_FRAMES      AUDIO_RING_FRAMES(AUDIO_FREQUENCY)
+#define FB_RING_LEAD        AUDIO_TX_LEAD(FB_RING_FRAMES)
+
+static uint32_t fb_buffer[FB_RING_FRAMES * AUDIO_CHANNELS];
+
+/* SAI DMA: position in 16.16 frames, the half/full events it went through */
+static uint64_t sai_position;
+static uint32_t sai_events;
+
+/* Host: 16.16 remainder of the frames asked by the feedback */
+static uint32_t host_remainder;
+
+/* Stubs of the SAI driver --------------------------------------------------*/
+Audio_RingTypeDef Audio_RX_Ring;
+Audio_RingTypeDef Audio_TX_Ring;
+
+void Audio_SAI_Init(void) {}
+void Audio_SAI_Start_RX(void) {}
+void Audio_SAI_Stop_RX(void) {}
+void Audio_SAI_Start_TX(void) {}
+void Audio_SAI_Stop_TX(void) {}
+void Audio_SAI_SetFrequency(uint32_t frequency) { (void)frequency; }
+
+void Audio_SAI_GetErrors(Audio_SAI_ErrorsTypeDef *errors)
+{
+  errors->rx_fifo = 0U;
+  errors->tx_fifo = 0U;
+  errors->sync = 0U;
+  errors->dma = 0U;
+}
+
+uint32_t Audio_SAI_Get_TX_Head(void)
+{
+  return (uint32_t)((sai_position >> 16) % FB_RING_FRAMES) * AUDIO_CHANNELS;
+}
+
+uint32_t Audio_SAI_Get_RX_Head(void)
+{
+  return 0U;
+}
+
+/* Stubs of the USBX device stack, not reached by the feedback path ---------*/
+UX_SYSTEM_SLAVE *_ux_system_slave;
+
+UINT _ux_device_stack_transfer_request(UX_SLAVE_TRANSFER *transfer_request,
+                                       ULONG slave_length, ULONG host_length)
+{
+  (void)transfer_request;
+  (void)slave_length;
+  (void)host_length;
+  return UX_SUCCESS;
+}
+
+UINT _ux_device_stack_transfer_run(UX_SLAVE_TRANSFER *transfer_request,
+                                   ULONG slave_length, ULONG host_length)
+{
+  (void)transfer_request;
+  (void)slave_length;
+  (void)host_length;
+  return UX_STATE_WAIT;
+}
+
+ALIGN_TYPE _ux_utility_interrupt_disable(VOID)
+{
+  return 0U;
+}
+
+VOID _ux_utility_interrupt_restore(ALIGN_TYPE flags)
+{
+  (void)flags;
+}
+
+/* Simulation ---------------------------------------------------------------*/
+static uint32_t fb_current(void)
+{
+  Audio_StatsTypeDef stats;
+
+  Audio_GetStats(&stats);
+  return stats.feedback;
+}
+
+/* One USB frame: the SAI plays 'rate' (16.16) frames, the host sends one
+   packet as the feedback asks, the device updates the feedback */
+static void fb_frame(uint32_t rate)
+{
+  uint32_t frames;
+
+  sai_position += rate;
+  while ((uint32_t)((sai_position >> 16) / (FB_RING_FRAMES / 2U)) != sai_events)
+  {
+    Audio_Ring_DMA_Event(&Audio_TX_Ring);
+    sai_events++;
+  }
+
+  host_remainder += fb_current();
+  frames = host_remainder >> 16;
+  host_remainder &= 0xFFFFU;
+
+  frames = Audio_Ring_Reserve(&Audio_TX_Ring, Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS, frames);
+  while (frames != 0U)
+  {
+    uint32_t span = Audio_Ring_Span(&Audio_TX_Ring, frames);
+
+    Audio_Ring_Commit(&Audio_TX_Ring, span);
+    frames -= span;
+  }
+
+  Audio_Feedback_Calculation();
+}
+
+static int32_t fb_level(void)
+{
+  return Audio_Ring_Level(&Audio_TX_Ring, Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS);
+}
+
+/* Run 'frames' USB frames, the feedback must stay within the deviation the
+   host accepts. Returns the feedback values furthest from nominal. */
+static void fb_run(uint32_t rate, uint32_t frames, uint32_t *lowest, uint32_t *highest)
+{
+  uint32_t nominal = AUDIO_FB_NOMINAL(AUDIO_FREQUENCY);
+
+  *lowest = UINT32_MAX;
+  *highest = 0U;
+  while (frames--)
+  {
+    uint32_t feedback;
+
+    fb_frame(rate);
+    feedback = fb_current();
+    CHECK((feedback >= nominal - AUDIO_FB_MAX_DEVIATION) &&
+          (feedback <= nominal + AUDIO_FB_MAX_DEVIATION));
+    *lowest = (feedback < *lowest) ? feedback : *lowest;
+    *highest = (feedback > *highest) ? feedback : *highest;
+  }
+}
+
+static void test_nominal_values(void)
+{
+  /* 16.16 samples per 1 ms frame, rounded to the nearest */
+  CHECK_EQ(AUDIO_FB_NOMINAL(48000), 0x00300000U);
+  CHECK_EQ(AUDIO_FB_NOMINAL(96000), 0x00600000U);
+  CHECK_EQ(AUDIO_FB_NOMINAL(44100), 0x002C199AU);
+  CHECK_EQ(AUDIO_FB_NOMINAL(88200), 0x00583333U);
+  CHECK_EQ(fb_current(), AUDIO_FB_NOMINAL(AUDIO_FREQUENCY));
+}
+
+/* The SAI at 'rate' 16.16 frames per ms, long enough to settle */
+static void test_settle(uint32_t rate)
+{
+  Audio_StatsTypeDef stats;
+  uint32_t underruns = Audio_TX_Ring.underruns;
+  uint32_t overruns = Audio_TX_Ring.overruns;
+  uint32_t lowest;
+  uint32_t highest;
+
+  fb_run(rate, 60000U, &lowest, &highest);
+  Audio_GetStats(&stats);
+
+  /* One window counts whole frames: 1/AUDIO_FB_WINDOW of a frame */
+  CHECK(abs((int32_t)(stats.rate - rate)) <= (int32_t)(0x10000U / AUDIO_FB_WINDOW));
+  /* The fill level is pulled back to the lead, the feedback to the rate */
+  CHECK(abs(fb_level() - (int32_t)FB_RING_LEAD) <= 2);
+  CHECK(abs((int32_t)(stats.feedback - rate)) <= (int32_t)(0x10000U / 16U));
+  CHECK_EQ(Audio_TX_Ring.underruns, underruns);
+  CHECK_EQ(Audio_TX_Ring.overruns, overruns);
+}
+
+/* A SAI clock the host cannot follow, its rate windows are rejected: the
+   correction is limited around the measured rate, the feedback around
+   nominal, and the ring xruns */
+static void test_clamp(void)
+{
+  uint32_t nominal = AUDIO_FB_NOMINAL(AUDIO_FREQUENCY);
+  Audio_StatsTypeDef stats;
+  uint32_t lowest;
+  uint32_t highest;
+
+  /* Measured below nominal: the correction limit comes first */
+  Audio_GetStats(&stats);
+  CHECK(stats.rate < nominal);
+  fb_run(nominal + 2U * AUDIO_FB_MAX_DEVIATION, 4000U, &lowest, &highest);
+  CHECK_EQ(highest, stats.rate + AUDIO_FB_MAX_DEVIATION);
+
+  /* Then the limit around nominal */
+  fb_run(nominal - 2U * AUDIO_FB_MAX_DEVIATION, 4000U, &lowest, &highest);
+  CHECK_EQ(lowest, nominal - AUDIO_FB_MAX_DEVIATION);
+
+  Audio_GetStats(&stats);
+  CHECK(stats.rate < nominal);
+}
+
+int main(void)
+{
+  uint32_t nominal = AUDIO_FB_NOMINAL(AUDIO_FREQUENCY);
+
+  /* The stream start: the ring primed to its lead */
+  Audio_Ring_Init(&Audio_TX_Ring, fb_buffer, FB_RING_FRAMES, AUDIO_CHANNELS, 1U, FB_RING_LEAD);
+  Audio_Ring_Resync(&Audio_TX_Ring, 0U);
+
+  test_nominal_values();
+  test_settle(nominal);
+  /* SAI clock 1000 ppm fast, then 500 ppm slow */
+  test_settle(nominal + nominal / 1000U);
+  test_settle(nominal - nominal / 2000U);
+  test_clamp();
+
+  return test_report("test_audio_feedback");
+}
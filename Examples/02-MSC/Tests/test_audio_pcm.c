@@ -0,0 +1,453 @@
+/**
+  ******************************************************************************
+  * @file    test_audio_pcm.c
+  * @brief   Host checks of the PCM conversion kernels
+  ******************************************************************************
+  * The word-at-a-time 24-bit kernels must give the bytes of the one byte at a
+  * time reference, for every length and for packets at any byte alignment.
+  * The kernels with the gain stage are checked against a scalar model of the
+  * Q8.24 gain, its saturation and its per frame ramp, for the 16, 24 and
+  * 32-bit formats and for streams narrower than the SAI frame. The Makefile
+  * also builds this test for 4 and 8 SAI slots.
+  ******************************************************************************
+  */
+#include "audio_pcm.h"
+#include "test.h"
+#include <math.h>
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define PCM_MAX_SAMPLES     96U
+#define PCM_MAX_FRAMES      48U
+
+#define PCM_STR(x)          #x
+#define PCM_XSTR(x)         PCM_STR(x)
+
+static void test_unpack24(void)
+{
+  uint8_t src[PCM_MAX_SAMPLES * 3U + 4U];
+  uint32_t fast[PCM_MAX_SAMPLES + 1U];
+  uint32_t ref[PCM_MAX_SAMPLES + 1U];
+
+  for (uint32_t offset = 0U; offset < 4U; offset++)
+  {
+    for (uint32_t samples = 0U; samples <= PCM_MAX_SAMPLES; samples++)
+    {
+      for (uint32_t i = 0U; i < sizeof(src); i++)
+      {
+        src[i] = (uint8_t)test_random();
+      }
+
+      /* The word past the end tells an overrun */
+      memset(fast, 0xA5, sizeof(fast));
+      memset(ref, 0xA5, sizeof(ref));
+
+      Audio_PCM_Unpack24(fast, &src[offset], samples);
+      Audio_PCM_Unpack24_Ref(ref, &src[offset], samples);
+
+      CHECK(memcmp(fast, ref, sizeof(fast)) == 0);
+      for (uint32_t i = 0U; i < samples; i++)
+      {
+        CHECK_EQ(fast[i] >> 24, 0U);
+      }
+    }
+  }
+}
+
+static void test_pack24(void)
+{
+  uint32_t src[PCM_MAX_SAMPLES];
+  uint8_t fast[PCM_MAX_SAMPLES * 3U + 8U];
+  uint8_t ref[PCM_MAX_SAMPLES * 3U + 8U];
+
+  for (uint32_t offset = 0U; offset < 4U; offset++)
+  {
+    for (uint32_t samples = 0U; samples <= PCM_MAX_SAMPLES; samples++)
+    {
+      /* The SAI word top byte is random too, it must not reach USB */
+      for (uint32_t i = 0U; i < PCM_MAX_SAMPLES; i++)
+      {
+        src[i] = test_random();
+      }
+
+      memset(fast, 0xA5, sizeof(fast));
+      memset(ref, 0xA5, sizeof(ref));
+
+      Audio_PCM_Pack24(&fast[offset], src, samples);
+      Audio_PCM_Pack24_Ref(&ref[offset], src, samples);
+
+      CHECK(memcmp(fast, ref, sizeof(fast)) == 0);
+    }
+  }
+}
+
+static void test_round_trip24(void)
+{
+  uint8_t packet[PCM_MAX_SAMPLES * 3U];
+  uint8_t back[PCM_MAX_SAMPLES * 3U];
+  uint32_t words[PCM_MAX_SAMPLES];
+
+  for (uint32_t i = 0U; i < sizeof(packet); i++)
+  {
+    packet[i] = (uint8_t)test_random();
+  }
+
+  Audio_PCM_Unpack24(words, packet, PCM_MAX_SAMPLES);
+  Audio_PCM_Pack24(back, words, PCM_MAX_SAMPLES);
+
+  CHECK(memcmp(packet, back, sizeof(packet)) == 0);
+}
+
+/* Scalar model of the gain stage ------------------------------------------*/
+static uint32_t model_scale(uint32_t word, int32_t gain)
+{
+  int64_t sample = (int32_t)(word << 8) >> 8;
+
+  sample = (sample * gain) >> AUDIO_PCM_GAIN_SHIFT;
+  if (sample > 0x7FFFFF)
+  {
+    sample = 0x7FFFFF;
+  }
+  else if (sample < -0x800000)
+  {
+    sample = -0x800000;
+  }
+  return (uint32_t)sample & 0x00FFFFFFU;
+}
+
+static void model_step(Audio_PCM_GainTypeDef *gain)
+{
+  for (uint32_t ch = 0U; ch < AUDIO_CHANNELS; ch++)
+  {
+    int32_t step = gain->step[ch];
+
+    if (step == 0)
+    {
+      continue;
+    }
+    gain->current[ch] += step;
+    if (((step > 0) && (gain->current[ch] >= gain->target[ch])) ||
+        ((step < 0) && (gain->current[ch] <= gain->target[ch])))
+    {
+      gain->current[ch] = gain->target[ch];
+      gain->step[ch] = 0;
+    }
+  }
+}
+
+/* Full scale and random samples, so that a boost saturates */
+static uint32_t gain_sample(void)
+{
+  uint32_t pick = test_random();
+
+  switch (pick & 7U)
+  {
+    case 0:
+      return 0x7FFFFFU;
+    case 1:
+      return 0x800000U;
+    default:
+      return pick >> 8;
+  }
+}
+
+static void gain_setup(Audio_PCM_GainTypeDef *gain, uint32_t ramp_frames)
+{
+  static const int32_t levels[] = { 6 * 256, 0, -6 * 256, -40 * 256, -96 * 256 };
+
+  Audio_PCM_Gain_Init(gain);
+  for (uint32_t ch = 0U; ch < AUDIO_CHANNELS; ch++)
+  {
+    int32_t target = Audio_PCM_Gain_FromdB(levels[(ch + test_random()) % 5U]);
+
+    if (ramp_frames == 0U)
+    {
+      gain->current[ch] = target;
+      gain->target[ch] = target;
+    }
+    else
+    {
+      Audio_PCM_Gain_Set(gain, ch, target, ramp_frames);
+    }
+  }
+}
+
+static void test_unpack24_gain(void)
+{
+  uint8_t src[PCM_MAX_FRAMES * AUDIO_CHANNELS * 3U];
+  uint32_t dst[PCM_MAX_FRAMES * AUDIO_CHANNELS + 1U];
+  uint32_t words[PCM_MAX_FRAMES * AUDIO_CHANNELS];
+
+  for (uint32_t ramp = 0U; ramp <= 2U * PCM_MAX_FRAMES; ramp += PCM_MAX_FRAMES / 2U)
+  {
+    for (uint32_t frames = 0U; frames <= PCM_MAX_FRAMES; frames++)
+    {
+      Audio_PCM_GainTypeDef gain;
+      Audio_PCM_GainTypeDef model;
+
+      gain_setup(&gain, ramp);
+      model = gain;
+
+      for (uint32_t i = 0U; i < frames * AUDIO_CHANNELS; i++)
+      {
+        words[i] = gain_sample();
+      }
+      Audio_PCM_Pack24_Ref(src, words, frames * AUDIO_CHANNELS);
+      memset(dst, 0xA5, sizeof(dst));
+
+      Audio_PCM_Unpack24_Gain(dst, src, frames, AUDIO_CHANNELS, &gain);
+
+      for (uint32_t f = 0U; f < frames; f++)
+      {
+        for (uint32_t ch = 0U; ch < AUDIO_CHANNELS; ch++)
+        {
+          uint32_t i = f * AUDIO_CHANNELS + ch;
+
+          CHECK_EQ(dst[i], model_scale(words[i], model.current[ch]));
+        }
+        model_step(&model);
+      }
+      CHECK_EQ(dst[frames * AUDIO_CHANNELS], 0xA5A5A5A5U);
+      CHECK(memcmp(&gain, &model, sizeof(gain)) == 0);
+    }
+  }
+}
+
+static void test_pack24_gain(void)
+{
+  uint8_t dst[PCM_MAX_FRAMES * AUDIO_CHANNELS * 3U + 1U];
+  uint32_t src[PCM_MAX_FRAMES * AUDIO_CHANNELS];
+
+  for (uint32_t ramp = 0U; ramp <= 2U * PCM_MAX_FRAMES; ramp += PCM_MAX_FRAMES / 2U)
+  {
+    for (uint32_t frames = 0U; frames <= PCM_MAX_FRAMES; frames++)
+    {
+      Audio_PCM_GainTypeDef gain;
+      Audio_PCM_GainTypeDef model;
+
+      gain_setup(&gain, ramp);
+      model = gain;
+
+      for (uint32_t i = 0U; i < frames * AUDIO_CHANNELS; i++)
+      {
+        src[i] = gain_sample();
+      }
+      memset(dst, 0xA5, sizeof(dst));
+
+      Audio_PCM_Pack24_Gain(dst, src, frames, AUDIO_CHANNELS, &gain);
+
+      for (uint32_t f = 0U; f < frames; f++)
+      {
+        for (uint32_t ch = 0U; ch < AUDIO_CHANNELS; ch++)
+        {
+          uint32_t i = f * AUDIO_CHANNELS + ch;
+          uint32_t word = model_scale(src[i], model.current[ch]);
+
+          CHECK_EQ(dst[i * 3U], word & 0xFFU);
+          CHECK_EQ(dst[i * 3U + 1U], (word >> 8) & 0xFFU);
+          CHECK_EQ(dst[i * 3U + 2U], word >> 16);
+        }
+        model_step(&model);
+      }
+      CHECK_EQ(dst[frames * AUDIO_CHANNELS * 3U], 0xA5U);
+      CHECK(memcmp(&gain, &model, sizeof(gain)) == 0);
+    }
+  }
+}
+
+static void test_gain_unity(void)
+{
+  uint8_t src[PCM_MAX_FRAMES * AUDIO_CHANNELS * 3U];
+  uint32_t gained[PCM_MAX_FRAMES * AUDIO_CHANNELS];
+  uint32_t plain[PCM_MAX_FRAMES * AUDIO_CHANNELS];
+  Audio_PCM_GainTypeDef gain;
+
+  /* 0 dB is exactly unity, the plain kernels run */
+  CHECK_EQ(Audio_PCM_Gain_FromdB(0), AUDIO_PCM_GAIN_UNITY);
+
+  for (uint32_t i = 0U; i < sizeof(src); i++)
+  {
+    src[i] = (uint8_t)test_random();
+  }
+  Audio_PCM_Gain_Init(&gain);
+  Audio_PCM_Unpack24_Gain(gained, src, PCM_MAX_FRAMES, AUDIO_CHANNELS, &gain);
+  Audio_PCM_Unpack24_Ref(plain, src, PCM_MAX_FRAMES * AUDIO_CHANNELS);
+  CHECK(memcmp(gained, plain, sizeof(plain)) == 0);
+}
+
+static void test_gain_from_db(void)
+{
+  for (int32_t db = AUDIO_VOLUME_MIN; db <= AUDIO_VOLUME_MAX; db += AUDIO_VOLUME_RES)
+  {
+    double exact = pow(10.0, (double)db / 256.0 / 20.0) * AUDIO_PCM_GAIN_UNITY;
+    double error = fabs(Audio_PCM_Gain_FromdB(db) - exact);
+
+    /* Within 0.1 %, or half a Q8.24 LSB at the lowest levels */
+    CHECK((error <= exact * 0.001) || (error <= 0.5));
+  }
+
+  /* Far below the range: silent, not a wrapped divisor */
+  CHECK_EQ(Audio_PCM_Gain_FromdB(-200 * 256), 0);
+  /* Levels between the 0.5 dB steps are rounded */
+  CHECK_EQ(Audio_PCM_Gain_FromdB(-6 * 256 - 63), Audio_PCM_Gain_FromdB(-6 * 256));
+  CHECK_EQ(Audio_PCM_Gain_FromdB(-6 * 256 + 63), Audio_PCM_Gain_FromdB(-6 * 256));
+}
+
+static void test_ramp24(void)
+{
+  uint32_t samples[PCM_MAX_FRAMES * AUDIO_CHANNELS];
+  uint32_t words[PCM_MAX_FRAMES * AUDIO_CHANNELS];
+  int32_t step = AUDIO_PCM_UNITY / 32;
+  int32_t gain = 0;
+
+  for (uint32_t i = 0U; i < PCM_MAX_FRAMES * AUDIO_CHANNELS; i++)
+  {
+    words[i] = gain_sample();
+    samples[i] = words[i];
+  }
+
+  /* Fade in: 0 to unity in 32 frames, then unity */
+  CHECK_EQ(Audio_PCM_Ramp24(samples, PCM_MAX_FRAMES, 0, step), AUDIO_PCM_UNITY);
+  for (uint32_t f = 0U; f < PCM_MAX_FRAMES; f++)
+  {
+    for (uint32_t ch = 0U; ch < AUDIO_CHANNELS; ch++)
+    {
+      uint32_t i = f * AUDIO_CHANNELS + ch;
+
+      CHECK_EQ(samples[i], model_scale(words[i], gain << 8));
+    }
+    gain = (gain + step > AUDIO_PCM_UNITY) ? AUDIO_PCM_UNITY : gain + step;
+  }
+}
+
+/* USB sample of 'subslot' bytes, little endian, <-> 24-bit SAI word */
+static uint32_t model_read(const uint8_t *src, uint32_t subslot)
+{
+  uint32_t value = 0U;
+
+  for (uint32_t b = 0U; b < subslot; b++)
+  {
+    value |= (uint32_t)src[b] << (8U * b);
+  }
+  /* 16-bit samples are the top of the word, 32-bit ones lose their low byte */
+  return (subslot == 2U) ? (value << 8) : (subslot == 4U) ? (value >> 8) : value;
+}
+
+static void model_write(uint8_t *dst, uint32_t word, uint32_t subslot)
+{
+  uint32_t value = (subslot == 2U) ? (word >> 8) : (subslot == 4U) ? (word << 8) : word;
+
+  for (uint32_t b = 0U; b < subslot; b++)
+  {
+    dst[b] = (uint8_t)(value >> (8U * b));
+  }
+}
+
+typedef struct
+{
+  uint32_t subslot;
+  Audio_PCM_UnpackFunc unpack;
+  Audio_PCM_PackFunc pack;
+} PCM_FormatTypeDef;
+
+static const PCM_FormatTypeDef pcm_formats[] =
+{
+  { 2U, Audio_PCM_Unpack16_Gain, Audio_PCM_Pack16_Gain },
+  { 3U, Audio_PCM_Unpack24_Gain, Audio_PCM_Pack24_Gain },
+  { 4U, Audio_PCM_Unpack32_Gain, Audio_PCM_Pack32_Gain },
+};
+
+/* Every format, stereo and every SAI slot: the stream channels go to the
+   first slots of the SAI frame, the other slots are silent */
+static void test_formats(void)
+{
+  static const uint32_t widths[] = { 2U, AUDIO_CHANNELS };
+  uint8_t packet[PCM_MAX_FRAMES * AUDIO_CHANNELS * 4U + 1U];
+  uint32_t frame_words[PCM_MAX_FRAMES * AUDIO_CHANNELS + 1U];
+
+  for (uint32_t f = 0U; f < sizeof(pcm_formats) / sizeof(pcm_formats[0]); f++)
+  {
+    const PCM_FormatTypeDef *format = &pcm_formats[f];
+
+    for (uint32_t w = 0U; w < 2U; w++)
+    {
+      uint32_t channels = widths[w];
+      uint32_t frames = PCM_MAX_FRAMES - f - w;
+      uint32_t bytes = frames * channels * format->subslot;
+      Audio_PCM_GainTypeDef gain;
+      Audio_PCM_GainTypeDef model;
+
+      /* USB to SAI */
+      gain_setup(&gain, PCM_MAX_FRAMES / 2U);
+      model = gain;
+      for (uint32_t i = 0U; i < bytes; i++)
+      {
+        packet[i] = (uint8_t)test_random();
+      }
+      memset(frame_words, 0xA5, sizeof(frame_words));
+
+      format->unpack(frame_words, packet, frames, channels, &gain);
+
+      for (uint32_t n = 0U; n < frames; n++)
+      {
+        for (uint32_t ch = 0U; ch < AUDIO_CHANNELS; ch++)
+        {
+          uint32_t word = 0U;
+
+          if (ch < channels)
+          {
+            word = model_read(&packet[(n * channels + ch) * format->subslot], format->subslot);
+            word = model_scale(word, model.current[ch]);
+          }
+          CHECK_EQ(frame_words[n * AUDIO_CHANNELS + ch], word);
+        }
+        model_step(&model);
+      }
+      CHECK_EQ(frame_words[frames * AUDIO_CHANNELS], 0xA5A5A5A5U);
+      CHECK(memcmp(&gain, &model, sizeof(gain)) == 0);
+
+      /* SAI to USB: the slots past the stream channels are not sent */
+      gain_setup(&gain, PCM_MAX_FRAMES / 2U);
+      model = gain;
+      for (uint32_t i = 0U; i < frames * AUDIO_CHANNELS; i++)
+      {
+        frame_words[i] = gain_sample();
+      }
+      memset(packet, 0xA5, sizeof(packet));
+
+      format->pack(packet, frame_words, frames, channels, &gain);
+
+      for (uint32_t n = 0U; n < frames; n++)
+      {
+        for (uint32_t ch = 0U; ch < channels; ch++)
+        {
+          uint8_t expect[4];
+          uint32_t at = (n * channels + ch) * format->subslot;
+
+          model_write(expect, model_scale(frame_words[n * AUDIO_CHANNELS + ch], model.current[ch]),
+                      format->subslot);
+          CHECK(memcmp(&packet[at], expect, format->subslot) == 0);
+        }
+        model_step(&model);
+      }
+      CHECK_EQ(packet[bytes], 0xA5U);
+      CHECK(memcmp(&gain, &model, sizeof(gain)) == 0);
+    }
+  }
+}
+
+int main(void)
+{
+  test_unpack24();
+  test_pack24();
+  test_round_trip24();
+  test_unpack24_gain();
+  test_pack24_gain();
+  test_gain_unity();
+  test_gain_from_db();
+  test_ramp24();
+  test_formats();
+
+  return test_report("test_audio_pcm, " PCM_XSTR(AUDIO_CHANNELS) " slots");
+}
@@ -0,0 +1,189 @@
+/**
+  ******************************************************************************
+  * @file    test_audio_ring.c
+  * @brief   Host checks of the USB/SAI audio ring
+  ******************************************************************************
+  * The DMA side is played by calling Audio_Ring_DMA_Event() at each half
+  * ring, the CPU side by the reserve/span/commit calls of the streams.
+  ******************************************************************************
+  */
+#include "audio_ring.h"
+#include "test.h"
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define RING_FRAMES     16U
+#define RING_CHANNELS   2U
+
+static uint32_t ring_buffer[RING_FRAMES * RING_CHANNELS];
+
+/* Write 'frames' frames as the ISO OUT path does: at most two spans */
+static uint32_t ring_write(Audio_RingTypeDef *ring, uint32_t dma_index, uint32_t frames,
+                           uint32_t value)
+{
+  uint32_t reserved = Audio_Ring_Reserve(ring, dma_index, frames);
+  uint32_t left = reserved;
+
+  while (left != 0U)
+  {
+    uint32_t span = Audio_Ring_Span(ring, left);
+    uint32_t *frame = Audio_Ring_Ptr(ring);
+
+    for (uint32_t i = 0U; i < span * RING_CHANNELS; i++)
+    {
+      frame[i] = value;
+    }
+    Audio_Ring_Commit(ring, span);
+    left -= span;
+  }
+
+  return reserved;
+}
+
+static void test_tx_fill_and_drop(void)
+{
+  Audio_RingTypeDef ring;
+
+  memset(&ring, 0, sizeof(ring));
+  Audio_Ring_Init(&ring, ring_buffer, RING_FRAMES, RING_CHANNELS, 1U, RING_FRAMES / 2U);
+
+  /* 5 + 5 + 5 frames fit, one frame stays free */
+  CHECK_EQ(ring_write(&ring, 0U, 5U, 1U), 5U);
+  CHECK_EQ(ring_write(&ring, 0U, 5U, 2U), 5U);
+  CHECK_EQ(ring_write(&ring, 0U, 5U, 3U), 5U);
+  CHECK_EQ(Audio_Ring_Level(&ring, 0U), 15);
+  CHECK_EQ(ring.overruns, 0U);
+
+  /* A packet that does not fit whole is dropped and counted once */
+  CHECK_EQ(ring_write(&ring, 0U, 1U, 4U), 0U);
+  CHECK_EQ(ring.overruns, 1U);
+  CHECK_EQ(ring.cpu, 15U);
+
+  /* The DMA frees half a ring, the next packet wraps over the buffer end */
+  Audio_Ring_DMA_Event(&ring);
+  CHECK_EQ(ring.dma_index, RING_FRAMES / 2U);
+  CHECK_EQ(Audio_Ring_Level(&ring, RING_FRAMES / 2U), 7);
+  CHECK_EQ(ring_write(&ring, RING_FRAMES / 2U, 4U, 5U), 4U);
+  CHECK_EQ(ring.cpu_index, 3U);
+  CHECK_EQ(ring_buffer[15U * RING_CHANNELS], 5U);
+  CHECK_EQ(ring_buffer[0], 5U);
+  CHECK_EQ(ring_buffer[2U * RING_CHANNELS + 1U], 5U);
+  CHECK_EQ(ring_buffer[3U * RING_CHANNELS], 1U);
+  CHECK_EQ(ring.underruns, 0U);
+}
+
+static void test_tx_underrun_resync(void)
+{
+  Audio_RingTypeDef ring;
+
+  memset(&ring, 0, sizeof(ring));
+  Audio_Ring_Init(&ring, ring_buffer, RING_FRAMES, RING_CHANNELS, 1U, RING_FRAMES / 2U);
+
+  CHECK_EQ(ring_write(&ring, 0U, 4U, 1U), 4U);
+
+  /* The DMA plays past the 4 frames written: one underrun per half ring */
+  Audio_Ring_DMA_Event(&ring);
+  CHECK_EQ(ring.underruns, 1U);
+  Audio_Ring_DMA_Event(&ring);
+  CHECK_EQ(ring.underruns, 2U);
+  CHECK(Audio_Ring_Level(&ring, 0U) < 0);
+
+  /* The next packet starts again 'lead' frames ahead of the DMA */
+  CHECK_EQ(ring_write(&ring, 2U, 4U, 2U), 4U);
+  CHECK_EQ(Audio_Ring_Level(&ring, 2U), (int32_t)(RING_FRAMES / 2U + 4U));
+  CHECK_EQ(ring.cpu_index, (2U + RING_FRAMES / 2U + 4U) % RING_FRAMES);
+  CHECK_EQ(ring.overruns, 0U);
+}
+
+static void test_rx_counters(void)
+{
+  Audio_RingTypeDef ring;
+  uint32_t frames;
+
+  memset(&ring, 0, sizeof(ring));
+  Audio_Ring_Init(&ring, ring_buffer, RING_FRAMES, RING_CHANNELS, 0U, RING_FRAMES / 4U);
+
+  /* Nothing captured yet: one empty packet, a zero frame request is not one */
+  CHECK_EQ(Audio_Ring_Reserve(&ring, 0U, 6U), 0U);
+  CHECK_EQ(ring.underruns, 1U);
+  CHECK_EQ(Audio_Ring_Reserve(&ring, 0U, 0U), 0U);
+  CHECK_EQ(ring.underruns, 1U);
+
+  /* Half a ring captured, read it in packets of 6 */
+  Audio_Ring_DMA_Event(&ring);
+  frames = Audio_Ring_Reserve(&ring, RING_FRAMES / 2U, 6U);
+  CHECK_EQ(frames, 6U);
+  Audio_Ring_Commit(&ring, frames);
+  frames = Audio_Ring_Reserve(&ring, RING_FRAMES / 2U, 6U);
+  CHECK_EQ(frames, 2U);
+  Audio_Ring_Commit(&ring, frames);
+  CHECK_EQ(ring.underruns, 1U);
+
+  /* The DMA writes over unread frames after a whole ring */
+  Audio_Ring_DMA_Event(&ring);
+  Audio_Ring_DMA_Event(&ring);
+  CHECK_EQ(ring.overruns, 0U);
+  Audio_Ring_DMA_Event(&ring);
+  CHECK_EQ(ring.overruns, 1U);
+
+  /* The next read starts 'lead' frames behind the DMA */
+  frames = Audio_Ring_Reserve(&ring, 1U, 16U);
+  CHECK_EQ(frames, RING_FRAMES / 4U);
+  CHECK_EQ(ring.cpu_index, (1U + RING_FRAMES - RING_FRAMES / 4U) % RING_FRAMES);
+}
+
+static void test_counter_wrap(void)
+{
+  Audio_RingTypeDef ring;
+
+  memset(&ring, 0, sizeof(ring));
+  Audio_Ring_Init(&ring, ring_buffer, RING_FRAMES, RING_CHANNELS, 1U, RING_FRAMES / 2U);
+
+  /* Both sides just short of 2^32, as after a long stream */
+  ring.dma = 0xFFFFFFF8U;
+  ring.cpu = 0xFFFFFFF8U;
+
+  for (uint32_t half = 0U; half < 8U; half++)
+  {
+    uint32_t dma_index = ring.dma_index;
+
+    CHECK_EQ(ring_write(&ring, dma_index, RING_FRAMES / 2U, half), RING_FRAMES / 2U);
+    CHECK_EQ(Audio_Ring_Level(&ring, dma_index), (int32_t)(RING_FRAMES / 2U));
+    Audio_Ring_DMA_Event(&ring);
+  }
+
+  CHECK_EQ(ring.dma, 0x00000038U);
+  CHECK_EQ(ring.underruns, 0U);
+  CHECK_EQ(ring.overruns, 0U);
+}
+
+static void test_dma_position(void)
+{
+  Audio_RingTypeDef ring;
+
+  memset(&ring, 0, sizeof(ring));
+  Audio_Ring_Init(&ring, ring_buffer, RING_FRAMES, RING_CHANNELS, 1U, RING_FRAMES / 2U);
+
+  Audio_Ring_DMA_Event(&ring);
+  CHECK_EQ(Audio_Ring_DMA_Position(&ring, 8U), 8U);
+  CHECK_EQ(Audio_Ring_DMA_Position(&ring, 11U), 11U);
+  /* Past the buffer end, the full event not handled yet */
+  CHECK_EQ(Audio_Ring_DMA_Position(&ring, 1U), 17U);
+  /* Up to 3/4 of a ring ahead of the last event */
+  CHECK_EQ(Audio_Ring_DMA_Position(&ring, 3U), 19U);
+  /* Further: sampled just before the half event that was then handled */
+  CHECK_EQ(Audio_Ring_DMA_Position(&ring, 4U), 4U);
+  CHECK_EQ(Audio_Ring_DMA_Position(&ring, 7U), 7U);
+}
+
+int main(void)
+{
+  test_tx_fill_and_drop();
+  test_tx_underrun_resync();
+  test_rx_counters();
+  test_counter_wrap();
+  test_dma_position();
+
+  return test_report("test_audio_ring");
+}
@@ -0,0 +1,242 @@
+/**
+  ******************************************************************************
+  * @file    test_audio_stats.c
+  * @brief   Host checks of the audio statistics tool against the simulated
+  *          device
+  ******************************************************************************
+  * Host/audio_stats.c runs as in the Linux tool, its control transfers
+  * going through the class entry of audio_sim.c instead of usbdevfs and
+  * its waits running the simulation. The block it decodes matches the
+  * Audio_StatsTypeDef of the firmware field by field, CLEAR_STATS restarts
+  * the counts, and each report of a poll gives the packets of its interval.
+  ******************************************************************************
+  */
+#include "audio_sim.h"
+#include "audio_stats.h"
+#include "ux_device_descriptors.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define TEST_REQUEST_VENDOR_IN  0xC0U
+#define TEST_REQUEST_VENDOR_OUT 0x40U
+
+/* Control transfers that fail once 'fail_after' went through */
+typedef struct
+{
+  ULONG transfers;
+  ULONG fail_after;
+} TEST_TransportTypeDef;
+
+static int test_control(void *context, uint8_t request_type, uint8_t request, uint16_t value,
+                        uint16_t index, uint8_t *data, uint16_t length)
+{
+  TEST_TransportTypeDef *test = context;
+
+  if ((test->fail_after != 0U) && (test->transfers >= test->fail_after))
+  {
+    return -1;
+  }
+  test->transfers++;
+  return (int)audio_sim_request(request_type, request, value, index, data, length);
+}
+
+static void test_wait(void *context, uint32_t ms)
+{
+  UX_PARAMETER_NOT_USED(context);
+  audio_sim_run(ms);
+}
+
+static TEST_TransportTypeDef test_transport_state;
+static const AudioStats_TransportTypeDef test_transport = { test_control, test_wait, &test_transport_state };
+
+static VOID test_connect(const Audio_SimConfigTypeDef *config)
+{
+  memset(&test_transport_state, 0, sizeof(test_transport_state));
+  audio_sim_connect(config, AUDIO_ALT_STEREO_24);
+  audio_sim_run(500U);
+}
+
+/* Each field of the firmware block where the tool reads it: distinct
+   values, the history sized by the firmware build */
+static void test_layout(void)
+{
+  Audio_StatsTypeDef block;
+  AudioStats_BlockTypeDef stats;
+  uint32_t *word = (uint32_t *)&block;
+  uint32_t i;
+
+  /* The requests and the device of the firmware */
+  CHECK_EQ(AUDIO_STATS_BLOCK_VERSION, AUDIO_STATS_VERSION);
+  CHECK_EQ(AUDIO_STATS_GET, UX_DEVICE_CLASS_AUDIO_VENDOR_GET_STATS);
+  CHECK_EQ(AUDIO_STATS_CLEAR, UX_DEVICE_CLASS_AUDIO_VENDOR_CLEAR_STATS);
+  CHECK_EQ(AUDIO_STATS_VID, USBD_VID);
+  CHECK_EQ(AUDIO_STATS_PID, USBD_PID);
+
+  for (i = 0U; i < sizeof(block) / 4U; i++)
+  {
+    word[i] = 0x1000U + i;
+  }
+  block.version = AUDIO_STATS_VERSION;
+  block.length = sizeof(block);
+  block.tx_fill_min = -5;
+  block.rx_fill_max = -7;
+
+  CHECK_EQ(audio_stats_decode(&stats, (const uint8_t *)&block, sizeof(block)), 0);
+  CHECK_EQ(stats.version, block.version);
+  CHECK_EQ(stats.length, block.length);
+  CHECK_EQ(stats.frequency, block.frequency);
+  CHECK_EQ(stats.out_packets, block.out_packets);
+  CHECK_EQ(stats.out_dropped, block.out_dropped);
+  CHECK_EQ(stats.tx_underruns, block.tx_underruns);
+  CHECK_EQ(stats.tx_fill_min, -5);
+  CHECK_EQ(stats.tx_fill_max, block.tx_fill_max);
+  CHECK_EQ(stats.out_latency, block.out_latency);
+  CHECK_EQ(stats.in_packets, block.in_packets);
+  CHECK_EQ(stats.in_empty, block.in_empty);
+  CHECK_EQ(stats.rx_overruns, block.rx_overruns);
+  CHECK_EQ(stats.rx_fill_min, block.rx_fill_min);
+  CHECK_EQ(stats.rx_fill_max, -7);
+  CHECK_EQ(stats.in_latency, block.in_latency);
+  CHECK_EQ(stats.rate, block.rate);
+  CHECK_EQ(stats.feedback, block.feedback);
+  CHECK_EQ(stats.feedback_count, block.feedback_count);
+  CHECK_EQ(stats.history_size, AUDIO_STATS_FB_HISTORY);
+  for (i = 0U; i < AUDIO_STATS_FB_HISTORY; i++)
+  {
+    CHECK_EQ(stats.feedback_history[i], block.feedback_history[i]);
+  }
+  CHECK_EQ(stats.sai_rx_fifo_errors, block.sai_rx_fifo_errors);
+  CHECK_EQ(stats.sai_tx_fifo_errors, block.sai_tx_fifo_errors);
+  CHECK_EQ(stats.sai_sync_errors, block.sai_sync_errors);
+  CHECK_EQ(stats.sai_dma_errors, block.sai_dma_errors);
+
+  /* Short, of another version, or a length no history fits */
+  CHECK_EQ(audio_stats_decode(&stats, (const uint8_t *)&block, sizeof(block) - 4U), -1);
+  CHECK_EQ(audio_stats_decode(&stats, (const uint8_t *)&block, 2U), -1);
+  block.version = AUDIO_STATS_VERSION + 1U;
+  CHECK_EQ(audio_stats_decode(&stats, (const uint8_t *)&block, sizeof(block)), -1);
+  block.version = AUDIO_STATS_VERSION;
+  block.length = sizeof(block) - 2U;
+  CHECK_EQ(audio_stats_decode(&stats, (const uint8_t *)&block, sizeof(block)), -1);
+}
+
+/* GET_STATS from a device held by other tasks: what the firmware has */
+static void test_read(void)
+{
+  Audio_SimConfigTypeDef config = { 100, 20, 3000 };
+  AudioStats_BlockTypeDef stats;
+  Audio_StatsTypeDef device;
+  uint32_t i;
+
+  test_connect(&config);
+  audio_sim_run(5000U);
+  CHECK_EQ(audio_stats_read(&test_transport, &stats), 0);
+  Audio_GetStats(&device);
+
+  CHECK_EQ(stats.length, sizeof(device));
+  CHECK_EQ(stats.frequency, AUDIO_FREQUENCY);
+  CHECK(stats.out_packets > 4000U);
+  CHECK_EQ(stats.out_packets, device.out_packets);
+  CHECK_EQ(stats.out_dropped, device.out_dropped);
+  CHECK_EQ(stats.tx_underruns, device.tx_underruns);
+  CHECK_EQ(stats.tx_fill_min, device.tx_fill_min);
+  CHECK_EQ(stats.tx_fill_max, device.tx_fill_max);
+  CHECK_EQ(stats.out_latency, device.out_latency);
+  CHECK_EQ(stats.in_packets, device.in_packets);
+  CHECK_EQ(stats.in_empty, device.in_empty);
+  CHECK_EQ(stats.rx_overruns, device.rx_overruns);
+  CHECK_EQ(stats.rx_fill_min, device.rx_fill_min);
+  CHECK_EQ(stats.rx_fill_max, device.rx_fill_max);
+  CHECK_EQ(stats.in_latency, device.in_latency);
+  CHECK_EQ(stats.rate, device.rate);
+  CHECK_EQ(stats.feedback, device.feedback);
+  CHECK(stats.feedback_count > 0U);
+  CHECK_EQ(stats.feedback_count, device.feedback_count);
+  for (i = 0U; i < AUDIO_STATS_FB_HISTORY; i++)
+  {
+    CHECK_EQ(stats.feedback_history[i], device.feedback_history[i]);
+  }
+}
+
+/* CLEAR_STATS restarts the counts; other vendor requests stall */
+static void test_clear(void)
+{
+  Audio_SimConfigTypeDef config = { 100, 0, 0 };
+  AudioStats_BlockTypeDef stats;
+  UCHAR data[8];
+
+  test_connect(&config);
+  CHECK_EQ(audio_stats_clear(&test_transport), 0);
+  CHECK_EQ(audio_stats_read(&test_transport, &stats), 0);
+  CHECK_EQ(stats.out_packets + stats.in_packets + stats.feedback_count, 0U);
+  CHECK(stats.tx_fill_min > stats.tx_fill_max);
+  audio_sim_run(10U);
+  CHECK_EQ(audio_stats_read(&test_transport, &stats), 0);
+  CHECK_EQ(stats.out_packets, 10U);
+  CHECK_EQ(stats.in_packets, 10U);
+
+  CHECK_EQ(audio_sim_request(TEST_REQUEST_VENDOR_IN, 0x7FU, 0U, 0U, data, sizeof(data)), -1);
+  CHECK_EQ(audio_sim_request(TEST_REQUEST_VENDOR_OUT, AUDIO_STATS_GET, 0U, 0U, data, 0U), -1);
+  CHECK_EQ(audio_sim_request(TEST_REQUEST_VENDOR_IN, AUDIO_STATS_CLEAR, 0U, 0U, data, sizeof(data)), -1);
+
+  /* A short read gets the start of the block, which the tool refuses */
+  CHECK_EQ(audio_sim_request(TEST_REQUEST_VENDOR_IN, AUDIO_STATS_GET, 0U, 0U, data, sizeof(data)), 8);
+  CHECK_EQ(audio_stats_decode(&stats, data, sizeof(data)), -1);
+}
+
+/* Occurrences of 'needle' in 'text' */
+static ULONG test_count(const char *text, const char *needle)
+{
+  ULONG count = 0U;
+
+  while ((text = strstr(text, needle)) != NULL)
+  {
+    count++;
+    text += strlen(needle);
+  }
+  return count;
+}
+
+/* Polled each second for 3 s: a report per read, each interval one
+   second of packets; a failed read ends the poll */
+static void test_poll(void)
+{
+  Audio_SimConfigTypeDef config = { 100, 0, 0 };
+  char *text = NULL;
+  size_t size = 0U;
+  FILE *out;
+
+  test_connect(&config);
+  out = open_memstream(&text, &size);
+  CHECK_EQ(audio_stats_poll(&test_transport, 1000U, 3U, 1, out), 0);
+  fclose(out);
+  CHECK_EQ(test_count(text, "\n["), 3U);
+  CHECK(strncmp(text, "[     0.000 s] 48000 Hz, rate 4", 30) == 0);
+  CHECK(strstr(text, "[     3.000 s]") != NULL);
+  CHECK_EQ(test_count(text, "OUT 0 packets, 0 dropped, 0 underruns, fill -"), 1U);
+  CHECK_EQ(test_count(text, "packets (+1000), 0 dropped (+0), 0 underruns (+0)"), 3U);
+  CHECK_EQ(test_count(text, "packets (+1000), 0 empty (+0), 0 overruns (+0)"), 3U);
+  CHECK(strstr(text, "OUT 3000 packets (+1000)") != NULL);
+  free(text);
+
+  test_connect(&config);
+  test_transport_state.fail_after = 3U;
+  out = open_memstream(&text, &size);
+  CHECK_EQ(audio_stats_poll(&test_transport, 100U, 0U, 0, out), -1);
+  fclose(out);
+  CHECK_EQ(test_count(text, "["), 3U);
+  free(text);
+}
+
+int main(void)
+{
+  test_layout();
+  test_read();
+  test_clear();
+  test_poll();
+
+  return test_report("test_audio_stats");
+}
@@ -0,0 +1,326 @@
+/**
+  ******************************************************************************
+  * @file    test_msc_sd.c
+  * @brief   Host checks of the non-blocking SD media
+  ******************************************************************************
+  * msc_media_sd.c runs over the simulated card of sd_sim.c and is driven
+  * through MSC_Media_Read/Write/Flush the way the storage class does: the
+  * call is repeated with the same arguments while it returns UX_STATE_WAIT,
+  * simulated time moving on between calls. Transfers must end in
+  * UX_STATE_NEXT with the card content right, or in UX_STATE_ERROR with
+  * the sense status of the failure; a NULL buffer aborts.
+  ******************************************************************************
+  */
+#include "sd_sim.h"
+#include "ux_device_class_storage.h"
+#include "test.h"
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define TEST_BLOCKS        65536U       /* 32 MB card */
+#define TEST_STEP_US       50U          /* main loop period */
+#define TEST_MAX_STEPS     100000U
+#define TEST_BUFFER_BLOCKS 64U
+
+static UCHAR test_buffer[TEST_BUFFER_BLOCKS * 512U];
+static UCHAR test_pattern[TEST_BUFFER_BLOCKS * 512U];
+
+#define SENSE(key, code, qualifier) \
+  UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_##key, code, qualifier)
+
+/* Call an operation until it stops waiting, returns its last status and
+   counts the UX_STATE_WAIT answers */
+typedef enum
+{
+  OP_READ,
+  OP_WRITE,
+  OP_FLUSH,
+} TestOpTypeDef;
+
+static ULONG test_waits;
+
+static UINT test_call(TestOpTypeDef op, UCHAR *buffer, ULONG blocks, ULONG lba, ULONG *media_status)
+{
+  switch (op)
+  {
+    case OP_READ:
+      return MSC_Media_Read(&MSC_Media_SD, buffer, blocks, lba, media_status);
+    case OP_WRITE:
+      return MSC_Media_Write(&MSC_Media_SD, buffer, blocks, lba, media_status);
+    default:
+      return MSC_Media_Flush(&MSC_Media_SD, media_status);
+  }
+}
+
+static UINT test_run(TestOpTypeDef op, UCHAR *buffer, ULONG blocks, ULONG lba, ULONG *media_status)
+{
+  UINT status;
+  ULONG steps;
+
+  test_waits = 0U;
+  for (steps = 0U; steps < TEST_MAX_STEPS; steps++)
+  {
+    *media_status = 0U;
+    status = test_call(op, buffer, blocks, lba, media_status);
+    if (status != UX_STATE_WAIT)
+    {
+      return status;
+    }
+    test_waits++;
+    sd_sim_advance(TEST_STEP_US);
+  }
+
+  return UX_STATE_WAIT;
+}
+
+static VOID test_fill(UCHAR *buffer, ULONG blocks)
+{
+  ULONG i;
+
+  for (i = 0U; i < (blocks * 512U); i++)
+  {
+    buffer[i] = (UCHAR)test_random();
+  }
+}
+
+/* Insert a card and poll the media as the storage class does until the
+   host would see it ready */
+static VOID test_open(const SD_SimCardTypeDef *card)
+{
+  ULONG media_status;
+  ULONG steps;
+  UINT attention = UX_FALSE;
+
+  sd_sim_insert(card);
+  for (steps = 0U; steps < TEST_MAX_STEPS; steps++)
+  {
+    MSC_Media_SD.Process();
+    media_status = 0U;
+    if (MSC_Media_SD.Status(&media_status) == UX_SUCCESS)
+    {
+      break;
+    }
+    if (media_status == SENSE(UNIT_ATTENTION, 0x28, 0x00))
+    {
+      attention = UX_TRUE;
+    }
+    sd_sim_advance(1000U);
+  }
+  CHECK(attention);
+  CHECK_EQ(MSC_Media_SD.GetLastLba(), card->blocks - 1U);
+}
+
+/* Reads from the card come in once the transfer ended, not before */
+static void test_read(void)
+{
+  ULONG media_status;
+  UINT status;
+
+  test_fill(sd_sim_block(1000U), 8U);
+  memset(test_buffer, 0, sizeof(test_buffer));
+
+  status = MSC_Media_Read(&MSC_Media_SD, test_buffer, 8U, 1000U, &media_status);
+  CHECK_EQ(status, UX_STATE_WAIT);
+  CHECK(sd_sim_dma_busy());
+  CHECK_EQ(test_buffer[0] | test_buffer[8U * 512U - 1U], 0);
+
+  status = test_run(OP_READ, test_buffer, 8U, 1000U, &media_status);
+  CHECK_EQ(status, UX_STATE_NEXT);
+  CHECK(test_waits > 0U);
+  CHECK(memcmp(test_buffer, sd_sim_block(1000U), 8U * 512U) == 0);
+}
+
+/* Small writes are cached: done at once, on the card after a flush. Long
+   ones go through to the card. */
+static void test_write(void)
+{
+  ULONG media_status;
+  ULONG busy_violations = sd_sim_stats.busy_violations;
+  UINT status;
+
+  test_fill(test_pattern, 4U);
+  status = MSC_Media_Write(&MSC_Media_SD, test_pattern, 4U, 2000U, &media_status);
+  CHECK_EQ(status, UX_STATE_NEXT);
+  CHECK(!sd_sim_mapped(2000U));
+
+  /* Served from the cache */
+  memset(test_buffer, 0, sizeof(test_buffer));
+  CHECK_EQ(MSC_Media_Read(&MSC_Media_SD, test_buffer, 4U, 2000U, &media_status), UX_STATE_NEXT);
+  CHECK(memcmp(test_buffer, test_pattern, 4U * 512U) == 0);
+
+  status = test_run(OP_FLUSH, UX_NULL, 0U, 0U, &media_status);
+  CHECK_EQ(status, UX_STATE_NEXT);
+  CHECK(test_waits > 0U);
+  CHECK(sd_sim_mapped(2000U) && sd_sim_mapped(2003U) && !sd_sim_mapped(2004U));
+  CHECK(memcmp(sd_sim_block(2000U), test_pattern, 4U * 512U) == 0);
+
+  test_fill(test_pattern, TEST_BUFFER_BLOCKS);
+  status = test_run(OP_WRITE, test_pattern, TEST_BUFFER_BLOCKS, 4000U, &media_status);
+  CHECK_EQ(status, UX_STATE_NEXT);
+  CHECK(test_waits > 0U);
+  CHECK(memcmp(sd_sim_block(4000U), test_pattern, TEST_BUFFER_BLOCKS * 512U) == 0);
+
+  /* A write right after one leaves the card programming: polled first */
+  test_fill(test_pattern, TEST_BUFFER_BLOCKS);
+  status = test_run(OP_WRITE, test_pattern, TEST_BUFFER_BLOCKS, 5000U, &media_status);
+  CHECK_EQ(status, UX_STATE_NEXT);
+  CHECK(memcmp(sd_sim_block(5000U), test_pattern, TEST_BUFFER_BLOCKS * 512U) == 0);
+  CHECK_EQ(sd_sim_stats.busy_violations, busy_violations);
+}
+
+/* A NULL buffer aborts the transfer in progress, the next one is clean */
+static void test_abort(void)
+{
+  ULONG media_status;
+  ULONG aborts = sd_sim_stats.aborts;
+  UINT status;
+
+  /* Let the last write end programming, the read starts its DMA at once */
+  sd_sim_advance(10000U);
+  status = MSC_Media_Read(&MSC_Media_SD, test_buffer, 8U, 7000U, &media_status);
+  CHECK_EQ(status, UX_STATE_WAIT);
+  CHECK(sd_sim_dma_busy());
+  CHECK_EQ(MSC_Media_Read(&MSC_Media_SD, UX_NULL, 0U, 0U, &media_status), UX_STATE_NEXT);
+  CHECK(!sd_sim_dma_busy());
+  CHECK_EQ(sd_sim_stats.aborts, aborts + 1U);
+
+  test_fill(test_pattern, TEST_BUFFER_BLOCKS);
+  status = MSC_Media_Write(&MSC_Media_SD, test_pattern, TEST_BUFFER_BLOCKS, 8000U, &media_status);
+  CHECK_EQ(status, UX_STATE_WAIT);
+  CHECK(sd_sim_dma_busy());
+  sd_sim_advance(TEST_STEP_US);
+  CHECK_EQ(MSC_Media_Write(&MSC_Media_SD, UX_NULL, 0U, 0U, &media_status), UX_STATE_NEXT);
+  CHECK(!sd_sim_dma_busy());
+  CHECK_EQ(sd_sim_stats.aborts, aborts + 2U);
+  CHECK(!sd_sim_mapped(8000U));
+
+  test_fill(sd_sim_block(7000U), 8U);
+  status = test_run(OP_READ, test_buffer, 8U, 7000U, &media_status);
+  CHECK_EQ(status, UX_STATE_NEXT);
+  CHECK(memcmp(test_buffer, sd_sim_block(7000U), 8U * 512U) == 0);
+}
+
+/* Failed transfers end in UX_STATE_ERROR with a medium error, the card is
+   usable again on the next command */
+static void test_errors(void)
+{
+  ULONG media_status;
+  UINT status;
+
+  sd_sim_fail(HAL_SD_ERROR_DATA_CRC_FAIL, 1U);
+  status = test_run(OP_READ, test_buffer, 8U, 9000U, &media_status);
+  CHECK_EQ(status, UX_STATE_ERROR);
+  CHECK_EQ(media_status, SENSE(MEDIUM_ERROR, 0x11, 0x00));
+  CHECK(!sd_sim_dma_busy());
+
+  status = test_run(OP_READ, test_buffer, 8U, 9000U, &media_status);
+  CHECK_EQ(status, UX_STATE_NEXT);
+
+  /* Never ends: the media gives up after its timeout */
+  sd_sim_fail(SD_SIM_STALL, 1U);
+  status = test_run(OP_READ, test_buffer, 8U, 9100U, &media_status);
+  CHECK_EQ(status, UX_STATE_ERROR);
+  CHECK_EQ(media_status, SENSE(MEDIUM_ERROR, 0x11, 0x00));
+  CHECK(test_waits >= (1000U * 1000U / TEST_STEP_US));
+  CHECK(!sd_sim_dma_busy());
+
+  sd_sim_fail(HAL_SD_ERROR_DATA_TIMEOUT, 1U);
+  test_fill(test_pattern, TEST_BUFFER_BLOCKS);
+  status = test_run(OP_WRITE, test_pattern, TEST_BUFFER_BLOCKS, 10000U, &media_status);
+  CHECK_EQ(status, UX_STATE_ERROR);
+  CHECK_EQ(media_status, SENSE(MEDIUM_ERROR, 0x03, 0x00));
+
+  status = test_run(OP_WRITE, test_pattern, TEST_BUFFER_BLOCKS, 10000U, &media_status);
+  CHECK_EQ(status, UX_STATE_NEXT);
+  CHECK(memcmp(sd_sim_block(10000U), test_pattern, TEST_BUFFER_BLOCKS * 512U) == 0);
+}
+
+/* A failed write-back keeps the line dirty, the next flush retries it. A
+   line failing SD_WCACHE_RETRIES times is dropped: its blocks read as a
+   medium error until the host writes them again. The underrun does not
+   touch the bus clock, unlike the CRC and timeout errors. */
+static void test_writeback_errors(void)
+{
+  ULONG media_status;
+  UINT status;
+  UINT i;
+
+  test_fill(test_pattern, 8U);
+  CHECK_EQ(test_run(OP_WRITE, test_pattern, 8U, 12000U, &media_status), UX_STATE_NEXT);
+  sd_sim_fail(HAL_SD_ERROR_TX_UNDERRUN, 1U);
+  status = test_run(OP_FLUSH, UX_NULL, 0U, 0U, &media_status);
+  CHECK_EQ(status, UX_STATE_ERROR);
+  CHECK_EQ(media_status, SENSE(MEDIUM_ERROR, 0x03, 0x00));
+  CHECK(!sd_sim_mapped(12000U));
+
+  /* Still in the cache, on the card after the retry */
+  CHECK_EQ(test_run(OP_READ, test_buffer, 8U, 12000U, &media_status), UX_STATE_NEXT);
+  CHECK(memcmp(test_buffer, test_pattern, 8U * 512U) == 0);
+  CHECK_EQ(test_run(OP_FLUSH, UX_NULL, 0U, 0U, &media_status), UX_STATE_NEXT);
+  CHECK(memcmp(sd_sim_block(12000U), test_pattern, 8U * 512U) == 0);
+
+  /* Failing for good, the idle write-back gives up on the line */
+  test_fill(test_pattern, 8U);
+  CHECK_EQ(test_run(OP_WRITE, test_pattern, 8U, 12000U, &media_status), UX_STATE_NEXT);
+  sd_sim_fail(HAL_SD_ERROR_TX_UNDERRUN, 3U);
+  for (i = 0U; i < 1000U; i++)
+  {
+    MSC_Media_SD.Process();
+    sd_sim_advance(1000U);
+  }
+  status = test_run(OP_FLUSH, UX_NULL, 0U, 0U, &media_status);
+  CHECK_EQ(status, UX_STATE_ERROR);
+  CHECK_EQ(media_status, SENSE(MEDIUM_ERROR, 0x03, 0x00));
+  CHECK_EQ(test_run(OP_FLUSH, UX_NULL, 0U, 0U, &media_status), UX_STATE_NEXT);
+
+  status = test_run(OP_READ, test_buffer, 4U, 12006U, &media_status);
+  CHECK_EQ(status, UX_STATE_ERROR);
+  CHECK_EQ(media_status, SENSE(MEDIUM_ERROR, 0x11, 0x00));
+  CHECK_EQ(test_run(OP_READ, test_buffer, 4U, 12008U, &media_status), UX_STATE_NEXT);
+
+  /* Written again, readable again */
+  CHECK_EQ(test_run(OP_WRITE, test_pattern, 8U, 12000U, &media_status), UX_STATE_NEXT);
+  CHECK_EQ(test_run(OP_READ, test_buffer, 8U, 12000U, &media_status), UX_STATE_NEXT);
+  CHECK(memcmp(test_buffer, test_pattern, 8U * 512U) == 0);
+  CHECK_EQ(test_run(OP_FLUSH, UX_NULL, 0U, 0U, &media_status), UX_STATE_NEXT);
+  CHECK(memcmp(sd_sim_block(12000U), test_pattern, 8U * 512U) == 0);
+}
+
+/* A card pulled out during a transfer: medium not present */
+static void test_removal(void)
+{
+  ULONG media_status;
+  UINT status;
+
+  status = MSC_Media_Read(&MSC_Media_SD, test_buffer, 8U, 11000U, &media_status);
+  CHECK_EQ(status, UX_STATE_WAIT);
+  sd_sim_remove();
+
+  status = test_run(OP_READ, test_buffer, 8U, 11000U, &media_status);
+  CHECK_EQ(status, UX_STATE_ERROR);
+  CHECK_EQ(media_status, SENSE(NOT_READY, 0x3A, 0x00));
+  CHECK(!sd_sim_dma_busy());
+
+  sd_sim_advance(100000U);
+  media_status = 0U;
+  CHECK_EQ(MSC_Media_SD.Status(&media_status), UX_ERROR);
+  CHECK_EQ(media_status, SENSE(NOT_READY, 0x3A, 0x00));
+}
+
+int main(void)
+{
+  SD_SimCardTypeDef card;
+
+  sd_sim_card_default(&card, TEST_BLOCKS);
+  test_open(&card);
+
+  test_read();
+  test_write();
+  test_abort();
+  test_errors();
+  test_writeback_errors();
+  test_removal();
+
+  return test_report("test_msc_sd");
+}
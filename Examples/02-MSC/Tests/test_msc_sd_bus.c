@@ -0,0 +1,231 @@
+/**
+  ******************************************************************************
+  * @file    test_msc_sd_bus.c
+  * @brief   Host checks of the SD bus mode and clock fallbacks
+  ******************************************************************************
+  * msc_media_sd.c is built into this file so that the static sd_bus_select()
+  * can be checked against canned CMD6 check mode dumps: the mode and clock
+  * it gives for each number of fallbacks.
+  * The media then runs over the simulated card of sd_sim.c: only the CRC
+  * errors and data timeouts step the clock down, high speed cards go down
+  * to 25 MHz then back to default speed, a busy or stalled card keeps its
+  * clock.
+  ******************************************************************************
+  */
+#include "../USBX/App/msc_media_sd.c"
+#include "sd_sim.h"
+#include "test.h"
+
+TEST_MAIN_DEFINE
+
+#define TEST_BLOCKS        65536U       /* 32 MB card */
+#define TEST_STEP_US       50U          /* main loop period */
+#define TEST_MAX_STEPS     100000U
+
+#define SENSE(key, code, qualifier) \
+  UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_##key, code, qualifier)
+
+static UCHAR test_buffer[8U * 512U];
+
+/* CMD6 check mode dumps of group 1 (access mode): version 1 structure with
+   high speed offered, one where the card only offers default speed, one
+   where it offers high speed but cannot switch (0xF), one with the high
+   speed function busy, and a version 0 one where byte 29 means nothing */
+static UCHAR test_status_hs[64];
+static UCHAR test_status_ds[64];
+static UCHAR test_status_no_switch[64];
+static UCHAR test_status_busy[64];
+static UCHAR test_status_v0[64];
+
+static VOID test_status(UCHAR *status, UCHAR support, UCHAR function, UCHAR version, UCHAR busy)
+{
+  memset(status, 0, 64U);
+  status[1] = 100U;
+  status[13] = support;
+  status[16] = function;
+  status[17] = version;
+  status[29] = busy;
+}
+
+/* Mode and clock of sd_bus_select() over the fallbacks, from the table of
+   the expected clocks in MHz * 1000, 0 ending it */
+static VOID test_select(const UCHAR *status, ULONG high_speed_steps, const ULONG *khz)
+{
+  ULONG fallbacks;
+  ULONG frequency;
+  ULONG mode;
+
+  for (fallbacks = 0U; khz[fallbacks] != 0U; fallbacks++)
+  {
+    frequency = 0U;
+    mode = sd_bus_select(status, fallbacks, &frequency);
+    CHECK_EQ(mode, (fallbacks < high_speed_steps) ? MSC_MEDIA_SD_HIGH_SPEED : MSC_MEDIA_SD_DEFAULT_SPEED);
+    CHECK_EQ(frequency / 1000U, khz[fallbacks]);
+  }
+}
+
+static void test_select_dumps(void)
+{
+  static const ULONG high_speed[] = { 50000U, 25000U, 25000U, 12500U, 6250U, 3125U, 1562U, 0U };
+  static const ULONG default_speed[] = { 25000U, 12500U, 6250U, 3125U, 1562U, 781U, 390U, 0U };
+
+  test_status(test_status_hs, 0x03U, 0x01U, 1U, 0x00U);
+  test_status(test_status_ds, 0x01U, 0x0FU, 1U, 0x00U);
+  test_status(test_status_no_switch, 0x03U, 0x0FU, 1U, 0x00U);
+  test_status(test_status_busy, 0x03U, 0x01U, 1U, 0x02U);
+  test_status(test_status_v0, 0x03U, 0x01U, 0U, 0x02U);
+
+  test_select(test_status_hs, SD_BUS_HS_STEPS, high_speed);
+  test_select(test_status_v0, SD_BUS_HS_STEPS, high_speed);
+  test_select(test_status_ds, 0U, default_speed);
+  test_select(test_status_no_switch, 0U, default_speed);
+  test_select(test_status_busy, 0U, default_speed);
+  test_select(UX_NULL, 0U, default_speed);
+}
+
+/* Insert a card and poll the media as the storage class does until the
+   host would see it ready */
+static VOID test_open(const SD_SimCardTypeDef *card)
+{
+  ULONG media_status;
+  ULONG steps;
+
+  sd_sim_remove();
+  sd_sim_advance(100000U);
+  MSC_Media_SD.Process();
+  sd_sim_insert(card);
+  for (steps = 0U; steps < TEST_MAX_STEPS; steps++)
+  {
+    MSC_Media_SD.Process();
+    media_status = 0U;
+    if (MSC_Media_SD.Status(&media_status) == UX_SUCCESS)
+    {
+      break;
+    }
+    sd_sim_advance(1000U);
+  }
+  CHECK_EQ(MSC_Media_SD.GetLastLba(), card->blocks - 1U);
+}
+
+/* A read of 8 blocks run to its end, its status */
+static UINT test_read(ULONG lba, ULONG *media_status)
+{
+  UINT status;
+  ULONG steps;
+
+  for (steps = 0U; steps < TEST_MAX_STEPS; steps++)
+  {
+    *media_status = 0U;
+    status = MSC_Media_Read(&MSC_Media_SD, test_buffer, 8U, lba, media_status);
+    if (status != UX_STATE_WAIT)
+    {
+      return status;
+    }
+    sd_sim_advance(TEST_STEP_US);
+  }
+
+  return UX_STATE_WAIT;
+}
+
+static VOID test_bus(ULONG mode, ULONG clock, ULONG fallbacks)
+{
+  MSC_MediaBusInfoTypeDef info;
+
+  MSC_Media_SD_GetBusInfo(&info);
+  CHECK_EQ(info.mode, mode);
+  CHECK_EQ(info.clock, clock);
+  CHECK_EQ(info.fallbacks, fallbacks);
+  CHECK_EQ(sd_sim_high_speed(), (mode == MSC_MEDIA_SD_HIGH_SPEED) ? UX_TRUE : UX_FALSE);
+  CHECK_EQ(sd_sim_clock(), clock);
+}
+
+/* The session starts at the fastest clock the card takes */
+static void test_setup(void)
+{
+  SD_SimCardTypeDef card;
+
+  sd_sim_card_default(&card, TEST_BLOCKS);
+  test_open(&card);
+  test_bus(MSC_MEDIA_SD_HIGH_SPEED, 50000000U, 0U);
+
+  /* CRC errors above 25 MHz: high speed at 25 MHz */
+  card.max_clock = 25000000U;
+  test_open(&card);
+  test_bus(MSC_MEDIA_SD_HIGH_SPEED, 25000000U, 1U);
+
+  /* Above 12.5 MHz: default speed at 12.5 MHz, never high speed below
+     25 MHz */
+  card.max_clock = 12500000U;
+  test_open(&card);
+  test_bus(MSC_MEDIA_SD_DEFAULT_SPEED, 12500000U, 3U);
+
+  /* High speed offered but busy: default speed */
+  card.max_clock = 0U;
+  card.switch_status = test_status_busy;
+  test_open(&card);
+  test_bus(MSC_MEDIA_SD_DEFAULT_SPEED, 25000000U, 0U);
+}
+
+/* A card that stays busy or a transfer that never ends fails the command
+   without touching the clock. CRC errors and data timeouts step it down
+   before the next command, through 25 MHz high speed to default speed. */
+static void test_fallbacks(void)
+{
+  SD_SimCardTypeDef card;
+  ULONG media_status;
+  ULONG crc_errors;
+  ULONG timeouts;
+
+  sd_sim_card_default(&card, TEST_BLOCKS);
+  test_open(&card);
+  test_bus(MSC_MEDIA_SD_HIGH_SPEED, 50000000U, 0U);
+  crc_errors = sd_bus.crc_errors;
+  timeouts = sd_bus.timeouts;
+
+  /* Programming past the timeout of the media, as the media knows after a
+     write: the command times out in CARD_WAIT */
+  sd_sim_hold_busy((SD_TIMEOUT + 100U) * 1000U);
+  sd_session.card_state = HAL_SD_CARD_PROGRAMMING;
+  CHECK_EQ(test_read(1000U, &media_status), UX_STATE_ERROR);
+  CHECK_EQ(media_status, SENSE(MEDIUM_ERROR, 0x11, 0x00));
+  CHECK_EQ(sd_bus.timeouts - timeouts, 1U);
+  test_bus(MSC_MEDIA_SD_HIGH_SPEED, 50000000U, 0U);
+  CHECK_EQ(test_read(1000U, &media_status), UX_STATE_NEXT);
+
+  /* Stalled transfer, command not answered */
+  sd_sim_fail(SD_SIM_STALL, 1U);
+  CHECK_EQ(test_read(1100U, &media_status), UX_STATE_ERROR);
+  sd_sim_fail(HAL_SD_ERROR_CMD_RSP_TIMEOUT, 1U);
+  CHECK_EQ(test_read(1100U, &media_status), UX_STATE_ERROR);
+  CHECK_EQ(test_read(1100U, &media_status), UX_STATE_NEXT);
+  test_bus(MSC_MEDIA_SD_HIGH_SPEED, 50000000U, 0U);
+
+  /* CRC error: high speed at 25 MHz */
+  sd_sim_fail(HAL_SD_ERROR_DATA_CRC_FAIL, 1U);
+  CHECK_EQ(test_read(1200U, &media_status), UX_STATE_ERROR);
+  CHECK_EQ(test_read(1200U, &media_status), UX_STATE_NEXT);
+  test_bus(MSC_MEDIA_SD_HIGH_SPEED, 25000000U, 1U);
+
+  /* Data timeout: back to default speed at 25 MHz, not 12.5 MHz in high speed */
+  sd_sim_fail(HAL_SD_ERROR_DATA_TIMEOUT, 1U);
+  CHECK_EQ(test_read(1300U, &media_status), UX_STATE_ERROR);
+  CHECK_EQ(test_read(1300U, &media_status), UX_STATE_NEXT);
+  test_bus(MSC_MEDIA_SD_DEFAULT_SPEED, 25000000U, 2U);
+
+  sd_sim_fail(HAL_SD_ERROR_DATA_CRC_FAIL, 1U);
+  CHECK_EQ(test_read(1400U, &media_status), UX_STATE_ERROR);
+  CHECK_EQ(test_read(1400U, &media_status), UX_STATE_NEXT);
+  test_bus(MSC_MEDIA_SD_DEFAULT_SPEED, 12500000U, 3U);
+  CHECK_EQ(sd_bus.crc_errors - crc_errors, 2U);
+  CHECK_EQ(sd_bus.timeouts - timeouts, 4U);
+  CHECK(memcmp(test_buffer, sd_sim_block(1400U), sizeof(test_buffer)) == 0);
+}
+
+int main(void)
+{
+  test_select_dumps();
+  test_setup();
+  test_fallbacks();
+
+  return test_report("test_msc_sd_bus");
+}
@@ -0,0 +1,184 @@
+/**
+  ******************************************************************************
+  * @file    test_msc_sd_cmds.c
+  * @brief   Host checks of the SD commands each SCSI command costs
+  ******************************************************************************
+  * SCSI commands go through the storage class of msc_sim.c to the SD media
+  * over the simulated card of sd_sim.c. MSC_Media_SD_GetCmdStats() gives
+  * the SD commands the media sent for each, checked against what the card
+  * saw: the card session answers the status and geometry commands without
+  * the card, data commands cost one CMD17/18/24/25 per chunk of the class
+  * buffer at most, and the card is only polled while it programs.
+  ******************************************************************************
+  */
+#include "msc_sim.h"
+#include "test.h"
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define TEST_BLOCKS        65536U       /* 32 MB card */
+#define TEST_CHUNK_BLOCKS  (UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE / 512U)
+#define TEST_RA_LINES      4U           /* SD_RA_LINES of the media */
+
+static UCHAR test_buffer[128U * 512U];
+
+/* SD commands sent since the last test_begin(), by the media and as the
+   card saw them */
+static MSC_MediaCmdStatsTypeDef test_media;
+static SD_SimStatsTypeDef test_card;
+
+static VOID test_begin(VOID)
+{
+  MSC_Media_SD_GetCmdStats(&test_media);
+  test_card = sd_sim_stats;
+}
+
+static VOID test_end(MSC_MediaCmdStatsTypeDef *media, SD_SimStatsTypeDef *card)
+{
+  MSC_MediaCmdStatsTypeDef now;
+
+  MSC_Media_SD_GetCmdStats(&now);
+  media->scsi_commands = now.scsi_commands - test_media.scsi_commands;
+  media->data_commands = now.data_commands - test_media.data_commands;
+  media->stop_commands = now.stop_commands - test_media.stop_commands;
+  media->status_polls = now.status_polls - test_media.status_polls;
+  media->info_commands = now.info_commands - test_media.info_commands;
+  media->erase_commands = now.erase_commands - test_media.erase_commands;
+
+  card->read_commands = sd_sim_stats.read_commands - test_card.read_commands;
+  card->write_commands = sd_sim_stats.write_commands - test_card.write_commands;
+  card->status_polls = sd_sim_stats.status_polls - test_card.status_polls;
+  card->erase_commands = sd_sim_stats.erase_commands - test_card.erase_commands;
+
+  /* The statistics of the media are the commands the card got */
+  CHECK_EQ(media->data_commands, card->read_commands + card->write_commands);
+  CHECK_EQ(media->status_polls, card->status_polls);
+  CHECK_EQ(media->erase_commands, card->erase_commands);
+}
+
+/* Commands answered from the card session: no SD command at all */
+static void test_no_card(void)
+{
+  MSC_MediaCmdStatsTypeDef media;
+  SD_SimStatsTypeDef card;
+  UCHAR capacity[10] = { UX_SLAVE_CLASS_STORAGE_SCSI_READ_CAPACITY };
+  UCHAR inquiry[6] = { UX_SLAVE_CLASS_STORAGE_SCSI_INQUIRY, 0U, 0U, 0U, 36U, 0U };
+  UCHAR mode_sense[6] = { UX_SLAVE_CLASS_STORAGE_SCSI_MODE_SENSE_SHORT, 0U, 0x3FU, 0U, 64U, 0U };
+  UINT i;
+
+  test_begin();
+  for (i = 0U; i < 100U; i++)
+  {
+    CHECK_EQ(msc_sim_test_unit_ready(0U), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+    msc_sim_idle(1000U);
+  }
+  CHECK_EQ(msc_sim_command(0U, capacity, sizeof(capacity), MSC_SIM_IN, test_buffer, 8U),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_command(0U, inquiry, sizeof(inquiry), MSC_SIM_IN, test_buffer, 36U),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_command(0U, mode_sense, sizeof(mode_sense), MSC_SIM_IN, test_buffer, 64U),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  test_end(&media, &card);
+
+  CHECK(media.scsi_commands >= 100U);
+  CHECK_EQ(media.data_commands + media.stop_commands + media.status_polls + media.info_commands, 0U);
+}
+
+/* A cold read: one CMD18 and its CMD12 per chunk of the class buffer, and
+   per line the read-ahead fetches once the stream is seen. No CMD13 as
+   nothing was written before. */
+static void test_read(void)
+{
+  MSC_MediaCmdStatsTypeDef media;
+  SD_SimStatsTypeDef card;
+
+  test_begin();
+  CHECK_EQ(msc_sim_read(0U, 20000U, 128U, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  test_end(&media, &card);
+
+  CHECK(media.data_commands >= 1U);
+  CHECK(media.data_commands <= ((128U / TEST_CHUNK_BLOCKS) + TEST_RA_LINES));
+  CHECK_EQ(media.stop_commands, media.data_commands);
+  CHECK_EQ(media.status_polls, 0U);
+  CHECK_EQ(card.write_commands, 0U);
+
+  /* A single block: CMD17, no CMD12 */
+  msc_sim_idle(200000U);
+  test_begin();
+  CHECK_EQ(msc_sim_read(0U, 30000U, 1U, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  test_end(&media, &card);
+  CHECK_EQ(media.data_commands, 1U);
+  CHECK_EQ(media.stop_commands, 0U);
+}
+
+/* Small writes stay in the cache until the flush, which sends one CMD25
+   for the whole run and polls the card while it programs */
+static void test_write(void)
+{
+  MSC_MediaCmdStatsTypeDef media;
+  SD_SimStatsTypeDef card;
+  ULONG lba;
+
+  memset(test_buffer, 0x5A, sizeof(test_buffer));
+  test_begin();
+  for (lba = 40000U; lba < 40016U; lba += 4U)
+  {
+    CHECK_EQ(msc_sim_write(0U, lba, 4U, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  }
+  test_end(&media, &card);
+  CHECK_EQ(media.data_commands + media.status_polls, 0U);
+
+  test_begin();
+  CHECK_EQ(msc_sim_synchronize_cache(0U), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  test_end(&media, &card);
+  CHECK_EQ(card.write_commands, 1U);
+  CHECK_EQ(media.stop_commands, 1U);
+  CHECK(media.status_polls >= 1U);
+  CHECK(sd_sim_mapped(40000U) && sd_sim_mapped(40015U));
+
+  /* Nothing left to write: a second flush costs nothing once the card is done */
+  msc_sim_idle(100000U);
+  test_begin();
+  CHECK_EQ(msc_sim_synchronize_cache(0U), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  test_end(&media, &card);
+  CHECK_EQ(media.data_commands, 0U);
+  CHECK(media.status_polls <= 1U);
+}
+
+/* The SD status is read once per card, not per command */
+static void test_session(void)
+{
+  MSC_MediaCmdStatsTypeDef media;
+  SD_SimCardTypeDef card;
+  SD_SimStatsTypeDef card_stats;
+
+  sd_sim_remove();
+  msc_sim_idle(100000U);
+  test_begin();
+  sd_sim_card_default(&card, TEST_BLOCKS);
+  sd_sim_insert(&card);
+  CHECK(msc_sim_wait_ready(0U, 2000U));
+  CHECK_EQ(msc_sim_read(0U, 50000U, 8U, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_test_unit_ready(0U), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  test_end(&media, &card_stats);
+  CHECK_EQ(media.info_commands, 1U);
+}
+
+int main(void)
+{
+  SD_SimCardTypeDef card;
+
+  msc_sim_connect();
+  sd_sim_card_default(&card, TEST_BLOCKS);
+  sd_sim_insert(&card);
+  CHECK(msc_sim_wait_ready(0U, 2000U));
+  msc_sim_idle(100000U);
+
+  test_no_card();
+  test_read();
+  test_write();
+  test_session();
+
+  return test_report("test_msc_sd_cmds");
+}
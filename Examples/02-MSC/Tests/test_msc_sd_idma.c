@@ -0,0 +1,239 @@
+/**
+  ******************************************************************************
+  * @file    test_msc_sd_idma.c
+  * @brief   Host checks of the IDMA linked lists of the SD media
+  ******************************************************************************
+  * The IDMA model of sd_sim.c runs the lists the HAL calls build: node
+  * buffers in list order, the next node found at its offset from the head,
+  * a transfer error on a bad node or a list too short.
+  * msc_media_sd.c is built into this file to look at its write-back cache:
+  * adjacent lines go out in one CMD25 chained in list order, also when the
+  * run on the card wraps around the end of the line array.
+  ******************************************************************************
+  */
+#include "../USBX/App/msc_media_sd.c"
+#include "sd_sim.h"
+#include "test.h"
+
+TEST_MAIN_DEFINE
+
+#define TEST_BLOCKS        65536U       /* 32 MB card */
+#define TEST_STEP_US       50U          /* main loop period */
+#define TEST_MAX_STEPS     100000U
+#define TEST_LINE_BLOCKS   SD_WCACHE_LINE_BLOCKS
+
+static UCHAR test_pattern[SD_WCACHE_LINES * TEST_LINE_BLOCKS * 512U];
+
+static VOID test_fill(UCHAR *buffer, ULONG length)
+{
+  ULONG i;
+
+  for (i = 0U; i < length; i++)
+  {
+    buffer[i] = (UCHAR)test_random();
+  }
+}
+
+/* Node buffers and the card side of the model, word aligned */
+static uint32_t test_buffers[3][512];
+static uint32_t test_card[4096 / 4];
+static SD_DMALinkNodeTypeDef test_nodes[4];
+
+/* A list over the nodes in 'order', node n with 'sizes[n]' bytes of
+   test_buffers[n] */
+static VOID test_list(SD_DMALinkedListTypeDef *list, const UINT *order, UINT count, const ULONG *sizes)
+{
+  SD_DMALinkNodeConfTypeDef conf;
+  UINT i;
+
+  memset(list, 0, sizeof(*list));
+  for (i = 0U; i < count; i++)
+  {
+    conf.BufferAddress = (uint32_t)(uintptr_t)test_buffers[i];
+    conf.BufferSize = sizes[i];
+    CHECK_EQ(HAL_SDEx_DMALinkedList_BuildNode(&test_nodes[order[i]], &conf), HAL_OK);
+    CHECK_EQ(HAL_SDEx_DMALinkedList_InsertNode(list, list->pTailNode, &test_nodes[order[i]]), HAL_OK);
+  }
+}
+
+/* The model against lists built by the HAL calls */
+static void test_model(void)
+{
+  static const UINT in_order[] = { 0U, 1U, 2U };
+  static const UINT wrapped[] = { 2U, 3U, 0U };
+  static const ULONG sizes[] = { 1024U, 512U, 2048U };
+  static const ULONG bad_size[] = { 1024U, 1000U, 2048U };
+  SD_DMALinkedListTypeDef list;
+  UCHAR *card = (UCHAR *)test_card;
+  ULONG list_errors;
+
+  /* A read scatters the card data over the buffers in list order */
+  test_fill(card, 3584U);
+  memset(test_buffers, 0, sizeof(test_buffers));
+  test_list(&list, in_order, 3U, sizes);
+  CHECK_EQ(list.NodesCounter, 3U);
+  CHECK_EQ(sd_sim_idma_list(list.pHeadNode, 3584U, card, UX_FALSE), 3U);
+  CHECK(memcmp(test_buffers[0], &card[0], 1024U) == 0);
+  CHECK(memcmp(test_buffers[1], &card[1024], 512U) == 0);
+  CHECK(memcmp(test_buffers[2], &card[1536], 2048U) == 0);
+
+  /* The data path ends the transfer inside a node */
+  CHECK_EQ(sd_sim_idma_list(list.pHeadNode, 1536U, UX_NULL, UX_FALSE), 2U);
+  CHECK_EQ(sd_sim_idma_list(list.pHeadNode, 2048U, UX_NULL, UX_FALSE), 3U);
+
+  /* A write gathers them */
+  memset(card, 0, 3584U);
+  CHECK_EQ(sd_sim_idma_list(list.pHeadNode, 3584U, card, UX_TRUE), 3U);
+  CHECK(memcmp(&card[0], test_buffers[0], 1024U) == 0);
+  CHECK(memcmp(&card[1024], test_buffers[1], 512U) == 0);
+  CHECK(memcmp(&card[1536], test_buffers[2], 2048U) == 0);
+
+  /* More data than the buffers: underrun without a next node */
+  CHECK_EQ(sd_sim_idma_list(list.pHeadNode, 4096U, UX_NULL, UX_FALSE), 0U);
+
+  /* Buffers of the IDMA are multiples of 32 bytes at word addresses */
+  test_list(&list, in_order, 3U, bad_size);
+  CHECK_EQ(sd_sim_idma_list(list.pHeadNode, 3584U, UX_NULL, UX_FALSE), 0U);
+  test_list(&list, in_order, 3U, sizes);
+  test_nodes[1].IDMABASER += 2U;
+  CHECK_EQ(sd_sim_idma_list(list.pHeadNode, 3584U, UX_NULL, UX_FALSE), 0U);
+
+  /* Nodes taken round a ring: the link is an offset from the head node,
+     a node below it cannot be chained */
+  list_errors = sd_sim_stats.list_errors;
+  test_list(&list, wrapped, 3U, sizes);
+  CHECK_EQ(sd_sim_stats.list_errors - list_errors, 1U);
+  CHECK_EQ(list.NodesCounter, 2U);
+  CHECK_EQ(sd_sim_idma_list(list.pHeadNode, 3584U, UX_NULL, UX_FALSE), 0U);
+}
+
+/* Insert a card and poll the media as the storage class does until the
+   host would see it ready */
+static VOID test_open(const SD_SimCardTypeDef *card)
+{
+  ULONG media_status;
+  ULONG steps;
+
+  sd_sim_insert(card);
+  for (steps = 0U; steps < TEST_MAX_STEPS; steps++)
+  {
+    MSC_Media_SD.Process();
+    media_status = 0U;
+    if (MSC_Media_SD.Status(&media_status) == UX_SUCCESS)
+    {
+      break;
+    }
+    sd_sim_advance(1000U);
+  }
+  CHECK_EQ(MSC_Media_SD.GetLastLba(), card->blocks - 1U);
+}
+
+/* A write of one line or a flush, run to its end */
+static UINT test_write(ULONG lba, ULONG blocks, UCHAR *buffer)
+{
+  ULONG media_status;
+  UINT status;
+  ULONG steps;
+
+  for (steps = 0U; steps < TEST_MAX_STEPS; steps++)
+  {
+    media_status = 0U;
+    status = (buffer != UX_NULL) ?
+             MSC_Media_Write(&MSC_Media_SD, buffer, blocks, lba, &media_status) :
+             MSC_Media_Flush(&MSC_Media_SD, &media_status);
+    if (status != UX_STATE_WAIT)
+    {
+      return status;
+    }
+    sd_sim_advance(TEST_STEP_US);
+  }
+
+  return UX_STATE_WAIT;
+}
+
+/* One CMD25 out of 'nodes' lines since 'before', the run on the card */
+static VOID test_chained(const SD_SimStatsTypeDef *before, ULONG nodes, ULONG lba, ULONG blocks)
+{
+  CHECK_EQ(sd_sim_stats.write_commands - before->write_commands, 1U);
+  CHECK_EQ(sd_sim_stats.linked_lists - before->linked_lists, 1U);
+  CHECK_EQ(sd_sim_stats.linked_nodes - before->linked_nodes, nodes);
+  CHECK_EQ(sd_sim_stats.list_errors, before->list_errors);
+  CHECK(memcmp(sd_sim_block(lba), test_pattern, blocks * 512U) == 0);
+}
+
+/* Full lines in order on the card and in the cache */
+static void test_lines(void)
+{
+  SD_SimStatsTypeDef before;
+  ULONG i;
+
+  test_fill(test_pattern, sizeof(test_pattern));
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    CHECK_EQ(test_write(20000U + (i * TEST_LINE_BLOCKS), TEST_LINE_BLOCKS,
+                        &test_pattern[i * TEST_LINE_BLOCKS * 512U]), UX_STATE_NEXT);
+  }
+  CHECK_EQ(sd_sim_stats.write_commands, 0U);
+
+  before = sd_sim_stats;
+  CHECK_EQ(test_write(0U, 0U, UX_NULL), UX_STATE_NEXT);
+  test_chained(&before, SD_WCACHE_LINES, 20000U, SD_WCACHE_LINES * TEST_LINE_BLOCKS);
+}
+
+/* A run on the card that starts in line 2 and wraps to lines 0 and 1, the
+   last one half full */
+static const ULONG test_wrap_lba[] = { 30064U, 30096U, 30000U, 30032U };
+static const ULONG test_wrap_blocks[] = { 32U, 16U, 32U, 32U };
+
+static VOID test_wrap_lines(VOID)
+{
+  ULONG i;
+
+  test_fill(test_pattern, sizeof(test_pattern));
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    CHECK_EQ(test_write(test_wrap_lba[i], test_wrap_blocks[i],
+                        &test_pattern[(test_wrap_lba[i] - 30000U) * 512U]), UX_STATE_NEXT);
+    CHECK_EQ(sd_wcache[i].lba, test_wrap_lba[i]);
+  }
+}
+
+/* Flushing from line 0 or evicting it writes the whole run */
+static void test_wrap(void)
+{
+  SD_SimStatsTypeDef before;
+  UCHAR data[8U * 512U];
+  ULONG lines = 0U;
+  ULONG i;
+
+  test_wrap_lines();
+  before = sd_sim_stats;
+  CHECK_EQ(test_write(0U, 0U, UX_NULL), UX_STATE_NEXT);
+  test_chained(&before, SD_WCACHE_LINES, 30000U, 112U);
+
+  /* Line 0 is the oldest, a new run takes its place */
+  test_wrap_lines();
+  before = sd_sim_stats;
+  test_fill(data, sizeof(data));
+  CHECK_EQ(test_write(40000U, 8U, data), UX_STATE_NEXT);
+  test_chained(&before, SD_WCACHE_LINES, 30000U, 112U);
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    lines += (sd_wcache[i].number_blocks != 0U) ? 1U : 0U;
+  }
+  CHECK_EQ(lines, 1U);
+}
+
+int main(void)
+{
+  SD_SimCardTypeDef card;
+
+  test_model();
+
+  sd_sim_card_default(&card, TEST_BLOCKS);
+  test_open(&card);
+  test_lines();
+  test_wrap();
+
+  return test_report("test_msc_sd_idma");
+}
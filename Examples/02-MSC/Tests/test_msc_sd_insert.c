@@ -0,0 +1,222 @@
+/**
+  ******************************************************************************
+  * @file    test_msc_sd_insert.c
+  * @brief   Host checks of card insertions and removals seen by the host
+  ******************************************************************************
+  * A scripted host polls the SD LUN through the storage class of msc_sim.c
+  * as cards of sd_sim.c come and go: TEST UNIT READY every 10 ms, REQUEST
+  * SENSE after each failure. While a card is identified the LUN reports
+  * that it is becoming ready, then the change of medium once, then it is
+  * ready. The identification runs in steps from the main loop, no pass of
+  * it may hold the USB tasks for more than a few commands.
+  ******************************************************************************
+  */
+#include "msc_sim.h"
+#include "test.h"
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define TEST_SD_LUN        0U
+#define TEST_RAM_LUN       1U
+#define TEST_BLOCKS        65536U       /* 32 MB card */
+#define TEST_POLL_US       10000U       /* host polling period */
+#define TEST_LOOP_MAX_US   5000U        /* longest main loop pass allowed */
+
+#define SENSE(key, code, qualifier) \
+  UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_##key, code, qualifier)
+
+#define SENSE_NO_MEDIUM    SENSE(NOT_READY, 0x3A, 0x00)
+#define SENSE_BECOMING     SENSE(NOT_READY, 0x04, 0x01)
+#define SENSE_CHANGED      SENSE(UNIT_ATTENTION, 0x28, 0x00)
+
+static UCHAR test_buffer[8U * 512U];
+
+/* What the host saw while polling */
+typedef struct
+{
+  ULONG no_medium;          /* 02/3A/00 */
+  ULONG becoming_ready;     /* 02/04/01 */
+  ULONG changed;            /* 06/28/00 */
+  ULONG other;
+  UINT ready;
+  ULONG ready_ms;           /* from the start of the polling */
+} TEST_PollTypeDef;
+
+/* Poll the SD LUN for 'ms' or until it is ready */
+static VOID test_poll(TEST_PollTypeDef *poll, ULONG ms)
+{
+  ULONG64 start = sd_sim_time;
+  ULONG sense;
+
+  memset(poll, 0, sizeof(*poll));
+  while (sd_sim_time < (start + ((ULONG64)ms * 1000U)))
+  {
+    if (msc_sim_test_unit_ready(TEST_SD_LUN) == UX_SLAVE_CLASS_STORAGE_CSW_PASSED)
+    {
+      poll->ready = UX_TRUE;
+      poll->ready_ms = (ULONG)((sd_sim_time - start) / 1000U);
+      return;
+    }
+    sense = msc_sim_request_sense(TEST_SD_LUN);
+    if (sense == SENSE_NO_MEDIUM)
+    {
+      poll->no_medium++;
+    }
+    else if (sense == SENSE_BECOMING)
+    {
+      poll->becoming_ready++;
+    }
+    else if (sense == SENSE_CHANGED)
+    {
+      poll->changed++;
+    }
+    else
+    {
+      poll->other++;
+    }
+    msc_sim_idle(TEST_POLL_US);
+  }
+}
+
+/* READ CAPACITY(10) of the SD LUN: bCSWStatus, the last LBA when it passed */
+static UCHAR test_capacity(ULONG *last_lba)
+{
+  UCHAR cdb[10] = { UX_SLAVE_CLASS_STORAGE_SCSI_READ_CAPACITY };
+  UCHAR data[8];
+  UCHAR status;
+
+  memset(data, 0, sizeof(data));
+  status = msc_sim_command(TEST_SD_LUN, cdb, sizeof(cdb), MSC_SIM_IN, data, sizeof(data));
+  *last_lba = _ux_utility_long_get_big_endian(&data[0]);
+  return status;
+}
+
+/* No card at power up, then one inserted: not present, becoming ready
+   while it is identified, changed once, ready */
+static void test_insert(void)
+{
+  SD_SimCardTypeDef card;
+  TEST_PollTypeDef poll;
+  ULONG last_lba = 0U;
+
+  test_poll(&poll, 100U);
+  CHECK(!poll.ready);
+  CHECK(poll.no_medium > 0U);
+  CHECK_EQ(poll.becoming_ready + poll.changed + poll.other, 0U);
+
+  msc_sim_stats.loop_max_us = 0U;
+  sd_sim_card_default(&card, TEST_BLOCKS);
+  sd_sim_insert(&card);
+
+  /* Past the debounce, in the middle of the ACMD41 polling: the host is
+     told to wait, the capacity is not there yet */
+  msc_sim_idle(100000U);
+  CHECK_EQ(msc_sim_test_unit_ready(TEST_SD_LUN), UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_request_sense(TEST_SD_LUN), SENSE_BECOMING);
+  CHECK_EQ(test_capacity(&last_lba), UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_request_sense(TEST_SD_LUN), SENSE_BECOMING);
+
+  /* The other LUNs answer meanwhile */
+  CHECK_EQ(msc_sim_read(TEST_RAM_LUN, 0U, 8U, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+
+  /* Ready once the card has powered up, 200 ms after the debounce */
+  test_poll(&poll, 1000U);
+  CHECK(poll.ready);
+  CHECK(poll.ready_ms >= 100U);
+  CHECK(poll.becoming_ready > 0U);
+  CHECK_EQ(poll.changed, 1U);
+  CHECK_EQ(poll.no_medium + poll.other, 0U);
+  CHECK_EQ(test_capacity(&last_lba), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(last_lba, TEST_BLOCKS - 1U);
+  CHECK(msc_sim_stats.loop_max_us <= TEST_LOOP_MAX_US);
+}
+
+/* Removed: not present until a new card is in, a card pulled out during
+   its identification is never reported ready */
+static void test_remove(void)
+{
+  SD_SimCardTypeDef card;
+  TEST_PollTypeDef poll;
+  ULONG last_lba = 0U;
+
+  /* Seen once the detect switch settled */
+  sd_sim_remove();
+  msc_sim_idle(60000U);
+  test_poll(&poll, 100U);
+  CHECK(!poll.ready);
+  CHECK(poll.no_medium > 0U);
+  CHECK_EQ(poll.becoming_ready + poll.changed + poll.other, 0U);
+  CHECK_EQ(msc_sim_read(TEST_SD_LUN, 0U, 8U, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_request_sense(TEST_SD_LUN), SENSE_NO_MEDIUM);
+
+  /* In and out again before the card is out of idle */
+  msc_sim_stats.loop_max_us = 0U;
+  sd_sim_card_default(&card, 2U * TEST_BLOCKS);
+  sd_sim_insert(&card);
+  msc_sim_idle(120000U);
+  CHECK_EQ(msc_sim_test_unit_ready(TEST_SD_LUN), UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_request_sense(TEST_SD_LUN), SENSE_BECOMING);
+  sd_sim_remove();
+  test_poll(&poll, 500U);
+  CHECK(!poll.ready);
+  CHECK_EQ(poll.changed, 0U);
+
+  /* The switch bounces on the way in: only the card that stays counts */
+  sd_sim_insert(&card);
+  msc_sim_idle(20000U);
+  sd_sim_remove();
+  msc_sim_idle(20000U);
+  sd_sim_insert(&card);
+  test_poll(&poll, 1000U);
+  CHECK(poll.ready);
+  CHECK_EQ(poll.changed, 1U);
+  CHECK_EQ(test_capacity(&last_lba), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(last_lba, (2U * TEST_BLOCKS) - 1U);
+  CHECK_EQ(msc_sim_read(TEST_SD_LUN, 1000U, 8U, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK(msc_sim_stats.loop_max_us <= TEST_LOOP_MAX_US);
+}
+
+/* A card that stays busy on ACMD41: identified again and again, becoming
+   ready all along, the main loop never held */
+static void test_no_power_up(void)
+{
+  SD_SimCardTypeDef card;
+  TEST_PollTypeDef poll;
+  ULONG identifications;
+
+  sd_sim_remove();
+  msc_sim_idle(100000U);
+  msc_sim_stats.loop_max_us = 0U;
+  identifications = sd_sim_stats.identifications;
+  sd_sim_card_default(&card, TEST_BLOCKS);
+  card.identify_us = 10000000U;
+  sd_sim_insert(&card);
+  test_poll(&poll, 4000U);
+  CHECK(!poll.ready);
+  CHECK(poll.becoming_ready > 0U);
+  CHECK_EQ(poll.changed + poll.other, 0U);
+  CHECK(sd_sim_stats.identifications - identifications >= 2U);
+  CHECK(msc_sim_stats.loop_max_us <= TEST_LOOP_MAX_US);
+  CHECK_EQ(msc_sim_read(TEST_RAM_LUN, 0U, 8U, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+
+  /* A good card in its place */
+  sd_sim_remove();
+  msc_sim_idle(100000U);
+  sd_sim_card_default(&card, TEST_BLOCKS);
+  sd_sim_insert(&card);
+  test_poll(&poll, 1000U);
+  CHECK(poll.ready);
+  CHECK_EQ(poll.changed, 1U);
+}
+
+int main(void)
+{
+  msc_sim_connect();
+
+  test_insert();
+  test_remove();
+  test_no_power_up();
+
+  return test_report("test_msc_sd_insert");
+}
@@ -0,0 +1,239 @@
+/**
+  ******************************************************************************
+  * @file    test_msc_storage.c
+  * @brief   Host checks of the LUN dispatch of ux_device_msc.c
+  ******************************************************************************
+  * The storage class runs over msc_sim.c with the three LUNs of
+  * ux_device_msc.c: the SD card of sd_sim.c on LUN 0, the RAM disk of
+  * msc_media_ram.c on LUN 1 and the RAM stand-in of the flash on LUN 2, the
+  * last two synchronous block devices behind the adaptation of msc_media.c.
+  * Each LUN must report its own geometry and flags, keep its own data, and
+  * the removable one must follow a card change.
+  ******************************************************************************
+  */
+#include "msc_sim.h"
+#include "test.h"
+#include <string.h>
+
+TEST_MAIN_DEFINE
+
+#define TEST_SD_LUN        0U
+#define TEST_RAM_LUN       1U
+#define TEST_FLASH_LUN     2U
+#define TEST_RAM_BLOCKS    128U         /* MSC_RAM_BLOCK_NUMBER */
+#define TEST_FLASH_BLOCKS  256U         /* the stand-in of msc_sim.c */
+#define TEST_BLOCKS        32U
+
+static UCHAR test_pattern[TEST_BLOCKS * 512U];
+static UCHAR test_buffer[TEST_BLOCKS * 512U];
+
+#define SENSE(key, code, qualifier) \
+  UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_##key, code, qualifier)
+
+static VOID test_fill(UCHAR *buffer, ULONG blocks)
+{
+  ULONG i;
+
+  for (i = 0U; i < (blocks * 512U); i++)
+  {
+    buffer[i] = (UCHAR)test_random();
+  }
+}
+
+/* READ CAPACITY(10): last LBA and block length, UX_FALSE on failure */
+static UINT test_capacity(UCHAR lun, ULONG *last_lba, ULONG *block_length)
+{
+  UCHAR cdb[10] = { UX_SLAVE_CLASS_STORAGE_SCSI_READ_CAPACITY };
+  UCHAR data[8];
+
+  if (msc_sim_command(lun, cdb, sizeof(cdb), MSC_SIM_IN, data, sizeof(data)) !=
+      UX_SLAVE_CLASS_STORAGE_CSW_PASSED)
+  {
+    return UX_FALSE;
+  }
+  *last_lba = _ux_utility_long_get_big_endian(&data[0]);
+  *block_length = _ux_utility_long_get_big_endian(&data[4]);
+  return UX_TRUE;
+}
+
+/* Standard INQUIRY data, byte 1 bit 7 is RMB */
+static UINT test_removable(UCHAR lun)
+{
+  UCHAR cdb[6] = { UX_SLAVE_CLASS_STORAGE_SCSI_INQUIRY, 0U, 0U, 0U, 36U, 0U };
+  UCHAR data[36];
+
+  memset(data, 0, sizeof(data));
+  CHECK_EQ(msc_sim_command(lun, cdb, sizeof(cdb), MSC_SIM_IN, data, sizeof(data)),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  return (data[1] & 0x80U) != 0U;
+}
+
+/* Each LUN describes its own block device */
+static void test_geometry(void)
+{
+  ULONG last_lba = 0U;
+  ULONG block_length = 0U;
+
+  CHECK(test_capacity(TEST_SD_LUN, &last_lba, &block_length));
+  CHECK_EQ(last_lba, 65535U);
+  CHECK_EQ(block_length, 512U);
+  CHECK(test_capacity(TEST_RAM_LUN, &last_lba, &block_length));
+  CHECK_EQ(last_lba, TEST_RAM_BLOCKS - 1U);
+  CHECK_EQ(block_length, 512U);
+  CHECK(test_capacity(TEST_FLASH_LUN, &last_lba, &block_length));
+  CHECK_EQ(last_lba, TEST_FLASH_BLOCKS - 1U);
+
+  CHECK(test_removable(TEST_SD_LUN));
+  CHECK(!test_removable(TEST_RAM_LUN));
+  CHECK(!test_removable(TEST_FLASH_LUN));
+}
+
+/* The same blocks of the three LUNs hold different data */
+static void test_data(void)
+{
+  static UCHAR sd_data[TEST_BLOCKS * 512U];
+  static UCHAR ram_data[TEST_BLOCKS * 512U];
+  static UCHAR flash_data[TEST_BLOCKS * 512U];
+
+  test_fill(sd_data, TEST_BLOCKS);
+  test_fill(ram_data, TEST_BLOCKS);
+  test_fill(flash_data, TEST_BLOCKS);
+  CHECK_EQ(msc_sim_write(TEST_SD_LUN, 64U, TEST_BLOCKS, sd_data), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_write(TEST_RAM_LUN, 64U, TEST_BLOCKS, ram_data), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_write(TEST_FLASH_LUN, 64U, TEST_BLOCKS, flash_data),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_synchronize_cache(TEST_SD_LUN), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_synchronize_cache(TEST_RAM_LUN), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+
+  CHECK_EQ(msc_sim_read(TEST_RAM_LUN, 64U, TEST_BLOCKS, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK(memcmp(test_buffer, ram_data, sizeof(ram_data)) == 0);
+  CHECK_EQ(msc_sim_read(TEST_FLASH_LUN, 64U, TEST_BLOCKS, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK(memcmp(test_buffer, flash_data, sizeof(flash_data)) == 0);
+  CHECK_EQ(msc_sim_read(TEST_SD_LUN, 64U, TEST_BLOCKS, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK(memcmp(test_buffer, sd_data, sizeof(sd_data)) == 0);
+  CHECK(memcmp(sd_sim_block(64U), sd_data, sizeof(sd_data)) == 0);
+
+  /* A short write at the end of the RAM disk */
+  test_fill(test_pattern, 2U);
+  CHECK_EQ(msc_sim_write(TEST_RAM_LUN, TEST_RAM_BLOCKS - 2U, 2U, test_pattern),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_read(TEST_RAM_LUN, TEST_RAM_BLOCKS - 2U, 2U, test_buffer),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK(memcmp(test_buffer, test_pattern, 2U * 512U) == 0);
+}
+
+/* Commands past the end of a LUN or that its block device cannot run fail
+   without touching the data */
+static void test_rejects(void)
+{
+  UCHAR cdb[10] = { UX_SLAVE_CLASS_STORAGE_SCSI_UNMAP, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 24U, 0U };
+  UCHAR parameters[24];
+
+  test_fill(test_pattern, 2U);
+  CHECK_EQ(msc_sim_write(TEST_RAM_LUN, TEST_RAM_BLOCKS - 1U, 2U, test_pattern),
+           UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_request_sense(TEST_RAM_LUN), SENSE(ILLEGAL_REQUEST, 0x21, 0x00));
+  CHECK_EQ(msc_sim_read(TEST_FLASH_LUN, TEST_FLASH_BLOCKS, 1U, test_buffer),
+           UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_request_sense(TEST_FLASH_LUN), SENSE(ILLEGAL_REQUEST, 0x21, 0x00));
+
+  /* A media error fails the command with the sense of the media */
+  sd_sim_fail(HAL_SD_ERROR_RX_OVERRUN, 1U);
+  CHECK_EQ(msc_sim_read(TEST_SD_LUN, 4096U, TEST_BLOCKS, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_request_sense(TEST_SD_LUN), SENSE(MEDIUM_ERROR, 0x11, 0x00));
+  CHECK_EQ(msc_sim_read(TEST_SD_LUN, 4096U, TEST_BLOCKS, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+
+  /* Only the SD card can discard: UNMAP is unknown on the RAM disk */
+  memset(parameters, 0, sizeof(parameters));
+  parameters[1] = 22U;
+  parameters[3] = 16U;
+  parameters[11] = 64U;
+  parameters[19] = 8U;
+  CHECK_EQ(msc_sim_command(TEST_RAM_LUN, cdb, sizeof(cdb), MSC_SIM_OUT, parameters, sizeof(parameters)),
+           UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_request_sense(TEST_RAM_LUN), SENSE(ILLEGAL_REQUEST, 0x20, 0x00));
+  CHECK_EQ(msc_sim_read(TEST_RAM_LUN, 64U, 8U, test_buffer), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+}
+
+/* UNMAP of whole erase groups (4 MB AU, 8192 blocks) on the SD card. The
+   host sending more than the parameter list (cases 9 and 11) gets the OUT
+   endpoint stalled and a failed CSW, and the blocks stay mapped. */
+static void test_unmap(void)
+{
+  UCHAR cdb[10] = { UX_SLAVE_CLASS_STORAGE_SCSI_UNMAP, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 24U, 0U };
+  UCHAR parameters[512];
+  ULONG stalls_out;
+
+  test_fill(test_pattern, TEST_BLOCKS);
+  CHECK_EQ(msc_sim_write(TEST_SD_LUN, 8192U, TEST_BLOCKS, test_pattern), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_write(TEST_SD_LUN, 16384U - TEST_BLOCKS, TEST_BLOCKS, test_pattern),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_synchronize_cache(TEST_SD_LUN), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK(sd_sim_mapped(8192U) && sd_sim_mapped(16383U));
+
+  memset(parameters, 0, sizeof(parameters));
+  parameters[1] = 22U;
+  parameters[3] = 16U;
+  parameters[14] = 0x20U;               /* LBA 8192 */
+  parameters[18] = 0x20U;               /* 8192 blocks */
+
+  stalls_out = msc_sim_stats.stalls_out;
+  CHECK_EQ(msc_sim_command(TEST_SD_LUN, cdb, sizeof(cdb), MSC_SIM_OUT, parameters, sizeof(parameters)),
+           UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_stats.stalls_out - stalls_out, 1U);
+  CHECK_EQ(msc_sim_stats.residue, sizeof(parameters) - 24U);
+  CHECK(sd_sim_mapped(8192U) && sd_sim_mapped(16383U));
+  CHECK(memcmp(sd_sim_block(8192U), test_pattern, sizeof(test_pattern)) == 0);
+
+  /* The parameter list alone: the whole group is discarded */
+  CHECK_EQ(msc_sim_command(TEST_SD_LUN, cdb, sizeof(cdb), MSC_SIM_OUT, parameters, 24U),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK(!sd_sim_mapped(8192U) && !sd_sim_mapped(16383U));
+}
+
+/* A new card of another size: the host is told, then sees its capacity.
+   The other LUNs are ready all along. */
+static void test_card_change(void)
+{
+  SD_SimCardTypeDef card;
+  ULONG last_lba = 0U;
+  ULONG block_length = 0U;
+
+  sd_sim_remove();
+  msc_sim_idle(100000U);
+  CHECK_EQ(msc_sim_test_unit_ready(TEST_SD_LUN), UX_SLAVE_CLASS_STORAGE_CSW_FAILED);
+  CHECK_EQ(msc_sim_request_sense(TEST_SD_LUN), SENSE(NOT_READY, 0x3A, 0x00));
+  CHECK_EQ(msc_sim_test_unit_ready(TEST_RAM_LUN), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+
+  sd_sim_card_default(&card, 131072U);
+  sd_sim_insert(&card);
+  CHECK(msc_sim_wait_ready(TEST_SD_LUN, 2000U));
+  CHECK(test_capacity(TEST_SD_LUN, &last_lba, &block_length));
+  CHECK_EQ(last_lba, 131071U);
+  CHECK_EQ(msc_sim_test_unit_ready(TEST_FLASH_LUN), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+
+  /* Blocks past the end of the first card are there now */
+  test_fill(test_pattern, TEST_BLOCKS);
+  CHECK_EQ(msc_sim_write(TEST_SD_LUN, 100000U, TEST_BLOCKS, test_pattern),
+           UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK_EQ(msc_sim_synchronize_cache(TEST_SD_LUN), UX_SLAVE_CLASS_STORAGE_CSW_PASSED);
+  CHECK(memcmp(sd_sim_block(100000U), test_pattern, sizeof(test_pattern)) == 0);
+}
+
+int main(void)
+{
+  SD_SimCardTypeDef card;
+
+  msc_sim_connect();
+  sd_sim_card_default(&card, 65536U);
+  sd_sim_insert(&card);
+  CHECK(msc_sim_wait_ready(TEST_SD_LUN, 2000U));
+
+  test_geometry();
+  test_data();
+  test_rejects();
+  test_unmap();
+  test_card_change();
+
+  return test_report("test_msc_storage");
+}
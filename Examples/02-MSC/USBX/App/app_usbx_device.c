@@ -52,12 +52,15 @@
 __ALIGN_BEGIN static UCHAR ux_device_byte_pool_buffer[UX_DEVICE_APP_MEM_POOL_SIZE] __ALIGN_END;
 /* Audio Parameters */
 static UX_SLAVE_CLASS_AUDIO_PARAMETER audio_parameter;
+/* Storage Parameters */
+static UX_SLAVE_CLASS_STORAGE_PARAMETER storage_parameter;
 
 /* USER CODE BEGIN PV */
 
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
+static UINT USBD_ChangeFunction(ULONG Device_State);
 /* USER CODE BEGIN PFP */
 
 /* USER CODE END PFP */
@@ -116,7 +119,7 @@ UINT MX_USBX_Device_Init(VOID)
                                  string_framework_length,
                                  language_id_framework,
                                  language_id_framework_length,
-                                 UX_NULL) != UX_SUCCESS)
+                                 USBD_ChangeFunction) != UX_SUCCESS)
   {
     /* USER CODE BEGIN USBX_DEVICE_INITIALIZE_ERROR */
     return UX_ERROR;
@@ -160,6 +163,21 @@ UINT MX_USBX_Device_Init(VOID)
     return UX_ERROR;
   }
 
+  /* Initialize the storage class parameters: SD, RAM and flash LUNs */
+  USBD_STORAGE_SetLunParameters(&storage_parameter);
+
+  /* Register the Mass Storage Interface, after the audio function */
+  if (ux_device_stack_class_register(_ux_system_slave_class_storage_name,
+                                     ux_device_class_storage_entry,
+                                     USBD_Get_Configuration_Number(CLASS_TYPE_MSC, 0),
+                                     USBD_Get_Interface_Number(CLASS_TYPE_MSC, 0),
+                                     &storage_parameter) != UX_SUCCESS)
+  {
+    /* USER CODE BEGIN USBX_DEVICE_STORAGE_REGISTER_ERROR */
+    return UX_ERROR;
+    /* USER CODE END USBX_DEVICE_STORAGE_REGISTER_ERROR */
+  }
+
   /* USER CODE BEGIN MX_USBX_Device_Init1 */
 
   /* USER CODE END MX_USBX_Device_Init1 */
@@ -215,6 +233,50 @@ ULONG _ux_utility_time_get(VOID)
   return time_tick;
 }
 
+/**
+  * @brief  USBD_ChangeFunction
+  *         This function is called when the device state changes, and at
+  *         each SOF from the USB interrupt.
+  * @param  Device_State: USB Device State
+  * @retval status
+  */
+static UINT USBD_ChangeFunction(ULONG Device_State)
+{
+  UINT status = UX_SUCCESS;
+
+  /* USER CODE BEGIN USBD_ChangeFunction0 */
+
+  /* USER CODE END USBD_ChangeFunction0 */
+
+  switch (Device_State)
+  {
+    case UX_DCD_STM32_SOF_RECEIVED:
+
+      /* USER CODE BEGIN UX_DCD_STM32_SOF_RECEIVED */
+#if AUDIO_FB_SOURCE != AUDIO_FB_PACKET
+      /* Frame boundary timestamps of the SAI rate */
+      Audio_SOF_Callback(USB_DRD_FS->FNR & USB_FNR_FN);
+#endif
+      /* USER CODE END UX_DCD_STM32_SOF_RECEIVED */
+
+      break;
+
+    default:
+
+      /* USER CODE BEGIN DEFAULT */
+
+      /* USER CODE END DEFAULT */
+
+      break;
+  }
+
+  /* USER CODE BEGIN USBD_ChangeFunction1 */
+
+  /* USER CODE END USBD_ChangeFunction1 */
+
+  return status;
+}
+
 /* USER CODE BEGIN 1 */
 
 /* USER CODE END 1 */
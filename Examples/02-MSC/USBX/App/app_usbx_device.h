@@ -42,8 +42,28 @@ extern "C" {
 /* USER CODE END ET */
 
 /* Exported constants --------------------------------------------------------*/
-#define UX_DEVICE_APP_MEM_POOL_SIZE         1024
-#define USBX_DEVICE_MEMORY_STACK_SIZE       5*1024
+/* USBX memory taken by the device stack: system blocks, class, interface and
+   endpoint pools, the control buffer and one data buffer per endpoint of the
+   framework (audio OUT and feedback, audio IN, storage OUT and IN) */
+#define USBX_DEVICE_ENDPOINTS               5U
+#define USBX_DEVICE_CORE_MEMORY_SIZE        (4U*1024U + UX_SLAVE_REQUEST_CONTROL_MAX_LENGTH \
+                                             + USBX_DEVICE_ENDPOINTS * UX_SLAVE_REQUEST_DATA_MAX_LENGTH)
+
+/* Audio class: the streaming buffers are static, nothing comes from USBX */
+#define USBX_DEVICE_AUDIO_MEMORY_SIZE       0U
+
+/* Storage class: instance, plus its own ping-pong buffers when the chunk is
+   larger than the endpoint buffers */
+#if defined(UX_DEVICE_CLASS_STORAGE_OWN_BUFFERS)
+#define USBX_DEVICE_STORAGE_MEMORY_SIZE     (sizeof(UX_SLAVE_CLASS_STORAGE) + 256U \
+                                             + 2U * UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE)
+#else
+#define USBX_DEVICE_STORAGE_MEMORY_SIZE     (sizeof(UX_SLAVE_CLASS_STORAGE) + 256U)
+#endif
+
+#define UX_DEVICE_APP_MEM_POOL_SIZE         USBX_DEVICE_MEMORY_STACK_SIZE
+#define USBX_DEVICE_MEMORY_STACK_SIZE       (USBX_DEVICE_CORE_MEMORY_SIZE + USBX_DEVICE_AUDIO_MEMORY_SIZE \
+                                             + USBX_DEVICE_STORAGE_MEMORY_SIZE)
 
 /* USER CODE BEGIN EC */
 
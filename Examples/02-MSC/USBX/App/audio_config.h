@@ -4,32 +4,137 @@
 #include "stm32h5xx_hal.h"
 
 /* Audio Format Settings */
+/* Rate at power up, the host selects another one through the clock source */
 #define AUDIO_FREQUENCY             48000
+/* Rates offered by the clock source, in increasing order */
+#define AUDIO_FREQUENCIES           { 44100, 48000, 88200, 96000 }
+#define AUDIO_FREQUENCY_COUNT       4
+#define AUDIO_FREQUENCY_MAX         96000
 #define AUDIO_BIT_DEPTH             24
+/* Slots in the SAI frame, i.e. channels the board carries: 2 for I2S,
+   4 or 8 when the external master sends TDM frames */
+#ifndef AUDIO_CHANNELS
 #define AUDIO_CHANNELS              2
+#endif
+#if (AUDIO_CHANNELS != 2) && (AUDIO_CHANNELS != 4) && (AUDIO_CHANNELS != 8)
+#error "AUDIO_CHANNELS must be 2, 4 or 8 SAI slots"
+#endif
 
-/* Sizes in Bytes */
-/* USB Transfer (Packed 24-bit): 3 bytes per sample */
-#define USB_FRAME_SIZE              (AUDIO_CHANNELS * 3)
+/* Streaming formats, one alternate setting each on both AS interfaces.
+   Stereo streams use the first two slots, TDM streams all of them. */
+#define AUDIO_ALT_STEREO_24         1   /* 3 bytes per sample */
+#define AUDIO_ALT_STEREO_16         2   /* 2 bytes, a third less bus load */
+#define AUDIO_ALT_STEREO_32         3   /* 4 bytes, 24 valid bits (SAI data size) */
+#define AUDIO_ALT_TDM_16            4   /* AUDIO_CHANNELS > 2 only, 2 bytes */
+#if AUDIO_CHANNELS > 2
+#define AUDIO_ALT_COUNT             4
+#else
+#define AUDIO_ALT_COUNT             3
+#endif
 
+/* Sizes in Bytes */
 /* SAI Storage (32-bit Slots): 4 bytes per sample */
 #define SAI_FRAME_SIZE              (AUDIO_CHANNELS * 4)
 
 /* USB Settings */
 /* Full Speed (1ms frame) */
-/* Samples per frame = 48 */
-/* Packet Size = 48 * 6 = 288 bytes */
-#define USB_AUDIO_MAX_PACKET_SIZE   ((AUDIO_FREQUENCY / 1000) * USB_FRAME_SIZE)
-/* Add some margin for Async adjustments (e.g. + 1 sample pair) */
-#define USB_AUDIO_EP_SIZE           (USB_AUDIO_MAX_PACKET_SIZE + USB_FRAME_SIZE)
+/* Samples per frame = 48 at 48 kHz, up to 96 at 96 kHz, sized for the
+   highest rate. Add some margin for Async adjustments (+ 1 frame), 44.1 kHz
+   multiples carry one more sample every 10 frames, within the margin. */
+#define USB_AUDIO_EP_SIZE_FOR(freq, channels, subslot) \
+  ((((freq) / 1000) + 1) * (channels) * (subslot))
+/* Full speed isochronous limit: 8-channel TDM only up to 48 kHz */
+#define USB_AUDIO_EP_SIZE_MAX       1023
+#define AUDIO_TDM_FREQUENCY_MAX     ((AUDIO_CHANNELS > 4) ? 48000 : AUDIO_FREQUENCY_MAX)
+/* Data endpoint size of each format */
+#define USB_AUDIO_EP_SIZE_STEREO_24 USB_AUDIO_EP_SIZE_FOR(AUDIO_FREQUENCY_MAX, 2, 3)
+#define USB_AUDIO_EP_SIZE_STEREO_16 USB_AUDIO_EP_SIZE_FOR(AUDIO_FREQUENCY_MAX, 2, 2)
+#define USB_AUDIO_EP_SIZE_STEREO_32 USB_AUDIO_EP_SIZE_FOR(AUDIO_FREQUENCY_MAX, 2, 4)
+#define USB_AUDIO_EP_SIZE_TDM_16    USB_AUDIO_EP_SIZE_FOR(AUDIO_TDM_FREQUENCY_MAX, AUDIO_CHANNELS, 2)
+/* Largest data endpoint size the descriptors advertise */
+#if (AUDIO_CHANNELS > 2) && (USB_AUDIO_EP_SIZE_TDM_16 > USB_AUDIO_EP_SIZE_STEREO_32)
+#define USB_AUDIO_EP_SIZE_LARGEST   USB_AUDIO_EP_SIZE_TDM_16
+#else
+#define USB_AUDIO_EP_SIZE_LARGEST   USB_AUDIO_EP_SIZE_STEREO_32
+#endif
+/* Packet buffers, for the largest format */
+#define USB_AUDIO_EP_SIZE           USB_AUDIO_EP_SIZE_MAX
 
 /* Ring Buffer Settings */
 /* We need a buffer large enough to handle jitter.
-   Say 10ms worth of data for safety. */
-#define AUDIO_BUFFER_FRAMES         480
+   10 ms is safe against host scheduling, AUDIO_LOW_LATENCY trades that
+   margin for latency (monitoring). The TX ring is kept half full, the RX
+   ring a quarter full, so the latency is ~RING_MS/2 out and ~RING_MS/4 in. */
+#ifndef AUDIO_RING_MS
+#ifdef AUDIO_LOW_LATENCY
+#define AUDIO_RING_MS               4
+#else
+#define AUDIO_RING_MS               10
+#endif
+#endif
+/* The TX lead must hold more than the 1 ms packet the DMA plays before the
+   next one: at 2 ms it runs dry between packets (Tests/bench_audio_latency) */
+#if AUDIO_RING_MS < 3
+#error "AUDIO_RING_MS must be at least 3 ms, a TX lead above one 1 ms packet"
+#endif
+/* An even number of frames */
+#define AUDIO_RING_FRAMES(freq)     ((((freq) * AUDIO_RING_MS) / 2000) * 2)
+/* Distance kept between the USB side and the DMA, in frames */
+#define AUDIO_TX_LEAD(frames)       ((frames) / 2)
+#define AUDIO_RX_LEAD(frames)       ((frames) / 4)
+/* Allocated for the highest rate */
+#define AUDIO_BUFFER_FRAMES         AUDIO_RING_FRAMES(AUDIO_FREQUENCY_MAX)
 /* Buffer Size in Bytes (for SAI 32-bit storage) */
 #define AUDIO_BUFFER_SIZE           (AUDIO_BUFFER_FRAMES * SAI_FRAME_SIZE)
 
+/* SAI FIFO: 8 words, part of the latency on both directions */
+#define AUDIO_SAI_FIFO_FRAMES       (8 / AUDIO_CHANNELS)
+
+/* Feature unit volume in 1/256 dB: -96 dB to +6 dB in 0.5 dB steps, the
+   boost saturates. Gain changes are ramped over AUDIO_GAIN_RAMP_FRAMES. */
+#define AUDIO_VOLUME_MIN            (-96 * 256)
+#define AUDIO_VOLUME_MAX            (6 * 256)
+#define AUDIO_VOLUME_RES            128
+#define AUDIO_GAIN_RAMP_FRAMES      256
+
+/* Fade in on stream start and fade out on stream stop, ~5 ms at 48 kHz */
+#define AUDIO_FADE_FRAMES           256
+
+/* Feedback Settings (16.16 samples per frame) */
+/* Nominal rate: 48.0 = 0x00300000, 44.1 = 0x002C199A */
+#define AUDIO_FB_NOMINAL(freq)      ((uint32_t)((((uint64_t)(freq) << 16) + 500) / 1000))
+/* SAI consumption is measured over this many packets, or USB frames with the
+   SOF sources (1/128 sample resolution) */
+#define AUDIO_FB_WINDOW             128
+/* PI correction on the TX ring fill level, error in frames.
+   P: 1/16 sample per frame of error. I: 1/1024 sample per frame accumulated. */
+#define AUDIO_FB_KP_SHIFT           4
+#define AUDIO_FB_KI_SHIFT           10
+#define AUDIO_FB_I_LIMIT            (AUDIO_BUFFER_FRAMES * 64)
+/* Never ask the host for more than +/- 1 sample per frame off nominal */
+#define AUDIO_FB_MAX_DEVIATION      0x00010000
+
+/* Where the SAI rate is measured, AUDIO_FB_SOURCE:
+   - AUDIO_FB_PACKET: DMA position read at each ISO OUT completion, the
+     window follows the host scheduling of the packets,
+   - AUDIO_FB_SOF: DMA position read at the SOF of every 2^AUDIO_FB_SOF_SHIFT
+     USB frames, the window counted in USB frame numbers,
+   - AUDIO_FB_IMPLICIT: measured as AUDIO_FB_SOF, without feedback endpoint.
+     The IN packet sizes carry the rate and the host paces OUT on them. */
+#define AUDIO_FB_PACKET             0
+#define AUDIO_FB_SOF                1
+#define AUDIO_FB_IMPLICIT           2
+#ifndef AUDIO_FB_SOURCE
+#define AUDIO_FB_SOURCE             AUDIO_FB_PACKET
+#endif
+#define AUDIO_FB_SOF_SHIFT          3
+
+/* Feedback values kept in the statistics, one per rate window */
+#define AUDIO_STATS_FB_HISTORY      8
+#if (AUDIO_FB_WINDOW % (1 << AUDIO_FB_SOF_SHIFT)) != 0
+#error "AUDIO_FB_WINDOW must be a multiple of 2^AUDIO_FB_SOF_SHIFT frames"
+#endif
+
 /* Pin Definitions for STM32H562RGT6 (LQFP64) */
 /* SAI1 Block A (RX) and Block B (TX) on GPIOB */
 /* PB12: SAI1_FS_A */
@@ -0,0 +1,403 @@
+#include "audio_pcm.h"
+
+/* The USB packets are not word aligned per group of 4 samples (12 bytes
+   is, but the packet buffer itself may not be), the Cortex-M33 handles
+   unaligned LDR/STR so plain word accesses are used. The shifts and masks
+   below compile to UBFX/BFI/ORR with shifted operand, 3 loads and 4 stores
+   (or 4 loads and 3 stores) per 4 samples instead of 12 byte accesses. */
+
+void Audio_PCM_Unpack24(uint32_t *dst, const uint8_t *src, uint32_t samples)
+{
+  uint32_t blocks = samples / 4;
+
+  while (blocks--)
+  {
+    /* Bytes: L0 M0 H0 L1 | M1 H1 L2 M2 | H2 L3 M3 H3 */
+    uint32_t w0 = __UNALIGNED_UINT32_READ(src);
+    uint32_t w1 = __UNALIGNED_UINT32_READ(src + 4);
+    uint32_t w2 = __UNALIGNED_UINT32_READ(src + 8);
+
+    dst[0] = w0 & 0x00FFFFFF;
+    dst[1] = (w0 >> 24) | ((w1 & 0x0000FFFF) << 8);
+    dst[2] = (w1 >> 16) | ((w2 & 0x000000FF) << 16);
+    dst[3] = w2 >> 8;
+
+    src += 12;
+    dst += 4;
+  }
+
+  /* 1 to 3 samples left */
+  Audio_PCM_Unpack24_Ref(dst, src, samples & 3);
+}
+
+void Audio_PCM_Pack24(uint8_t *dst, const uint32_t *src, uint32_t samples)
+{
+  uint32_t blocks = samples / 4;
+
+  while (blocks--)
+  {
+    /* The SAI word top byte is not part of the sample */
+    uint32_t s0 = src[0];
+    uint32_t s1 = src[1];
+    uint32_t s2 = src[2];
+    uint32_t s3 = src[3];
+
+    __UNALIGNED_UINT32_WRITE(dst, (s0 & 0x00FFFFFF) | (s1 << 24));
+    __UNALIGNED_UINT32_WRITE(dst + 4, ((s1 >> 8) & 0x0000FFFF) | (s2 << 16));
+    __UNALIGNED_UINT32_WRITE(dst + 8, ((s2 >> 16) & 0x000000FF) | (s3 << 8));
+
+    src += 4;
+    dst += 12;
+  }
+
+  /* 1 to 3 samples left */
+  Audio_PCM_Pack24_Ref(dst, src, samples & 3);
+}
+
+void Audio_PCM_Unpack24_Ref(uint32_t *dst, const uint8_t *src, uint32_t samples)
+{
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    /* Right Aligned in 32-bit word -> 0x00HHMMLL */
+    dst[i] = ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+    src += 3;
+  }
+}
+
+void Audio_PCM_Pack24_Ref(uint8_t *dst, const uint32_t *src, uint32_t samples)
+{
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    /* USB Format: LL MM HH */
+    dst[0] = (src[i]) & 0xFF;
+    dst[1] = (src[i] >> 8) & 0xFF;
+    dst[2] = (src[i] >> 16) & 0xFF;
+    dst += 3;
+  }
+}
+
+int32_t Audio_PCM_Ramp24(uint32_t *samples, uint32_t frames, int32_t gain, int32_t step)
+{
+  while (frames--)
+  {
+    for (uint32_t ch = 0; ch < AUDIO_CHANNELS; ch++)
+    {
+      /* Sign extend the 24-bit sample, scale, keep 24 bits */
+      int32_t sample = (int32_t)(*samples << 8) >> 8;
+
+      sample = (int32_t)(((int64_t)sample * gain) >> 16);
+      *samples++ = (uint32_t)sample & 0x00FFFFFF;
+    }
+
+    gain += step;
+    if (gain > AUDIO_PCM_UNITY)
+    {
+      gain = AUDIO_PCM_UNITY;
+    }
+    else if (gain < 0)
+    {
+      gain = 0;
+    }
+  }
+
+  return gain;
+}
+
+/* 10^(-r/40): 0.5 dB steps over 20 dB, Q8.24 */
+static const int32_t audio_pcm_gain_table[40] =
+{
+  0x01000000, 0x00F1ADF9, 0x00E42905, 0x00D765AC, 0x00CB5918,
+  0x00BFF911, 0x00B53BEF, 0x00AB1896, 0x00A1866C, 0x00987D50,
+  0x008FF59A, 0x0087E80B, 0x00804DCE, 0x00792071, 0x007259DB,
+  0x006BF44D, 0x0065EA5A, 0x006036E1, 0x005AD50D, 0x0055C04C,
+  0x0050F44E, 0x004C6D01, 0x0048268E, 0x00441D54, 0x00404DE6,
+  0x003CB509, 0x00394FAF, 0x00361AF6, 0x00331427, 0x003038AF,
+  0x002D8622, 0x002AFA36, 0x002892C2, 0x00264DBB, 0x00242935,
+  0x0022235E, 0x00203A7E, 0x001E6CF8, 0x001CB943, 0x001B1DED,
+};
+
+void Audio_PCM_Gain_Init(Audio_PCM_GainTypeDef *gain)
+{
+  for (uint32_t ch = 0; ch < AUDIO_CHANNELS; ch++)
+  {
+    gain->current[ch] = AUDIO_PCM_GAIN_UNITY;
+    gain->target[ch] = AUDIO_PCM_GAIN_UNITY;
+    gain->step[ch] = 0;
+  }
+}
+
+void Audio_PCM_Gain_Set(Audio_PCM_GainTypeDef *gain, uint32_t channel, int32_t target,
+                        uint32_t frames)
+{
+  int32_t step = (target - gain->current[channel]) / (int32_t)frames;
+
+  /* Small changes still get there */
+  if ((step == 0) && (target != gain->current[channel]))
+  {
+    step = (target > gain->current[channel]) ? 1 : -1;
+  }
+
+  gain->target[channel] = target;
+  gain->step[channel] = step;
+}
+
+int32_t Audio_PCM_Gain_FromdB(int32_t db)
+{
+  /* Attenuation in 0.5 dB steps, rounded; negative for a boost */
+  int32_t steps = (-db + 64) >> 7;
+  int32_t decades = steps / 40;
+  int32_t r = steps % 40;
+  int32_t value;
+
+  if (r < 0)
+  {
+    r += 40;
+    decades--;
+  }
+
+  value = audio_pcm_gain_table[r];
+  if (decades > 7)
+  {
+    /* Below 1 LSB of Q8.24 */
+    value = 0;
+  }
+  else if (decades > 0)
+  {
+    /* One rounded division, the error stays within 0.5 LSB */
+    int32_t divisor = 10;
+
+    while (--decades > 0)
+    {
+      divisor *= 10;
+    }
+    value = (value + divisor / 2) / divisor;
+  }
+  while (decades < 0)
+  {
+    value *= 10;
+    decades++;
+  }
+
+  return value;
+}
+
+static inline uint32_t Audio_PCM_Scale24(uint32_t word, int32_t gain)
+{
+  /* Sign extend the 24-bit sample, scale, saturate to 24 bits */
+  int32_t sample = (int32_t)(word << 8) >> 8;
+
+  sample = (int32_t)(((int64_t)sample * gain) >> AUDIO_PCM_GAIN_SHIFT);
+  return (uint32_t)__SSAT(sample, 24) & 0x00FFFFFF;
+}
+
+static inline uint32_t Audio_PCM_Gain_Ramping(const Audio_PCM_GainTypeDef *gain)
+{
+  for (uint32_t ch = 0; ch < AUDIO_CHANNELS; ch++)
+  {
+    if (gain->step[ch] != 0)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static inline uint32_t Audio_PCM_Gain_Unity(const Audio_PCM_GainTypeDef *gain)
+{
+  for (uint32_t ch = 0; ch < AUDIO_CHANNELS; ch++)
+  {
+    if (gain->current[ch] != AUDIO_PCM_GAIN_UNITY)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static inline void Audio_PCM_Gain_Step(Audio_PCM_GainTypeDef *gain)
+{
+  for (uint32_t ch = 0; ch < AUDIO_CHANNELS; ch++)
+  {
+    int32_t step = gain->step[ch];
+
+    if (step == 0)
+    {
+      continue;
+    }
+
+    gain->current[ch] += step;
+    if (((step > 0) && (gain->current[ch] >= gain->target[ch])) ||
+        ((step < 0) && (gain->current[ch] <= gain->target[ch])))
+    {
+      gain->current[ch] = gain->target[ch];
+      gain->step[ch] = 0;
+    }
+  }
+}
+
+/* USB sample of 'subslot' bytes <-> 24-bit SAI word. 16-bit samples are
+   shifted up, 32-bit ones lose their low byte (the SAI data size is 24). */
+static inline uint32_t Audio_PCM_Read(const uint8_t *src, uint32_t subslot)
+{
+  if (subslot == 2)
+  {
+    return (uint32_t)__UNALIGNED_UINT16_READ(src) << 8;
+  }
+  if (subslot == 4)
+  {
+    return __UNALIGNED_UINT32_READ(src) >> 8;
+  }
+  return ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+}
+
+static inline void Audio_PCM_Write(uint8_t *dst, uint32_t word, uint32_t subslot)
+{
+  if (subslot == 2)
+  {
+    __UNALIGNED_UINT16_WRITE(dst, (uint16_t)(word >> 8));
+  }
+  else if (subslot == 4)
+  {
+    __UNALIGNED_UINT32_WRITE(dst, word << 8);
+  }
+  else
+  {
+    dst[0] = word & 0xFF;
+    dst[1] = (word >> 8) & 0xFF;
+    dst[2] = (word >> 16) & 0xFF;
+  }
+}
+
+/* One frame at a time: 'channels' USB samples to the first slots of the
+   SAI frame, the other slots are silent. The gains move after each frame. */
+static inline void Audio_PCM_Unpack_Frames(uint32_t *dst, const uint8_t *src, uint32_t frames,
+                                           uint32_t channels, uint32_t subslot,
+                                           Audio_PCM_GainTypeDef *gain)
+{
+  while (frames--)
+  {
+    uint32_t ch;
+
+    for (ch = 0; ch < channels; ch++)
+    {
+      dst[ch] = Audio_PCM_Scale24(Audio_PCM_Read(src, subslot), gain->current[ch]);
+      src += subslot;
+    }
+    for (; ch < AUDIO_CHANNELS; ch++)
+    {
+      dst[ch] = 0;
+    }
+    dst += AUDIO_CHANNELS;
+    Audio_PCM_Gain_Step(gain);
+  }
+}
+
+static inline void Audio_PCM_Pack_Frames(uint8_t *dst, const uint32_t *src, uint32_t frames,
+                                         uint32_t channels, uint32_t subslot,
+                                         Audio_PCM_GainTypeDef *gain)
+{
+  while (frames--)
+  {
+    for (uint32_t ch = 0; ch < channels; ch++)
+    {
+      Audio_PCM_Write(dst, Audio_PCM_Scale24(src[ch], gain->current[ch]), subslot);
+      dst += subslot;
+    }
+    src += AUDIO_CHANNELS;
+    Audio_PCM_Gain_Step(gain);
+  }
+}
+
+void Audio_PCM_Unpack24_Gain(uint32_t *dst, const uint8_t *src, uint32_t frames,
+                             uint32_t channels, Audio_PCM_GainTypeDef *gain)
+{
+  /* Stream narrower than the SAI frame */
+  if (channels != AUDIO_CHANNELS)
+  {
+    Audio_PCM_Unpack_Frames(dst, src, frames, channels, 3, gain);
+    return;
+  }
+
+  /* Ramping: one frame at a time, the gains move after each frame */
+  while (frames && Audio_PCM_Gain_Ramping(gain))
+  {
+    Audio_PCM_Unpack_Frames(dst, src, 1, AUDIO_CHANNELS, 3, gain);
+    dst += AUDIO_CHANNELS;
+    src += AUDIO_CHANNELS * 3;
+    frames--;
+  }
+
+  /* Steady gains: 4 samples per iteration as Audio_PCM_Unpack24 */
+  uint32_t samples = frames * AUDIO_CHANNELS;
+
+  if (Audio_PCM_Gain_Unity(gain))
+  {
+    Audio_PCM_Unpack24(dst, src, samples);
+    return;
+  }
+
+  uint32_t blocks = samples / 4;
+  uint32_t ch = 0;
+
+  while (blocks--)
+  {
+    uint32_t w0 = __UNALIGNED_UINT32_READ(src);
+    uint32_t w1 = __UNALIGNED_UINT32_READ(src + 4);
+    uint32_t w2 = __UNALIGNED_UINT32_READ(src + 8);
+
+    dst[0] = Audio_PCM_Scale24(w0, gain->current[ch % AUDIO_CHANNELS]);
+    dst[1] = Audio_PCM_Scale24((w0 >> 24) | (w1 << 8), gain->current[(ch + 1) % AUDIO_CHANNELS]);
+    dst[2] = Audio_PCM_Scale24((w1 >> 16) | (w2 << 16), gain->current[(ch + 2) % AUDIO_CHANNELS]);
+    dst[3] = Audio_PCM_Scale24(w2 >> 8, gain->current[(ch + 3) % AUDIO_CHANNELS]);
+
+    ch = (ch + 4) % AUDIO_CHANNELS;
+    src += 12;
+    dst += 4;
+  }
+
+  /* 1 to 3 samples left */
+  for (samples &= 3; samples; samples--)
+  {
+    uint32_t word = ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+
+    *dst++ = Audio_PCM_Scale24(word, gain->current[ch]);
+    ch = (ch + 1) % AUDIO_CHANNELS;
+    src += 3;
+  }
+}
+
+void Audio_PCM_Pack24_Gain(uint8_t *dst, const uint32_t *src, uint32_t frames,
+                           uint32_t channels, Audio_PCM_GainTypeDef *gain)
+{
+  if ((channels == AUDIO_CHANNELS) && !Audio_PCM_Gain_Ramping(gain) && Audio_PCM_Gain_Unity(gain))
+  {
+    Audio_PCM_Pack24(dst, src, frames * AUDIO_CHANNELS);
+    return;
+  }
+
+  Audio_PCM_Pack_Frames(dst, src, frames, channels, 3, gain);
+}
+
+void Audio_PCM_Unpack16_Gain(uint32_t *dst, const uint8_t *src, uint32_t frames,
+                             uint32_t channels, Audio_PCM_GainTypeDef *gain)
+{
+  Audio_PCM_Unpack_Frames(dst, src, frames, channels, 2, gain);
+}
+
+void Audio_PCM_Pack16_Gain(uint8_t *dst, const uint32_t *src, uint32_t frames,
+                           uint32_t channels, Audio_PCM_GainTypeDef *gain)
+{
+  Audio_PCM_Pack_Frames(dst, src, frames, channels, 2, gain);
+}
+
+void Audio_PCM_Unpack32_Gain(uint32_t *dst, const uint8_t *src, uint32_t frames,
+                             uint32_t channels, Audio_PCM_GainTypeDef *gain)
+{
+  Audio_PCM_Unpack_Frames(dst, src, frames, channels, 4, gain);
+}
+
+void Audio_PCM_Pack32_Gain(uint8_t *dst, const uint32_t *src, uint32_t frames,
+                           uint32_t channels, Audio_PCM_GainTypeDef *gain)
+{
+  Audio_PCM_Pack_Frames(dst, src, frames, channels, 4, gain);
+}
@@ -0,0 +1,67 @@
+#ifndef AUDIO_PCM_H
+#define AUDIO_PCM_H
+
+#include "audio_config.h"
+
+/* Conversion between packed 24-bit USB samples (3 bytes, little endian)
+   and 24-bit samples right aligned in the 32-bit SAI words (0x00HHMMLL).
+   Counts are in samples, i.e. frames * AUDIO_CHANNELS. */
+
+/* Fast kernels: 4 samples (12 bytes <-> 4 words) per iteration */
+void Audio_PCM_Unpack24(uint32_t *dst, const uint8_t *src, uint32_t samples);
+void Audio_PCM_Pack24(uint8_t *dst, const uint32_t *src, uint32_t samples);
+
+/* Reference kernels: one byte at a time, the fast ones must match them */
+void Audio_PCM_Unpack24_Ref(uint32_t *dst, const uint8_t *src, uint32_t samples);
+void Audio_PCM_Pack24_Ref(uint8_t *dst, const uint32_t *src, uint32_t samples);
+
+/* Gain in Q16, 1.0 = AUDIO_PCM_UNITY */
+#define AUDIO_PCM_UNITY     0x10000
+
+/* Linear gain ramp applied in place to 24-bit SAI words, 'step' is added
+   to the gain after each frame and the gain stays within 0..UNITY.
+   Returns the gain reached, to continue the ramp over the next span. */
+int32_t Audio_PCM_Ramp24(uint32_t *samples, uint32_t frames, int32_t gain, int32_t step);
+
+/* Volume gain stage, fused into the 24-bit conversions. Gains are Q8.24
+   (AUDIO_PCM_GAIN_UNITY = 1.0), the results saturate to 24 bits. Each
+   channel moves linearly to its target by 'step' per frame. */
+#define AUDIO_PCM_GAIN_SHIFT    24
+#define AUDIO_PCM_GAIN_UNITY    (1 << AUDIO_PCM_GAIN_SHIFT)
+
+typedef struct
+{
+  int32_t current[AUDIO_CHANNELS];
+  int32_t target[AUDIO_CHANNELS];
+  int32_t step[AUDIO_CHANNELS];
+} Audio_PCM_GainTypeDef;
+
+void Audio_PCM_Gain_Init(Audio_PCM_GainTypeDef *gain);
+/* New target for a channel, reached after 'frames' frames */
+void Audio_PCM_Gain_Set(Audio_PCM_GainTypeDef *gain, uint32_t channel, int32_t target,
+                        uint32_t frames);
+/* Linear gain of a level in 1/256 dB, rounded to 0.5 dB */
+int32_t Audio_PCM_Gain_FromdB(int32_t db);
+
+/* Stream format kernels, selected from the alternate setting. Counts in
+   frames: 'channels' USB samples of 2, 3 or 4 bytes per frame, to or from
+   the first slots of the AUDIO_CHANNELS words of a SAI frame. */
+typedef void (*Audio_PCM_UnpackFunc)(uint32_t *dst, const uint8_t *src, uint32_t frames,
+                                     uint32_t channels, Audio_PCM_GainTypeDef *gain);
+typedef void (*Audio_PCM_PackFunc)(uint8_t *dst, const uint32_t *src, uint32_t frames,
+                                   uint32_t channels, Audio_PCM_GainTypeDef *gain);
+
+void Audio_PCM_Unpack16_Gain(uint32_t *dst, const uint8_t *src, uint32_t frames,
+                             uint32_t channels, Audio_PCM_GainTypeDef *gain);
+void Audio_PCM_Pack16_Gain(uint8_t *dst, const uint32_t *src, uint32_t frames,
+                           uint32_t channels, Audio_PCM_GainTypeDef *gain);
+void Audio_PCM_Unpack24_Gain(uint32_t *dst, const uint8_t *src, uint32_t frames,
+                             uint32_t channels, Audio_PCM_GainTypeDef *gain);
+void Audio_PCM_Pack24_Gain(uint8_t *dst, const uint32_t *src, uint32_t frames,
+                           uint32_t channels, Audio_PCM_GainTypeDef *gain);
+void Audio_PCM_Unpack32_Gain(uint32_t *dst, const uint8_t *src, uint32_t frames,
+                             uint32_t channels, Audio_PCM_GainTypeDef *gain);
+void Audio_PCM_Pack32_Gain(uint8_t *dst, const uint32_t *src, uint32_t frames,
+                           uint32_t channels, Audio_PCM_GainTypeDef *gain);
+
+#endif /* AUDIO_PCM_H */
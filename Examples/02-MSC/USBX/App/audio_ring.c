@@ -0,0 +1,259 @@
+/**
+  ******************************************************************************
+  * @file    audio_ring.c
+  * @brief   Single producer / single consumer ring between USB and SAI DMA
+  ******************************************************************************
+  * The CPU side is moved by the USB streams from the main loop, the DMA side
+  * by the SAI half and full transfer interrupts. Both sides count the frames
+  * they moved with free running 32-bit counters, the ring level is their
+  * difference. A level out of 0..frames is an xrun, the CPU side is then put
+  * back at its lead from the DMA.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "audio_ring.h"
+
+/**
+  * @brief  Audio_Ring_Init
+  *         Describe the buffer of a ring and reset both of its sides. The
+  *         xrun counters are not cleared.
+  * @param  ring: ring to set up.
+  * @param  buffer: frames of 'channels' SAI words.
+  * @param  frames: ring size in frames, even.
+  * @param  channels: SAI words per frame.
+  * @param  dma_reads: 1 for a TX ring, 0 for an RX ring.
+  * @param  lead: CPU distance to the DMA after a resync, in frames.
+  * @retval none
+  */
+void Audio_Ring_Init(Audio_RingTypeDef *ring, uint32_t *buffer, uint32_t frames,
+                     uint32_t channels, uint8_t dma_reads, uint32_t lead)
+{
+  ring->buffer = buffer;
+  ring->frames = frames;
+  ring->channels = channels;
+  ring->dma_reads = dma_reads;
+  ring->lead = lead;
+
+  /* The xrun counters are kept over re-inits (rate changes) */
+  Audio_Ring_Reset(ring);
+}
+
+/**
+  * @brief  Audio_Ring_Reset
+  *         Put both sides at the buffer start, before the DMA is started.
+  * @param  ring: ring to reset.
+  * @retval none
+  */
+void Audio_Ring_Reset(Audio_RingTypeDef *ring)
+{
+  /* The DMA is (re)started at the buffer start */
+  ring->dma = 0;
+  ring->dma_index = 0;
+  ring->cpu = 0;
+  ring->cpu_index = 0;
+}
+
+/**
+  * @brief  Audio_Ring_DMA_Event
+  *         Move the DMA side by half a ring, from the half and full transfer
+  *         interrupts. Counts a TX underrun or an RX overrun when the DMA
+  *         passed the CPU side.
+  * @param  ring: ring of the DMA.
+  * @retval none
+  */
+void Audio_Ring_DMA_Event(Audio_RingTypeDef *ring)
+{
+  uint32_t half = ring->frames / 2;
+
+  ring->dma_index = (ring->dma_index == 0) ? half : 0;
+  ring->dma += half;
+
+  if (ring->dma_reads)
+  {
+    /* The DMA played past what the CPU wrote */
+    if ((int32_t)(ring->cpu - ring->dma) < 0)
+    {
+      ring->underruns++;
+    }
+  }
+  else
+  {
+    /* The DMA wrote over frames the CPU did not read yet */
+    if ((ring->dma - ring->cpu) > ring->frames)
+    {
+      ring->overruns++;
+    }
+  }
+}
+
+/**
+  * @brief  Audio_Ring_DMA_Position
+  *         Monotonic DMA position, between two transfer events.
+  * @param  ring: ring of the DMA.
+  * @param  dma_index: frame the DMA is at now.
+  * @retval frames moved by the DMA since the reset
+  */
+uint32_t Audio_Ring_DMA_Position(const Audio_RingTypeDef *ring, uint32_t dma_index)
+{
+  uint32_t base;
+  uint32_t base_index;
+
+  /* The event interrupt may run in between, read again until stable */
+  do
+  {
+    base = ring->dma;
+    base_index = ring->dma_index;
+  } while (base != ring->dma);
+
+  uint32_t ahead = (dma_index + ring->frames - base_index) % ring->frames;
+
+  /* The DMA is at most half a ring (plus the interrupt latency) ahead of
+     its last event. Further than 3/4 means dma_index was sampled just
+     before an event that was handled meanwhile. */
+  if (ahead >= ring->frames - ring->frames / 4)
+  {
+    return base - (ring->frames - ahead);
+  }
+
+  return base + ahead;
+}
+
+/**
+  * @brief  Audio_Ring_Level
+  *         Frames written not yet played (TX) or captured not yet read (RX).
+  * @param  ring: ring to check.
+  * @param  dma_index: frame the DMA is at now.
+  * @retval level in frames, out of 0..frames after an xrun
+  */
+int32_t Audio_Ring_Level(const Audio_RingTypeDef *ring, uint32_t dma_index)
+{
+  uint32_t position = Audio_Ring_DMA_Position(ring, dma_index);
+
+  if (ring->dma_reads)
+  {
+    return (int32_t)(ring->cpu - position);
+  }
+
+  return (int32_t)(position - ring->cpu);
+}
+
+/**
+  * @brief  Audio_Ring_Resync
+  *         Move the CPU side 'lead' frames ahead of the DMA (TX) or behind
+  *         it (RX).
+  * @param  ring: ring to resync.
+  * @param  dma_index: frame the DMA is at now.
+  * @retval none
+  */
+void Audio_Ring_Resync(Audio_RingTypeDef *ring, uint32_t dma_index)
+{
+  uint32_t position = Audio_Ring_DMA_Position(ring, dma_index);
+
+  if (ring->dma_reads)
+  {
+    /* Write ahead of the DMA */
+    ring->cpu_index = (dma_index + ring->lead) % ring->frames;
+    ring->cpu = position + ring->lead;
+  }
+  else
+  {
+    /* Read behind the DMA */
+    ring->cpu_index = (dma_index + ring->frames - ring->lead) % ring->frames;
+    ring->cpu = position - ring->lead;
+  }
+}
+
+/**
+  * @brief  Audio_Ring_Reserve
+  *         Frames the CPU side can move for one packet, resyncing first after
+  *         an xrun. A TX packet that does not fit whole is dropped and counted
+  *         in overruns, an RX packet that gets no frame is counted in
+  *         underruns.
+  * @param  ring: ring of the stream.
+  * @param  dma_index: frame the DMA is at now.
+  * @param  frames: frames of the packet.
+  * @retval TX: 'frames' or 0, RX: up to 'frames'
+  */
+uint32_t Audio_Ring_Reserve(Audio_RingTypeDef *ring, uint32_t dma_index, uint32_t frames)
+{
+  int32_t level = Audio_Ring_Level(ring, dma_index);
+
+  /* Xrun: counted by the DMA event, start again from a sane distance */
+  if ((level < 0) || (level > (int32_t)ring->frames))
+  {
+    Audio_Ring_Resync(ring, dma_index);
+    level = Audio_Ring_Level(ring, dma_index);
+  }
+
+  if (ring->dma_reads)
+  {
+    /* Keep one frame free so that full and empty differ */
+    if ((uint32_t)level + frames >= ring->frames)
+    {
+      ring->overruns++;
+      return 0;
+    }
+    return frames;
+  }
+
+  /* Nothing captured for this packet */
+  if ((level == 0) && (frames != 0))
+  {
+    ring->underruns++;
+  }
+
+  return ((uint32_t)level < frames) ? (uint32_t)level : frames;
+}
+
+/**
+  * @brief  Audio_Ring_Span
+  *         Contiguous frames from the CPU index up to the buffer end.
+  * @param  ring: ring of the stream.
+  * @param  frames: frames wanted.
+  * @retval at most 'frames'
+  */
+uint32_t Audio_Ring_Span(const Audio_RingTypeDef *ring, uint32_t frames)
+{
+  uint32_t span = ring->frames - ring->cpu_index;
+
+  return (span < frames) ? span : frames;
+}
+
+/**
+  * @brief  Audio_Ring_Ptr
+  *         Buffer address of the CPU index.
+  * @param  ring: ring of the stream.
+  * @retval first SAI word of the frame
+  */
+uint32_t *Audio_Ring_Ptr(const Audio_RingTypeDef *ring)
+{
+  return &ring->buffer[ring->cpu_index * ring->channels];
+}
+
+/**
+  * @brief  Audio_Ring_Commit
+  *         Move the CPU side over the frames written (TX) or read (RX).
+  * @param  ring: ring of the stream.
+  * @param  frames: frames moved, at most the last span.
+  * @retval none
+  */
+void Audio_Ring_Commit(Audio_RingTypeDef *ring, uint32_t frames)
+{
+  ring->cpu_index = (ring->cpu_index + frames) % ring->frames;
+  ring->cpu += frames;
+}
+
+/**
+  * @brief  Audio_Ring_Rewind
+  *         Step the CPU side back over frames already committed, to rework
+  *         them.
+  * @param  ring: ring of the stream.
+  * @param  frames: frames to step back over.
+  * @retval none
+  */
+void Audio_Ring_Rewind(Audio_RingTypeDef *ring, uint32_t frames)
+{
+  ring->cpu_index = (ring->cpu_index + ring->frames - frames) % ring->frames;
+  ring->cpu -= frames;
+}
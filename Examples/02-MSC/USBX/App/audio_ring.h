@@ -0,0 +1,67 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <stdint.h>
+
+/* Single producer / single consumer ring between the CPU (USB callbacks)
+   and a circular DMA (SAI). One side is the CPU, the other the DMA:
+   - TX ring: the CPU writes, the DMA reads,
+   - RX ring: the DMA writes, the CPU reads.
+   Each side owns its counter, a monotonic 32-bit count of the frames it
+   moved (differences stay right across the 2^32 wrap), and its index in
+   the buffer. No lock is needed, the DMA side is only moved by the half
+   and full transfer interrupts. */
+
+typedef struct
+{
+  uint32_t *buffer;             /* frames of 'channels' SAI words */
+  uint32_t frames;              /* ring size in frames, even */
+  uint32_t channels;
+  uint32_t lead;                /* CPU distance to the DMA after a resync, in frames */
+  uint8_t  dma_reads;           /* 1: TX ring, 0: RX ring */
+
+  volatile uint32_t cpu;        /* frames moved by the CPU */
+  volatile uint32_t cpu_index;
+  volatile uint32_t dma;        /* frames moved by the DMA, at the last half/full event */
+  volatile uint32_t dma_index;  /* 0 or frames / 2 */
+
+  /* Since power up, the ring must be zero-initialised once. Each counter
+     has a single source: the DMA side counts half ring events that found
+     the CPU side passed, the CPU side counts packets.
+     overruns:  TX: packets dropped for lack of space (CPU side),
+                RX: half rings written over unread frames (DMA side).
+     underruns: TX: half rings played past the written frames (DMA side),
+                RX: packets that got no captured frame (CPU side). */
+  volatile uint32_t overruns;
+  volatile uint32_t underruns;
+} Audio_RingTypeDef;
+
+void Audio_Ring_Init(Audio_RingTypeDef *ring, uint32_t *buffer, uint32_t frames,
+                     uint32_t channels, uint8_t dma_reads, uint32_t lead);
+void Audio_Ring_Reset(Audio_RingTypeDef *ring);
+
+/* DMA side, from the half and full transfer interrupts */
+void Audio_Ring_DMA_Event(Audio_RingTypeDef *ring);
+
+/* Monotonic DMA position, dma_index being the frame the DMA is at now */
+uint32_t Audio_Ring_DMA_Position(const Audio_RingTypeDef *ring, uint32_t dma_index);
+
+/* Frames between the CPU and the DMA: written not yet played (TX) or
+   captured not yet read (RX). Out of 0..frames after an xrun. */
+int32_t Audio_Ring_Level(const Audio_RingTypeDef *ring, uint32_t dma_index);
+
+/* Move the CPU side 'lead' frames away from the DMA */
+void Audio_Ring_Resync(Audio_RingTypeDef *ring, uint32_t dma_index);
+
+/* CPU side: frames that can be moved now, resyncing after an xrun.
+   TX returns 'frames' or 0 (packet dropped), RX returns up to 'frames'. */
+uint32_t Audio_Ring_Reserve(Audio_RingTypeDef *ring, uint32_t dma_index, uint32_t frames);
+
+/* CPU side: contiguous frames from the CPU index, at most 'frames' */
+uint32_t Audio_Ring_Span(const Audio_RingTypeDef *ring, uint32_t frames);
+uint32_t *Audio_Ring_Ptr(const Audio_RingTypeDef *ring);
+void Audio_Ring_Commit(Audio_RingTypeDef *ring, uint32_t frames);
+/* CPU side: step back over frames already committed, to rework them */
+void Audio_Ring_Rewind(Audio_RingTypeDef *ring, uint32_t frames);
+
+#endif /* AUDIO_RING_H */
@@ -1,12 +1,77 @@
 #include "audio_sai_slave.h"
 #include "main.h"
+#include <string.h>
+
+/* The HAL SAI module is not part of this project: both slave blocks are
+   programmed through their registers, the DMA through the HAL. */
+#define AUDIO_SAI_RX_BLOCK          SAI1_Block_A
+#define AUDIO_SAI_TX_BLOCK          SAI1_Block_B
 
 /* Global Handles */
-SAI_HandleTypeDef hsai_BlockA1; /* RX */
-SAI_HandleTypeDef hsai_BlockB1; /* TX */
 DMA_HandleTypeDef handle_GPDMA1_Channel0; /* SAI_A RX */
 DMA_HandleTypeDef handle_GPDMA1_Channel1; /* SAI_B TX */
 
+/* GPDMA circular transfers are linked lists on STM32H5: one node looping
+   on itself over the whole buffer, with half and full transfer events. */
+DMA_NodeTypeDef Node_GPDMA1_Channel0;
+DMA_QListTypeDef List_GPDMA1_Channel0;
+DMA_NodeTypeDef Node_GPDMA1_Channel1;
+DMA_QListTypeDef List_GPDMA1_Channel1;
+
+/* Rings shared with the USB callbacks */
+Audio_RingTypeDef Audio_RX_Ring;
+Audio_RingTypeDef Audio_TX_Ring;
+
+/* SAI frame: AUDIO_CHANNELS 32-bit slots. I2S frames have a half frame
+   FS, TDM frames a one bit FS pulse at the start. */
+#define AUDIO_SAI_FRAME_LENGTH      (32 * AUDIO_CHANNELS)
+#define AUDIO_SAI_FS_LENGTH         ((AUDIO_CHANNELS == 2) ? 32 : 1)
+#define AUDIO_SAI_SLOTS_ACTIVE      ((1U << AUDIO_CHANNELS) - 1U)
+
+/* Free protocol, 24-bit data MSB first. I2S strobing: data driven on the
+   falling SCK edge, sampled on the rising one. */
+#define AUDIO_SAI_CR1_SLAVE_TX      (SAI_xCR1_MODE_1 | SAI_xCR1_DS_2 | SAI_xCR1_DS_1 | SAI_xCR1_CKSTR)
+#define AUDIO_SAI_CR1_SLAVE_RX      (SAI_xCR1_MODE_1 | SAI_xCR1_MODE_0 | \
+                                     SAI_xCR1_DS_2 | SAI_xCR1_DS_1 | SAI_xCR1_CKSTR)
+/* FS active low, one bit before the first slot */
+#define AUDIO_SAI_FRCR              ((((uint32_t)AUDIO_SAI_FRAME_LENGTH - 1U) << SAI_xFRCR_FRL_Pos) | \
+                                     (((uint32_t)AUDIO_SAI_FS_LENGTH - 1U) << SAI_xFRCR_FSALL_Pos) | \
+                                     SAI_xFRCR_FSOFF)
+#define AUDIO_SAI_SLOTR             (SAI_xSLOTR_SLOTSZ_1 | \
+                                     (((uint32_t)AUDIO_CHANNELS - 1U) << SAI_xSLOTR_NBSLOT_Pos) | \
+                                     (AUDIO_SAI_SLOTS_ACTIVE << SAI_xSLOTR_SLOTEN_Pos))
+/* A block is disabled at its frame end, its FIFO filled within a frame */
+#define AUDIO_SAI_TIMEOUT_MS        2U
+
+/* Current rate, the rings are sized for it */
+static uint32_t audio_sai_frequency = AUDIO_FREQUENCY;
+
+/* Per direction DMA state, Audio_SAI_StateTypeDef */
+static volatile uint8_t audio_sai_rx_state = AUDIO_SAI_IDLE;
+static volatile uint8_t audio_sai_tx_state = AUDIO_SAI_IDLE;
+/* Half/full events left before the draining TX DMA is paused */
+static volatile uint8_t audio_sai_tx_drain = 0;
+
+/* Error counts, only written at the SAI and DMA interrupt priority */
+static volatile Audio_SAI_ErrorsTypeDef audio_sai_errors;
+
+static void Audio_SAI_Block_Init(SAI_Block_TypeDef *block, uint32_t cr1);
+static void Audio_SAI_Block_Disable(SAI_Block_TypeDef *block);
+static void Audio_SAI_Block_Start(SAI_Block_TypeDef *block, DMA_HandleTypeDef *hdma,
+                                  uint8_t *buffer, uint32_t size);
+static void Audio_SAI_Block_Stop(SAI_Block_TypeDef *block, DMA_HandleTypeDef *hdma);
+static void Audio_SAI_DMA_Init(DMA_HandleTypeDef *hdma, DMA_NodeTypeDef *node,
+                               DMA_QListTypeDef *list, uint32_t request, uint32_t direction);
+static void Audio_SAI_Ring_Init(uint32_t frequency);
+static void Audio_SAI_TX_Event(void);
+static void Audio_SAI_Pause(SAI_Block_TypeDef *block);
+static void Audio_SAI_Resume(SAI_Block_TypeDef *block);
+static void Audio_SAI_Sync_Check(SAI_Block_TypeDef *block);
+static uint8_t Audio_SAI_FIFO_Error(SAI_Block_TypeDef *block);
+static void Audio_SAI_DMA_RX_Event(DMA_HandleTypeDef *hdma);
+static void Audio_SAI_DMA_TX_Event(DMA_HandleTypeDef *hdma);
+static void Audio_SAI_DMA_Error(DMA_HandleTypeDef *hdma);
+
 /* Buffers */
 #if defined ( __ICCARM__ )
 #pragma data_alignment=4
@@ -47,148 +112,442 @@ void Audio_SAI_Init(void)
   GPIO_InitStruct.Alternate = GPIO_AF6_SAI1;
   HAL_GPIO_Init(SAI_PORT, &GPIO_InitStruct);
 
-  /* SAI Block A (RX - Slave) */
-  hsai_BlockA1.Instance = SAI1_Block_A;
-  hsai_BlockA1.Init.AudioMode = SAI_MODESLAVE_RX;
-  hsai_BlockA1.Init.Synchro = SAI_ASYNCHRONOUS; /* Sync to external clock */
-  hsai_BlockA1.Init.OutputDrive = SAI_OUTPUTDRIVE_DISABLE;
-  hsai_BlockA1.Init.NoDivider = SAI_MASTERDIVIDER_ENABLE; /* Don't care in Slave */
-  hsai_BlockA1.Init.FIFOThreshold = SAI_FIFOTHRESHOLD_EMPTY;
-  hsai_BlockA1.Init.AudioFrequency = AUDIO_FREQUENCY;
-  hsai_BlockA1.Init.SynchroExt = SAI_SYNCEXT_DISABLE;
-  hsai_BlockA1.Init.MonoStereoMode = SAI_STEREOMODE;
-  hsai_BlockA1.Init.CompandingMode = SAI_NOCOMPANDING;
-  hsai_BlockA1.Init.TriState = SAI_OUTPUT_NOTRELEASED;
-
-  /* Added DataSize to avoid uninitialized behavior */
-  /* We use 24-bit data in 32-bit slot */
-  hsai_BlockA1.Init.DataSize = SAI_DATASIZE_24;
-
-  /* Frame Config */
-  hsai_BlockA1.FrameInit.FrameLength = 64; /* 32 bits * 2 */
-  hsai_BlockA1.FrameInit.ActiveFrameLength = 32;
-  hsai_BlockA1.FrameInit.FSDefinition = SAI_FS_STARTFRAME;
-  hsai_BlockA1.FrameInit.FSPolarity = SAI_FS_ACTIVE_LOW;
-  hsai_BlockA1.FrameInit.FSOffset = SAI_FS_BEFOREFIRSTBIT;
-
-  /* Slot Config */
-  hsai_BlockA1.SlotInit.FirstBitOffset = 0;
-  hsai_BlockA1.SlotInit.SlotSize = SAI_SLOTSIZE_32B;
-  hsai_BlockA1.SlotInit.SlotNumber = 2;
-  hsai_BlockA1.SlotInit.SlotActive = SAI_SLOTACTIVE_0 | SAI_SLOTACTIVE_1;
-
-  HAL_SAI_Init(&hsai_BlockA1);
-
-  /* SAI Block B (TX - Slave) */
-  /* Synchronous to Block A (internally) or just configured same way?
-     Since signals are external, we configure it as Synchronous Slave
-     or Asynchronous Slave connected to same pins.
-     If we set Sync to Block A, it uses internal routing.
-     If we set Async, it expects pins.
-     Since we share pins PE4/PE5, we should set Block B to Sync with A
-     so it doesn't try to re-configure the GPIOs or expect separate ones?
-     Wait, on STM32 SAI, usually one block is Master/Slave and other Syncs to it.
-     But here BOTH are Slaves to External.
-     The best way is to configure Block A as ASYNC SLAVE, and Block B as SYNC SLAVE to A.
-     This way Block B uses the clocks seen by Block A. */
-
-  hsai_BlockB1.Instance = SAI1_Block_B;
-  hsai_BlockB1.Init.AudioMode = SAI_MODESLAVE_TX;
-  hsai_BlockB1.Init.Synchro = SAI_SYNCHRONOUS; /* Sync to Block A */
-  hsai_BlockB1.Init.OutputDrive = SAI_OUTPUTDRIVE_DISABLE;
-  hsai_BlockB1.Init.FIFOThreshold = SAI_FIFOTHRESHOLD_EMPTY;
-  hsai_BlockB1.Init.AudioFrequency = AUDIO_FREQUENCY;
-  hsai_BlockB1.Init.MonoStereoMode = SAI_STEREOMODE;
-  hsai_BlockB1.Init.CompandingMode = SAI_NOCOMPANDING;
-  hsai_BlockB1.Init.TriState = SAI_OUTPUT_NOTRELEASED;
-
-  hsai_BlockB1.Init.DataSize = SAI_DATASIZE_24;
-
-  /* Frame/Slot must match */
-  hsai_BlockB1.FrameInit.FrameLength = 64;
-  hsai_BlockB1.FrameInit.ActiveFrameLength = 32;
-  hsai_BlockB1.FrameInit.FSDefinition = SAI_FS_STARTFRAME;
-  hsai_BlockB1.FrameInit.FSPolarity = SAI_FS_ACTIVE_LOW;
-  hsai_BlockB1.FrameInit.FSOffset = SAI_FS_BEFOREFIRSTBIT;
-
-  hsai_BlockB1.SlotInit.FirstBitOffset = 0;
-  hsai_BlockB1.SlotInit.SlotSize = SAI_SLOTSIZE_32B;
-  hsai_BlockB1.SlotInit.SlotNumber = 2;
-  hsai_BlockB1.SlotInit.SlotActive = SAI_SLOTACTIVE_0 | SAI_SLOTACTIVE_1;
-
-  HAL_SAI_Init(&hsai_BlockB1);
+  /* Both blocks are slaves of the external master. Block A (RX) is
+     asynchronous and takes SCK and FS from the pins, block B (TX) is
+     synchronous with A and uses the clocks seen by block A. */
+  SAI1->GCR = 0U;
+  Audio_SAI_Block_Init(AUDIO_SAI_RX_BLOCK, AUDIO_SAI_CR1_SLAVE_RX);
+  Audio_SAI_Block_Init(AUDIO_SAI_TX_BLOCK, AUDIO_SAI_CR1_SLAVE_TX | SAI_xCR1_SYNCEN_0);
 
   /* DMA Init (GPDMA) */
-  /* Note: GPDMA Config is complex on H5. Assuming Standard Linked List or Circular */
+  /* SAI Data Reg is 32-bit, the buffers hold one 32-bit word per sample
+     and the USB callbacks repack to 24-bit. */
 
   /* RX DMA */
-  handle_GPDMA1_Channel0.Instance = GPDMA1_Channel0;
-  handle_GPDMA1_Channel0.Init.Request = GPDMA1_REQUEST_SAI1_A;
-  handle_GPDMA1_Channel0.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
-  handle_GPDMA1_Channel0.Init.Direction = DMA_PERIPH_TO_MEMORY;
-  handle_GPDMA1_Channel0.Init.SrcInc = DMA_SINC_FIXED;
-  handle_GPDMA1_Channel0.Init.DestInc = DMA_DINC_INCREMENTED;
-  handle_GPDMA1_Channel0.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_BYTE; /* SAI FIFO is accessed as bytes usually or words? 24-bit needs care. Using Byte allows packing. */
-  /* Wait, SAI Data Reg is 32-bit. But we want 24-bit packed?
-     No, SAI usually puts 32-bit words. If we want 24-bit, we might get 0-padding.
-     The config says Slot 32-bit.
-     If we use DMA_SRC_DATAWIDTH_WORD, we get 32-bit.
-     USB expects 3 bytes. We would need to repack.
-     For simplicity now, let's assume we transfer 32-bit (4 bytes) per sample and skip one in USB,
-     OR we configure SAI to 24-bit slot?
-     If Slot is 32-bit, SAI fills 32-bit.
-     Let's stick to 32-bit in Buffer and handle conversion in USB loop. */
-
-  handle_GPDMA1_Channel0.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_WORD;
-  handle_GPDMA1_Channel0.Init.DestDataWidth = DMA_DEST_DATAWIDTH_WORD;
-  handle_GPDMA1_Channel0.Init.Priority = DMA_HIGH_PRIORITY;
-  handle_GPDMA1_Channel0.Init.SrcBurstLength = 1;
-  handle_GPDMA1_Channel0.Init.DestBurstLength = 1;
-  handle_GPDMA1_Channel0.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0|DMA_DEST_ALLOCATED_PORT0;
-  handle_GPDMA1_Channel0.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
-  handle_GPDMA1_Channel0.Init.Mode = DMA_CIRCULAR;
-
-  HAL_DMA_Init(&handle_GPDMA1_Channel0);
-  __HAL_LINKDMA(&hsai_BlockA1, hdmarx, handle_GPDMA1_Channel0);
+  Audio_SAI_DMA_Init(&handle_GPDMA1_Channel0, &Node_GPDMA1_Channel0, &List_GPDMA1_Channel0,
+                     GPDMA1_REQUEST_SAI1_A, DMA_PERIPH_TO_MEMORY);
+  handle_GPDMA1_Channel0.XferHalfCpltCallback = Audio_SAI_DMA_RX_Event;
+  handle_GPDMA1_Channel0.XferCpltCallback = Audio_SAI_DMA_RX_Event;
+  handle_GPDMA1_Channel0.XferErrorCallback = Audio_SAI_DMA_Error;
 
   /* TX DMA */
-  handle_GPDMA1_Channel1.Instance = GPDMA1_Channel1;
-  handle_GPDMA1_Channel1.Init.Request = GPDMA1_REQUEST_SAI1_B;
-  handle_GPDMA1_Channel1.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
-  handle_GPDMA1_Channel1.Init.Direction = DMA_MEMORY_TO_PERIPH;
-  handle_GPDMA1_Channel1.Init.SrcInc = DMA_SINC_INCREMENTED;
-  handle_GPDMA1_Channel1.Init.DestInc = DMA_DINC_FIXED;
-  handle_GPDMA1_Channel1.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_WORD;
-  handle_GPDMA1_Channel1.Init.DestDataWidth = DMA_DEST_DATAWIDTH_WORD;
-  handle_GPDMA1_Channel1.Init.Priority = DMA_HIGH_PRIORITY;
-  handle_GPDMA1_Channel1.Init.SrcBurstLength = 1;
-  handle_GPDMA1_Channel1.Init.DestBurstLength = 1;
-  handle_GPDMA1_Channel1.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0|DMA_DEST_ALLOCATED_PORT0;
-  handle_GPDMA1_Channel1.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
-  handle_GPDMA1_Channel1.Init.Mode = DMA_CIRCULAR;
-
-  HAL_DMA_Init(&handle_GPDMA1_Channel1);
-  __HAL_LINKDMA(&hsai_BlockB1, hdmatx, handle_GPDMA1_Channel1);
+  Audio_SAI_DMA_Init(&handle_GPDMA1_Channel1, &Node_GPDMA1_Channel1, &List_GPDMA1_Channel1,
+                     GPDMA1_REQUEST_SAI1_B, DMA_MEMORY_TO_PERIPH);
+  handle_GPDMA1_Channel1.XferHalfCpltCallback = Audio_SAI_DMA_TX_Event;
+  handle_GPDMA1_Channel1.XferCpltCallback = Audio_SAI_DMA_TX_Event;
+  handle_GPDMA1_Channel1.XferErrorCallback = Audio_SAI_DMA_Error;
+
+  HAL_NVIC_SetPriority(GPDMA1_Channel0_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(GPDMA1_Channel0_IRQn);
+  HAL_NVIC_SetPriority(GPDMA1_Channel1_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(GPDMA1_Channel1_IRQn);
+  /* FIFO errors, same priority as the DMA events */
+  HAL_NVIC_SetPriority(SAI1_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(SAI1_IRQn);
+
+  Audio_SAI_Ring_Init(audio_sai_frequency);
+}
+
+/* Block set up disabled, FIFO flushed, threshold empty, frame of
+   AUDIO_CHANNELS 32-bit slots */
+static void Audio_SAI_Block_Init(SAI_Block_TypeDef *block, uint32_t cr1)
+{
+  Audio_SAI_Block_Disable(block);
+
+  block->IMR = 0U;
+  block->CLRFR = 0xFFFFFFFFU;
+  block->CR1 = cr1;
+  block->CR2 = SAI_xCR2_FFLUSH;
+  block->FRCR = AUDIO_SAI_FRCR;
+  block->SLOTR = AUDIO_SAI_SLOTR;
+}
+
+/* SAIEN reads back 0 once the current frame ended, at once without clocks */
+static void Audio_SAI_Block_Disable(SAI_Block_TypeDef *block)
+{
+  uint32_t tick = HAL_GetTick();
+
+  block->CR1 &= ~SAI_xCR1_SAIEN;
+  while (((block->CR1 & SAI_xCR1_SAIEN) != 0U) && ((HAL_GetTick() - tick) < AUDIO_SAI_TIMEOUT_MS))
+  {
+  }
+}
+
+/* Circular DMA over size bytes of buffer, then the block. Only the FIFO
+   error interrupt is enabled, the frame sync flags are polled from the
+   DMA events. */
+static void Audio_SAI_Block_Start(SAI_Block_TypeDef *block, DMA_HandleTypeDef *hdma,
+                                  uint8_t *buffer, uint32_t size)
+{
+  uint32_t *node = hdma->LinkedListQueue->Head->LinkRegisters;
+  uint32_t tick;
+
+  node[NODE_CBR1_DEFAULT_OFFSET] = size;
+  if (block == AUDIO_SAI_TX_BLOCK)
+  {
+    node[NODE_CSAR_DEFAULT_OFFSET] = (uint32_t)buffer;
+    node[NODE_CDAR_DEFAULT_OFFSET] = (uint32_t)&block->DR;
+  }
+  else
+  {
+    node[NODE_CSAR_DEFAULT_OFFSET] = (uint32_t)&block->DR;
+    node[NODE_CDAR_DEFAULT_OFFSET] = (uint32_t)buffer;
+  }
+  HAL_DMAEx_List_Start_IT(hdma);
+
+  block->CLRFR = SAI_xCLRFR_COVRUDR | SAI_xCLRFR_CAFSDET | SAI_xCLRFR_CLFSDET;
+  block->IMR = SAI_xIMR_OVRUDRIE;
+  block->CR1 |= SAI_xCR1_DMAEN;
+
+  /* TX: the first samples are in the FIFO before the first frame */
+  if (block == AUDIO_SAI_TX_BLOCK)
+  {
+    tick = HAL_GetTick();
+    while (((block->SR & SAI_xSR_FLVL) == 0U) && ((HAL_GetTick() - tick) < AUDIO_SAI_TIMEOUT_MS))
+    {
+    }
+  }
+
+  block->CR1 |= SAI_xCR1_SAIEN;
+}
+
+/* DMA and block off, FIFO flushed */
+static void Audio_SAI_Block_Stop(SAI_Block_TypeDef *block, DMA_HandleTypeDef *hdma)
+{
+  block->CR1 &= ~SAI_xCR1_DMAEN;
+  block->IMR = 0U;
+
+  /* Fails harmlessly when the channel already stopped on an error */
+  (void)HAL_DMA_Abort(hdma);
+
+  Audio_SAI_Block_Disable(block);
+  block->CR2 |= SAI_xCR2_FFLUSH;
+  block->CLRFR = 0xFFFFFFFFU;
+}
+
+/* The rings hold the same time span at every rate, within the buffers
+   allocated for AUDIO_FREQUENCY_MAX. */
+static void Audio_SAI_Ring_Init(uint32_t frequency)
+{
+  uint32_t frames = AUDIO_RING_FRAMES(frequency);
+
+  /* RX: USB reads a quarter ring behind the DMA. TX: USB writes half a ring ahead. */
+  Audio_Ring_Init(&Audio_RX_Ring, (uint32_t *)Audio_RX_Buffer, frames,
+                  AUDIO_CHANNELS, 0, AUDIO_RX_LEAD(frames));
+  Audio_Ring_Init(&Audio_TX_Ring, (uint32_t *)Audio_TX_Buffer, frames,
+                  AUDIO_CHANNELS, 1, AUDIO_TX_LEAD(frames));
+}
+
+/* Default: the external clock master is strapped or set up elsewhere */
+__weak void Audio_SAI_ClockConfig(uint32_t frequency)
+{
+  UNUSED(frequency);
+}
+
+void Audio_SAI_SetFrequency(uint32_t frequency)
+{
+  uint8_t rx_running = (audio_sai_rx_state == AUDIO_SAI_RUNNING);
+  uint8_t tx_running = (audio_sai_tx_state == AUDIO_SAI_RUNNING);
+
+  if (frequency == audio_sai_frequency)
+  {
+    return;
+  }
+
+  Audio_SAI_Stop();
+
+  /* Slave blocks have no divider to change: the new bit and frame clocks
+     come from the master */
+  Audio_SAI_ClockConfig(frequency);
+
+  audio_sai_frequency = frequency;
+  Audio_SAI_Ring_Init(frequency);
+
+  if (rx_running)
+  {
+    Audio_SAI_Start_RX();
+  }
+  if (tx_running)
+  {
+    Audio_SAI_Start_TX();
+  }
+}
+
+uint32_t Audio_SAI_GetFrequency(void)
+{
+  return audio_sai_frequency;
+}
+
+static void Audio_SAI_DMA_Init(DMA_HandleTypeDef *hdma, DMA_NodeTypeDef *node,
+                               DMA_QListTypeDef *list, uint32_t request, uint32_t direction)
+{
+  DMA_NodeConfTypeDef NodeConfig = {0};
+
+  /* Node: word transfers between the SAI FIFO and the buffer */
+  NodeConfig.NodeType = DMA_GPDMA_LINEAR_NODE;
+  NodeConfig.Init.Request = request;
+  NodeConfig.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
+  NodeConfig.Init.Direction = direction;
+  NodeConfig.Init.SrcInc = (direction == DMA_MEMORY_TO_PERIPH) ? DMA_SINC_INCREMENTED : DMA_SINC_FIXED;
+  NodeConfig.Init.DestInc = (direction == DMA_MEMORY_TO_PERIPH) ? DMA_DINC_FIXED : DMA_DINC_INCREMENTED;
+  NodeConfig.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_WORD;
+  NodeConfig.Init.DestDataWidth = DMA_DEST_DATAWIDTH_WORD;
+  NodeConfig.Init.SrcBurstLength = 1;
+  NodeConfig.Init.DestBurstLength = 1;
+  NodeConfig.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0|DMA_DEST_ALLOCATED_PORT0;
+  NodeConfig.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+  NodeConfig.DataHandlingConfig.DataExchange = DMA_EXCHANGE_NONE;
+  NodeConfig.DataHandlingConfig.DataAlignment = DMA_DATA_RIGHTALIGN_ZEROPADDED;
+  NodeConfig.TriggerConfig.TriggerPolarity = DMA_TRIG_POLARITY_MASKED;
+  /* Addresses and size are filled by Audio_SAI_Block_Start */
+  HAL_DMAEx_List_BuildNode(&NodeConfig, node);
+
+  /* The node loops on itself */
+  HAL_DMAEx_List_ResetQ(list);
+  HAL_DMAEx_List_InsertNode_Tail(list, node);
+  HAL_DMAEx_List_SetCircularMode(list);
+
+  hdma->Instance = (direction == DMA_MEMORY_TO_PERIPH) ? GPDMA1_Channel1 : GPDMA1_Channel0;
+  hdma->InitLinkedList.Priority = DMA_HIGH_PRIORITY;
+  hdma->InitLinkedList.LinkStepMode = DMA_LSM_FULL_EXECUTION;
+  hdma->InitLinkedList.LinkAllocatedPort = DMA_LINK_ALLOCATED_PORT0;
+  hdma->InitLinkedList.TransferEventMode = DMA_TCEM_LAST_LL_ITEM_TRANSFER;
+  hdma->InitLinkedList.LinkedListMode = DMA_LINKEDLIST_CIRCULAR;
+
+  HAL_DMAEx_List_Init(hdma);
+  HAL_DMAEx_List_LinkQ(hdma, list);
 }
 
 void Audio_SAI_Start(void)
 {
-  HAL_SAI_Receive_DMA(&hsai_BlockA1, Audio_RX_Buffer, AUDIO_BUFFER_SIZE / 4);
-  HAL_SAI_Transmit_DMA(&hsai_BlockB1, Audio_TX_Buffer, AUDIO_BUFFER_SIZE / 4);
+  Audio_SAI_Start_RX();
+  Audio_SAI_Start_TX();
 }
 
+/* B before A, B runs on the clocks of A. Both blocks are stopped whatever
+   their state, a DMA error may have left one enabled. */
 void Audio_SAI_Stop(void)
 {
-  HAL_SAI_DMAStop(&hsai_BlockA1);
-  HAL_SAI_DMAStop(&hsai_BlockB1);
+  Audio_SAI_Block_Stop(AUDIO_SAI_TX_BLOCK, &handle_GPDMA1_Channel1);
+  audio_sai_tx_state = AUDIO_SAI_IDLE;
+  Audio_SAI_Block_Stop(AUDIO_SAI_RX_BLOCK, &handle_GPDMA1_Channel0);
+  audio_sai_rx_state = AUDIO_SAI_IDLE;
+}
+
+/* Block B is synchronous to block A: A stays enabled, if need be without
+   its DMA, as long as B runs. Pausing only clears the SAI DMA requests,
+   the block and the other direction keep running and the paused DMA
+   resumes where it stopped. The SAI realigns on slot 0 after the FIFO
+   under/overrun that follows. */
+void Audio_SAI_Start_RX(void)
+{
+  if (audio_sai_rx_state == AUDIO_SAI_IDLE)
+  {
+    /* The DMA starts at the buffer start */
+    Audio_Ring_Reset(&Audio_RX_Ring);
+    Audio_Ring_Resync(&Audio_RX_Ring, 0);
+
+    /* Over the part of the buffer used at this rate */
+    Audio_SAI_Block_Start(AUDIO_SAI_RX_BLOCK, &handle_GPDMA1_Channel0,
+                          Audio_RX_Buffer, Audio_RX_Ring.frames * SAI_FRAME_SIZE);
+  }
+  else if (audio_sai_rx_state == AUDIO_SAI_PAUSED)
+  {
+    Audio_SAI_Resume(AUDIO_SAI_RX_BLOCK);
+  }
+
+  audio_sai_rx_state = AUDIO_SAI_RUNNING;
+}
+
+void Audio_SAI_Stop_RX(void)
+{
+  if (audio_sai_rx_state != AUDIO_SAI_RUNNING)
+  {
+    return;
+  }
+
+  if (audio_sai_tx_state == AUDIO_SAI_IDLE)
+  {
+    Audio_SAI_Block_Stop(AUDIO_SAI_RX_BLOCK, &handle_GPDMA1_Channel0);
+    audio_sai_rx_state = AUDIO_SAI_IDLE;
+  }
+  else
+  {
+    /* Block B still needs the clocks of block A */
+    Audio_SAI_Pause(AUDIO_SAI_RX_BLOCK);
+    audio_sai_rx_state = AUDIO_SAI_PAUSED;
+  }
+}
+
+void Audio_SAI_Start_TX(void)
+{
+  /* Enable block A for its clocks, without RX DMA if not streaming */
+  if (audio_sai_rx_state == AUDIO_SAI_IDLE)
+  {
+    Audio_SAI_Start_RX();
+    Audio_SAI_Pause(AUDIO_SAI_RX_BLOCK);
+    audio_sai_rx_state = AUDIO_SAI_PAUSED;
+  }
+
+  if (audio_sai_tx_state == AUDIO_SAI_IDLE)
+  {
+    /* The DMA starts at the buffer start, on silence */
+    memset(Audio_TX_Buffer, 0, Audio_TX_Ring.frames * SAI_FRAME_SIZE);
+    Audio_Ring_Reset(&Audio_TX_Ring);
+    Audio_Ring_Resync(&Audio_TX_Ring, 0);
+
+    Audio_SAI_Block_Start(AUDIO_SAI_TX_BLOCK, &handle_GPDMA1_Channel1,
+                          Audio_TX_Buffer, Audio_TX_Ring.frames * SAI_FRAME_SIZE);
+  }
+  else if (audio_sai_tx_state == AUDIO_SAI_PAUSED)
+  {
+    Audio_SAI_Resume(AUDIO_SAI_TX_BLOCK);
+  }
+
+  /* A drain in progress is cancelled, the DMA never stopped */
+  audio_sai_tx_state = AUDIO_SAI_RUNNING;
+}
+
+void Audio_SAI_Stop_TX(void)
+{
+  if (audio_sai_tx_state != AUDIO_SAI_RUNNING)
+  {
+    return;
+  }
+
+  /* The caller filled the ring with silence: the DMA plays what is still
+     queued and is paused from its events once it went round the ring. */
+  audio_sai_tx_drain = AUDIO_SAI_TX_DRAIN_EVENTS;
+  audio_sai_tx_state = AUDIO_SAI_DRAINING;
+}
+
+Audio_SAI_StateTypeDef Audio_SAI_Get_RX_State(void)
+{
+  return (Audio_SAI_StateTypeDef)audio_sai_rx_state;
+}
+
+Audio_SAI_StateTypeDef Audio_SAI_Get_TX_State(void)
+{
+  return (Audio_SAI_StateTypeDef)audio_sai_tx_state;
+}
+
+static void Audio_SAI_TX_Event(void)
+{
+  Audio_Ring_DMA_Event(&Audio_TX_Ring);
+
+  if ((audio_sai_tx_state == AUDIO_SAI_DRAINING) && (--audio_sai_tx_drain == 0U))
+  {
+    Audio_SAI_Pause(AUDIO_SAI_TX_BLOCK);
+    audio_sai_tx_state = AUDIO_SAI_PAUSED;
+  }
+}
+
+/* A paused block under/overruns every frame, its FIFO interrupt is off */
+static void Audio_SAI_Pause(SAI_Block_TypeDef *block)
+{
+  block->CR1 &= ~SAI_xCR1_DMAEN;
+  block->IMR &= ~SAI_xIMR_OVRUDRIE;
+}
+
+static void Audio_SAI_Resume(SAI_Block_TypeDef *block)
+{
+  block->CR1 |= SAI_xCR1_DMAEN;
+  block->CLRFR = SAI_xCLRFR_COVRUDR;
+  block->IMR |= SAI_xIMR_OVRUDRIE;
+}
+
+static void Audio_SAI_Sync_Check(SAI_Block_TypeDef *block)
+{
+  if ((block->SR & (SAI_xSR_AFSDET | SAI_xSR_LFSDET)) != 0U)
+  {
+    block->CLRFR = SAI_xCLRFR_CAFSDET | SAI_xCLRFR_CLFSDET;
+    audio_sai_errors.sync++;
+  }
 }
 
+void Audio_SAI_GetErrors(Audio_SAI_ErrorsTypeDef *errors)
+{
+  errors->rx_fifo = audio_sai_errors.rx_fifo;
+  errors->tx_fifo = audio_sai_errors.tx_fifo;
+  errors->sync = audio_sai_errors.sync;
+  errors->dma = audio_sai_errors.dma;
+}
+
+/* GPDMA block counters are in bytes */
 uint32_t Audio_SAI_Get_TX_Head(void)
 {
-   return (AUDIO_BUFFER_SIZE / 4) - __HAL_DMA_GET_COUNTER(&handle_GPDMA1_Channel1);
+   return (Audio_TX_Ring.frames * SAI_FRAME_SIZE - __HAL_DMA_GET_COUNTER(&handle_GPDMA1_Channel1)) / 4;
 }
 
 uint32_t Audio_SAI_Get_RX_Head(void)
 {
-   return (AUDIO_BUFFER_SIZE / 4) - __HAL_DMA_GET_COUNTER(&handle_GPDMA1_Channel0);
+   return (Audio_RX_Ring.frames * SAI_FRAME_SIZE - __HAL_DMA_GET_COUNTER(&handle_GPDMA1_Channel0)) / 4;
+}
+
+/* Half/full transfer events move the DMA side of the rings */
+static void Audio_SAI_DMA_RX_Event(DMA_HandleTypeDef *hdma)
+{
+  UNUSED(hdma);
+  Audio_SAI_Sync_Check(AUDIO_SAI_RX_BLOCK);
+  Audio_Ring_DMA_Event(&Audio_RX_Ring);
+}
+
+static void Audio_SAI_DMA_TX_Event(DMA_HandleTypeDef *hdma)
+{
+  UNUSED(hdma);
+  Audio_SAI_Sync_Check(AUDIO_SAI_TX_BLOCK);
+  Audio_SAI_TX_Event();
+}
+
+/* A DMA transfer error disabled the channel: the block stops requesting
+   and keeps its clocks for the other one, the direction restarts with the
+   host. */
+static void Audio_SAI_DMA_Error(DMA_HandleTypeDef *hdma)
+{
+  audio_sai_errors.dma++;
+
+  if (hdma == &handle_GPDMA1_Channel0)
+  {
+    Audio_SAI_Pause(AUDIO_SAI_RX_BLOCK);
+    audio_sai_rx_state = AUDIO_SAI_IDLE;
+  }
+  else
+  {
+    Audio_SAI_Pause(AUDIO_SAI_TX_BLOCK);
+    audio_sai_tx_state = AUDIO_SAI_IDLE;
+  }
+}
+
+/* FIFO overrun (RX) or underrun (TX): a frame was lost or repeated */
+static uint8_t Audio_SAI_FIFO_Error(SAI_Block_TypeDef *block)
+{
+  if (((block->SR & SAI_xSR_OVRUDR) != 0U) && ((block->IMR & SAI_xIMR_OVRUDRIE) != 0U))
+  {
+    block->CLRFR = SAI_xCLRFR_COVRUDR;
+    return 1U;
+  }
+
+  return 0U;
+}
+
+void SAI1_IRQHandler(void)
+{
+  if (Audio_SAI_FIFO_Error(AUDIO_SAI_RX_BLOCK))
+  {
+    audio_sai_errors.rx_fifo++;
+  }
+  if (Audio_SAI_FIFO_Error(AUDIO_SAI_TX_BLOCK))
+  {
+    audio_sai_errors.tx_fifo++;
+  }
+}
+
+void GPDMA1_Channel0_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&handle_GPDMA1_Channel0);
+}
+
+void GPDMA1_Channel1_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&handle_GPDMA1_Channel1);
 }
@@ -2,19 +2,61 @@
 #define AUDIO_SAI_SLAVE_H
 
 #include "audio_config.h"
+#include "audio_ring.h"
+
+/* Per direction DMA state */
+typedef enum
+{
+  AUDIO_SAI_IDLE = 0,     /* DMA stopped, block disabled */
+  AUDIO_SAI_RUNNING,
+  AUDIO_SAI_DRAINING,     /* TX only: playing the queued frames, then silence */
+  AUDIO_SAI_PAUSED        /* DMA requests off, block still enabled */
+} Audio_SAI_StateTypeDef;
+
+/* SAI errors since power up */
+typedef struct
+{
+  uint32_t rx_fifo;       /* block A overruns while its DMA runs */
+  uint32_t tx_fifo;       /* block B underruns while its DMA runs */
+  uint32_t sync;          /* anticipated or late frame syncs */
+  uint32_t dma;           /* DMA transfer errors */
+} Audio_SAI_ErrorsTypeDef;
+
+/* Half/full events from the TX stop to the pause: more than one ring */
+#define AUDIO_SAI_TX_DRAIN_EVENTS   3
 
 /* Exported Functions */
 void Audio_SAI_Init(void);
+/* Both directions */
 void Audio_SAI_Start(void);
 void Audio_SAI_Stop(void);
 
+/* One direction, without disturbing the other one */
+void Audio_SAI_Start_RX(void);
+void Audio_SAI_Stop_RX(void);
+void Audio_SAI_Start_TX(void);
+void Audio_SAI_Stop_TX(void);
+Audio_SAI_StateTypeDef Audio_SAI_Get_RX_State(void);
+Audio_SAI_StateTypeDef Audio_SAI_Get_TX_State(void);
+
+/* Rate change, stops and restarts the DMA if running */
+void Audio_SAI_SetFrequency(uint32_t frequency);
+uint32_t Audio_SAI_GetFrequency(void);
+void Audio_SAI_GetErrors(Audio_SAI_ErrorsTypeDef *errors);
+/* Called on rate change, to be provided when the clock master is programmable */
+void Audio_SAI_ClockConfig(uint32_t frequency);
+
 /* Buffer Access */
 /* These pointers point to the Ring Buffers managed by DMA */
 extern uint8_t Audio_RX_Buffer[AUDIO_BUFFER_SIZE];
 extern uint8_t Audio_TX_Buffer[AUDIO_BUFFER_SIZE];
 
+/* Rings over the buffers, the DMA side is moved by the half/full events */
+extern Audio_RingTypeDef Audio_RX_Ring;
+extern Audio_RingTypeDef Audio_TX_Ring;
+
 /* Pointers for USBX to read/write */
-/* Current DMA position (Head) */
+/* Current DMA position (Head), in 32-bit words */
 uint32_t Audio_SAI_Get_TX_Head(void);
 uint32_t Audio_SAI_Get_RX_Head(void);
 
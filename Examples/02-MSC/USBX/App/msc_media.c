@@ -0,0 +1,196 @@
+/**
+  ******************************************************************************
+  * @file    msc_media.c
+  * @brief   Sync/async adaptation of the MSC block devices
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "msc_media.h"
+
+/* Private function prototypes -----------------------------------------------*/
+static UINT msc_media_to_state(UINT status);
+static UINT msc_media_wait(UINT (*op)(UCHAR *, ULONG, ULONG, ULONG *), UCHAR *data_pointer,
+                           ULONG number_blocks, ULONG lba, ULONG *media_status);
+
+/* Private user code ---------------------------------------------------------*/
+/**
+  * @brief  msc_media_to_state
+  *         Turn a synchronous completion status into a state.
+  * @param  status: UX_SUCCESS or an error.
+  * @retval UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT msc_media_to_state(UINT status)
+{
+  return (status == UX_SUCCESS) ? UX_STATE_NEXT : UX_STATE_ERROR;
+}
+
+/**
+  * @brief  msc_media_wait
+  *         Run a non-blocking operation to its end.
+  * @param  op: non-blocking read or write.
+  * @param  data_pointer: Address of the buffer to be used for reading or writing.
+  * @param  number_blocks: number of sectors to read/write.
+  * @param  lba: Logical block address is the sector address to read/write.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS or UX_ERROR
+  */
+static UINT msc_media_wait(UINT (*op)(UCHAR *, ULONG, ULONG, ULONG *), UCHAR *data_pointer,
+                           ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  UINT status;
+
+  do
+  {
+    status = op(data_pointer, number_blocks, lba, media_status);
+  } while (status == UX_STATE_WAIT);
+
+  return (status == UX_STATE_NEXT) ? UX_SUCCESS : UX_ERROR;
+}
+
+/**
+  * @brief  MSC_Media_Read
+  *         Non-blocking read, for the storage class.
+  * @param  media: block device.
+  * @param  data_pointer: Address of the buffer to be filled, NULL to abort.
+  * @param  number_blocks: number of sectors to read.
+  * @param  lba: Logical block address is the sector address to read.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+UINT MSC_Media_Read(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                    ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  if (media->ReadAsync != UX_NULL)
+  {
+    return media->ReadAsync(data_pointer, number_blocks, lba, media_status);
+  }
+
+  /* Nothing to abort, synchronous reads are over when they return */
+  if ((data_pointer == UX_NULL) || (number_blocks == 0U))
+  {
+    return UX_STATE_NEXT;
+  }
+
+  return msc_media_to_state(media->Read(data_pointer, number_blocks, lba, media_status));
+}
+
+/**
+  * @brief  MSC_Media_Write
+  *         Non-blocking write, for the storage class.
+  * @param  media: block device.
+  * @param  data_pointer: Address of the buffer to be written, NULL to abort.
+  * @param  number_blocks: number of sectors to write.
+  * @param  lba: Logical block address is the sector address to write.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+UINT MSC_Media_Write(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                     ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  if (media->WriteAsync != UX_NULL)
+  {
+    return media->WriteAsync(data_pointer, number_blocks, lba, media_status);
+  }
+
+  if ((data_pointer == UX_NULL) || (number_blocks == 0U))
+  {
+    return UX_STATE_NEXT;
+  }
+
+  return msc_media_to_state(media->Write(data_pointer, number_blocks, lba, media_status));
+}
+
+/**
+  * @brief  MSC_Media_Flush
+  *         Non-blocking flush, for the storage class.
+  * @param  media: block device.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+UINT MSC_Media_Flush(const MSC_MediaTypeDef *media, ULONG *media_status)
+{
+  if (media->FlushAsync != UX_NULL)
+  {
+    return media->FlushAsync(media_status);
+  }
+
+  if (media->Flush != UX_NULL)
+  {
+    return msc_media_to_state(media->Flush(media_status));
+  }
+
+  /* No cache, nothing to flush */
+  return UX_STATE_NEXT;
+}
+
+/**
+  * @brief  MSC_Media_ReadSync
+  *         Blocking read.
+  * @param  media: block device.
+  * @param  data_pointer: Address of the buffer to be filled.
+  * @param  number_blocks: number of sectors to read.
+  * @param  lba: Logical block address is the sector address to read.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS or UX_ERROR
+  */
+UINT MSC_Media_ReadSync(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                        ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  if (media->Read != UX_NULL)
+  {
+    return media->Read(data_pointer, number_blocks, lba, media_status);
+  }
+
+  return msc_media_wait(media->ReadAsync, data_pointer, number_blocks, lba, media_status);
+}
+
+/**
+  * @brief  MSC_Media_WriteSync
+  *         Blocking write.
+  * @param  media: block device.
+  * @param  data_pointer: Address of the buffer to be written.
+  * @param  number_blocks: number of sectors to write.
+  * @param  lba: Logical block address is the sector address to write.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS or UX_ERROR
+  */
+UINT MSC_Media_WriteSync(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                         ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  if (media->Write != UX_NULL)
+  {
+    return media->Write(data_pointer, number_blocks, lba, media_status);
+  }
+
+  return msc_media_wait(media->WriteAsync, data_pointer, number_blocks, lba, media_status);
+}
+
+/**
+  * @brief  MSC_Media_FlushSync
+  *         Blocking flush.
+  * @param  media: block device.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS or UX_ERROR
+  */
+UINT MSC_Media_FlushSync(const MSC_MediaTypeDef *media, ULONG *media_status)
+{
+  UINT status;
+
+  if (media->Flush != UX_NULL)
+  {
+    return media->Flush(media_status);
+  }
+
+  if (media->FlushAsync == UX_NULL)
+  {
+    return UX_SUCCESS;
+  }
+
+  do
+  {
+    status = media->FlushAsync(media_status);
+  } while (status == UX_STATE_WAIT);
+
+  return (status == UX_STATE_NEXT) ? UX_SUCCESS : UX_ERROR;
+}
@@ -0,0 +1,116 @@
+/**
+  ******************************************************************************
+  * @file    msc_media.h
+  * @brief   Block device interface of the MSC logical units
+  ******************************************************************************
+  * Each LUN of the storage class is backed by one MSC_MediaTypeDef. A backend
+  * provides the synchronous access functions, the non-blocking ones, or both:
+  *  - Read/Write/Flush block until done and return UX_SUCCESS or UX_ERROR.
+  *  - ReadAsync/WriteAsync/FlushAsync return UX_STATE_WAIT, UX_STATE_NEXT or
+  *    UX_STATE_ERROR. They are called again with the same arguments while
+  *    UX_STATE_WAIT is returned, a call with a NULL buffer aborts.
+  *  - DiscardAsync, when not NULL, lets the media drop blocks the host no
+  *    longer uses (SCSI UNMAP). It follows the non-blocking convention in
+  *    both USBX modes, a call with 0 blocks aborts.
+  * On error media_status is filled like the storage class sense status.
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __MSC_MEDIA_H__
+#define __MSC_MEDIA_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "ux_api.h"
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  /* Synchronous access */
+  UINT  (*Read)(UCHAR *data_pointer, ULONG number_blocks, ULONG lba, ULONG *media_status);
+  UINT  (*Write)(UCHAR *data_pointer, ULONG number_blocks, ULONG lba, ULONG *media_status);
+  UINT  (*Flush)(ULONG *media_status);
+
+  /* Non-blocking access */
+  UINT  (*ReadAsync)(UCHAR *data_pointer, ULONG number_blocks, ULONG lba, ULONG *media_status);
+  UINT  (*WriteAsync)(UCHAR *data_pointer, ULONG number_blocks, ULONG lba, ULONG *media_status);
+  UINT  (*FlushAsync)(ULONG *media_status);
+
+  /* Non-blocking discard of unused blocks, NULL if not supported */
+  UINT  (*DiscardAsync)(ULONG number_blocks, ULONG lba, ULONG *media_status);
+  ULONG (*GetDiscardGranularity)(VOID);
+
+  /* UX_SUCCESS when the media can be accessed */
+  UINT  (*Status)(ULONG *media_status);
+  ULONG (*GetLastLba)(VOID);
+  ULONG (*GetBlockLength)(VOID);
+
+  /* Background work, called from the main loop, may be NULL */
+  VOID  (*Process)(VOID);
+
+  UCHAR removable;
+  UCHAR read_only;
+} MSC_MediaTypeDef;
+
+typedef struct
+{
+  ULONG hits;                /* reads served from RAM */
+  ULONG misses;              /* reads sent to the card */
+  ULONG prefetches;          /* read-ahead lines fetched */
+  ULONG miss_latency;        /* last card read latency, in ms */
+  ULONG miss_latency_max;
+  ULONG miss_latency_total;
+} MSC_MediaReadStatsTypeDef;
+
+typedef struct
+{
+  ULONG scsi_commands;       /* SCSI commands checking the media status */
+  ULONG data_commands;       /* CMD17/18/24/25 */
+  ULONG stop_commands;       /* CMD12 ending multi-block transfers */
+  ULONG status_polls;        /* CMD13 */
+  ULONG info_commands;       /* ACMD13 on session open */
+  ULONG erase_commands;      /* CMD38 for discarded blocks */
+} MSC_MediaCmdStatsTypeDef;
+
+typedef struct
+{
+  ULONG mode;                /* MSC_MEDIA_SD_DEFAULT_SPEED or MSC_MEDIA_SD_HIGH_SPEED */
+  ULONG clock;               /* bus clock in Hz, 0 without card */
+  ULONG fallbacks;           /* clock halvings after CRC errors or timeouts, reset per card */
+  ULONG crc_errors;
+  ULONG timeouts;            /* data or response timeouts */
+  ULONG throughput;          /* bytes/s while DMA transfers run */
+} MSC_MediaBusInfoTypeDef;
+
+/* Exported constants --------------------------------------------------------*/
+#define MSC_MEDIA_SD_DEFAULT_SPEED   0U   /* 25 MHz */
+#define MSC_MEDIA_SD_HIGH_SPEED      1U   /* 50 MHz */
+
+extern const MSC_MediaTypeDef MSC_Media_SD;
+extern const MSC_MediaTypeDef MSC_Media_RAM;
+extern const MSC_MediaTypeDef MSC_Media_Flash;
+
+/* Exported functions prototypes ---------------------------------------------*/
+UINT MSC_Media_Read(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                    ULONG number_blocks, ULONG lba, ULONG *media_status);
+UINT MSC_Media_Write(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                     ULONG number_blocks, ULONG lba, ULONG *media_status);
+UINT MSC_Media_Flush(const MSC_MediaTypeDef *media, ULONG *media_status);
+UINT MSC_Media_ReadSync(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                        ULONG number_blocks, ULONG lba, ULONG *media_status);
+UINT MSC_Media_WriteSync(const MSC_MediaTypeDef *media, UCHAR *data_pointer,
+                         ULONG number_blocks, ULONG lba, ULONG *media_status);
+UINT MSC_Media_FlushSync(const MSC_MediaTypeDef *media, ULONG *media_status);
+
+VOID MSC_Media_SD_DetectCallback(VOID);
+VOID MSC_Media_SD_GetReadStats(MSC_MediaReadStatsTypeDef *stats);
+VOID MSC_Media_SD_GetCmdStats(MSC_MediaCmdStatsTypeDef *stats);
+VOID MSC_Media_SD_GetBusInfo(MSC_MediaBusInfoTypeDef *info);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  /* __MSC_MEDIA_H__ */
@@ -0,0 +1,215 @@
+/**
+  ******************************************************************************
+  * @file    msc_media_flash.c
+  * @brief   MSC block device in internal flash
+  ******************************************************************************
+  * The volume uses the last MSC_FLASH_DISK_SIZE bytes of bank 2, which must
+  * be kept out of the application image. Each 8 KB flash sector holds 16
+  * blocks and is rewritten as a whole: read, patch, erase and program.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "msc_media.h"
+#include "ux_device_class_storage.h"
+#include "main.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#ifndef MSC_FLASH_DISK_SIZE
+#define MSC_FLASH_DISK_SIZE      (128U * 1024U)
+#endif
+#define MSC_FLASH_BLOCK_SIZE     512U
+#define MSC_FLASH_QUADWORD       16U
+
+/* Private macro -------------------------------------------------------------*/
+#define MSC_FLASH_DISK_BASE      (FLASH_BASE + FLASH_SIZE - MSC_FLASH_DISK_SIZE)
+
+/* Private variables ---------------------------------------------------------*/
+#if defined ( __ICCARM__ )
+#pragma data_alignment=4
+#endif
+__ALIGN_BEGIN static UCHAR flash_sector_buffer[FLASH_SECTOR_SIZE] __ALIGN_END;
+
+/* Private function prototypes -----------------------------------------------*/
+static HAL_StatusTypeDef flash_program_sector(uint32_t address);
+static UINT flash_media_read(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                             ULONG *media_status);
+static UINT flash_media_write(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                              ULONG *media_status);
+static UINT flash_media_status(ULONG *media_status);
+static ULONG flash_media_get_last_lba(VOID);
+static ULONG flash_media_get_block_length(VOID);
+
+/* Exported constants --------------------------------------------------------*/
+const MSC_MediaTypeDef MSC_Media_Flash =
+{
+  flash_media_read,
+  flash_media_write,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  flash_media_status,
+  flash_media_get_last_lba,
+  flash_media_get_block_length,
+  UX_NULL,
+  UX_FALSE,
+  UX_FALSE,
+};
+
+/* Private user code ---------------------------------------------------------*/
+/**
+  * @brief  flash_program_sector
+  *         Erase a flash sector and program it with flash_sector_buffer.
+  * @param  address: sector address.
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef flash_program_sector(uint32_t address)
+{
+  FLASH_EraseInitTypeDef erase;
+  HAL_StatusTypeDef status;
+  uint32_t sector_error;
+  uint32_t offset;
+  uint32_t i;
+
+  erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+  erase.Banks = FLASH_BANK_2;
+  erase.Sector = (address - (FLASH_BASE + FLASH_BANK_SIZE)) / FLASH_SECTOR_SIZE;
+  erase.NbSectors = 1U;
+
+  HAL_FLASH_Unlock();
+  status = HAL_FLASHEx_Erase(&erase, &sector_error);
+
+  for (offset = 0U; (status == HAL_OK) && (offset < FLASH_SECTOR_SIZE); offset += MSC_FLASH_QUADWORD)
+  {
+    /* Erased quad-words are left alone */
+    for (i = 0U; i < MSC_FLASH_QUADWORD; i++)
+    {
+      if (flash_sector_buffer[offset + i] != 0xFFU)
+      {
+        break;
+      }
+    }
+
+    if (i < MSC_FLASH_QUADWORD)
+    {
+      status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_QUADWORD, address + offset,
+                                 (uint32_t)&flash_sector_buffer[offset]);
+    }
+  }
+  HAL_FLASH_Lock();
+
+  return status;
+}
+
+/**
+  * @brief  flash_media_read
+  *         Read from the flash disk.
+  * @param  data_pointer: Address of the buffer to be filled.
+  * @param  number_blocks: number of sectors to read.
+  * @param  lba: Logical block address is the sector address to read.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS
+  */
+static UINT flash_media_read(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                             ULONG *media_status)
+{
+  UX_PARAMETER_NOT_USED(media_status);
+
+  memcpy(data_pointer, (const void *)(MSC_FLASH_DISK_BASE + (lba * MSC_FLASH_BLOCK_SIZE)),
+         number_blocks * MSC_FLASH_BLOCK_SIZE);
+  return UX_SUCCESS;
+}
+
+/**
+  * @brief  flash_media_write
+  *         Write to the flash disk, sectors whose content does not change
+  *         are not rewritten.
+  * @param  data_pointer: Address of the buffer to be written.
+  * @param  number_blocks: number of sectors to write.
+  * @param  lba: Logical block address is the sector address to write.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS or UX_ERROR
+  */
+static UINT flash_media_write(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                              ULONG *media_status)
+{
+  uint32_t address;
+  uint32_t sector;
+  uint32_t offset;
+  uint32_t length;
+  uint32_t chunk;
+  UINT status = UX_SUCCESS;
+
+  address = MSC_FLASH_DISK_BASE + (lba * MSC_FLASH_BLOCK_SIZE);
+  length = number_blocks * MSC_FLASH_BLOCK_SIZE;
+
+  while (length > 0U)
+  {
+    sector = address & ~(FLASH_SECTOR_SIZE - 1U);
+    offset = address - sector;
+    chunk = FLASH_SECTOR_SIZE - offset;
+    if (chunk > length)
+    {
+      chunk = length;
+    }
+
+    if (memcmp((const void *)address, data_pointer, chunk) != 0)
+    {
+      memcpy(flash_sector_buffer, (const void *)sector, FLASH_SECTOR_SIZE);
+      memcpy(&flash_sector_buffer[offset], data_pointer, chunk);
+      if (flash_program_sector(sector) != HAL_OK)
+      {
+        *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_MEDIUM_ERROR, 0x03, 0x00);
+        status = UX_ERROR;
+        break;
+      }
+    }
+
+    address += chunk;
+    data_pointer += chunk;
+    length -= chunk;
+  }
+
+  /* Do not serve old content from the instruction cache */
+  HAL_ICACHE_Invalidate();
+
+  return status;
+}
+
+/**
+  * @brief  flash_media_status
+  *         The flash disk is always ready.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS
+  */
+static UINT flash_media_status(ULONG *media_status)
+{
+  UX_PARAMETER_NOT_USED(media_status);
+  return UX_SUCCESS;
+}
+
+/**
+  * @brief  flash_media_get_last_lba
+  *         Get the flash disk last LBA.
+  * @param  none
+  * @retval last lba
+  */
+static ULONG flash_media_get_last_lba(VOID)
+{
+  return (MSC_FLASH_DISK_SIZE / MSC_FLASH_BLOCK_SIZE) - 1U;
+}
+
+/**
+  * @brief  flash_media_get_block_length
+  *         Get the flash disk block length.
+  * @param  none
+  * @retval block length
+  */
+static ULONG flash_media_get_block_length(VOID)
+{
+  return MSC_FLASH_BLOCK_SIZE;
+}
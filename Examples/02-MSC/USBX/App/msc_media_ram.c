@@ -0,0 +1,125 @@
+/**
+  ******************************************************************************
+  * @file    msc_media_ram.c
+  * @brief   MSC block device in internal RAM
+  ******************************************************************************
+  * Zero latency scratch volume, its content is lost on reset. The host has
+  * to format it after each power up.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "msc_media.h"
+#include "main.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#ifndef MSC_RAM_BLOCK_NUMBER
+#define MSC_RAM_BLOCK_NUMBER     128U
+#endif
+#define MSC_RAM_BLOCK_SIZE       512U
+
+/* Private variables ---------------------------------------------------------*/
+#if defined ( __ICCARM__ )
+#pragma data_alignment=4
+#endif
+__ALIGN_BEGIN static UCHAR ram_disk[MSC_RAM_BLOCK_NUMBER * MSC_RAM_BLOCK_SIZE] __ALIGN_END;
+
+/* Private function prototypes -----------------------------------------------*/
+static UINT ram_media_read(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                           ULONG *media_status);
+static UINT ram_media_write(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                            ULONG *media_status);
+static UINT ram_media_status(ULONG *media_status);
+static ULONG ram_media_get_last_lba(VOID);
+static ULONG ram_media_get_block_length(VOID);
+
+/* Exported constants --------------------------------------------------------*/
+const MSC_MediaTypeDef MSC_Media_RAM =
+{
+  ram_media_read,
+  ram_media_write,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  ram_media_status,
+  ram_media_get_last_lba,
+  ram_media_get_block_length,
+  UX_NULL,
+  UX_FALSE,
+  UX_FALSE,
+};
+
+/* Private user code ---------------------------------------------------------*/
+/**
+  * @brief  ram_media_read
+  *         Read from the RAM disk.
+  * @param  data_pointer: Address of the buffer to be filled.
+  * @param  number_blocks: number of sectors to read.
+  * @param  lba: Logical block address is the sector address to read.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS
+  */
+static UINT ram_media_read(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                           ULONG *media_status)
+{
+  UX_PARAMETER_NOT_USED(media_status);
+
+  memcpy(data_pointer, &ram_disk[lba * MSC_RAM_BLOCK_SIZE], number_blocks * MSC_RAM_BLOCK_SIZE);
+  return UX_SUCCESS;
+}
+
+/**
+  * @brief  ram_media_write
+  *         Write to the RAM disk.
+  * @param  data_pointer: Address of the buffer to be written.
+  * @param  number_blocks: number of sectors to write.
+  * @param  lba: Logical block address is the sector address to write.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS
+  */
+static UINT ram_media_write(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                            ULONG *media_status)
+{
+  UX_PARAMETER_NOT_USED(media_status);
+
+  memcpy(&ram_disk[lba * MSC_RAM_BLOCK_SIZE], data_pointer, number_blocks * MSC_RAM_BLOCK_SIZE);
+  return UX_SUCCESS;
+}
+
+/**
+  * @brief  ram_media_status
+  *         The RAM disk is always ready.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS
+  */
+static UINT ram_media_status(ULONG *media_status)
+{
+  UX_PARAMETER_NOT_USED(media_status);
+  return UX_SUCCESS;
+}
+
+/**
+  * @brief  ram_media_get_last_lba
+  *         Get the RAM disk last LBA.
+  * @param  none
+  * @retval last lba
+  */
+static ULONG ram_media_get_last_lba(VOID)
+{
+  return MSC_RAM_BLOCK_NUMBER - 1U;
+}
+
+/**
+  * @brief  ram_media_get_block_length
+  *         Get the RAM disk block length.
+  * @param  none
+  * @retval block length
+  */
+static ULONG ram_media_get_block_length(VOID)
+{
+  return MSC_RAM_BLOCK_SIZE;
+}
@@ -0,0 +1,2152 @@
+/**
+  ******************************************************************************
+  * @file    msc_media_sd.c
+  * @brief   MSC block device on the SDMMC1 card
+  ******************************************************************************
+  * Non-blocking DMA transfers, with a write-back cache merging adjacent
+  * sectors and a read-ahead ring for sequential streams. Adjacent cache
+  * lines are written back by one command through an IDMA linked list. The card geometry
+  * and state are kept in a session opened once per card insertion, which
+  * also switches the bus to the fastest mode the card and board support.
+  * Blocks unmapped by the host are erased, by whole erase groups only.
+  * The card detect switch interrupts on both edges; once it settles the
+  * media goes through absent, initialising, ready and removed, so cards can
+  * be swapped while the device stays enumerated. The card is identified in
+  * steps of a few commands from the main loop, the host is told the unit
+  * is becoming ready meanwhile.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "msc_media.h"
+#include "board.h"
+#include "sdmmc.h"
+#include "ux_device_class_storage.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum
+{
+  SD_XFER_IDLE = 0,
+  SD_XFER_CARD_WAIT,
+  SD_XFER_DMA_WAIT,
+} SD_XferStateTypeDef;
+
+typedef enum
+{
+  SD_MEDIA_ABSENT = 0,  /* no card, reported as medium not present */
+  SD_MEDIA_INIT,        /* card inserted, identified from the main loop */
+  SD_MEDIA_READY,       /* session open */
+  SD_MEDIA_REMOVED,     /* card pulled out, not reported to the host yet */
+} SD_MediaStateTypeDef;
+
+typedef enum
+{
+  SD_INIT_POWER_ON = 0, /* power up, CMD0, CMD8 */
+  SD_INIT_OP_COND,      /* one ACMD41 per poll until the card is out of idle */
+  SD_INIT_CARD,         /* CID, RCA, CSD, 4 bits bus */
+  SD_INIT_BUS_QUERY,    /* CMD6 check mode */
+  SD_INIT_BUS_CHECK,    /* one bus mode and clock, checked by a block read */
+  SD_INIT_STATUS,       /* SD status, the session is open */
+} SD_InitStepTypeDef;
+
+typedef struct
+{
+  uint8_t valid;
+  uint8_t speed_class;
+  uint8_t uhs_speed_grade;
+  uint8_t video_speed_class;
+  ULONG block_number;
+  ULONG block_size;
+  ULONG erase_group_blocks;
+  ULONG erase_timeout;  /* ms to erase SD_ERASE_CHUNK_GROUPS erase groups */
+  HAL_SD_CardStateTypeDef card_state;  /* last known, polled only when not in transfer */
+} SD_SessionTypeDef;
+
+typedef struct
+{
+  ULONG mode;           /* MSC_MEDIA_SD_DEFAULT_SPEED or MSC_MEDIA_SD_HIGH_SPEED */
+  ULONG clock;          /* SDMMC_CK, in Hz */
+  ULONG fallbacks;      /* steps down after CRC errors or data timeouts, for this card */
+  UINT retune;          /* fallbacks stepped, applied before the next transfer */
+  UINT switch_valid;    /* sd_bus_switch_status was read, high speed not refused */
+  ULONG crc_errors;
+  ULONG timeouts;
+  ULONG64 bytes;        /* data moved by DMA transfers */
+  ULONG64 busy_ms;      /* time spent in DMA transfers */
+} SD_BusTypeDef;
+
+typedef struct
+{
+  ULONG lba;
+  ULONG number_blocks;  /* 0 when the line is free */
+  ULONG age;
+  uint8_t retries;      /* failed write-backs of the line */
+} SD_WCacheLineTypeDef;
+
+typedef enum
+{
+  SD_RA_FREE = 0,
+  SD_RA_FETCH,
+  SD_RA_READY,
+} SD_RALineStateTypeDef;
+
+typedef struct
+{
+  ULONG lba;
+  SD_RALineStateTypeDef state;
+} SD_RALineTypeDef;
+
+/* Private define ------------------------------------------------------------*/
+/* 0 writes every command through to the card, to compare with the cache */
+#ifndef MSC_SD_WCACHE
+#define MSC_SD_WCACHE            1U
+#endif
+/* 0 reads only what the host asks, to compare with the read-ahead */
+#ifndef MSC_SD_READ_AHEAD
+#define MSC_SD_READ_AHEAD        1U
+#endif
+#define SD_BLOCK_SIZE            512U
+#define SD_BUS_DS_FREQ           25000000U   /* default speed */
+#define SD_BUS_HS_FREQ           50000000U   /* high speed */
+#define SD_BUS_HS_STEPS          2U          /* high speed at 50 then 25 MHz */
+#define SD_BUS_MAX_FALLBACKS     6U
+#define SD_BUS_SWITCH_CHECK_HS   0x00FFFFF1U /* CMD6 mode 0, group 1 function 1 */
+#define SD_BUS_STATUS_SIZE       64U
+#define SD_BUS_ERRORS            (HAL_SD_ERROR_DATA_CRC_FAIL | HAL_SD_ERROR_CMD_CRC_FAIL | \
+                                  HAL_SD_ERROR_DATA_TIMEOUT)  /* blamed on the bus clock */
+#define SD_BUS_TIMEOUTS          (HAL_SD_ERROR_DATA_TIMEOUT | HAL_SD_ERROR_CMD_RSP_TIMEOUT)
+#define SD_CCC_SWITCH            (1U << 10)
+#define SD_WCACHE_LINES          4U
+#define SD_WCACHE_LINE_BLOCKS    32U
+#define SD_WCACHE_IDLE_TIMEOUT   100U
+#define SD_WCACHE_RETRIES        3U          /* failed write-backs before a line is dropped */
+#define SD_WCACHE_NONE           0xFFU
+#define SD_RA_LINES              4U
+#define SD_RA_LINE_BLOCKS        16U
+#define SD_RA_TRIGGER            2U
+#define SD_RA_NONE               0xFFU
+#define SD_SG_NODES              SD_WCACHE_LINES
+#define SD_ERASE_CHUNK_GROUPS    16U         /* erase groups per CMD38 */
+#define SD_ERASE_GROUP_TIMEOUT   250U        /* ms, when the SD status has none */
+#define SD_DETECT_DEBOUNCE       50U         /* ms the detect switch must stay still */
+#define SD_MEDIA_INIT_RETRY      500U        /* ms between identification attempts */
+#define SD_OP_COND_TIMEOUT       1000U       /* ms for the card to leave the idle state */
+
+/* Private macro -------------------------------------------------------------*/
+#define SD_READY_FLAG  0x00
+#define SD_READ_FLAG   0x01
+#define SD_WRITE_FLAG  0x02
+#define SD_ERROR_FLAG  0x04
+#define SD_TIMEOUT     1000U
+
+/* Private variables ---------------------------------------------------------*/
+static SD_XferStateTypeDef sd_xfer_state = SD_XFER_IDLE;
+static volatile uint8_t sd_xfer_flags;
+static uint32_t sd_xfer_start;
+static uint32_t sd_xfer_timeout = SD_TIMEOUT;
+
+/* Card session, built on insertion and dropped on removal */
+static SD_SessionTypeDef sd_session;
+static SD_InitStepTypeDef sd_init_step = SD_INIT_POWER_ON;
+static uint32_t sd_init_tick;          /* start of the current step */
+static MSC_MediaCmdStatsTypeDef sd_cmd_stats;
+static SD_BusTypeDef sd_bus;
+static uint8_t sd_bus_switch_status[SD_BUS_STATUS_SIZE];  /* CMD6 check mode status of the card */
+
+/* Media state, driven by the debounced card detect switch. The first
+   sample is taken once the switch has been still since reset. */
+static SD_MediaStateTypeDef sd_media_state = SD_MEDIA_ABSENT;
+static uint8_t sd_media_changed;       /* unit attention to report */
+static uint32_t sd_media_init_tick;
+static volatile uint8_t sd_detect_event = 1U;
+static volatile uint32_t sd_detect_tick;
+
+/* Write-back cache, each line holds a run of adjacent blocks */
+static SD_WCacheLineTypeDef sd_wcache[SD_WCACHE_LINES];
+#if defined ( __ICCARM__ )
+#pragma data_alignment=4
+#endif
+__ALIGN_BEGIN static UCHAR sd_wcache_data[SD_WCACHE_LINES][SD_WCACHE_LINE_BLOCKS * SD_BLOCK_SIZE] __ALIGN_END;
+static ULONG sd_wcache_age;
+static uint8_t sd_wcache_wb = SD_WCACHE_NONE;
+static uint32_t sd_wcache_tick;
+static ULONG sd_wcache_error;         /* sense of lost lines, reported by the next flush */
+static uint8_t sd_wcache_wb_lines;    /* lines written back with sd_wcache_wb, bit mask */
+
+/* Blocks of the lines dropped after SD_WCACHE_RETRIES failed write-backs,
+   the card holds older data: reads fail until the host writes them again */
+static ULONG sd_wcache_lost_lba;
+static ULONG sd_wcache_lost_blocks;
+
+/* Host write commands versus SD multi-block writes issued */
+static ULONG sd_wcache_host_writes;
+static ULONG sd_wcache_sd_writes;
+
+/* IDMA linked list of the next transfer, used when it has several nodes.
+   The nodes follow each other in memory as the HAL links them by offset. */
+#if defined ( __ICCARM__ )
+#pragma data_alignment=4
+#endif
+__ALIGN_BEGIN static SD_DMALinkNodeTypeDef sd_sg_nodes[SD_SG_NODES] __ALIGN_END;
+static SD_DMALinkedListTypeDef sd_sg_list;
+
+/* Read-ahead ring, filled in order while a sequential stream goes on */
+static SD_RALineTypeDef sd_ra[SD_RA_LINES];
+#if defined ( __ICCARM__ )
+#pragma data_alignment=4
+#endif
+__ALIGN_BEGIN static UCHAR sd_ra_data[SD_RA_LINES][SD_RA_LINE_BLOCKS * SD_BLOCK_SIZE] __ALIGN_END;
+static uint8_t sd_ra_head;
+static uint8_t sd_ra_fetch = SD_RA_NONE;
+static ULONG sd_ra_next_lba;
+static ULONG sd_ra_end_lba;
+static ULONG sd_ra_sequential;
+static uint32_t sd_read_start;
+static MSC_MediaReadStatsTypeDef sd_read_stats;
+
+/* Discard in progress, erased by chunks of erase groups */
+static ULONG sd_discard_next;
+static ULONG sd_discard_end;  /* 0 when no discard is in progress */
+
+/* Private function prototypes -----------------------------------------------*/
+static UINT sd_xfer_run(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                        uint8_t flag, ULONG *media_status);
+static VOID sd_xfer_abort(VOID);
+static VOID sd_sg_reset(VOID);
+static UINT sd_sg_add(UCHAR *buffer, ULONG number_blocks);
+static HAL_SD_CardStateTypeDef sd_card_state(VOID);
+static UINT sd_session_open_run(VOID);
+static VOID sd_session_close(VOID);
+static VOID sd_media_update(VOID);
+static VOID sd_media_init_run(VOID);
+static UINT sd_bus_query(uint8_t *switch_status);
+static ULONG sd_bus_select(const uint8_t *switch_status, ULONG fallbacks, ULONG *frequency);
+static ULONG sd_bus_divider(ULONG kernel_clock, ULONG frequency);
+static VOID sd_bus_set_clock(ULONG frequency);
+static UINT sd_bus_apply(VOID);
+static UINT sd_bus_check(VOID);
+static UINT sd_bus_error(UINT timeout);
+static UINT sd_wcache_writeback(ULONG *media_status);
+static UINT sd_wcache_evict(uint8_t index, ULONG *media_status);
+static uint8_t sd_wcache_find_overlap(ULONG lba, ULONG number_blocks, uint8_t skip);
+static UINT sd_wcache_write(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                            ULONG *media_status);
+static UINT sd_wcache_read_hit(UCHAR *data_pointer, ULONG number_blocks, ULONG lba);
+static VOID sd_wcache_overlay(UCHAR *data_pointer, ULONG number_blocks, ULONG lba);
+static VOID sd_wcache_lose(ULONG lba, ULONG number_blocks, ULONG media_status);
+static VOID sd_wcache_rewritten(ULONG lba, ULONG number_blocks);
+static UINT sd_wcache_flush_status(UINT status);
+static UINT sd_ra_read_hit(UCHAR *data_pointer, ULONG number_blocks, ULONG lba);
+static VOID sd_ra_invalidate(ULONG lba, ULONG number_blocks);
+static VOID sd_ra_cancel(VOID);
+static UINT sd_ra_fetch_run(VOID);
+static VOID sd_ra_fetch_start(VOID);
+static UINT sd_media_read(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                          ULONG *media_status);
+static UINT sd_media_write(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                           ULONG *media_status);
+static UINT sd_media_flush(ULONG *media_status);
+static UINT sd_discard_run(ULONG number_blocks, ULONG lba, ULONG *media_status);
+static UINT sd_media_discard(ULONG number_blocks, ULONG lba, ULONG *media_status);
+static ULONG sd_media_get_discard_granularity(VOID);
+static UINT sd_media_status(ULONG *media_status);
+static ULONG sd_media_get_last_lba(VOID);
+static ULONG sd_media_get_block_length(VOID);
+static VOID sd_media_process(VOID);
+
+/* Exported constants --------------------------------------------------------*/
+const MSC_MediaTypeDef MSC_Media_SD =
+{
+  UX_NULL,
+  UX_NULL,
+  UX_NULL,
+  sd_media_read,
+  sd_media_write,
+  sd_media_flush,
+  sd_media_discard,
+  sd_media_get_discard_granularity,
+  sd_media_status,
+  sd_media_get_last_lba,
+  sd_media_get_block_length,
+  sd_media_process,
+  UX_TRUE,
+  UX_FALSE,
+};
+
+/* Private user code ---------------------------------------------------------*/
+/**
+  * @brief  sd_xfer_run
+  *         Run one step of the non-blocking SD transfer state machine.
+  *         The storage class calls the media callback again with the same
+  *         arguments for as long as UX_STATE_WAIT is returned.
+  *         A write returns once its data is sent, the card programming is
+  *         only waited for before the next command.
+  * @param  data_pointer: Address of the buffer to be used for reading or writing.
+  * @param  number_blocks: number of sectors to read/write.
+  * @param  lba: Logical block address is the sector address to read/write.
+  * @param  flag: SD_READ_FLAG, SD_WRITE_FLAG, or SD_READY_FLAG to only wait
+  *         for the card to be ready.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT sd_xfer_run(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                        uint8_t flag, ULONG *media_status)
+{
+  HAL_StatusTypeDef hal_status;
+
+  /* Check if the SD card is present */
+  if (!board_sd_detect_getstate() || !sd_session.valid)
+  {
+    sd_xfer_abort();
+    *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_NOT_READY, 0x3A, 0x00);
+    return UX_STATE_ERROR;
+  }
+
+  switch (sd_xfer_state)
+  {
+    case SD_XFER_IDLE:
+      /* Errors of an earlier command are not blamed on this one */
+      hsd1.ErrorCode = HAL_SD_ERROR_NONE;
+      sd_xfer_flags = 0;
+      sd_xfer_start = HAL_GetTick();
+      sd_xfer_state = SD_XFER_CARD_WAIT;
+
+      /* Fall through.  */
+    case SD_XFER_CARD_WAIT:
+      /* Poll the card only when it is not known to be ready */
+      if ((sd_session.card_state != HAL_SD_CARD_TRANSFER) &&
+          (sd_card_state() != HAL_SD_CARD_TRANSFER))
+      {
+        break;
+      }
+      sd_xfer_timeout = SD_TIMEOUT;
+
+      /* A bus error stepped the fallbacks: move the card to the mode and
+         clock they give, now that it takes commands again */
+      if (sd_bus.retune && (sd_bus_apply() != UX_SUCCESS))
+      {
+        sd_xfer_flags |= SD_ERROR_FLAG;
+        break;
+      }
+
+      if (flag == SD_READY_FLAG)
+      {
+        sd_xfer_state = SD_XFER_IDLE;
+        return UX_STATE_NEXT;
+      }
+
+      /* Start the Dma transfer, scattered over the linked list nodes if one is built */
+      if (flag == SD_READ_FLAG)
+      {
+        hal_status = (sd_sg_list.NodesCounter > 1U) ?
+                     HAL_SDEx_DMALinkedList_ReadBlocks(&hsd1, &sd_sg_list, lba, number_blocks) :
+                     HAL_SD_ReadBlocks_DMA(&hsd1, data_pointer, lba, number_blocks);
+        sd_session.card_state = HAL_SD_CARD_SENDING;
+      }
+      else
+      {
+        hal_status = (sd_sg_list.NodesCounter > 1U) ?
+                     HAL_SDEx_DMALinkedList_WriteBlocks(&hsd1, &sd_sg_list, lba, number_blocks) :
+                     HAL_SD_WriteBlocks_DMA(&hsd1, data_pointer, lba, number_blocks);
+        sd_session.card_state = HAL_SD_CARD_RECEIVING;
+      }
+
+      if (hal_status != HAL_OK)
+      {
+        sd_xfer_flags |= SD_ERROR_FLAG;
+        break;
+      }
+
+      /* CMD17/18/24/25, multi-block transfers end with CMD12 */
+      sd_cmd_stats.data_commands++;
+      if (number_blocks > 1U)
+      {
+        sd_cmd_stats.stop_commands++;
+      }
+
+      sd_xfer_start = HAL_GetTick();
+      sd_xfer_state = SD_XFER_DMA_WAIT;
+      return UX_STATE_WAIT;
+
+    case SD_XFER_DMA_WAIT:
+      /* Wait for the transfer complete callback */
+      if ((sd_xfer_flags & flag) == 0U)
+      {
+        break;
+      }
+
+      sd_bus.bytes += (ULONG64)number_blocks * SD_BLOCK_SIZE;
+      sd_bus.busy_ms += HAL_GetTick() - sd_xfer_start;
+
+      /* A read leaves the card ready, a write leaves it programming */
+      sd_session.card_state = (flag == SD_READ_FLAG) ? HAL_SD_CARD_TRANSFER : HAL_SD_CARD_PROGRAMMING;
+      sd_sg_reset();
+      sd_xfer_state = SD_XFER_IDLE;
+      return UX_STATE_NEXT;
+
+    default:
+      sd_xfer_state = SD_XFER_IDLE;
+      return UX_STATE_ERROR;
+  }
+
+  /* Check error or timeout */
+  if (((sd_xfer_flags & SD_ERROR_FLAG) != 0U) ||
+      ((HAL_GetTick() - sd_xfer_start) > sd_xfer_timeout))
+  {
+    if (sd_bus_error((sd_xfer_flags & SD_ERROR_FLAG) == 0U))
+    {
+      sd_bus.retune = UX_TRUE;
+    }
+    sd_xfer_abort();
+    *media_status = (flag == SD_READ_FLAG) ?
+                    UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_MEDIUM_ERROR, 0x11, 0x00) :
+                    UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_MEDIUM_ERROR, 0x03, 0x00);
+    return UX_STATE_ERROR;
+  }
+
+  return UX_STATE_WAIT;
+}
+
+/**
+  * @brief  sd_xfer_abort
+  *         Abort the SD transfer in progress, if any.
+  * @param  none
+  * @retval none
+  */
+static VOID sd_xfer_abort(VOID)
+{
+  if (sd_xfer_state == SD_XFER_DMA_WAIT)
+  {
+    HAL_SD_Abort(&hsd1);
+  }
+
+  sd_xfer_state = SD_XFER_IDLE;
+  sd_xfer_flags = 0;
+  sd_xfer_timeout = SD_TIMEOUT;
+  sd_sg_reset();
+
+  /* Card state unknown, poll it before the next command */
+  sd_session.card_state = HAL_SD_CARD_ERROR;
+}
+
+/**
+  * @brief  sd_sg_reset
+  *         Empty the linked list, the next transfer uses a single buffer.
+  * @param  none
+  * @retval none
+  */
+static VOID sd_sg_reset(VOID)
+{
+  sd_sg_list.pHeadNode = UX_NULL;
+  sd_sg_list.pTailNode = UX_NULL;
+  sd_sg_list.NodesCounter = 0U;
+}
+
+/**
+  * @brief  sd_sg_add
+  *         Append a buffer to the linked list of the next transfer.
+  * @param  buffer: node buffer, 32 bytes multiple long.
+  * @param  number_blocks: number of sectors in the buffer.
+  * @retval UX_SUCCESS or UX_ERROR
+  */
+static UINT sd_sg_add(UCHAR *buffer, ULONG number_blocks)
+{
+  SD_DMALinkNodeConfTypeDef node_conf;
+  SD_DMALinkNodeTypeDef *node;
+
+  if (sd_sg_list.NodesCounter >= SD_SG_NODES)
+  {
+    return UX_ERROR;
+  }
+
+  node = &sd_sg_nodes[sd_sg_list.NodesCounter];
+  node_conf.BufferAddress = (uint32_t)buffer;
+  node_conf.BufferSize = number_blocks * SD_BLOCK_SIZE;
+  if ((HAL_SDEx_DMALinkedList_BuildNode(node, &node_conf) != HAL_OK) ||
+      (HAL_SDEx_DMALinkedList_InsertNode(&sd_sg_list, sd_sg_list.pTailNode, node) != HAL_OK))
+  {
+    return UX_ERROR;
+  }
+
+  return UX_SUCCESS;
+}
+
+/**
+  * @brief  sd_card_state
+  *         Read the card state with CMD13.
+  * @param  none
+  * @retval card state
+  */
+static HAL_SD_CardStateTypeDef sd_card_state(VOID)
+{
+  sd_cmd_stats.status_polls++;
+  sd_session.card_state = HAL_SD_GetCardState(&hsd1);
+
+  return sd_session.card_state;
+}
+
+/**
+  * @brief  sd_session_open_run
+  *         Run one step of the identification of the card and the build of
+  *         its session: geometry, bus mode, speed class and erase group
+  *         size. Each step is a few commands at most, the main loop polls
+  *         them so that the card taking up to a second to power up does
+  *         not hold the USB tasks meanwhile.
+  * @param  none
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT once the session is open or
+  *         UX_STATE_ERROR, identification starts again on the next call
+  */
+static UINT sd_session_open_run(VOID)
+{
+  /* Allocation unit sizes in blocks, from the SD status AU_SIZE code */
+  static const ULONG au_blocks[16] =
+  {
+    0U, 32U, 64U, 128U, 256U, 512U, 1024U, 2048U, 4096U, 8192U,
+    16384U, 24576U, 32768U, 49152U, 65536U, 131072U
+  };
+  HAL_SD_CardInfoTypeDef card_info;
+  HAL_SD_CardCSDTypeDef card_csd;
+  HAL_SD_CardStatusTypeDef card_status;
+  HAL_StatusTypeDef hal_status;
+  SD_InitStepTypeDef step = sd_init_step;
+
+  /* The next call starts the identification again, unless a step moves on */
+  sd_init_step = SD_INIT_POWER_ON;
+
+  switch (step)
+  {
+    case SD_INIT_POWER_ON:
+      if (MX_SDMMC1_SD_PowerOn() != HAL_OK)
+      {
+        return UX_STATE_ERROR;
+      }
+
+      /* A new card starts again from the fastest clock it offers */
+      sd_bus.fallbacks = 0U;
+      sd_init_tick = HAL_GetTick();
+      sd_init_step = SD_INIT_OP_COND;
+      return UX_STATE_WAIT;
+
+    case SD_INIT_OP_COND:
+      hal_status = MX_SDMMC1_SD_OpCond();
+      if (hal_status == HAL_BUSY)
+      {
+        if ((HAL_GetTick() - sd_init_tick) >= SD_OP_COND_TIMEOUT)
+        {
+          return UX_STATE_ERROR;
+        }
+        sd_init_step = SD_INIT_OP_COND;
+        return UX_STATE_WAIT;
+      }
+      if (hal_status != HAL_OK)
+      {
+        return UX_STATE_ERROR;
+      }
+      sd_init_step = SD_INIT_CARD;
+      return UX_STATE_WAIT;
+
+    case SD_INIT_CARD:
+      if (MX_SDMMC1_SD_InitCard() != HAL_OK)
+      {
+        return UX_STATE_ERROR;
+      }
+      sd_init_step = SD_INIT_BUS_QUERY;
+      return UX_STATE_WAIT;
+
+    case SD_INIT_BUS_QUERY:
+      /* CMD6 is part of the switch command class, from SD 1.10 on */
+      if (HAL_SD_GetCardCSD(&hsd1, &card_csd) != HAL_OK)
+      {
+        return UX_STATE_ERROR;
+      }
+      sd_bus.switch_valid = (((card_csd.CardComdClasses & SD_CCC_SWITCH) != 0U) &&
+                             (sd_bus_query(sd_bus_switch_status) == UX_SUCCESS)) ? UX_TRUE : UX_FALSE;
+
+      /* The card starts in default speed after identification */
+      sd_bus.mode = MSC_MEDIA_SD_DEFAULT_SPEED;
+      sd_init_step = SD_INIT_BUS_CHECK;
+      return UX_STATE_WAIT;
+
+    case SD_INIT_BUS_CHECK:
+      switch (sd_bus_check())
+      {
+        case UX_STATE_NEXT:
+          sd_init_step = SD_INIT_STATUS;
+          return UX_STATE_WAIT;
+
+        case UX_STATE_WAIT:
+          sd_init_step = SD_INIT_BUS_CHECK;
+          return UX_STATE_WAIT;
+
+        default:
+          return UX_STATE_ERROR;
+      }
+
+    case SD_INIT_STATUS:
+    default:
+      break;
+  }
+
+  /* The CID/CSD were read during identification */
+  if ((HAL_SD_GetCardInfo(&hsd1, &card_info) != HAL_OK) ||
+      (HAL_SD_GetCardCSD(&hsd1, &card_csd) != HAL_OK))
+  {
+    return UX_STATE_ERROR;
+  }
+
+  /* ACMD13 */
+  sd_cmd_stats.info_commands++;
+  if (HAL_SD_GetCardStatus(&hsd1, &card_status) != HAL_OK)
+  {
+    return UX_STATE_ERROR;
+  }
+
+  sd_session.block_number = card_info.BlockNbr;
+  sd_session.block_size = card_info.BlockSize;
+  sd_session.speed_class = card_status.SpeedClass;
+  sd_session.uhs_speed_grade = card_status.UhsSpeedGrade;
+  sd_session.video_speed_class = card_status.VideoSpeedClass;
+
+  /* Erase at allocation unit granularity, or the CSD sector size for
+     standard capacity cards not reporting an AU size */
+  sd_session.erase_group_blocks = au_blocks[card_status.AllocationUnitSize & 0x0FU];
+  if (sd_session.erase_group_blocks == 0U)
+  {
+    sd_session.erase_group_blocks = (card_csd.EraseGrSize != 0U) ? 1U : ((ULONG)card_csd.EraseGrMul + 1U);
+  }
+
+  /* The SD status gives the erase time of ERASE_SIZE allocation units */
+  if ((card_status.EraseSize != 0U) && (card_status.EraseTimeout != 0U))
+  {
+    sd_session.erase_timeout = ((ULONG)card_status.EraseTimeout * 1000U * SD_ERASE_CHUNK_GROUPS) /
+                               card_status.EraseSize + (ULONG)card_status.EraseOffset * 1000U;
+  }
+  else
+  {
+    sd_session.erase_timeout = SD_ERASE_GROUP_TIMEOUT * SD_ERASE_CHUNK_GROUPS;
+  }
+  if (sd_session.erase_timeout < SD_TIMEOUT)
+  {
+    sd_session.erase_timeout = SD_TIMEOUT;
+  }
+
+  sd_session.card_state = HAL_SD_CARD_TRANSFER;
+  sd_session.valid = UX_TRUE;
+
+  return UX_STATE_NEXT;
+}
+
+/**
+  * @brief  sd_session_close
+  *         Drop the card session and everything cached for the card.
+  * @param  none
+  * @retval none
+  */
+static VOID sd_session_close(VOID)
+{
+  uint8_t i;
+
+  if ((sd_wcache_wb != SD_WCACHE_NONE) || (sd_ra_fetch != SD_RA_NONE))
+  {
+    sd_xfer_abort();
+  }
+  sd_wcache_wb = SD_WCACHE_NONE;
+  sd_wcache_wb_lines = 0U;
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    sd_wcache[i].number_blocks = 0U;
+  }
+
+  sd_ra_fetch = SD_RA_NONE;
+  for (i = 0U; i < SD_RA_LINES; i++)
+  {
+    sd_ra[i].state = SD_RA_FREE;
+  }
+  sd_ra_sequential = 0U;
+  sd_discard_end = 0U;
+  sd_discard_next = 0U;
+  sd_wcache_lost_blocks = 0U;
+
+  sd_session.valid = UX_FALSE;
+  sd_init_step = SD_INIT_POWER_ON;
+}
+
+/**
+  * @brief  sd_media_update
+  *         Follow the detect switch. Once it stayed still for
+  *         SD_DETECT_DEBOUNCE it gives the card presence: a removal drops
+  *         the session at once, an insertion starts the identification,
+  *         which only sd_media_process() runs.
+  * @param  none
+  * @retval none
+  */
+static VOID sd_media_update(VOID)
+{
+  uint32_t tick = HAL_GetTick();
+
+  if (sd_detect_event && ((tick - sd_detect_tick) >= SD_DETECT_DEBOUNCE))
+  {
+    /* An edge from now on starts a new debounce period */
+    sd_detect_event = 0U;
+
+    if (board_sd_detect_getstate())
+    {
+      if ((sd_media_state == SD_MEDIA_ABSENT) || (sd_media_state == SD_MEDIA_REMOVED))
+      {
+        sd_media_state = SD_MEDIA_INIT;
+        sd_media_init_tick = tick - SD_MEDIA_INIT_RETRY;
+        sd_init_step = SD_INIT_POWER_ON;
+      }
+    }
+    else if ((sd_media_state == SD_MEDIA_INIT) || (sd_media_state == SD_MEDIA_READY))
+    {
+      if (sd_session.valid)
+      {
+        sd_session_close();
+      }
+      sd_media_changed = 0U;
+      sd_media_state = SD_MEDIA_REMOVED;
+    }
+  }
+}
+
+/**
+  * @brief  sd_media_init_run
+  *         Identify an inserted card one step per call, when no transfer
+  *         owns the bus. A failed identification starts again after
+  *         SD_MEDIA_INIT_RETRY.
+  * @param  none
+  * @retval none
+  */
+static VOID sd_media_init_run(VOID)
+{
+  uint32_t tick = HAL_GetTick();
+  UINT status;
+
+  if ((sd_xfer_state != SD_XFER_IDLE) || (((tick - sd_media_init_tick) < SD_MEDIA_INIT_RETRY) &&
+                                          (sd_init_step == SD_INIT_POWER_ON)))
+  {
+    return;
+  }
+
+  status = sd_session_open_run();
+  if (status == UX_STATE_NEXT)
+  {
+    sd_media_changed = 1U;
+    sd_media_state = SD_MEDIA_READY;
+  }
+  else if (status == UX_STATE_ERROR)
+  {
+    sd_media_init_tick = tick;
+  }
+}
+
+/**
+  * @brief  sd_bus_query
+  *         Read the switch function status of the card (CMD6 check mode),
+  *         the card is left in its current mode. All 64 bytes must come in,
+  *         sd_bus_select then checks function group 1 before a switch.
+  * @param  switch_status: filled with the 64 bytes status.
+  * @retval UX_SUCCESS or UX_ERROR
+  */
+static UINT sd_bus_query(uint8_t *switch_status)
+{
+  SDMMC_DataInitTypeDef data;
+  uint32_t words[SD_BUS_STATUS_SIZE / 4U] = {0};
+  uint32_t tickstart = HAL_GetTick();
+  uint32_t index = 0U;
+  uint32_t count;
+  UINT status = UX_SUCCESS;
+
+  hsd1.Instance->DCTRL = 0U;
+  if (SDMMC_CmdBlockLength(hsd1.Instance, SD_BUS_STATUS_SIZE) != HAL_SD_ERROR_NONE)
+  {
+    return UX_ERROR;
+  }
+
+  data.DataTimeOut   = SDMMC_DATATIMEOUT;
+  data.DataLength    = SD_BUS_STATUS_SIZE;
+  data.DataBlockSize = SDMMC_DATABLOCK_SIZE_64B;
+  data.TransferDir   = SDMMC_TRANSFER_DIR_TO_SDMMC;
+  data.TransferMode  = SDMMC_TRANSFER_MODE_BLOCK;
+  data.DPSM          = SDMMC_DPSM_ENABLE;
+  (void)SDMMC_ConfigData(hsd1.Instance, &data);
+
+  if (SDMMC_CmdSwitch(hsd1.Instance, SD_BUS_SWITCH_CHECK_HS) != HAL_SD_ERROR_NONE)
+  {
+    status = UX_ERROR;
+  }
+
+  while ((status == UX_SUCCESS) &&
+         !__HAL_SD_GET_FLAG(&hsd1, SDMMC_FLAG_RXOVERR | SDMMC_FLAG_DCRCFAIL | SDMMC_FLAG_DTIMEOUT |
+                            SDMMC_FLAG_DBCKEND | SDMMC_FLAG_DATAEND))
+  {
+    if (__HAL_SD_GET_FLAG(&hsd1, SDMMC_FLAG_RXFIFOHF) && (index < (SD_BUS_STATUS_SIZE / 4U)))
+    {
+      for (count = 0U; count < 8U; count++)
+      {
+        words[index++] = SDMMC_ReadFIFO(hsd1.Instance);
+      }
+    }
+    if ((HAL_GetTick() - tickstart) > SD_TIMEOUT)
+    {
+      status = UX_ERROR;
+    }
+  }
+
+  /* The end of the block can be flagged before the last half FIFO was read */
+  while ((status == UX_SUCCESS) && !__HAL_SD_GET_FLAG(&hsd1, SDMMC_FLAG_RXFIFOE) &&
+         (index < (SD_BUS_STATUS_SIZE / 4U)))
+  {
+    words[index++] = SDMMC_ReadFIFO(hsd1.Instance);
+  }
+
+  if (__HAL_SD_GET_FLAG(&hsd1, SDMMC_FLAG_RXOVERR | SDMMC_FLAG_DCRCFAIL | SDMMC_FLAG_DTIMEOUT) ||
+      (index < (SD_BUS_STATUS_SIZE / 4U)))
+  {
+    status = UX_ERROR;
+  }
+  __HAL_SD_CLEAR_FLAG(&hsd1, SDMMC_STATIC_DATA_FLAGS);
+
+  /* Standard capacity cards use the block length for data transfers */
+  if (SDMMC_CmdBlockLength(hsd1.Instance, SD_BLOCK_SIZE) != HAL_SD_ERROR_NONE)
+  {
+    status = UX_ERROR;
+  }
+
+  memcpy(switch_status, words, SD_BUS_STATUS_SIZE);
+
+  return status;
+}
+
+/**
+  * @brief  sd_bus_select
+  *         Choose the bus mode and clock from the switch function status.
+  *         Each fallback halves the clock, high speed first goes down to
+  *         25 MHz then the card is moved back to default speed.
+  * @param  switch_status: CMD6 check mode status, NULL if CMD6 is not supported.
+  * @param  fallbacks: number of fallbacks after CRC errors or data timeouts.
+  * @param  frequency: filled with the bus clock, in Hz.
+  * @retval MSC_MEDIA_SD_DEFAULT_SPEED or MSC_MEDIA_SD_HIGH_SPEED
+  */
+static ULONG sd_bus_select(const uint8_t *switch_status, ULONG fallbacks, ULONG *frequency)
+{
+  UINT high_speed = UX_FALSE;
+
+  /* Function group 1: support bits in byte 13, the function the switch
+     would select in byte 16 (0xF when it cannot), busy bits in byte 29
+     of version 1 structures */
+  if ((switch_status != UX_NULL) && ((switch_status[13] & 0x02U) != 0U) &&
+      ((switch_status[16] & 0x0FU) == 0x01U) &&
+      ((switch_status[17] == 0U) || ((switch_status[29] & 0x02U) == 0U)))
+  {
+    high_speed = UX_TRUE;
+  }
+
+  if (high_speed)
+  {
+    if (fallbacks < SD_BUS_HS_STEPS)
+    {
+      *frequency = SD_BUS_HS_FREQ >> fallbacks;
+      return MSC_MEDIA_SD_HIGH_SPEED;
+    }
+    fallbacks -= SD_BUS_HS_STEPS;
+  }
+
+  *frequency = SD_BUS_DS_FREQ >> fallbacks;
+  return MSC_MEDIA_SD_DEFAULT_SPEED;
+}
+
+/**
+  * @brief  sd_bus_divider
+  *         Get the smallest divider keeping the bus clock under a frequency.
+  * @param  kernel_clock: SDMMC kernel clock, in Hz.
+  * @param  frequency: highest bus clock, in Hz.
+  * @retval CLKDIV value, SDMMC_CK = kernel_clock / (2 * CLKDIV)
+  */
+static ULONG sd_bus_divider(ULONG kernel_clock, ULONG frequency)
+{
+  ULONG divider;
+
+  divider = (kernel_clock + (2U * frequency) - 1U) / (2U * frequency);
+  if (divider == 0U)
+  {
+    divider = 1U;
+  }
+  if (divider > SDMMC_CLKCR_CLKDIV_Msk)
+  {
+    divider = SDMMC_CLKCR_CLKDIV_Msk;
+  }
+
+  return divider;
+}
+
+/**
+  * @brief  sd_bus_set_clock
+  *         Retune the bus clock divider.
+  * @param  frequency: highest bus clock, in Hz.
+  * @retval none
+  */
+static VOID sd_bus_set_clock(ULONG frequency)
+{
+  ULONG kernel_clock = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SDMMC1);
+  ULONG divider = sd_bus_divider(kernel_clock, frequency);
+
+  MODIFY_REG(hsd1.Instance->CLKCR, SDMMC_CLKCR_CLKDIV, divider);
+  sd_bus.clock = kernel_clock / (2U * divider);
+}
+
+/**
+  * @brief  sd_bus_apply
+  *         Move the card to the mode sd_bus_select gives for the fallbacks
+  *         so far, then set the bus clock. High speed goes down to 25 MHz
+  *         before the card is switched back to default speed, the clock is
+  *         never lowered further while the card stays in high speed.
+  *         A refused switch to high speed leaves the card in default speed.
+  * @param  none
+  * @retval UX_SUCCESS, or UX_ERROR when the card refused default speed
+  */
+static UINT sd_bus_apply(VOID)
+{
+  ULONG frequency;
+  ULONG mode;
+
+  mode = sd_bus_select(sd_bus.switch_valid ? sd_bus_switch_status : UX_NULL, sd_bus.fallbacks, &frequency);
+  if (mode != sd_bus.mode)
+  {
+    /* The HAL only switches cards it flagged as high speed capable,
+       the check mode status says the card is */
+    if (mode == MSC_MEDIA_SD_HIGH_SPEED)
+    {
+      hsd1.SdCard.CardSpeed = CARD_HIGH_SPEED;
+    }
+    if (HAL_SD_ConfigSpeedBusOperation(&hsd1, (mode == MSC_MEDIA_SD_HIGH_SPEED) ?
+                                       SDMMC_SPEED_MODE_HIGH : SDMMC_SPEED_MODE_DEFAULT) != HAL_OK)
+    {
+      if (mode != MSC_MEDIA_SD_HIGH_SPEED)
+      {
+        return UX_ERROR;
+      }
+
+      /* Switch refused, not a bus error: stay in default speed */
+      sd_bus.switch_valid = UX_FALSE;
+      mode = sd_bus_select(UX_NULL, sd_bus.fallbacks, &frequency);
+    }
+    if (mode != MSC_MEDIA_SD_HIGH_SPEED)
+    {
+      hsd1.SdCard.CardSpeed = CARD_NORMAL_SPEED;
+    }
+    sd_bus.mode = mode;
+  }
+
+  sd_bus_set_clock(frequency);
+  sd_bus.retune = UX_FALSE;
+
+  return UX_SUCCESS;
+}
+
+/**
+  * @brief  sd_bus_check
+  *         Move the card to the mode and clock of the fallbacks so far and
+  *         check a block read there, the card having been asked for its
+  *         switch functions first. The card starts at the fastest mode it
+  *         supports, on CRC errors or data timeouts the next call tries a
+  *         slower clock, then default speed. A refused switch leaves the
+  *         card in default speed, other errors fail the session.
+  *         The board has no 1.8V transceiver, UHS modes are not offered.
+  * @param  none
+  * @retval UX_STATE_NEXT once a read passed, UX_STATE_WAIT to try the
+  *         next fallback or UX_STATE_ERROR
+  */
+static UINT sd_bus_check(VOID)
+{
+  if ((sd_bus.fallbacks > SD_BUS_MAX_FALLBACKS) || (sd_bus_apply() != UX_SUCCESS))
+  {
+    return UX_STATE_ERROR;
+  }
+
+  /* Check data at the new clock */
+  sd_cmd_stats.data_commands++;
+  if ((HAL_SD_ReadBlocks(&hsd1, sd_ra_data[0], 0U, 1U, SD_TIMEOUT) == HAL_OK) &&
+      (sd_card_state() == HAL_SD_CARD_TRANSFER))
+  {
+    return UX_STATE_NEXT;
+  }
+
+  return sd_bus_error(UX_FALSE) ? UX_STATE_WAIT : UX_STATE_ERROR;
+}
+
+/**
+  * @brief  sd_bus_error
+  *         Count a failed command or transfer. Only the CRC errors and data
+  *         timeouts the SDMMC flags are blamed on the bus clock and step the
+  *         fallbacks, the card keeps them until it is removed. A card that stays busy or does not answer a command is
+  *         counted as a timeout but keeps its clock.
+  * @param  timeout: UX_TRUE when the transfer ran out of time.
+  * @retval UX_TRUE when the fallbacks were stepped
+  */
+static UINT sd_bus_error(UINT timeout)
+{
+  if ((hsd1.ErrorCode & (HAL_SD_ERROR_DATA_CRC_FAIL | HAL_SD_ERROR_CMD_CRC_FAIL)) != 0U)
+  {
+    sd_bus.crc_errors++;
+  }
+  else if (timeout || ((hsd1.ErrorCode & SD_BUS_TIMEOUTS) != 0U))
+  {
+    sd_bus.timeouts++;
+  }
+
+  if (((hsd1.ErrorCode & SD_BUS_ERRORS) != 0U) && (sd_bus.fallbacks < SD_BUS_MAX_FALLBACKS))
+  {
+    sd_bus.fallbacks++;
+    return UX_TRUE;
+  }
+
+  return UX_FALSE;
+}
+
+/**
+  * @brief  sd_wcache_writeback
+  *         Run the write-back of the cache line selected by sd_wcache_wb.
+  *         The write-back starts from the first line of its run on the
+  *         card, the lines following it are chained behind it in the IDMA
+  *         linked list whatever their place in the cache, so that the run
+  *         goes out in one multi-block write without being copied together
+  *         first. The nodes are taken in order from sd_sg_nodes, each one
+  *         above the head node as the IDMA needs.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT sd_wcache_writeback(ULONG *media_status)
+{
+  SD_WCacheLineTypeDef *line;
+  ULONG number_blocks;
+  UINT status;
+  uint8_t i;
+
+  /* Build the chain when the transfer (re)starts */
+  if (sd_xfer_state == SD_XFER_IDLE)
+  {
+    /* Go back to the first line of the run */
+    i = 0U;
+    while (i < SD_WCACHE_LINES)
+    {
+      if ((i != sd_wcache_wb) && (sd_wcache[i].number_blocks != 0U) &&
+          ((sd_wcache[i].lba + sd_wcache[i].number_blocks) == sd_wcache[sd_wcache_wb].lba))
+      {
+        sd_wcache_wb = i;
+        i = 0U;
+        continue;
+      }
+      i++;
+    }
+  }
+
+  line = &sd_wcache[sd_wcache_wb];
+  number_blocks = line->number_blocks;
+
+  if (sd_xfer_state == SD_XFER_IDLE)
+  {
+    sd_sg_reset();
+    sd_wcache_wb_lines = (uint8_t)(1U << sd_wcache_wb);
+    (void)sd_sg_add(sd_wcache_data[sd_wcache_wb], line->number_blocks);
+
+    i = 0U;
+    while (i < SD_WCACHE_LINES)
+    {
+      if (((sd_wcache_wb_lines & (1U << i)) == 0U) && (sd_wcache[i].number_blocks != 0U) &&
+          (sd_wcache[i].lba == (line->lba + number_blocks)))
+      {
+        if (sd_sg_add(sd_wcache_data[i], sd_wcache[i].number_blocks) != UX_SUCCESS)
+        {
+          break;
+        }
+        sd_wcache_wb_lines |= (uint8_t)(1U << i);
+        number_blocks += sd_wcache[i].number_blocks;
+        i = 0U;
+        continue;
+      }
+      i++;
+    }
+
+    /* A single line goes through the plain DMA */
+    if (sd_sg_list.NodesCounter < 2U)
+    {
+      sd_sg_reset();
+    }
+  }
+  else
+  {
+    for (i = 0U; i < SD_WCACHE_LINES; i++)
+    {
+      if ((i != sd_wcache_wb) && ((sd_wcache_wb_lines & (1U << i)) != 0U))
+      {
+        number_blocks += sd_wcache[i].number_blocks;
+      }
+    }
+  }
+
+  status = sd_xfer_run(sd_wcache_data[sd_wcache_wb], number_blocks, line->lba,
+                       SD_WRITE_FLAG, media_status);
+  if (status == UX_STATE_WAIT)
+  {
+    return status;
+  }
+
+  if (status == UX_STATE_NEXT)
+  {
+    sd_wcache_sd_writes++;
+  }
+
+  /* Written lines are free again. Failed ones stay dirty for the next
+     write-back, until they failed SD_WCACHE_RETRIES times. */
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    if ((sd_wcache_wb_lines & (1U << i)) == 0U)
+    {
+      continue;
+    }
+
+    if ((status != UX_STATE_NEXT) && (++sd_wcache[i].retries < SD_WCACHE_RETRIES))
+    {
+      continue;
+    }
+
+    if (status != UX_STATE_NEXT)
+    {
+      sd_wcache_lose(sd_wcache[i].lba, sd_wcache[i].number_blocks, *media_status);
+    }
+    sd_wcache[i].number_blocks = 0U;
+  }
+  sd_wcache_wb_lines = 0U;
+  sd_wcache_wb = SD_WCACHE_NONE;
+
+  /* The idle write-back retries after a pause */
+  if (status != UX_STATE_NEXT)
+  {
+    sd_wcache_tick = HAL_GetTick();
+  }
+
+  return status;
+}
+
+/**
+  * @brief  sd_wcache_lose
+  *         Record blocks of a dropped cache line: the next flush reports
+  *         the error, reads of the blocks fail until they are written again.
+  *         One range is kept, it grows to cover the blocks of all lines lost.
+  * @param  lba: first block lost.
+  * @param  number_blocks: number of blocks lost.
+  * @param  media_status: sense status of the failed write-back.
+  * @retval none
+  */
+static VOID sd_wcache_lose(ULONG lba, ULONG number_blocks, ULONG media_status)
+{
+  ULONG end = lba + number_blocks;
+
+  if (sd_wcache_lost_blocks != 0U)
+  {
+    if ((sd_wcache_lost_lba + sd_wcache_lost_blocks) > end)
+    {
+      end = sd_wcache_lost_lba + sd_wcache_lost_blocks;
+    }
+    if (sd_wcache_lost_lba < lba)
+    {
+      lba = sd_wcache_lost_lba;
+    }
+  }
+
+  sd_wcache_lost_lba = lba;
+  sd_wcache_lost_blocks = end - lba;
+  sd_wcache_error = media_status;
+}
+
+/**
+  * @brief  sd_wcache_rewritten
+  *         Take blocks the host wrote again out of the lost range. A write
+  *         inside the range leaves it as it is.
+  * @param  lba: first block written.
+  * @param  number_blocks: number of blocks written.
+  * @retval none
+  */
+static VOID sd_wcache_rewritten(ULONG lba, ULONG number_blocks)
+{
+  ULONG lost_end = sd_wcache_lost_lba + sd_wcache_lost_blocks;
+  ULONG end = lba + number_blocks;
+
+  if ((lba <= sd_wcache_lost_lba) && (end >= lost_end))
+  {
+    sd_wcache_lost_blocks = 0U;
+  }
+  else if ((lba <= sd_wcache_lost_lba) && (end > sd_wcache_lost_lba))
+  {
+    sd_wcache_lost_blocks = lost_end - end;
+    sd_wcache_lost_lba = end;
+  }
+  else if ((lba < lost_end) && (end >= lost_end))
+  {
+    sd_wcache_lost_blocks = lba - sd_wcache_lost_lba;
+  }
+}
+
+/**
+  * @brief  sd_wcache_flush_status
+  *         A write-back the flush runs fails the flush itself: lines it
+  *         lost need not be reported again by the next one.
+  * @param  status: write-back status.
+  * @retval status
+  */
+static UINT sd_wcache_flush_status(UINT status)
+{
+  if (status == UX_STATE_ERROR)
+  {
+    sd_wcache_error = 0U;
+  }
+
+  return status;
+}
+
+/**
+  * @brief  sd_wcache_evict
+  *         Start the write-back of a cache line.
+  * @param  index: cache line index.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT or UX_STATE_ERROR
+  */
+static UINT sd_wcache_evict(uint8_t index, ULONG *media_status)
+{
+  UINT status;
+
+  sd_wcache_wb = index;
+  status = sd_wcache_writeback(media_status);
+
+  /* The caller is called again and retries once the line is free */
+  return (status == UX_STATE_NEXT) ? UX_STATE_WAIT : status;
+}
+
+/**
+  * @brief  sd_wcache_find_overlap
+  *         Find a dirty cache line holding any of the given blocks.
+  * @param  lba: first block.
+  * @param  number_blocks: number of blocks.
+  * @param  skip: cache line index to ignore.
+  * @retval cache line index or SD_WCACHE_NONE
+  */
+static uint8_t sd_wcache_find_overlap(ULONG lba, ULONG number_blocks, uint8_t skip)
+{
+  SD_WCacheLineTypeDef *line;
+  uint8_t i;
+
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    line = &sd_wcache[i];
+    if ((i != skip) && (line->number_blocks != 0U) &&
+        (lba < (line->lba + line->number_blocks)) && (line->lba < (lba + number_blocks)))
+    {
+      return i;
+    }
+  }
+
+  return SD_WCACHE_NONE;
+}
+
+/**
+  * @brief  sd_wcache_write
+  *         Store blocks in the write-back cache. Writes that extend or
+  *         overwrite a cached run are merged into its line so that adjacent
+  *         sectors reach the card in a single CMD25.
+  * @param  data_pointer: Address of the buffer to be written.
+  * @param  number_blocks: number of sectors to write.
+  * @param  lba: Logical block address is the sector address to write.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT sd_wcache_write(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                            ULONG *media_status)
+{
+  SD_WCacheLineTypeDef *line;
+  uint8_t index = SD_WCACHE_NONE;
+  uint8_t i;
+
+  /* Too big to be cached, write it through */
+  if ((number_blocks > SD_WCACHE_LINE_BLOCKS) || (MSC_SD_WCACHE == 0U))
+  {
+    i = sd_wcache_find_overlap(lba, number_blocks, SD_WCACHE_NONE);
+    if (i != SD_WCACHE_NONE)
+    {
+      return sd_wcache_evict(i, media_status);
+    }
+
+    return sd_xfer_run(data_pointer, number_blocks, lba, SD_WRITE_FLAG, media_status);
+  }
+
+  /* Look for a line this write extends or overwrites */
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    line = &sd_wcache[i];
+    if ((line->number_blocks != 0U) && (lba >= line->lba) &&
+        (lba <= (line->lba + line->number_blocks)) &&
+        ((lba + number_blocks) <= (line->lba + SD_WCACHE_LINE_BLOCKS)))
+    {
+      index = i;
+      break;
+    }
+  }
+
+  /* Older copies of these blocks in other lines must reach the card first */
+  i = sd_wcache_find_overlap(lba, number_blocks, index);
+  if (i != SD_WCACHE_NONE)
+  {
+    return sd_wcache_evict(i, media_status);
+  }
+
+  if (index == SD_WCACHE_NONE)
+  {
+    /* Take a free line, or write back the least recently used one */
+    index = 0U;
+    for (i = 0U; i < SD_WCACHE_LINES; i++)
+    {
+      if (sd_wcache[i].number_blocks == 0U)
+      {
+        index = i;
+        break;
+      }
+
+      if (sd_wcache[i].age < sd_wcache[index].age)
+      {
+        index = i;
+      }
+    }
+
+    if (sd_wcache[index].number_blocks != 0U)
+    {
+      return sd_wcache_evict(index, media_status);
+    }
+
+    sd_wcache[index].lba = lba;
+    sd_wcache[index].retries = 0U;
+  }
+
+  line = &sd_wcache[index];
+  memcpy(&sd_wcache_data[index][(lba - line->lba) * SD_BLOCK_SIZE],
+         data_pointer, number_blocks * SD_BLOCK_SIZE);
+  if ((lba + number_blocks) > (line->lba + line->number_blocks))
+  {
+    line->number_blocks = lba + number_blocks - line->lba;
+  }
+  line->age = ++sd_wcache_age;
+
+  sd_wcache_tick = HAL_GetTick();
+  sd_wcache_host_writes++;
+
+  return UX_STATE_NEXT;
+}
+
+/**
+  * @brief  sd_wcache_read_hit
+  *         Serve a read from the write-back cache if one line holds all blocks.
+  * @param  data_pointer: Address of the buffer to be filled.
+  * @param  number_blocks: number of sectors to read.
+  * @param  lba: Logical block address is the sector address to read.
+  * @retval UX_TRUE on hit
+  */
+static UINT sd_wcache_read_hit(UCHAR *data_pointer, ULONG number_blocks, ULONG lba)
+{
+  SD_WCacheLineTypeDef *line;
+  uint8_t i;
+
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    line = &sd_wcache[i];
+    if ((line->number_blocks != 0U) && (lba >= line->lba) &&
+        ((lba + number_blocks) <= (line->lba + line->number_blocks)))
+    {
+      memcpy(data_pointer, &sd_wcache_data[i][(lba - line->lba) * SD_BLOCK_SIZE],
+             number_blocks * SD_BLOCK_SIZE);
+      return UX_TRUE;
+    }
+  }
+
+  return UX_FALSE;
+}
+
+/**
+  * @brief  sd_wcache_overlay
+  *         Patch blocks read from the card with newer cached ones.
+  * @param  data_pointer: Address of the buffer read from the card.
+  * @param  number_blocks: number of sectors read.
+  * @param  lba: Logical block address is the sector address read.
+  * @retval none
+  */
+static VOID sd_wcache_overlay(UCHAR *data_pointer, ULONG number_blocks, ULONG lba)
+{
+  SD_WCacheLineTypeDef *line;
+  ULONG first;
+  ULONG last;
+  uint8_t i;
+
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    line = &sd_wcache[i];
+    if (line->number_blocks == 0U)
+    {
+      continue;
+    }
+
+    first = (lba > line->lba) ? lba : line->lba;
+    last = ((lba + number_blocks) < (line->lba + line->number_blocks)) ?
+           (lba + number_blocks) : (line->lba + line->number_blocks);
+    if (first < last)
+    {
+      memcpy(&data_pointer[(first - lba) * SD_BLOCK_SIZE],
+             &sd_wcache_data[i][(first - line->lba) * SD_BLOCK_SIZE],
+             (last - first) * SD_BLOCK_SIZE);
+    }
+  }
+}
+
+/**
+  * @brief  sd_ra_read_hit
+  *         Serve a read from the read-ahead lines, the blocks may span
+  *         several lines.
+  * @param  data_pointer: Address of the buffer to be filled.
+  * @param  number_blocks: number of sectors to read.
+  * @param  lba: Logical block address is the sector address to read.
+  * @retval UX_TRUE on hit
+  */
+static UINT sd_ra_read_hit(UCHAR *data_pointer, ULONG number_blocks, ULONG lba)
+{
+  ULONG done = 0U;
+  ULONG count;
+  ULONG block;
+  uint8_t i;
+
+  while (done < number_blocks)
+  {
+    block = lba + done;
+    for (i = 0U; i < SD_RA_LINES; i++)
+    {
+      if ((sd_ra[i].state == SD_RA_READY) && (block >= sd_ra[i].lba) &&
+          (block < (sd_ra[i].lba + SD_RA_LINE_BLOCKS)))
+      {
+        break;
+      }
+    }
+
+    if (i == SD_RA_LINES)
+    {
+      return UX_FALSE;
+    }
+
+    count = sd_ra[i].lba + SD_RA_LINE_BLOCKS - block;
+    if (count > (number_blocks - done))
+    {
+      count = number_blocks - done;
+    }
+    memcpy(&data_pointer[done * SD_BLOCK_SIZE],
+           &sd_ra_data[i][(block - sd_ra[i].lba) * SD_BLOCK_SIZE],
+           count * SD_BLOCK_SIZE);
+    done += count;
+  }
+
+  return UX_TRUE;
+}
+
+/**
+  * @brief  sd_ra_invalidate
+  *         Drop read-ahead lines holding any of the given blocks.
+  * @param  lba: first block.
+  * @param  number_blocks: number of blocks.
+  * @retval none
+  */
+static VOID sd_ra_invalidate(ULONG lba, ULONG number_blocks)
+{
+  uint8_t i;
+
+  for (i = 0U; i < SD_RA_LINES; i++)
+  {
+    if ((sd_ra[i].state != SD_RA_FREE) &&
+        (lba < (sd_ra[i].lba + SD_RA_LINE_BLOCKS)) && (sd_ra[i].lba < (lba + number_blocks)))
+    {
+      if (i == sd_ra_fetch)
+      {
+        sd_ra_cancel();
+      }
+      sd_ra[i].state = SD_RA_FREE;
+    }
+  }
+}
+
+/**
+  * @brief  sd_ra_cancel
+  *         Abort the read-ahead in progress.
+  * @param  none
+  * @retval none
+  */
+static VOID sd_ra_cancel(VOID)
+{
+  sd_xfer_abort();
+  sd_ra[sd_ra_fetch].state = SD_RA_FREE;
+  sd_ra_fetch = SD_RA_NONE;
+}
+
+/**
+  * @brief  sd_ra_fetch_run
+  *         Run the read-ahead in progress.
+  * @param  none
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT sd_ra_fetch_run(VOID)
+{
+  SD_RALineTypeDef *line = &sd_ra[sd_ra_fetch];
+  ULONG media_status;
+  UINT status;
+
+  status = sd_xfer_run(sd_ra_data[sd_ra_fetch], SD_RA_LINE_BLOCKS, line->lba,
+                       SD_READ_FLAG, &media_status);
+  if (status == UX_STATE_WAIT)
+  {
+    return status;
+  }
+
+  if (status == UX_STATE_NEXT)
+  {
+    line->state = SD_RA_READY;
+    sd_read_stats.prefetches++;
+  }
+  else
+  {
+    /* Stop the stream, the host read will report the error */
+    line->state = SD_RA_FREE;
+    sd_ra_sequential = 0U;
+  }
+  sd_ra_fetch = SD_RA_NONE;
+
+  return status;
+}
+
+/**
+  * @brief  sd_ra_fetch_start
+  *         Start fetching the next line of a sequential stream, unless the
+  *         ring is already filled ahead of the host.
+  * @param  none
+  * @retval none
+  */
+static VOID sd_ra_fetch_start(VOID)
+{
+  SD_RALineTypeDef *line;
+  uint8_t i;
+
+  if ((MSC_SD_READ_AHEAD == 0U) || (sd_ra_sequential < SD_RA_TRIGGER))
+  {
+    return;
+  }
+
+  /* New stream, restart the ring at the host position */
+  if ((sd_ra_next_lba < sd_ra_end_lba) ||
+      (sd_ra_next_lba > (sd_ra_end_lba + (SD_RA_LINES * SD_RA_LINE_BLOCKS))))
+  {
+    for (i = 0U; i < SD_RA_LINES; i++)
+    {
+      sd_ra[i].state = SD_RA_FREE;
+    }
+    sd_ra_head = 0U;
+    sd_ra_next_lba = sd_ra_end_lba;
+  }
+
+  /* Stop at the end of the card */
+  if ((sd_ra_next_lba + SD_RA_LINE_BLOCKS) > sd_session.block_number)
+  {
+    return;
+  }
+
+  /* The oldest line is still ahead of the host */
+  line = &sd_ra[sd_ra_head];
+  if ((line->state == SD_RA_READY) && ((line->lba + SD_RA_LINE_BLOCKS) > sd_ra_end_lba))
+  {
+    return;
+  }
+
+  line->lba = sd_ra_next_lba;
+  line->state = SD_RA_FETCH;
+  sd_ra_fetch = sd_ra_head;
+  sd_ra_head = (uint8_t)((sd_ra_head + 1U) % SD_RA_LINES);
+  sd_ra_next_lba += SD_RA_LINE_BLOCKS;
+
+  (void)sd_ra_fetch_run();
+}
+
+/**
+  * @brief  sd_media_read
+  *         Read from the card, non-blocking.
+  * @param  data_pointer: Address of the buffer to be filled, NULL to abort.
+  * @param  number_blocks: number of sectors to read.
+  * @param  lba: Logical block address is the sector address to read.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT sd_media_read(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                          ULONG *media_status)
+{
+  UINT status;
+
+  /* Abort request from the storage class, a write-back or read-ahead is left running */
+  if ((data_pointer == UX_NULL) || (number_blocks == 0U))
+  {
+    if ((sd_wcache_wb == SD_WCACHE_NONE) && (sd_ra_fetch == SD_RA_NONE))
+    {
+      sd_xfer_abort();
+    }
+    return UX_STATE_NEXT;
+  }
+
+  /* The card is busy with a write-back */
+  if (sd_wcache_wb != SD_WCACHE_NONE)
+  {
+    status = sd_wcache_writeback(media_status);
+    if (status != UX_STATE_NEXT)
+    {
+      return status;
+    }
+  }
+
+  /* The card is busy with a read-ahead, wait for it if it has the first block */
+  if (sd_ra_fetch != SD_RA_NONE)
+  {
+    if ((lba >= sd_ra[sd_ra_fetch].lba) && (lba < (sd_ra[sd_ra_fetch].lba + SD_RA_LINE_BLOCKS)))
+    {
+      if (sd_ra_fetch_run() == UX_STATE_WAIT)
+      {
+        return UX_STATE_WAIT;
+      }
+    }
+    else
+    {
+      sd_ra_cancel();
+    }
+  }
+
+  if (sd_xfer_state == SD_XFER_IDLE)
+  {
+    /* The card holds older data than the host wrote */
+    if ((sd_wcache_lost_blocks != 0U) && (lba < (sd_wcache_lost_lba + sd_wcache_lost_blocks)) &&
+        (sd_wcache_lost_lba < (lba + number_blocks)))
+    {
+      *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_MEDIUM_ERROR, 0x11, 0x00);
+      return UX_STATE_ERROR;
+    }
+
+    /* Track sequential streams */
+    sd_ra_sequential = (lba == sd_ra_end_lba) ? (sd_ra_sequential + 1U) : 0U;
+    sd_ra_end_lba = lba + number_blocks;
+
+    if (sd_wcache_read_hit(data_pointer, number_blocks, lba) ||
+        sd_ra_read_hit(data_pointer, number_blocks, lba))
+    {
+      sd_wcache_overlay(data_pointer, number_blocks, lba);
+      sd_read_stats.hits++;
+      return UX_STATE_NEXT;
+    }
+
+    sd_read_stats.misses++;
+    sd_read_start = HAL_GetTick();
+  }
+
+  status = sd_xfer_run(data_pointer, number_blocks, lba, SD_READ_FLAG, media_status);
+  if (status == UX_STATE_NEXT)
+  {
+    sd_wcache_overlay(data_pointer, number_blocks, lba);
+
+    sd_read_stats.miss_latency = HAL_GetTick() - sd_read_start;
+    sd_read_stats.miss_latency_total += sd_read_stats.miss_latency;
+    if (sd_read_stats.miss_latency > sd_read_stats.miss_latency_max)
+    {
+      sd_read_stats.miss_latency_max = sd_read_stats.miss_latency;
+    }
+  }
+
+  return status;
+}
+
+/**
+  * @brief  sd_media_write
+  *         Write to the card through the write-back cache, non-blocking.
+  * @param  data_pointer: Address of the buffer to be written, NULL to abort.
+  * @param  number_blocks: number of sectors to write.
+  * @param  lba: Logical block address is the sector address to write.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT sd_media_write(UCHAR *data_pointer, ULONG number_blocks, ULONG lba,
+                           ULONG *media_status)
+{
+  UINT status;
+
+  /* Abort request from the storage class, a write-back or read-ahead is left running */
+  if ((data_pointer == UX_NULL) || (number_blocks == 0U))
+  {
+    if ((sd_wcache_wb == SD_WCACHE_NONE) && (sd_ra_fetch == SD_RA_NONE))
+    {
+      sd_xfer_abort();
+    }
+    return UX_STATE_NEXT;
+  }
+
+  /* Read-ahead copies of these blocks become stale */
+  sd_ra_invalidate(lba, number_blocks);
+  if (sd_ra_fetch != SD_RA_NONE)
+  {
+    sd_ra_cancel();
+  }
+
+  /* The card is busy with a write-back */
+  if (sd_wcache_wb != SD_WCACHE_NONE)
+  {
+    status = sd_wcache_writeback(media_status);
+    if (status != UX_STATE_NEXT)
+    {
+      return status;
+    }
+  }
+
+  /* Write-through already started */
+  if (sd_xfer_state != SD_XFER_IDLE)
+  {
+    status = sd_xfer_run(data_pointer, number_blocks, lba, SD_WRITE_FLAG, media_status);
+    if ((status == UX_STATE_NEXT) && (sd_wcache_lost_blocks != 0U))
+    {
+      sd_wcache_rewritten(lba, number_blocks);
+    }
+    return status;
+  }
+
+  status = sd_wcache_write(data_pointer, number_blocks, lba, media_status);
+  if ((status == UX_STATE_NEXT) && (sd_wcache_lost_blocks != 0U))
+  {
+    sd_wcache_rewritten(lba, number_blocks);
+  }
+
+  return status;
+}
+
+/**
+  * @brief  sd_media_flush
+  *         Write the whole cache back, non-blocking.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT sd_media_flush(ULONG *media_status)
+{
+  UINT status;
+  uint8_t i;
+
+  /* Report lines lost since the last flush */
+  if (sd_wcache_error != 0U)
+  {
+    *media_status = sd_wcache_error;
+    sd_wcache_error = 0U;
+    return UX_STATE_ERROR;
+  }
+
+  if (sd_wcache_wb != SD_WCACHE_NONE)
+  {
+    status = sd_wcache_writeback(media_status);
+    if (status != UX_STATE_NEXT)
+    {
+      return sd_wcache_flush_status(status);
+    }
+  }
+
+  /* Write back the whole cache, whatever the range asked */
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    if (sd_wcache[i].number_blocks != 0U)
+    {
+      return sd_wcache_flush_status(sd_wcache_evict(i, media_status));
+    }
+  }
+
+  /* Wait for the card to end programming the last write */
+  return sd_xfer_run(UX_NULL, 0U, 0U, SD_READY_FLAG, media_status);
+}
+
+/**
+  * @brief  sd_discard_run
+  *         One step of the discard of a range, sd_discard_next and
+  *         sd_discard_end keep the erase progress between the steps.
+  * @param  number_blocks: number of sectors to discard.
+  * @param  lba: Logical block address is the first sector to discard.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT sd_discard_run(ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  SD_WCacheLineTypeDef *line;
+  ULONG group;
+  ULONG end;
+  UINT status;
+  uint8_t i;
+
+  /* Read-ahead copies of these blocks become stale */
+  sd_ra_invalidate(lba, number_blocks);
+  if (sd_ra_fetch != SD_RA_NONE)
+  {
+    sd_ra_cancel();
+  }
+
+  /* The card is busy with a write-back */
+  if (sd_wcache_wb != SD_WCACHE_NONE)
+  {
+    status = sd_wcache_writeback(media_status);
+    if (status != UX_STATE_NEXT)
+    {
+      return status;
+    }
+  }
+
+  /* Wait for the card to end programming the last write or erase */
+  status = sd_xfer_run(UX_NULL, 0U, 0U, SD_READY_FLAG, media_status);
+  if (status != UX_STATE_NEXT)
+  {
+    return status;
+  }
+
+  if (sd_discard_end == 0U)
+  {
+    group = sd_session.erase_group_blocks;
+    sd_discard_next = ((lba + group - 1U) / group) * group;
+    end = ((lba + number_blocks) / group) * group;
+
+    /* No whole erase group in the range, nothing to erase */
+    if (sd_discard_next >= end)
+    {
+      return UX_STATE_NEXT;
+    }
+    sd_discard_end = end;
+  }
+  else if (sd_discard_next >= sd_discard_end)
+  {
+    return UX_STATE_NEXT;
+  }
+
+  /* Cached copies of erased blocks are dropped, lines also holding kept
+     blocks are written back before the erase */
+  for (i = 0U; i < SD_WCACHE_LINES; i++)
+  {
+    line = &sd_wcache[i];
+    if ((line->number_blocks != 0U) &&
+        (sd_discard_next < (line->lba + line->number_blocks)) && (line->lba < sd_discard_end))
+    {
+      if ((line->lba >= sd_discard_next) && ((line->lba + line->number_blocks) <= sd_discard_end))
+      {
+        line->number_blocks = 0U;
+      }
+      else
+      {
+        /* The line is written back, the erase is still to come */
+        status = sd_wcache_evict(i, media_status);
+        return (status == UX_STATE_NEXT) ? UX_STATE_WAIT : status;
+      }
+    }
+  }
+
+  /* CMD32/33/38 on the next chunk, the card programs it in the background */
+  end = sd_discard_next + (sd_session.erase_group_blocks * SD_ERASE_CHUNK_GROUPS);
+  if (end > sd_discard_end)
+  {
+    end = sd_discard_end;
+  }
+
+  sd_cmd_stats.erase_commands++;
+  if (HAL_SD_Erase(&hsd1, sd_discard_next, end - 1U) != HAL_OK)
+  {
+    *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_MEDIUM_ERROR, 0x0C, 0x00);
+    return UX_STATE_ERROR;
+  }
+
+  sd_session.card_state = HAL_SD_CARD_PROGRAMMING;
+  sd_xfer_timeout = sd_session.erase_timeout;
+  if (sd_wcache_lost_blocks != 0U)
+  {
+    sd_wcache_rewritten(sd_discard_next, end - sd_discard_next);
+  }
+  sd_discard_next = end;
+
+  /* Own the card until it ends the erase, the next call goes on */
+  status = sd_xfer_run(UX_NULL, 0U, 0U, SD_READY_FLAG, media_status);
+  if (status == UX_STATE_ERROR)
+  {
+    return status;
+  }
+
+  return UX_STATE_WAIT;
+}
+
+/**
+  * @brief  sd_media_discard
+  *         Erase blocks the host unmapped, non-blocking. Only the erase
+  *         groups fully inside the range are erased, the blocks around
+  *         keep their data. Large ranges are erased by chunks so that each
+  *         CMD38 ends within its timeout.
+  * @param  number_blocks: number of sectors to discard, 0 to abort.
+  * @param  lba: Logical block address is the first sector to discard.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_WAIT, UX_STATE_NEXT or UX_STATE_ERROR
+  */
+static UINT sd_media_discard(ULONG number_blocks, ULONG lba, ULONG *media_status)
+{
+  UINT status = UX_STATE_NEXT;
+
+  if (number_blocks != 0U)
+  {
+    status = sd_discard_run(number_blocks, lba, media_status);
+  }
+
+  /* Done, failed or aborted: the next range starts from scratch */
+  if (status != UX_STATE_WAIT)
+  {
+    sd_discard_end = 0U;
+    sd_discard_next = 0U;
+  }
+
+  return status;
+}
+
+/**
+  * @brief  sd_media_get_discard_granularity
+  *         Get the number of blocks erased at once by the card.
+  * @param  none
+  * @retval erase group size in blocks
+  */
+static ULONG sd_media_get_discard_granularity(VOID)
+{
+  sd_media_update();
+  if (sd_media_state != SD_MEDIA_READY)
+  {
+    return 0U;
+  }
+
+  return sd_session.erase_group_blocks;
+}
+
+/**
+  * @brief  sd_media_status
+  *         Check the card can be accessed.
+  * @param  media_status: sense status on error.
+  * @retval UX_SUCCESS or UX_ERROR
+  */
+static UINT sd_media_status(ULONG *media_status)
+{
+  /* Called once per READ/WRITE/TEST UNIT READY/SYNCHRONIZE CACHE */
+  sd_cmd_stats.scsi_commands++;
+
+  sd_media_update();
+
+  switch (sd_media_state)
+  {
+    case SD_MEDIA_READY:
+      /* A new card: the host must drop what it knew of the previous one */
+      if (sd_media_changed)
+      {
+        sd_media_changed = 0U;
+        *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_UNIT_ATTENTION, 0x28, 0x00);
+        return UX_ERROR;
+      }
+      return UX_SUCCESS;
+
+    case SD_MEDIA_INIT:
+      /* Logical unit is in process of becoming ready */
+      *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_NOT_READY, 0x04, 0x01);
+      return UX_ERROR;
+
+    case SD_MEDIA_REMOVED:
+      /* Removal reported once, a card inserted later raises a unit attention */
+      sd_media_state = SD_MEDIA_ABSENT;
+
+      /* Fall through.  */
+    default:
+      *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_NOT_READY, 0x3A, 0x00);
+      return UX_ERROR;
+  }
+}
+
+/**
+  * @brief  sd_media_get_last_lba
+  *         Get the card last LBA.
+  * @param  none
+  * @retval last lba
+  */
+static ULONG sd_media_get_last_lba(VOID)
+{
+  sd_media_update();
+  if (sd_media_state != SD_MEDIA_READY)
+  {
+    return 0U;
+  }
+
+  return sd_session.block_number - 1U;
+}
+
+/**
+  * @brief  sd_media_get_block_length
+  *         Get the card block length.
+  * @param  none
+  * @retval block length
+  */
+static ULONG sd_media_get_block_length(VOID)
+{
+  sd_media_update();
+  if (sd_media_state != SD_MEDIA_READY)
+  {
+    return SD_BLOCK_SIZE;
+  }
+
+  return sd_session.block_size;
+}
+
+/**
+  * @brief  sd_media_process
+  *         Background work of the card, called from the main loop.
+  *         Writes the cache back once the host stays idle, reads ahead of
+  *         sequential streams and drops the caches when the card is removed.
+  * @param  none
+  * @retval none
+  */
+static VOID sd_media_process(VOID)
+{
+  ULONG media_status = 0U;
+  uint8_t i;
+
+  /* Follow insertions and removals, identify a new card before the host asks */
+  sd_media_update();
+  if (sd_media_state == SD_MEDIA_INIT)
+  {
+    sd_media_init_run();
+  }
+  if (sd_media_state != SD_MEDIA_READY)
+  {
+    return;
+  }
+
+  /* Keep a started write-back going between commands */
+  if (sd_wcache_wb != SD_WCACHE_NONE)
+  {
+    /* A failed line stays dirty and is retried, see sd_wcache_writeback() */
+    (void)sd_wcache_writeback(&media_status);
+    return;
+  }
+
+  /* Keep a started read-ahead going, the host data is sent meanwhile */
+  if (sd_ra_fetch != SD_RA_NONE)
+  {
+    (void)sd_ra_fetch_run();
+    return;
+  }
+
+  /* A command owns the card */
+  if (sd_xfer_state != SD_XFER_IDLE)
+  {
+    return;
+  }
+
+  /* Write the cache back once the host stops writing */
+  if ((HAL_GetTick() - sd_wcache_tick) >= SD_WCACHE_IDLE_TIMEOUT)
+  {
+    for (i = 0U; i < SD_WCACHE_LINES; i++)
+    {
+      if (sd_wcache[i].number_blocks != 0U)
+      {
+        (void)sd_wcache_evict(i, &media_status);
+        return;
+      }
+    }
+  }
+
+  sd_ra_fetch_start();
+}
+
+/**
+  * @brief  MSC_Media_SD_DetectCallback
+  *         Card detect switch edge, called from the EXTI interrupt. The
+  *         switch bounces, it is only sampled once it stays still.
+  * @param  none
+  * @retval none
+  */
+VOID MSC_Media_SD_DetectCallback(VOID)
+{
+  sd_detect_tick = HAL_GetTick();
+  sd_detect_event = 1U;
+}
+
+/**
+  * @brief  MSC_Media_SD_GetReadStats
+  *         Get the read path counters.
+  * @param  stats: filled with the counters.
+  * @retval none
+  */
+VOID MSC_Media_SD_GetReadStats(MSC_MediaReadStatsTypeDef *stats)
+{
+  *stats = sd_read_stats;
+}
+
+/**
+  * @brief  MSC_Media_SD_GetCmdStats
+  *         Get the SD commands issued for the SCSI commands, the ratio of
+  *         the two shows the command overhead of the transfers.
+  * @param  stats: filled with the counters.
+  * @retval none
+  */
+VOID MSC_Media_SD_GetCmdStats(MSC_MediaCmdStatsTypeDef *stats)
+{
+  *stats = sd_cmd_stats;
+}
+
+/**
+  * @brief  MSC_Media_SD_GetBusInfo
+  *         Get the negotiated bus mode and the measured throughput.
+  * @param  info: filled with the bus information.
+  * @retval none
+  */
+VOID MSC_Media_SD_GetBusInfo(MSC_MediaBusInfoTypeDef *info)
+{
+  info->mode = sd_bus.mode;
+  info->clock = sd_session.valid ? sd_bus.clock : 0U;
+  info->fallbacks = sd_bus.fallbacks;
+  info->crc_errors = sd_bus.crc_errors;
+  info->timeouts = sd_bus.timeouts;
+  info->throughput = (sd_bus.busy_ms != 0U) ? (ULONG)((sd_bus.bytes * 1000U) / sd_bus.busy_ms) : 0U;
+}
+
+/**
+  * @brief Rx Transfer completed callback.
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_RxCpltCallback(SD_HandleTypeDef *hsd)
+{
+  UNUSED(hsd);
+  sd_xfer_flags |= SD_READ_FLAG;
+}
+
+/**
+  * @brief Tx Transfer completed callback.
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_TxCpltCallback(SD_HandleTypeDef *hsd)
+{
+  UNUSED(hsd);
+  sd_xfer_flags |= SD_WRITE_FLAG;
+}
+
+/**
+  * @brief SD error callback.
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+  UNUSED(hsd);
+  sd_xfer_flags |= SD_ERROR_FLAG;
+}
@@ -1,5 +1,8 @@
 #include "ux_device_audio.h"
 #include "audio_sai_slave.h"
+#include "audio_pcm.h"
+#include "ux_device_stack.h"
+#include <string.h>
 
 /* Local handles */
 static UX_SLAVE_INTERFACE *audio_interface_control;
@@ -13,6 +16,58 @@ static UX_SLAVE_ENDPOINT *audio_endpoint_feedback;
 static volatile uint32_t audio_active_out = 0;
 static volatile uint32_t audio_active_in = 0;
 
+/* Streaming formats, indexed by alternate setting */
+typedef struct
+{
+    uint8_t channels;
+    uint8_t subslot;                /* bytes per sample on USB */
+    uint16_t max_packet;            /* data endpoint wMaxPacketSize */
+    Audio_PCM_UnpackFunc unpack;
+    Audio_PCM_PackFunc pack;
+} Audio_FormatTypeDef;
+
+static const Audio_FormatTypeDef audio_formats[AUDIO_ALT_COUNT + 1] =
+{
+    { 0, 0, 0, NULL, NULL },        /* zero bandwidth */
+    { 2, 3, USB_AUDIO_EP_SIZE_STEREO_24, Audio_PCM_Unpack24_Gain, Audio_PCM_Pack24_Gain },
+    { 2, 2, USB_AUDIO_EP_SIZE_STEREO_16, Audio_PCM_Unpack16_Gain, Audio_PCM_Pack16_Gain },
+    { 2, 4, USB_AUDIO_EP_SIZE_STEREO_32, Audio_PCM_Unpack32_Gain, Audio_PCM_Pack32_Gain },
+#if AUDIO_CHANNELS > 2
+    { AUDIO_CHANNELS, 2, USB_AUDIO_EP_SIZE_TDM_16, Audio_PCM_Unpack16_Gain, Audio_PCM_Pack16_Gain },
+#endif
+};
+
+/* Formats of the active streams */
+static const Audio_FormatTypeDef *audio_format_out = &audio_formats[AUDIO_ALT_STEREO_24];
+static const Audio_FormatTypeDef *audio_format_in = &audio_formats[AUDIO_ALT_STEREO_24];
+
+/* Sampling rate selected by the host through the clock source */
+static const uint32_t audio_frequencies[AUDIO_FREQUENCY_COUNT] = AUDIO_FREQUENCIES;
+static uint32_t audio_frequency = AUDIO_FREQUENCY;
+
+/* IN packet sizing: the 1/1000 remainder of the rate (44.1 kHz sends
+   nine packets of 44 frames, then one of 45) */
+static uint32_t in_packet_remainder = 0;
+
+/* Last ring levels measured by the streams, in frames */
+static volatile int32_t latency_out_frames = 0;
+static volatile int32_t latency_in_frames = 0;
+
+/* Feature units: controls set by the host, the gain stage they drive */
+typedef struct
+{
+    uint8_t mute[AUDIO_CHANNELS + 1];       /* master, then each channel */
+    int16_t volume[AUDIO_CHANNELS + 1];     /* 1/256 dB */
+    Audio_PCM_GainTypeDef gain;
+} Audio_FeatureUnitTypeDef;
+
+static Audio_FeatureUnitTypeDef audio_feature_out;
+static Audio_FeatureUnitTypeDef audio_feature_in;
+
+/* Fade in gains of the OUT and IN streams (Q16), ramped up after each start */
+static int32_t audio_fade_gain_out = AUDIO_PCM_UNITY;
+static int32_t audio_fade_gain_in = AUDIO_PCM_UNITY;
+
 /* Internal Buffers */
 /* USB buffers need to hold one packet. */
 static uint8_t usb_rx_packet[USB_AUDIO_EP_SIZE];
@@ -20,20 +75,73 @@ static uint8_t usb_tx_packet[USB_AUDIO_EP_SIZE];
 static uint8_t feedback_data[4]; /* 4 bytes for UAC 2.0 (16.16) */
 
 /* Feedback Logic */
-static uint32_t feedback_accum = 0;
-static uint32_t feedback_count = 0;
-static uint32_t last_dma_head = 0;
-/* Initial guess: 48.0 samples/frame */
-static uint32_t current_feedback = 0x00300000;
+/* SAI consumption measured over AUDIO_FB_WINDOW packets */
+static uint32_t feedback_window_frames = 0;
+static uint32_t feedback_window_count = 0;
+static uint32_t last_dma_position = 0;
+/* Measured SAI rate, 16.16 samples/frame */
+static uint32_t feedback_rate = AUDIO_FB_NOMINAL(AUDIO_FREQUENCY);
+/* Integral of the fill level error, in frames */
+static int32_t feedback_integral = 0;
+/* Value sent to the host, 16.16 samples/frame */
+static volatile uint32_t current_feedback = AUDIO_FB_NOMINAL(AUDIO_FREQUENCY);
 
-/* Ring Buffer Pointers (Software) */
-static volatile uint32_t tx_write_ptr = 0; /* Index in frames (0 to AUDIO_BUFFER_FRAMES-1) */
-static volatile uint32_t rx_read_ptr = 0;  /* Index in frames */
+#if AUDIO_FB_SOURCE != AUDIO_FB_PACKET
+/* SOF timestamps: the DMA position of one ring and the USB frame number,
+   sampled together every 2^AUDIO_FB_SOF_SHIFT SOFs */
+static const Audio_RingTypeDef *sof_ring = NULL;    /* NULL: restart */
+static uint32_t sof_count = 0;
+static uint32_t sof_frame_number = 0;
+static uint32_t sof_position = 0;
+static uint32_t sof_window_frames = 0;              /* SAI frames */
+static uint32_t sof_window_sofs = 0;                /* USB frames */
+/* IN packet sizing on the measured rate, 16.16 remainder */
+static uint32_t in_packet_fraction = 0;
+#endif
+
+/* Statistics: the counts of the streaming endpoints, and the counters kept by
+   the rings and the SAI at the last clear */
+typedef struct
+{
+    uint32_t out_packets;
+    uint32_t out_dropped;
+    uint32_t in_packets;
+    uint32_t in_empty;
+    int32_t tx_fill_min;
+    int32_t tx_fill_max;
+    int32_t rx_fill_min;
+    int32_t rx_fill_max;
+    volatile uint32_t feedback_count;
+    uint32_t feedback_history[AUDIO_STATS_FB_HISTORY];
+
+    uint32_t tx_underruns_base;
+    uint32_t rx_overruns_base;
+    Audio_SAI_ErrorsTypeDef sai_base;
+} Audio_StatsStateTypeDef;
+
+static Audio_StatsStateTypeDef audio_stats =
+{
+    .tx_fill_min = INT32_MAX, .tx_fill_max = INT32_MIN,
+    .rx_fill_min = INT32_MAX, .rx_fill_max = INT32_MIN,
+};
 
 /* Forward Decls */
-static void _ux_device_class_audio_iso_out_callback(UX_SLAVE_TRANSFER *transfer);
-static void _ux_device_class_audio_iso_in_callback(UX_SLAVE_TRANSFER *transfer);
-static void _ux_device_class_audio_feedback_callback(UX_SLAVE_TRANSFER *transfer);
+static void _ux_device_class_audio_iso_out_done(UX_SLAVE_TRANSFER *transfer);
+static void _ux_device_class_audio_iso_in_done(UX_SLAVE_TRANSFER *transfer);
+static void _ux_device_class_audio_feedback_done(UX_SLAVE_TRANSFER *transfer);
+static void _ux_device_class_audio_transfer_step(UX_SLAVE_ENDPOINT *endpoint,
+                                                 void (*done)(UX_SLAVE_TRANSFER *transfer));
+static UINT _ux_device_class_audio_control_request(void);
+static UINT _ux_device_class_audio_vendor_request(UX_SLAVE_TRANSFER *transfer);
+static void _ux_device_class_audio_stats_fill(int32_t level, int32_t *min, int32_t *max);
+static UINT _ux_device_class_audio_format_fits(const Audio_FormatTypeDef *format, ULONG frequency);
+static void _ux_device_class_audio_tx_fade_out(void);
+static void _ux_device_class_audio_feedback_reset(void);
+static void _ux_device_class_audio_rate_update(uint32_t measured);
+static void _ux_device_class_audio_feedback_control(uint32_t current_dma);
+static void _ux_device_class_audio_feature_init(Audio_FeatureUnitTypeDef *feature);
+static UINT _ux_device_class_audio_feature_request(Audio_FeatureUnitTypeDef *feature,
+                                                   UX_SLAVE_TRANSFER *transfer);
 
 UINT ux_device_class_audio_entry(UX_SLAVE_CLASS_COMMAND *command)
 {
@@ -49,6 +157,8 @@ UINT ux_device_class_audio_entry(UX_SLAVE_CLASS_COMMAND *command)
                 if (!sai_initialized)
                 {
                     Audio_SAI_Init();
+                    _ux_device_class_audio_feature_init(&audio_feature_out);
+                    _ux_device_class_audio_feature_init(&audio_feature_in);
                     sai_initialized = 1;
                 }
             }
@@ -65,26 +175,40 @@ UINT ux_device_class_audio_entry(UX_SLAVE_CLASS_COMMAND *command)
                 }
                 else if (interface->ux_slave_interface_descriptor.bInterfaceSubClass == 0x02) /* AS */
                 {
-                    /* Check Alt Setting. Alt 0 is Zero Bandwidth. Alt 1 is Active. */
-                    if (interface->ux_slave_interface_descriptor.bAlternateSetting == 1)
+                    /* Check Alt Setting. Alt 0 is Zero Bandwidth, the others select a format. */
+                    ULONG alternate = interface->ux_slave_interface_descriptor.bAlternateSetting;
+                    if ((alternate >= 1) && (alternate <= AUDIO_ALT_COUNT))
                     {
+                        /* The format cannot carry the current rate, refuse the alt setting */
+                        if (!_ux_device_class_audio_format_fits(&audio_formats[alternate], audio_frequency))
+                        {
+                            return UX_ERROR;
+                        }
+
                         /* Check endpoints to determine direction */
                         if (interface->ux_slave_interface_first_endpoint->ux_slave_endpoint_descriptor.bEndpointAddress & 0x80)
                         {
                             /* IN Endpoint -> Record */
                             audio_interface_stream_in = interface;
                             audio_endpoint_iso_in = interface->ux_slave_interface_first_endpoint;
+                            audio_format_in = &audio_formats[alternate];
                             audio_active_in = 1;
 
+                            /* Start or resume the RX DMA only, playback is not disturbed */
+                            Audio_SAI_Start_RX();
+                            audio_fade_gain_in = 0;
+                            in_packet_remainder = 0;
+#if AUDIO_FB_SOURCE != AUDIO_FB_PACKET
+                            in_packet_fraction = 0;
+#endif
+
                             /* Reset Read Pointer to current DMA Head to avoid reading stale data */
                             /* Note: DMA Head is in Words (32-bit). We need index in Frames (2 words) */
                             /* But SAI might be running. Safe to sync. */
-                            rx_read_ptr = Audio_SAI_Get_RX_Head() / 2; /* Convert 32-bit words to Frames (LR) */
+                            Audio_Ring_Resync(&Audio_RX_Ring, Audio_SAI_Get_RX_Head() / AUDIO_CHANNELS); /* Convert 32-bit words to Frames (LR) */
 
-                            /* Start the transfer chain */
-                            UX_SLAVE_TRANSFER *transfer = &audio_endpoint_iso_in->ux_slave_endpoint_transfer_request;
-                            transfer->ux_slave_transfer_request_completion_function = _ux_device_class_audio_iso_in_callback;
-                            _ux_device_class_audio_iso_in_callback(transfer);
+                            /* Start the transfer chain, Audio_Process keeps it going */
+                            _ux_device_class_audio_iso_in_done(&audio_endpoint_iso_in->ux_slave_endpoint_transfer_request);
                         }
                         else
                         {
@@ -93,34 +217,33 @@ UINT ux_device_class_audio_entry(UX_SLAVE_CLASS_COMMAND *command)
                             audio_endpoint_iso_out = interface->ux_slave_interface_first_endpoint;
 
                             /* Find Feedback Endpoint (IN) */
-                            if (interface->ux_slave_interface_first_endpoint->ux_slave_endpoint_next_endpoint)
-                            {
-                                audio_endpoint_feedback = interface->ux_slave_interface_first_endpoint->ux_slave_endpoint_next_endpoint;
-                            }
+                            audio_endpoint_feedback = interface->ux_slave_interface_first_endpoint->ux_slave_endpoint_next_endpoint;
 
+                            audio_format_out = &audio_formats[alternate];
                             audio_active_out = 1;
 
+                            /* Start or resume the TX DMA only, recording is not disturbed */
+                            Audio_SAI_Start_TX();
+                            audio_fade_gain_out = 0;
+
                             /* Reset Write Pointer to current DMA Head + Margin */
-                            /* tx_write_ptr is where we write. DMA reads from Head. */
+                            /* The ring CPU side is where we write. DMA reads from Head. */
                             /* We want to write ahead of DMA. */
-                            tx_write_ptr = (Audio_SAI_Get_TX_Head() / 2 + (AUDIO_BUFFER_FRAMES / 2)) % AUDIO_BUFFER_FRAMES;
-                            last_dma_head = Audio_SAI_Get_TX_Head(); /* Initialize tracker */
+                            Audio_Ring_Resync(&Audio_TX_Ring, Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS);
+                            _ux_device_class_audio_feedback_reset();
 
                             /* Start OUT reception */
                             UX_SLAVE_TRANSFER *transfer_out = &audio_endpoint_iso_out->ux_slave_endpoint_transfer_request;
-                            transfer_out->ux_slave_transfer_request_completion_function = _ux_device_class_audio_iso_out_callback;
                             transfer_out->ux_slave_transfer_request_data_pointer = usb_rx_packet;
-                            transfer_out->ux_slave_transfer_request_requested_length = USB_AUDIO_EP_SIZE;
-                            ux_device_stack_transfer_request(transfer_out, USB_AUDIO_EP_SIZE, USB_AUDIO_EP_SIZE);
+                            transfer_out->ux_slave_transfer_request_requested_length = audio_format_out->max_packet;
+                            ux_device_stack_transfer_request(transfer_out, audio_format_out->max_packet, audio_format_out->max_packet);
 
-                            /* Start Feedback transmission */
-                            UX_SLAVE_TRANSFER *transfer_fb = &audio_endpoint_feedback->ux_slave_endpoint_transfer_request;
-                            transfer_fb->ux_slave_transfer_request_completion_function = _ux_device_class_audio_feedback_callback;
-                            _ux_device_class_audio_feedback_callback(transfer_fb);
+                            /* Start Feedback transmission, none with implicit feedback */
+                            if (audio_endpoint_feedback != UX_NULL)
+                            {
+                                _ux_device_class_audio_feedback_done(&audio_endpoint_feedback->ux_slave_endpoint_transfer_request);
+                            }
                         }
-
-                        /* If both active, Start SAI */
-                        Audio_SAI_Start();
                     }
                 }
             }
@@ -133,127 +256,383 @@ UINT ux_device_class_audio_entry(UX_SLAVE_CLASS_COMMAND *command)
              /* But we should be careful not to stop RX if only TX is closed. */
              /* USBX doesn't pass the interface pointer in DEACTIVATE usually? */
              /* Actually command->ux_slave_class_command_interface is valid. */
+             /* Each direction stops on its own, the other one keeps streaming. */
              interface = (UX_SLAVE_INTERFACE *)command->ux_slave_class_command_interface;
-             if (interface == audio_interface_stream_out) {
+             if ((interface == audio_interface_stream_out) && audio_active_out) {
                  audio_active_out = 0;
+                 _ux_device_class_audio_tx_fade_out();
+                 Audio_SAI_Stop_TX();
              }
-             if (interface == audio_interface_stream_in) {
+             if ((interface == audio_interface_stream_in) && audio_active_in) {
                  audio_active_in = 0;
-             }
-
-             if (!audio_active_out && !audio_active_in) {
-                 Audio_SAI_Stop();
+                 Audio_SAI_Stop_RX();
              }
              break;
 
         case UX_SLAVE_CLASS_COMMAND_REQUEST:
-             /* Handle Class Requests (Volume, Mute) */
-             break;
+             /* Class requests to the AC interface, an error stalls EP0 */
+             return _ux_device_class_audio_control_request();
     }
     return UX_SUCCESS;
 }
 
-static void _ux_device_class_audio_iso_out_callback(UX_SLAVE_TRANSFER *transfer)
+static UINT _ux_device_class_audio_control_request(void)
+{
+    UX_SLAVE_TRANSFER *transfer = &_ux_system_slave->ux_system_slave_device.ux_slave_device_control_endpoint.ux_slave_endpoint_transfer_request;
+    UCHAR *setup = transfer->ux_slave_transfer_request_setup;
+    UCHAR *data = transfer->ux_slave_transfer_request_data_pointer;
+
+    UCHAR request = setup[UX_SETUP_REQUEST];
+    UCHAR control = setup[UX_SETUP_VALUE + 1];
+    UCHAR entity = setup[UX_SETUP_INDEX + 1];
+    ULONG length = _ux_utility_short_get(setup + UX_SETUP_LENGTH);
+    ULONG i;
+
+    if ((setup[UX_SETUP_REQUEST_TYPE] & UX_REQUEST_TYPE) == UX_REQUEST_TYPE_VENDOR)
+    {
+        return _ux_device_class_audio_vendor_request(transfer);
+    }
+
+    if (entity == UX_DEVICE_CLASS_AUDIO_FEATURE_UNIT_OUT_ID)
+    {
+        return _ux_device_class_audio_feature_request(&audio_feature_out, transfer);
+    }
+    if (entity == UX_DEVICE_CLASS_AUDIO_FEATURE_UNIT_IN_ID)
+    {
+        return _ux_device_class_audio_feature_request(&audio_feature_in, transfer);
+    }
+
+    if (entity != UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID)
+    {
+        return UX_ERROR;
+    }
+
+    if (setup[UX_SETUP_REQUEST_TYPE] & UX_REQUEST_IN)
+    {
+        if ((control == UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL) &&
+            (request == UX_DEVICE_CLASS_AUDIO_REQUEST_CUR))
+        {
+            /* Layout 3 parameter block: dCUR */
+            _ux_utility_long_put(data, audio_frequency);
+            _ux_device_stack_transfer_request(transfer, UX_MIN(4, length), length);
+            return UX_SUCCESS;
+        }
+
+        if ((control == UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL) &&
+            (request == UX_DEVICE_CLASS_AUDIO_REQUEST_RANGE))
+        {
+            /* wNumSubRanges, then one dMIN/dMAX/dRES triplet per discrete rate */
+            _ux_utility_short_put(data, AUDIO_FREQUENCY_COUNT);
+            for (i = 0; i < AUDIO_FREQUENCY_COUNT; i++)
+            {
+                _ux_utility_long_put(data + 2 + i * 12, audio_frequencies[i]);
+                _ux_utility_long_put(data + 2 + i * 12 + 4, audio_frequencies[i]);
+                _ux_utility_long_put(data + 2 + i * 12 + 8, 0);
+            }
+            _ux_device_stack_transfer_request(transfer, UX_MIN(2 + AUDIO_FREQUENCY_COUNT * 12, length), length);
+            return UX_SUCCESS;
+        }
+
+        if ((control == UX_DEVICE_CLASS_AUDIO_CS_CLOCK_VALID_CONTROL) &&
+            (request == UX_DEVICE_CLASS_AUDIO_REQUEST_CUR))
+        {
+            /* Layout 1 parameter block: bCUR, the clock is always valid */
+            data[0] = 1;
+            _ux_device_stack_transfer_request(transfer, UX_MIN(1, length), length);
+            return UX_SUCCESS;
+        }
+
+        return UX_ERROR;
+    }
+
+    if ((control == UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL) &&
+        (request == UX_DEVICE_CLASS_AUDIO_REQUEST_CUR) &&
+        (transfer->ux_slave_transfer_request_actual_length >= 4))
+    {
+        ULONG frequency = _ux_utility_long_get(data);
+
+        for (i = 0; i < AUDIO_FREQUENCY_COUNT; i++)
+        {
+            if (audio_frequencies[i] == frequency)
+            {
+                break;
+            }
+        }
+        if (i == AUDIO_FREQUENCY_COUNT)
+        {
+            return UX_ERROR;
+        }
+
+        /* The streaming formats must carry the rate */
+        if ((audio_active_out && !_ux_device_class_audio_format_fits(audio_format_out, frequency)) ||
+            (audio_active_in && !_ux_device_class_audio_format_fits(audio_format_in, frequency)))
+        {
+            return UX_ERROR;
+        }
+
+        if (frequency != audio_frequency)
+        {
+            audio_frequency = frequency;
+            Audio_SAI_SetFrequency(frequency);
+
+            /* Restart the rate measurement and the fill level control */
+            _ux_device_class_audio_feedback_reset();
+        }
+        return UX_SUCCESS;
+    }
+
+    return UX_ERROR;
+}
+
+static void _ux_device_class_audio_feature_init(Audio_FeatureUnitTypeDef *feature)
+{
+    for (uint32_t ch = 0; ch <= AUDIO_CHANNELS; ch++)
+    {
+        feature->mute[ch] = 0;
+        feature->volume[ch] = 0;
+    }
+    Audio_PCM_Gain_Init(&feature->gain);
+}
+
+static void _ux_device_class_audio_feature_update(Audio_FeatureUnitTypeDef *feature)
+{
+    /* Master and channel controls add up, the stream ramps to the result */
+    for (uint32_t ch = 0; ch < AUDIO_CHANNELS; ch++)
+    {
+        int32_t target = 0;
+
+        if (!feature->mute[0] && !feature->mute[ch + 1])
+        {
+            int32_t db = feature->volume[0] + feature->volume[ch + 1];
+            if (db > AUDIO_VOLUME_MIN)
+            {
+                target = Audio_PCM_Gain_FromdB(db);
+            }
+        }
+        Audio_PCM_Gain_Set(&feature->gain, ch, target, AUDIO_GAIN_RAMP_FRAMES);
+    }
+}
+
+static UINT _ux_device_class_audio_feature_request(Audio_FeatureUnitTypeDef *feature,
+                                                   UX_SLAVE_TRANSFER *transfer)
+{
+    UCHAR *setup = transfer->ux_slave_transfer_request_setup;
+    UCHAR *data = transfer->ux_slave_transfer_request_data_pointer;
+
+    UCHAR request = setup[UX_SETUP_REQUEST];
+    UCHAR control = setup[UX_SETUP_VALUE + 1];
+    UCHAR channel = setup[UX_SETUP_VALUE];
+    ULONG length = _ux_utility_short_get(setup + UX_SETUP_LENGTH);
+
+    if ((channel > AUDIO_CHANNELS) ||
+        ((control != UX_DEVICE_CLASS_AUDIO_FU_MUTE_CONTROL) &&
+         (control != UX_DEVICE_CLASS_AUDIO_FU_VOLUME_CONTROL)))
+    {
+        return UX_ERROR;
+    }
+
+    if (setup[UX_SETUP_REQUEST_TYPE] & UX_REQUEST_IN)
+    {
+        if (request == UX_DEVICE_CLASS_AUDIO_REQUEST_CUR)
+        {
+            if (control == UX_DEVICE_CLASS_AUDIO_FU_MUTE_CONTROL)
+            {
+                /* Layout 1 parameter block: bCUR */
+                data[0] = feature->mute[channel];
+                _ux_device_stack_transfer_request(transfer, UX_MIN(1, length), length);
+            }
+            else
+            {
+                /* Layout 2 parameter block: wCUR */
+                _ux_utility_short_put(data, (USHORT)feature->volume[channel]);
+                _ux_device_stack_transfer_request(transfer, UX_MIN(2, length), length);
+            }
+            return UX_SUCCESS;
+        }
+
+        if ((request == UX_DEVICE_CLASS_AUDIO_REQUEST_RANGE) &&
+            (control == UX_DEVICE_CLASS_AUDIO_FU_VOLUME_CONTROL))
+        {
+            /* wNumSubRanges, wMIN, wMAX, wRES */
+            _ux_utility_short_put(data, 1);
+            _ux_utility_short_put(data + 2, (USHORT)AUDIO_VOLUME_MIN);
+            _ux_utility_short_put(data + 4, (USHORT)AUDIO_VOLUME_MAX);
+            _ux_utility_short_put(data + 6, (USHORT)AUDIO_VOLUME_RES);
+            _ux_device_stack_transfer_request(transfer, UX_MIN(8, length), length);
+            return UX_SUCCESS;
+        }
+
+        return UX_ERROR;
+    }
+
+    if (request != UX_DEVICE_CLASS_AUDIO_REQUEST_CUR)
+    {
+        return UX_ERROR;
+    }
+
+    if (control == UX_DEVICE_CLASS_AUDIO_FU_MUTE_CONTROL)
+    {
+        if (transfer->ux_slave_transfer_request_actual_length < 1)
+        {
+            return UX_ERROR;
+        }
+        feature->mute[channel] = (data[0] != 0);
+    }
+    else
+    {
+        if (transfer->ux_slave_transfer_request_actual_length < 2)
+        {
+            return UX_ERROR;
+        }
+
+        /* Out of range values are clamped, 0x8000 (-inf) is the minimum */
+        int32_t volume = (int16_t)_ux_utility_short_get(data);
+        if (volume < AUDIO_VOLUME_MIN)
+        {
+            volume = AUDIO_VOLUME_MIN;
+        }
+        else if (volume > AUDIO_VOLUME_MAX)
+        {
+            volume = AUDIO_VOLUME_MAX;
+        }
+        feature->volume[channel] = (int16_t)volume;
+    }
+
+    _ux_device_class_audio_feature_update(feature);
+    return UX_SUCCESS;
+}
+
+static void _ux_device_class_audio_iso_out_done(UX_SLAVE_TRANSFER *transfer)
 {
     if (!audio_active_out) return;
 
     uint8_t *data = transfer->ux_slave_transfer_request_data_pointer;
     uint32_t len = transfer->ux_slave_transfer_request_actual_length;
 
-    /* Calculate frames received (3 bytes/sample * 2 channels = 6 bytes/frame) */
-    uint32_t frames = len / 6;
+    /* Calculate frames received (e.g. 3 bytes/sample * 2 channels = 6 bytes/frame) */
+    const Audio_FormatTypeDef *format = audio_format_out;
+    uint32_t frame_size = format->channels * format->subslot;
+    uint32_t frames = len / frame_size;
 
     /* Write to Ring Buffer */
-    uint32_t current_tx_head_frames = Audio_SAI_Get_TX_Head() / 2; /* DMA Read Ptr (Frames) */
+    uint32_t current_tx_head_frames = Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS; /* DMA Read Ptr (Frames) */
 
     /* Check available space to avoid overwriting DMA Read Ptr */
-    /* Space = (ReadPtr - WritePtr - 1 + Size) % Size */
-    uint32_t space = (current_tx_head_frames - tx_write_ptr - 1 + AUDIO_BUFFER_FRAMES) % AUDIO_BUFFER_FRAMES;
-
-    if (space >= frames)
+    if (Audio_Ring_Reserve(&Audio_TX_Ring, current_tx_head_frames, frames) == frames)
     {
-        for (uint32_t i = 0; i < frames; i++)
-        {
-            /* Left Channel (3 bytes) */
-            uint32_t idx = i * 6;
-            /* Correct Packing for SAI_DATASIZE_24 (Right Aligned in 32-bit word) -> 0x00HHMMLL */
-            uint32_t sample_l = (data[idx+2] << 16) | (data[idx+1] << 8) | (data[idx]);
-
-            /* Right Channel (3 bytes) */
-            uint32_t sample_r = (data[idx+5] << 16) | (data[idx+4] << 8) | (data[idx+3]);
+        /* Unpack the stream format to SAI_DATASIZE_24 (Right Aligned in 32-bit word) -> 0x00HHMMLL */
+        /* At most two contiguous spans: up to the ring end, then from its start */
+        uint32_t span = Audio_Ring_Span(&Audio_TX_Ring, frames);
 
-            /* Write 32-bit words to TX Buffer */
-            /* Buffer is cast to uint32_t*. 2 words per frame. */
-            ((uint32_t*)Audio_TX_Buffer)[tx_write_ptr * 2] = sample_l;
-            ((uint32_t*)Audio_TX_Buffer)[tx_write_ptr * 2 + 1] = sample_r;
+        /* Volume applied in the same pass */
+        format->unpack(Audio_Ring_Ptr(&Audio_TX_Ring), data, span, format->channels,
+                       &audio_feature_out.gain);
+        format->unpack(Audio_TX_Ring.buffer, data + span * frame_size, frames - span,
+                       format->channels, &audio_feature_out.gain);
 
-            tx_write_ptr = (tx_write_ptr + 1) % AUDIO_BUFFER_FRAMES;
+        /* Fade in after the stream start */
+        if (audio_fade_gain_out < AUDIO_PCM_UNITY)
+        {
+            audio_fade_gain_out = Audio_PCM_Ramp24(Audio_Ring_Ptr(&Audio_TX_Ring), span,
+                                              audio_fade_gain_out, AUDIO_PCM_UNITY / AUDIO_FADE_FRAMES);
+            audio_fade_gain_out = Audio_PCM_Ramp24(Audio_TX_Ring.buffer, frames - span,
+                                              audio_fade_gain_out, AUDIO_PCM_UNITY / AUDIO_FADE_FRAMES);
         }
+
+        Audio_Ring_Commit(&Audio_TX_Ring, frames);
     }
     else
     {
-        /* Buffer Overflow / Underrun imminent. Packet Dropped. */
-        /* In a real app we might error out or partial write. */
+        /* Buffer Overflow. Packet Dropped, counted in Audio_TX_Ring.overruns. */
+        audio_stats.out_dropped++;
     }
+    audio_stats.out_packets++;
 
-    /* Feedback Calculation Logic (Every SOF usually, but here every packet ~1ms) */
+#if AUDIO_FB_SOURCE == AUDIO_FB_PACKET
+    /* Feedback Calculation Logic, every packet ~1ms (Audio_SOF_Callback with the SOF sources) */
     Audio_Feedback_Calculation();
+#endif
 
     /* Re-arm transfer */
-    ux_device_stack_transfer_request(transfer, USB_AUDIO_EP_SIZE, USB_AUDIO_EP_SIZE);
+    ux_device_stack_transfer_request(transfer, format->max_packet, format->max_packet);
 }
 
-static void _ux_device_class_audio_iso_in_callback(UX_SLAVE_TRANSFER *transfer)
+static void _ux_device_class_audio_iso_in_done(UX_SLAVE_TRANSFER *transfer)
 {
     if (!audio_active_in) return;
 
     /* Read from Ring Buffer */
-    uint32_t current_rx_head_frames = Audio_SAI_Get_RX_Head() / 2; /* DMA Write Ptr */
+    uint32_t current_rx_head_frames = Audio_SAI_Get_RX_Head() / AUDIO_CHANNELS; /* DMA Write Ptr */
 
-    /* Calculate Available Frames */
-    /* Available = (WritePtr - ReadPtr + Size) % Size */
-    uint32_t available = (current_rx_head_frames - rx_read_ptr + AUDIO_BUFFER_FRAMES) % AUDIO_BUFFER_FRAMES;
+    /* Async IN: the nominal frames of one USB frame, so the packets follow
+       the rate and not the completion timing. One frame more or less when
+       the ring is off its lead, which keeps the capture latency constant
+       and absorbs the SAI clock drift. */
+#if AUDIO_FB_SOURCE == AUDIO_FB_PACKET
+    uint32_t frames_to_send = audio_frequency / 1000;
+    in_packet_remainder += audio_frequency % 1000;
+    if (in_packet_remainder >= 1000)
+    {
+        in_packet_remainder -= 1000;
+        frames_to_send++;
+    }
+#else
+    /* The rate measured on the SOFs: with implicit feedback the host sends
+       OUT packets of the sizes it receives here. */
+    in_packet_fraction += feedback_rate;
+    uint32_t frames_to_send = in_packet_fraction >> 16;
+    in_packet_fraction &= 0xFFFF;
+#endif
 
-    /* Async IN: We send exactly what is available in the buffer since last SOF */
-    /* Clamp to Max Packet Size (plus margin) */
-    uint32_t frames_to_send = available;
+    int32_t level = Audio_Ring_Level(&Audio_RX_Ring, current_rx_head_frames);
+    latency_in_frames = level;
+    _ux_device_class_audio_stats_fill(level, &audio_stats.rx_fill_min, &audio_stats.rx_fill_max);
+    if (level > (int32_t)Audio_RX_Ring.lead + 1)
+    {
+        frames_to_send++;
+    }
+    else if (level < (int32_t)Audio_RX_Ring.lead - 1)
+    {
+        frames_to_send--;
+    }
 
-    if (frames_to_send > (USB_AUDIO_EP_SIZE / 6))
+    const Audio_FormatTypeDef *format = audio_format_in;
+    uint32_t frame_size = format->channels * format->subslot;
+    if (frames_to_send > format->max_packet / frame_size)
     {
-        frames_to_send = (USB_AUDIO_EP_SIZE / 6);
+        frames_to_send = format->max_packet / frame_size;
     }
 
-    /* If available is 0, we send 0-length packet (ZLP) or small packet? */
-    /* UAC 2.0 allows ZLP for Asynchronous if no data is ready. */
-    /* However, continuous stream is better. */
+    /* Less if the ring ran short, nothing at all (ZLP) after an xrun */
+    frames_to_send = Audio_Ring_Reserve(&Audio_RX_Ring, current_rx_head_frames, frames_to_send);
 
-    uint32_t byte_count = 0;
+    /* Pack to the stream format (16, 24 or 32-bit little endian) */
+    /* Source is Right Aligned: 0x00HHMMLL */
+    /* At most two contiguous spans: up to the ring end, then from its start */
+    uint32_t span = Audio_Ring_Span(&Audio_RX_Ring, frames_to_send);
 
-    for (uint32_t i = 0; i < frames_to_send; i++)
+    /* Fade in after the stream start, the frames are ours until committed */
+    if (audio_fade_gain_in < AUDIO_PCM_UNITY)
     {
-        uint32_t sample_l = 0;
-        uint32_t sample_r = 0;
-
-        if (available > 0)
-        {
-            sample_l = ((uint32_t*)Audio_RX_Buffer)[rx_read_ptr * 2];
-            sample_r = ((uint32_t*)Audio_RX_Buffer)[rx_read_ptr * 2 + 1];
-
-            rx_read_ptr = (rx_read_ptr + 1) % AUDIO_BUFFER_FRAMES;
-            available--;
-        }
+        audio_fade_gain_in = Audio_PCM_Ramp24(Audio_Ring_Ptr(&Audio_RX_Ring), span,
+                                         audio_fade_gain_in, AUDIO_PCM_UNITY / AUDIO_FADE_FRAMES);
+        audio_fade_gain_in = Audio_PCM_Ramp24(Audio_RX_Ring.buffer, frames_to_send - span,
+                                         audio_fade_gain_in, AUDIO_PCM_UNITY / AUDIO_FADE_FRAMES);
+    }
 
-        /* Pack to 24-bit */
-        /* Source is Right Aligned: 0x00HHMMLL */
-        /* We want USB Format: LL MM HH */
+    /* Volume applied in the same pass */
+    format->pack(usb_tx_packet, Audio_Ring_Ptr(&Audio_RX_Ring), span, format->channels,
+                 &audio_feature_in.gain);
+    format->pack(usb_tx_packet + span * frame_size, Audio_RX_Ring.buffer, frames_to_send - span,
+                 format->channels, &audio_feature_in.gain);
 
-        usb_tx_packet[byte_count++] = (sample_l) & 0xFF;        /* LL */
-        usb_tx_packet[byte_count++] = (sample_l >> 8) & 0xFF;   /* MM */
-        usb_tx_packet[byte_count++] = (sample_l >> 16) & 0xFF;  /* HH */
+    Audio_Ring_Commit(&Audio_RX_Ring, frames_to_send);
 
-        usb_tx_packet[byte_count++] = (sample_r) & 0xFF;
-        usb_tx_packet[byte_count++] = (sample_r >> 8) & 0xFF;
-        usb_tx_packet[byte_count++] = (sample_r >> 16) & 0xFF;
+    uint32_t byte_count = frames_to_send * frame_size;
+    audio_stats.in_packets++;
+    if (byte_count == 0)
+    {
+        audio_stats.in_empty++;
     }
 
     transfer->ux_slave_transfer_request_data_pointer = usb_tx_packet;
@@ -262,44 +641,346 @@ static void _ux_device_class_audio_iso_in_callback(UX_SLAVE_TRANSFER *transfer)
     ux_device_stack_transfer_request(transfer, byte_count, byte_count);
 }
 
+static UINT _ux_device_class_audio_format_fits(const Audio_FormatTypeDef *format, ULONG frequency)
+{
+    /* One frame of margin for the rate adjustments, as the descriptors */
+    return (((frequency / 1000) + 1) * format->channels * format->subslot) <= format->max_packet;
+}
+
+static void _ux_device_class_audio_tx_fade_out(void)
+{
+    /* The host sent its last packet: ramp the end of what is queued down to
+       zero and fill the rest of the ring with silence, so that the DMA can
+       drain without a click before it is paused. */
+    uint32_t current_dma = Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS;
+    int32_t level = Audio_Ring_Level(&Audio_TX_Ring, current_dma);
+
+    if ((level < 0) || (level >= (int32_t)Audio_TX_Ring.frames))
+    {
+        /* Xrun: nothing sensible queued, silence from the DMA on */
+        Audio_Ring_Resync(&Audio_TX_Ring, current_dma);
+        level = 0;
+    }
+
+    uint32_t fade = ((uint32_t)level < AUDIO_FADE_FRAMES) ? (uint32_t)level : AUDIO_FADE_FRAMES;
+    if (fade > 0)
+    {
+        int32_t gain = AUDIO_PCM_UNITY;
+        int32_t step = -(int32_t)(AUDIO_PCM_UNITY / fade);
+
+        Audio_Ring_Rewind(&Audio_TX_Ring, fade);
+        uint32_t span = Audio_Ring_Span(&Audio_TX_Ring, fade);
+        gain = Audio_PCM_Ramp24(Audio_Ring_Ptr(&Audio_TX_Ring), span, gain, step);
+        Audio_PCM_Ramp24(Audio_TX_Ring.buffer, fade - span, gain, step);
+        Audio_Ring_Commit(&Audio_TX_Ring, fade);
+    }
+
+    /* Silence up to the DMA, one frame short so full and empty differ */
+    uint32_t silence = Audio_TX_Ring.frames - (uint32_t)level - 1;
+    uint32_t span = Audio_Ring_Span(&Audio_TX_Ring, silence);
+    memset(Audio_Ring_Ptr(&Audio_TX_Ring), 0, span * SAI_FRAME_SIZE);
+    memset(Audio_TX_Ring.buffer, 0, (silence - span) * SAI_FRAME_SIZE);
+    Audio_Ring_Commit(&Audio_TX_Ring, silence);
+}
+
+static void _ux_device_class_audio_feedback_reset(void)
+{
+    last_dma_position = Audio_Ring_DMA_Position(&Audio_TX_Ring, Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS); /* Initialize tracker */
+    feedback_window_frames = 0;
+    feedback_window_count = 0;
+    feedback_integral = 0;
+    feedback_rate = AUDIO_FB_NOMINAL(audio_frequency);
+    current_feedback = feedback_rate;
+#if AUDIO_FB_SOURCE != AUDIO_FB_PACKET
+    sof_ring = NULL;
+#endif
+}
+
+static void _ux_device_class_audio_rate_update(uint32_t measured)
+{
+    uint32_t nominal = AUDIO_FB_NOMINAL(audio_frequency);
+
+    /* Reject windows spoilt by a DMA restart */
+    if ((measured > nominal - AUDIO_FB_MAX_DEVIATION) &&
+        (measured < nominal + AUDIO_FB_MAX_DEVIATION))
+    {
+        /* Filter: New = (Old * 3 + New) / 4 */
+        feedback_rate = (feedback_rate * 3 + measured) / 4;
+    }
+
+#if AUDIO_FB_SOURCE == AUDIO_FB_IMPLICIT
+    /* No feedback endpoint, the IN packets carry the rate itself */
+    current_feedback = feedback_rate;
+#endif
+
+    audio_stats.feedback_history[audio_stats.feedback_count % AUDIO_STATS_FB_HISTORY] = current_feedback;
+    audio_stats.feedback_count++;
+}
+
 void Audio_Feedback_Calculation(void)
 {
-    /* Calculate samples consumed by SAI since last check */
-    /* We assume this function is called roughly every 1ms (Frame) inside ISO OUT callback */
+    /* Called once per ISO OUT packet, i.e. roughly every 1ms (Frame). */
+    /* Two parts:
+       - the SAI consumption rate, measured over AUDIO_FB_WINDOW packets so
+         that it has sub-sample precision (a single packet only ever sees
+         whole samples),
+       - a PI correction on the TX ring fill level, so the ring is pulled
+         back to half full instead of slowly drifting into over/underrun. */
 
-    uint32_t current_dma = Audio_SAI_Get_TX_Head(); /* Words */
+    uint32_t current_dma = Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS; /* Frames */
 
-    /* Calculate delta in Words */
-    uint32_t delta_words;
-    if (current_dma >= last_dma_head)
+    /* Frames consumed since last check, the ring position does not wrap */
+    uint32_t position = Audio_Ring_DMA_Position(&Audio_TX_Ring, current_dma);
+    uint32_t delta_frames = position - last_dma_position;
+    last_dma_position = position;
+
+    /* Rate: frames consumed per packet over the window, 16.16 */
+    feedback_window_frames += delta_frames;
+    if (++feedback_window_count >= AUDIO_FB_WINDOW)
+    {
+        _ux_device_class_audio_rate_update((uint32_t)(((uint64_t)feedback_window_frames << 16) / AUDIO_FB_WINDOW));
+
+        feedback_window_frames = 0;
+        feedback_window_count = 0;
+    }
+
+    _ux_device_class_audio_feedback_control(current_dma);
+}
+
+#if AUDIO_FB_SOURCE != AUDIO_FB_PACKET
+void Audio_SOF_Callback(uint32_t frame_number)
+{
+    /* Called at each SOF, from the USB interrupt, with the frame number of
+       the SOF (USB_DRD_FS->FNR). The completions of the ISO transfers move
+       with the host scheduling, the SOFs do not: the DMA position read here
+       is on a frame boundary (to the interrupt latency), and the frame
+       number counts the SOFs that were missed. */
+    const Audio_RingTypeDef *ring;
+    uint32_t current_dma;
+
+    if (audio_active_out)
     {
-        delta_words = current_dma - last_dma_head;
+#if AUDIO_FB_SOURCE == AUDIO_FB_SOF
+        /* Fill level control at each frame, same gains as per packet */
+        _ux_device_class_audio_feedback_control(Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS);
+#else
+        /* No control, the host follows the IN stream */
+        latency_out_frames = Audio_Ring_Level(&Audio_TX_Ring, Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS);
+        _ux_device_class_audio_stats_fill(latency_out_frames, &audio_stats.tx_fill_min, &audio_stats.tx_fill_max);
+#endif
+    }
+
+    if ((++sof_count & ((1U << AUDIO_FB_SOF_SHIFT) - 1)) != 0)
+    {
+        return;
+    }
+
+    /* Both blocks run on the same SAI clock, either ring measures it */
+    if (audio_active_out)
+    {
+        ring = &Audio_TX_Ring;
+        current_dma = Audio_SAI_Get_TX_Head() / AUDIO_CHANNELS;
+    }
+    else if (audio_active_in)
+    {
+        ring = &Audio_RX_Ring;
+        current_dma = Audio_SAI_Get_RX_Head() / AUDIO_CHANNELS;
     }
     else
     {
-        /* Wrapped */
-        delta_words = (AUDIO_BUFFER_SIZE / 4) - last_dma_head + current_dma;
+        sof_ring = NULL;
+        return;
     }
 
-    last_dma_head = current_dma;
+    uint32_t position = Audio_Ring_DMA_Position(ring, current_dma);
 
-    /* Convert Words to Samples (Frames). 2 Words per Frame (Stereo) */
-    uint32_t samples = delta_words / 2;
+    if (ring != sof_ring)
+    {
+        /* First timestamp, or the stream measured changed */
+        sof_ring = ring;
+        sof_window_frames = 0;
+        sof_window_sofs = 0;
+    }
+    else
+    {
+        /* The frame number is 11 bits */
+        sof_window_frames += position - sof_position;
+        sof_window_sofs += (frame_number - sof_frame_number) & USB_FNR_FN;
+    }
+    sof_frame_number = frame_number;
+    sof_position = position;
 
-    /* Accumulate for averaging (simple IIR or window) */
-    /* Using a simple moving average or just raw? Raw is too jittery. */
-    /* Filter: New = (Old * 3 + New) / 4 */
-    /* Note: We need 16.16 format. */
-    /* Measured 'samples' is e.g. 48. */
-    /* In 16.16, 48 is 0x00300000. */
+    if (sof_window_sofs >= AUDIO_FB_WINDOW)
+    {
+        _ux_device_class_audio_rate_update((uint32_t)(((uint64_t)sof_window_frames << 16) / sof_window_sofs));
 
-    uint32_t measured_fixed = samples << 16;
+        sof_window_frames = 0;
+        sof_window_sofs = 0;
+    }
+}
+#endif
+
+static void _ux_device_class_audio_feedback_control(uint32_t current_dma)
+{
+    uint32_t nominal = AUDIO_FB_NOMINAL(audio_frequency);
 
-    /* Filter */
-    current_feedback = (current_feedback * 3 + measured_fixed) / 4;
+    /* Fill level: frames written ahead of the DMA read pointer */
+    int32_t fill = Audio_Ring_Level(&Audio_TX_Ring, current_dma);
+    int32_t error = (int32_t)Audio_TX_Ring.lead - fill;
+    latency_out_frames = fill;
+    _ux_device_class_audio_stats_fill(fill, &audio_stats.tx_fill_min, &audio_stats.tx_fill_max);
+
+    feedback_integral += error;
+    if (feedback_integral > AUDIO_FB_I_LIMIT)
+    {
+        feedback_integral = AUDIO_FB_I_LIMIT;
+    }
+    else if (feedback_integral < -AUDIO_FB_I_LIMIT)
+    {
+        feedback_integral = -AUDIO_FB_I_LIMIT;
+    }
+
+    /* Below half full: ask for more samples, above: for fewer */
+    int32_t correction = (error * 0x10000) / (1 << AUDIO_FB_KP_SHIFT) +
+                         (feedback_integral * (0x10000 / (1 << AUDIO_FB_KI_SHIFT)));
+
+    if (correction > AUDIO_FB_MAX_DEVIATION)
+    {
+        correction = AUDIO_FB_MAX_DEVIATION;
+    }
+    else if (correction < -AUDIO_FB_MAX_DEVIATION)
+    {
+        correction = -AUDIO_FB_MAX_DEVIATION;
+    }
+
+    int32_t feedback = (int32_t)feedback_rate + correction;
+
+    /* Keep the result within what the host accepts around nominal */
+    if (feedback > (int32_t)(nominal + AUDIO_FB_MAX_DEVIATION))
+    {
+        feedback = nominal + AUDIO_FB_MAX_DEVIATION;
+    }
+    else if (feedback < (int32_t)(nominal - AUDIO_FB_MAX_DEVIATION))
+    {
+        feedback = nominal - AUDIO_FB_MAX_DEVIATION;
+    }
+
+    current_feedback = (uint32_t)feedback;
+}
+
+void Audio_GetLatency(Audio_LatencyTypeDef *latency)
+{
+    /* Levels out of range after an xrun read as empty */
+    uint32_t out = (latency_out_frames > 0) ? (uint32_t)latency_out_frames : 0;
+    uint32_t in = (latency_in_frames > 0) ? (uint32_t)latency_in_frames : 0;
+
+    latency->frequency = audio_frequency;
+    latency->out_frames = audio_active_out ? out + AUDIO_SAI_FIFO_FRAMES : 0;
+    latency->in_frames = audio_active_in ? in + AUDIO_SAI_FIFO_FRAMES : 0;
+    latency->round_trip = latency->out_frames + latency->in_frames + audio_frequency / 1000;
 }
 
-static void _ux_device_class_audio_feedback_callback(UX_SLAVE_TRANSFER *transfer)
+static void _ux_device_class_audio_stats_fill(int32_t level, int32_t *min, int32_t *max)
+{
+    if (level < *min)
+    {
+        *min = level;
+    }
+    if (level > *max)
+    {
+        *max = level;
+    }
+}
+
+void Audio_GetStats(Audio_StatsTypeDef *stats)
+{
+    Audio_LatencyTypeDef latency;
+    Audio_SAI_ErrorsTypeDef errors;
+
+    Audio_GetLatency(&latency);
+    Audio_SAI_GetErrors(&errors);
+
+    stats->version = AUDIO_STATS_VERSION;
+    stats->length = sizeof(Audio_StatsTypeDef);
+    stats->frequency = audio_frequency;
+
+    stats->out_packets = audio_stats.out_packets;
+    stats->out_dropped = audio_stats.out_dropped;
+    stats->tx_underruns = Audio_TX_Ring.underruns - audio_stats.tx_underruns_base;
+    stats->tx_fill_min = audio_stats.tx_fill_min;
+    stats->tx_fill_max = audio_stats.tx_fill_max;
+    stats->out_latency = latency.out_frames;
+
+    stats->in_packets = audio_stats.in_packets;
+    stats->in_empty = audio_stats.in_empty;
+    stats->rx_overruns = Audio_RX_Ring.overruns - audio_stats.rx_overruns_base;
+    stats->rx_fill_min = audio_stats.rx_fill_min;
+    stats->rx_fill_max = audio_stats.rx_fill_max;
+    stats->in_latency = latency.in_frames;
+
+    stats->rate = feedback_rate;
+    stats->feedback = current_feedback;
+    /* The SOF interrupt may end a rate window during the copy */
+    do
+    {
+        stats->feedback_count = audio_stats.feedback_count;
+        for (uint32_t i = 0; i < AUDIO_STATS_FB_HISTORY; i++)
+        {
+            stats->feedback_history[i] = audio_stats.feedback_history[i];
+        }
+    } while (stats->feedback_count != audio_stats.feedback_count);
+
+    stats->sai_rx_fifo_errors = errors.rx_fifo - audio_stats.sai_base.rx_fifo;
+    stats->sai_tx_fifo_errors = errors.tx_fifo - audio_stats.sai_base.tx_fifo;
+    stats->sai_sync_errors = errors.sync - audio_stats.sai_base.sync;
+    stats->sai_dma_errors = errors.dma - audio_stats.sai_base.dma;
+}
+
+void Audio_ClearStats(void)
+{
+    UX_INTERRUPT_SAVE_AREA
+
+    /* Short, but the rate history and the TX fill may be written from the
+       SOF interrupt */
+    UX_DISABLE
+    memset(&audio_stats, 0, sizeof(audio_stats));
+    audio_stats.tx_fill_min = INT32_MAX;
+    audio_stats.tx_fill_max = INT32_MIN;
+    audio_stats.rx_fill_min = INT32_MAX;
+    audio_stats.rx_fill_max = INT32_MIN;
+    audio_stats.tx_underruns_base = Audio_TX_Ring.underruns;
+    audio_stats.rx_overruns_base = Audio_RX_Ring.overruns;
+    Audio_SAI_GetErrors(&audio_stats.sai_base);
+    UX_RESTORE
+}
+
+static UINT _ux_device_class_audio_vendor_request(UX_SLAVE_TRANSFER *transfer)
+{
+    UCHAR *setup = transfer->ux_slave_transfer_request_setup;
+    ULONG length = _ux_utility_short_get(setup + UX_SETUP_LENGTH);
+
+    if ((setup[UX_SETUP_REQUEST] == UX_DEVICE_CLASS_AUDIO_VENDOR_GET_STATS) &&
+        (setup[UX_SETUP_REQUEST_TYPE] & UX_REQUEST_IN))
+    {
+        /* Snapshot from the main loop (ux_system_tasks_run), the streams go on meanwhile */
+        Audio_StatsTypeDef stats;
+        Audio_GetStats(&stats);
+        memcpy(transfer->ux_slave_transfer_request_data_pointer, &stats, UX_MIN(sizeof(stats), length));
+        _ux_device_stack_transfer_request(transfer, UX_MIN(sizeof(stats), length), length);
+        return UX_SUCCESS;
+    }
+
+    if ((setup[UX_SETUP_REQUEST] == UX_DEVICE_CLASS_AUDIO_VENDOR_CLEAR_STATS) &&
+        !(setup[UX_SETUP_REQUEST_TYPE] & UX_REQUEST_IN))
+    {
+        Audio_ClearStats();
+        return UX_SUCCESS;
+    }
+
+    return UX_ERROR;
+}
+
+static void _ux_device_class_audio_feedback_done(UX_SLAVE_TRANSFER *transfer)
 {
     if (!audio_active_out) return;
 
@@ -320,3 +1001,49 @@ static void _ux_device_class_audio_feedback_callback(UX_SLAVE_TRANSFER *transfer
 
     ux_device_stack_transfer_request(transfer, 4, 4);
 }
+
+/* One step of a streaming endpoint. A completed transfer goes to its
+   handler, which arms the next one. A failed one is armed again as is. */
+static void _ux_device_class_audio_transfer_step(UX_SLAVE_ENDPOINT *endpoint,
+                                                 void (*done)(UX_SLAVE_TRANSFER *transfer))
+{
+    UX_SLAVE_TRANSFER *transfer = &endpoint->ux_slave_endpoint_transfer_request;
+    ULONG length = transfer->ux_slave_transfer_request_requested_length;
+    UINT status;
+
+    status = ux_device_stack_transfer_run(transfer, length, length);
+    if (status == UX_STATE_WAIT)
+    {
+        return;
+    }
+
+    if (status == UX_STATE_NEXT)
+    {
+        done(transfer);
+    }
+    else
+    {
+        ux_device_stack_transfer_request(transfer, length, length);
+    }
+}
+
+void Audio_Process(void)
+{
+    /* Standalone: the DCD calls the completion functions of the control
+       endpoint only, the streaming endpoints are polled here. An ISO
+       endpoint is re-armed within its frame, call this from every pass of
+       the main loop. */
+    if (audio_active_out)
+    {
+        _ux_device_class_audio_transfer_step(audio_endpoint_iso_out, _ux_device_class_audio_iso_out_done);
+        if (audio_endpoint_feedback != UX_NULL)
+        {
+            _ux_device_class_audio_transfer_step(audio_endpoint_feedback, _ux_device_class_audio_feedback_done);
+        }
+    }
+
+    if (audio_active_in)
+    {
+        _ux_device_class_audio_transfer_step(audio_endpoint_iso_in, _ux_device_class_audio_iso_in_done);
+    }
+}
@@ -12,6 +12,79 @@
 #define UX_DEVICE_CLASS_AUDIO_START      0x01
 #define UX_DEVICE_CLASS_AUDIO_STOP       0x02
 
+/* UAC 2.0 class requests */
+#define UX_DEVICE_CLASS_AUDIO_REQUEST_CUR           0x01
+#define UX_DEVICE_CLASS_AUDIO_REQUEST_RANGE         0x02
+
+/* Feature units, playback and record (wIndex high byte) and their controls
+   (wValue high byte, the low byte is the channel, 0 for master) */
+#define UX_DEVICE_CLASS_AUDIO_FEATURE_UNIT_OUT_ID   0x03
+#define UX_DEVICE_CLASS_AUDIO_FEATURE_UNIT_IN_ID    0x06
+#define UX_DEVICE_CLASS_AUDIO_FU_MUTE_CONTROL       0x01
+#define UX_DEVICE_CLASS_AUDIO_FU_VOLUME_CONTROL     0x02
+
+/* Clock source entity and its controls (wValue high byte) */
+#define UX_DEVICE_CLASS_AUDIO_CLOCK_SOURCE_ID       0x01
+#define UX_DEVICE_CLASS_AUDIO_CS_SAM_FREQ_CONTROL   0x01
+#define UX_DEVICE_CLASS_AUDIO_CS_CLOCK_VALID_CONTROL 0x02
+
+/* Vendor requests, to the device or the AC interface. GET_STATS returns
+   Audio_StatsTypeDef (little endian), CLEAR_STATS restarts its counts. */
+#define UX_DEVICE_CLASS_AUDIO_VENDOR_GET_STATS      0x01
+#define UX_DEVICE_CLASS_AUDIO_VENDOR_CLEAR_STATS    0x02
+#define AUDIO_STATS_VERSION                         1
+
+/* Audio delay through the device, in frames at the current rate */
+typedef struct
+{
+    uint32_t out_frames;    /* ISO OUT packet to the SAI output: TX ring + SAI FIFO */
+    uint32_t in_frames;     /* SAI input to the ISO IN packet: SAI FIFO + RX ring */
+    uint32_t round_trip;    /* both, plus the packet being sent */
+    uint32_t frequency;
+} Audio_LatencyTypeDef;
+
+/* Stream statistics since the last clear. Each count has a single writer:
+   the main loop for the packet counts, the SAI/DMA interrupts for the ring
+   xruns and the SAI errors, and in the SOF and implicit feedback modes the
+   SOF interrupt for the rate, its history and the TX fill. Audio_GetStats
+   reads word by word without a lock, the history is read again when a rate
+   window ends meanwhile. Audio_ClearStats holds the interrupts off for the
+   short reset of the counts. */
+typedef struct
+{
+    uint16_t version;               /* AUDIO_STATS_VERSION */
+    uint16_t length;                /* of this block, in bytes */
+    uint32_t frequency;
+
+    /* Playback */
+    uint32_t out_packets;
+    uint32_t out_dropped;           /* no room in the TX ring */
+    uint32_t tx_underruns;          /* the DMA played past the data */
+    int32_t  tx_fill_min;           /* TX ring level, frames (min > max: no sample) */
+    int32_t  tx_fill_max;
+    uint32_t out_latency;           /* frames, Audio_GetLatency */
+
+    /* Record */
+    uint32_t in_packets;
+    uint32_t in_empty;              /* zero length, nothing captured */
+    uint32_t rx_overruns;           /* the DMA wrote over unread frames */
+    int32_t  rx_fill_min;
+    int32_t  rx_fill_max;
+    uint32_t in_latency;
+
+    /* Clock, 16.16 samples per frame */
+    uint32_t rate;                  /* measured SAI rate */
+    uint32_t feedback;              /* value sent to the host */
+    uint32_t feedback_count;        /* rate windows, the last one at (count - 1) % history */
+    uint32_t feedback_history[AUDIO_STATS_FB_HISTORY];
+
+    /* SAI */
+    uint32_t sai_rx_fifo_errors;
+    uint32_t sai_tx_fifo_errors;
+    uint32_t sai_sync_errors;
+    uint32_t sai_dma_errors;
+} Audio_StatsTypeDef;
+
 /* Dummy Parameter Struct */
 typedef struct
 {
@@ -21,5 +94,10 @@ typedef struct
 /* Function Prototypes */
 UINT ux_device_class_audio_entry(UX_SLAVE_CLASS_COMMAND *command);
 void Audio_Feedback_Calculation(void);
+void Audio_SOF_Callback(uint32_t frame_number);
+void Audio_Process(void);
+void Audio_GetLatency(Audio_LatencyTypeDef *latency);
+void Audio_GetStats(Audio_StatsTypeDef *stats);
+void Audio_ClearStats(void);
 
 #endif /* UX_DEVICE_AUDIO_H */
@@ -35,7 +35,7 @@ __ALIGN_BEGIN const uint8_t USBD_DeviceDesc_Audio[] __ALIGN_END = {
   0x01                        /* bNumConfigurations */
 };
 
-/* Configuration Descriptor (Composite: IAD + AC + AS_OUT + AS_IN) */
+/* Configuration Descriptor (Composite: IAD + AC + AS_OUT + AS_IN, MSC) */
 /* Length Calculation:
    Config: 9
    IAD: 8
@@ -47,35 +47,85 @@ __ALIGN_BEGIN const uint8_t USBD_DeviceDesc_Audio[] __ALIGN_END = {
      Output Terminal (Speaker): 12
      Input Terminal (Mic): 17
      Output Terminal (USB In): 12
-     Feature Unit (Spk): 18
-     Feature Unit (Mic): 18
+     Feature Unit (Spk): 6 + 4 per channel and master (18 in stereo)
+     Feature Unit (Mic): same
    AS Interface Out (If 1):
      Alt 0 (Zero BW): 9
-     Alt 1 (Operational): 9
-     AS General: 16
-     Format Type: 6
-     Endpoint ISO OUT: 7
-     Endpoint Feedback: 7
-     CS EP ISO OUT: 8
+     Per format alt: 9 (Std) + 16 (AS General) + 6 (Format Type)
+                     + 7 (EP ISO OUT) + 8 (CS EP) + 7 (EP Feedback) = 53
+                     (46 with implicit feedback, no feedback endpoint)
    AS Interface In (If 2):
      Alt 0: 9
-     Alt 1: 9
-     AS General: 16
-     Format Type: 6
-     Endpoint ISO IN: 7
-     CS EP ISO IN: 8
+     Per format alt: 9 + 16 + 6 + 7 (EP ISO IN) + 8 (CS EP) = 46
+   MSC Interface (If 3):
+     Std: 9 + 7 (EP Bulk OUT) + 7 (EP Bulk IN) = 23
 
-   Total roughly: ~254 bytes.
+   Stereo, 3 format alts: 26 + 111 + (9 + 3 * 53) + (9 + 3 * 46) + 23 = 475
 */
+#define USB_AUDIO_FU_DESC_SIZE      (6 + (AUDIO_CHANNELS + 1) * 4)
+#define USB_AUDIO_AC_CS_SIZE        (9 + 8 + 17 + 12 + 17 + 12 + 2 * USB_AUDIO_FU_DESC_SIZE)
+#if AUDIO_FB_SOURCE == AUDIO_FB_IMPLICIT
+#define USB_AUDIO_AS_OUT_SIZE       (9 + AUDIO_ALT_COUNT * 46)
+#else
+#define USB_AUDIO_AS_OUT_SIZE       (9 + AUDIO_ALT_COUNT * 53)
+#endif
+#define USB_AUDIO_AS_IN_SIZE        (9 + AUDIO_ALT_COUNT * 46)
+#define USB_MSC_DESC_SIZE           (9 + 7 + 7)
+#define USB_AUDIO_CONFIG_DESC_SIZE  (9 + 8 + 9 + USB_AUDIO_AC_CS_SIZE + USB_AUDIO_AS_OUT_SIZE + USB_AUDIO_AS_IN_SIZE \
+                                     + USB_MSC_DESC_SIZE)
+
+/* Channel cluster of the terminals: every SAI slot, front left/right in stereo */
+#if AUDIO_CHANNELS == 2
+#define USB_AUDIO_CHANNEL_CONFIG    0x03
+#else
+#define USB_AUDIO_CHANNEL_CONFIG    0x00
+#endif
+
+/* Feature unit controls: Mute, Vol R/W on the master and each channel */
+#define USB_AUDIO_FU_CONTROLS       0x0F, 0x00, 0x00, 0x00
+#if AUDIO_CHANNELS == 2
+#define USB_AUDIO_FU_CHANNELS       USB_AUDIO_FU_CONTROLS, USB_AUDIO_FU_CONTROLS
+#elif AUDIO_CHANNELS == 4
+#define USB_AUDIO_FU_CHANNELS       USB_AUDIO_FU_CONTROLS, USB_AUDIO_FU_CONTROLS, \
+                                    USB_AUDIO_FU_CONTROLS, USB_AUDIO_FU_CONTROLS
+#else
+#define USB_AUDIO_FU_CHANNELS       USB_AUDIO_FU_CONTROLS, USB_AUDIO_FU_CONTROLS, \
+                                    USB_AUDIO_FU_CONTROLS, USB_AUDIO_FU_CONTROLS, \
+                                    USB_AUDIO_FU_CONTROLS, USB_AUDIO_FU_CONTROLS, \
+                                    USB_AUDIO_FU_CONTROLS, USB_AUDIO_FU_CONTROLS
+#endif
+
+/* AS General + Format Type I + data endpoint + CS endpoint of one format */
+#define USB_AUDIO_AS_FORMAT(terminal, channels, config, subslot, bits, ep, attributes, size) \
+  0x10, 0x24, 0x01, terminal, 0x00, 0x01,   /* AS General, TermLink, Ctl 0, Fmt Type I */ \
+  0x01, 0x00, 0x00, 0x00,                   /* bmFormats: PCM */ \
+  channels, config, 0x00, 0x00, 0x00, 0x00, /* bNrChannels, bmChannelConfig, iChannelNames */ \
+  0x06, 0x24, 0x02, 0x01, subslot, bits,    /* Type I, bSubslotSize, bBitResolution */ \
+  0x07, 0x05, ep, attributes, LOBYTE(size), HIBYTE(size), 0x01, /* Interval 1 (1ms FS) */ \
+  0x08, 0x25, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00
 
-/* Corrected Size: 14 -> 18 for Feature Units, Input Terminals 12 -> 17 */
-/*
-AC: 9(Conf)+8(IAD)+9(Std)+111(CS) = 137
-AS Out (Alt 0/1): 9+9 + 16(Gen)+6(Fmt)+7(EpData)+8(EpCS)+7(EpFb) = 62
-AS In (Alt 0/1):  9+9 + 16(Gen)+6(Fmt)+7(EpData)+8(EpCS) = 55
-Total: 137 + 62 + 55 = 254
-*/
-#define USB_AUDIO_CONFIG_DESC_SIZE  (254)
+#if AUDIO_FB_SOURCE == AUDIO_FB_IMPLICIT
+/* Playback format alt: Data endpoint (Async ISO OUT), paced on the IN stream */
+#define USB_AUDIO_AS_OUT_ALT(alt, channels, config, subslot, bits, size) \
+  0x09, 0x04, 0x01, alt, 0x01, 0x01, 0x02, 0x20, 0x00, \
+  USB_AUDIO_AS_FORMAT(0x02, channels, config, subslot, bits, USBD_AUDIO_EPOUT_ADDR, 0x05, size)
+
+/* Record format alt: Data endpoint (Async ISO IN, implicit feedback data) */
+#define USB_AUDIO_AS_IN_ALT(alt, channels, config, subslot, bits, size) \
+  0x09, 0x04, 0x02, alt, 0x01, 0x01, 0x02, 0x20, 0x00, \
+  USB_AUDIO_AS_FORMAT(0x07, channels, config, subslot, bits, USBD_AUDIO_EPIN_ADDR, 0x25, size)
+#else
+/* Playback format alt: Data (Async ISO OUT) + Feedback endpoints */
+#define USB_AUDIO_AS_OUT_ALT(alt, channels, config, subslot, bits, size) \
+  0x09, 0x04, 0x01, alt, 0x02, 0x01, 0x02, 0x20, 0x00, \
+  USB_AUDIO_AS_FORMAT(0x02, channels, config, subslot, bits, USBD_AUDIO_EPOUT_ADDR, 0x05, size), \
+  0x07, 0x05, USBD_AUDIO_EPFB_ADDR, 0x11, USBD_AUDIO_EPFB_SIZE, 0x00, 0x01  /* Feedback IN, 16.16 */
+
+/* Record format alt: Data endpoint (Async ISO IN) */
+#define USB_AUDIO_AS_IN_ALT(alt, channels, config, subslot, bits, size) \
+  0x09, 0x04, 0x02, alt, 0x01, 0x01, 0x02, 0x20, 0x00, \
+  USB_AUDIO_AS_FORMAT(0x07, channels, config, subslot, bits, USBD_AUDIO_EPIN_ADDR, 0x05, size)
+#endif
 
 __ALIGN_BEGIN const uint8_t USBD_ConfigDesc_Audio[] __ALIGN_END = {
   /* Configuration Descriptor */
@@ -83,7 +133,7 @@ __ALIGN_BEGIN const uint8_t USBD_ConfigDesc_Audio[] __ALIGN_END = {
   USB_DESC_TYPE_CONFIGURATION,              /* bDescriptorType */
   LOBYTE(USB_AUDIO_CONFIG_DESC_SIZE),       /* wTotalLength */
   HIBYTE(USB_AUDIO_CONFIG_DESC_SIZE),
-  0x03,                                     /* bNumInterfaces (AC, AS_OUT, AS_IN) */
+  0x04,                                     /* bNumInterfaces (AC, AS_OUT, AS_IN, MSC) */
   0x01,                                     /* bConfigurationValue */
   0x00,                                     /* iConfiguration */
   0xC0,                                     /* bmAttributes (Self-powered) */
@@ -106,23 +156,22 @@ __ALIGN_BEGIN const uint8_t USBD_ConfigDesc_Audio[] __ALIGN_END = {
   0x09, 0x24, 0x01, /* Header, ADC 2.0 */
   0x00, 0x02,       /* bcdADC 2.0 */
   0x01,             /* bCategory (Desktop Speaker) */
-  0x6F, 0x00,       /* wTotalLength (Calculated: 9+8+17+12+17+12+18+18 = 111 (0x6F)) */
+  LOBYTE(USB_AUDIO_AC_CS_SIZE), HIBYTE(USB_AUDIO_AC_CS_SIZE), /* wTotalLength (111 in stereo) */
   0x00,             /* bmControls */
 
   /* Clock Source (ID 1) */
-  0x08, 0x24, 0x02, 0x01, 0x01, 0x03, 0x00, 0x00,
-  /* ID 1, Internal Fixed Clock, Ctrl: Freq Read Only */
+  0x08, 0x24, 0x0A, 0x01, 0x03, 0x07, 0x00, 0x00,
+  /* ID 1, Internal Programmable Clock, Ctrl: Freq Read/Write, Validity Read Only */
 
   /* Input Terminal (USB Streaming OUT) (ID 2) */
-  0x11, 0x24, 0x02, 0x02, 0x01, 0x01, 0x00, 0x01, 0x02, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  /* ID 2, Type USB Stream, Assoc 0, Clk 1, 2 Channels, Config 3 (L/R) */
+  0x11, 0x24, 0x02, 0x02, 0x01, 0x01, 0x00, 0x01, AUDIO_CHANNELS, USB_AUDIO_CHANNEL_CONFIG, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  /* ID 2, Type USB Stream, Assoc 0, Clk 1, SAI slots Channels, Config 3 (L/R) in stereo */
 
   /* Feature Unit (Play Volume/Mute) (ID 3) */
-  /* Length 18 (0x12): Header 5 + Master(4) + Ch1(4) + Ch2(4) + iFeature(1) */
-  0x12, 0x24, 0x06, 0x03, 0x02,
-  0x0F, 0x00, 0x00, 0x00, /* Master Controls (Mute, Vol, etc) */
-  0x00, 0x00, 0x00, 0x00, /* Ch 1 (None - use Master) */
-  0x00, 0x00, 0x00, 0x00, /* Ch 2 (None - use Master) */
+  /* Length 18 (0x12) in stereo: Header 5 + Master(4) + Ch1(4) + Ch2(4) + iFeature(1) */
+  USB_AUDIO_FU_DESC_SIZE, 0x24, 0x06, 0x03, 0x02,
+  USB_AUDIO_FU_CONTROLS,  /* Master Controls (Mute, Vol R/W) */
+  USB_AUDIO_FU_CHANNELS,  /* Each channel (Mute, Vol R/W) */
   0x00,                   /* iFeature */
 
   /* Output Terminal (Speaker) (ID 4) */
@@ -130,15 +179,13 @@ __ALIGN_BEGIN const uint8_t USBD_ConfigDesc_Audio[] __ALIGN_END = {
   /* ID 4, Type Speaker, Assoc 0, Source 3, Clk 1 */
 
   /* Input Terminal (Microphone) (ID 5) */
-  0x11, 0x24, 0x02, 0x05, 0x01, 0x02, 0x00, 0x01, 0x02, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  /* ID 5, Type Mic, Assoc 0, Clk 1, 2 Ch, Config 3 */
+  0x11, 0x24, 0x02, 0x05, 0x01, 0x02, 0x00, 0x01, AUDIO_CHANNELS, USB_AUDIO_CHANNEL_CONFIG, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  /* ID 5, Type Mic, Assoc 0, Clk 1, SAI slots Channels, Config 3 in stereo */
 
   /* Feature Unit (Rec Volume/Mute) (ID 6) */
-  /* Length 18 */
-  0x12, 0x24, 0x06, 0x06, 0x05,
-  0x0F, 0x00, 0x00, 0x00, /* Master */
-  0x00, 0x00, 0x00, 0x00, /* Ch 1 */
-  0x00, 0x00, 0x00, 0x00, /* Ch 2 */
+  USB_AUDIO_FU_DESC_SIZE, 0x24, 0x06, 0x06, 0x05,
+  USB_AUDIO_FU_CONTROLS,  /* Master (Mute, Vol R/W) */
+  USB_AUDIO_FU_CHANNELS,  /* Each channel (Mute, Vol R/W) */
   0x00,                   /* iFeature */
 
   /* Output Terminal (USB Streaming IN) (ID 7) */
@@ -150,48 +197,36 @@ __ALIGN_BEGIN const uint8_t USBD_ConfigDesc_Audio[] __ALIGN_END = {
   /* Alt 0 (Zero Bandwidth) */
   0x09, 0x04, 0x01, 0x00, 0x00, 0x01, 0x02, 0x20, 0x00,
 
-  /* Alt 1 (Operational) */
-  0x09, 0x04, 0x01, 0x01, 0x02, 0x01, 0x02, 0x20, 0x00, /* 2 Endpoints (Data + Feedback) */
-
-  /* Class-Specific AS General */
-  0x10, 0x24, 0x01, 0x02, 0x00, 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  /* TermLink 2, Ctl 0, Fmt Type I, PCM, 2 Channels, Config 3 */
-
-  /* Format Type I */
-  0x06, 0x24, 0x02, 0x01, 0x03, 0x18, /* Type I, PCM, 3 bytes/slot, 24 bits */
-
-  /* Endpoint 1: ISO OUT (Async) */
-  0x07, 0x05, 0x01, 0x05, LOBYTE(USB_AUDIO_EP_SIZE), HIBYTE(USB_AUDIO_EP_SIZE), 0x01,
-  /* Addr 0x01, Async ISO, Size, Interval 1 (1ms FS or 125us HS) */
-  /* Note: For FS, Interval=1 means 1ms. For HS, Interval=1 means 125us. */
-
-  /* Class-Specific AS Isochronous Audio Data Endpoint (CS_ENDPOINT) */
-  0x08, 0x25, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
-
-  /* Endpoint 2: Feedback IN */
-  0x07, 0x05, 0x82, 0x11, 0x04, 0x00, 0x01, /* 4 bytes for 16.16 feedback */
-  /* Addr 0x82, Sync Feedback, Size 4, Interval 1 */
+  /* One alt per format, in the AUDIO_ALT_* order. Stereo streams go to the
+     first two channels of the cluster. */
+  USB_AUDIO_AS_OUT_ALT(AUDIO_ALT_STEREO_24, 0x02, 0x03, 0x03, 0x18, USB_AUDIO_EP_SIZE_STEREO_24),
+  USB_AUDIO_AS_OUT_ALT(AUDIO_ALT_STEREO_16, 0x02, 0x03, 0x02, 0x10, USB_AUDIO_EP_SIZE_STEREO_16),
+  USB_AUDIO_AS_OUT_ALT(AUDIO_ALT_STEREO_32, 0x02, 0x03, 0x04, 0x18, USB_AUDIO_EP_SIZE_STEREO_32),
+#if AUDIO_CHANNELS > 2
+  USB_AUDIO_AS_OUT_ALT(AUDIO_ALT_TDM_16, AUDIO_CHANNELS, 0x00, 0x02, 0x10, USB_AUDIO_EP_SIZE_TDM_16),
+#endif
 
   /* ----------------------------------------------------------------------- */
   /* Audio Streaming Interface IN (Interface 2) - Record */
   /* Alt 0 */
   0x09, 0x04, 0x02, 0x00, 0x00, 0x01, 0x02, 0x20, 0x00,
 
-  /* Alt 1 */
-  0x09, 0x04, 0x02, 0x01, 0x01, 0x01, 0x02, 0x20, 0x00, /* 1 Endpoint (Data) - Asynchronous */
+  USB_AUDIO_AS_IN_ALT(AUDIO_ALT_STEREO_24, 0x02, 0x03, 0x03, 0x18, USB_AUDIO_EP_SIZE_STEREO_24),
+  USB_AUDIO_AS_IN_ALT(AUDIO_ALT_STEREO_16, 0x02, 0x03, 0x02, 0x10, USB_AUDIO_EP_SIZE_STEREO_16),
+  USB_AUDIO_AS_IN_ALT(AUDIO_ALT_STEREO_32, 0x02, 0x03, 0x04, 0x18, USB_AUDIO_EP_SIZE_STEREO_32),
+#if AUDIO_CHANNELS > 2
+  USB_AUDIO_AS_IN_ALT(AUDIO_ALT_TDM_16, AUDIO_CHANNELS, 0x00, 0x02, 0x10, USB_AUDIO_EP_SIZE_TDM_16),
+#endif
 
-  /* AS General */
-  0x10, 0x24, 0x01, 0x07, 0x00, 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  /* TermLink 7 */
-
-  /* Format Type I */
-  0x06, 0x24, 0x02, 0x01, 0x03, 0x18,
-
-  /* Endpoint 3: ISO IN (Async) */
-  0x07, 0x05, 0x83, 0x05, LOBYTE(USB_AUDIO_EP_SIZE), HIBYTE(USB_AUDIO_EP_SIZE), 0x01,
-
-  /* Class-Specific AS Isochronous Audio Data Endpoint */
-  0x08, 0x25, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00
+  /* ----------------------------------------------------------------------- */
+  /* Mass Storage Interface (Interface 3), outside the audio IAD */
+  0x09, 0x04, USBD_MSC_INTERFACE_NUMBER, 0x00, 0x02, 0x08, 0x06, 0x50, 0x00,
+  /* 2 endpoints, Class MSC, Subclass SCSI transparent, Protocol Bulk-Only */
+
+  0x07, 0x05, USBD_MSC_EPOUT_ADDR, 0x02,
+  LOBYTE(USBD_MSC_EPOUT_FS_MPS), HIBYTE(USBD_MSC_EPOUT_FS_MPS), 0x00, /* Bulk OUT */
+  0x07, 0x05, USBD_MSC_EPIN_ADDR, 0x02,
+  LOBYTE(USBD_MSC_EPIN_FS_MPS), HIBYTE(USBD_MSC_EPIN_FS_MPS), 0x00,   /* Bulk IN */
 };
 
 /* Strings */
@@ -219,7 +254,7 @@ uint8_t *USBD_Get_Device_Framework_Speed(uint8_t Speed, ULONG *Length)
        The standard ST/USBX builder builds one large buffer.
        I will create a static buffer with both.
     */
-    static uint8_t full_framework[1024]; /* Enough space */
+    static uint8_t full_framework[sizeof(USBD_DeviceDesc_Audio) + sizeof(USBD_ConfigDesc_Audio)];
     static uint8_t init = 0;
 
     if (!init) {
@@ -247,7 +282,13 @@ uint8_t *USBD_Get_Language_Id_Framework(ULONG *Length)
 
 uint16_t USBD_Get_Interface_Number(uint8_t class_type, uint8_t interface_type)
 {
-    return 0; /* Stub */
+    /* The audio function starts at interface 0, storage follows it */
+    if (class_type == CLASS_TYPE_MSC)
+    {
+        return USBD_MSC_INTERFACE_NUMBER;
+    }
+
+    return 0;
 }
 
 uint16_t USBD_Get_Configuration_Number(uint8_t class_type, uint8_t interface_type)
@@ -259,4 +300,5 @@ uint16_t USBD_Get_Configuration_Number(uint8_t class_type, uint8_t interface_typ
 USBD_DevClassHandleTypeDef  USBD_Device_FS, USBD_Device_HS;
 uint8_t UserClassInstance[USBD_MAX_CLASS_INTERFACES] = {
   CLASS_TYPE_AUDIO,
+  CLASS_TYPE_MSC,
 };
@@ -32,7 +32,7 @@ extern "C" {
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include "audio_config.h"
 /* USER CODE END Includes */
 
 /* Private defines -----------------------------------------------------------*/
@@ -226,6 +226,7 @@ uint16_t USBD_Get_Configuration_Number(uint8_t class_type, uint8_t interface_typ
 #define USBD_PRODUCT_STRING                           "STM32 USB Device"
 #define USBD_SERIAL_NUMBER                            "000000000001"
 
+#define USB_DESC_TYPE_DEVICE                          0x01U
 #define USB_DESC_TYPE_INTERFACE                       0x04U
 #define USB_DESC_TYPE_ENDPOINT                        0x05U
 #define USB_DESC_TYPE_CONFIGURATION                   0x02U
@@ -251,14 +252,47 @@ uint16_t USBD_Get_Configuration_Number(uint8_t class_type, uint8_t interface_typ
 
 #define USBD_STRING_FRAMEWORK_MAX_LENGTH              256U
 
-/* Device Storage Class */
-#define USBD_MSC_EPOUT_ADDR                           0x01U
-#define USBD_MSC_EPIN_ADDR                            0x81U
+#ifndef LOBYTE
+#define LOBYTE(x)  ((uint8_t)((x) & 0x00FFU))
+#endif
+#ifndef HIBYTE
+#define HIBYTE(x)  ((uint8_t)(((x) & 0xFF00U) >> 8U))
+#endif
+
+/* Device Audio Class, streaming endpoints */
+#define USBD_AUDIO_EPOUT_ADDR                         0x01U
+#define USBD_AUDIO_EPFB_ADDR                          0x82U
+#define USBD_AUDIO_EPIN_ADDR                          0x83U
+#define USBD_AUDIO_EPFB_SIZE                          4U
+
+/* Device Storage Class, after the audio interfaces and endpoints 1 to 3 */
+#define USBD_MSC_INTERFACE_NUMBER                     3U
+#define USBD_MSC_EPOUT_ADDR                           0x04U
+#define USBD_MSC_EPIN_ADDR                            0x84U
 #define USBD_MSC_EPOUT_FS_MPS                         64U
 #define USBD_MSC_EPOUT_HS_MPS                         512U
 #define USBD_MSC_EPIN_FS_MPS                          64U
 #define USBD_MSC_EPIN_HS_MPS                          512U
 
+/* Packet memory of the full speed device: the buffer descriptor table has
+   8 bytes per endpoint number 0 to 4, then the control endpoint buffers */
+#define USBD_PMA_BTABLE_SIZE                          (8U * 5U)
+#define USBD_PMA_EP0_OUT                              USBD_PMA_BTABLE_SIZE
+#define USBD_PMA_EP0_IN                               (USBD_PMA_EP0_OUT + USBD_MAX_EP0_SIZE)
+#define USBD_PMA_MSC_OUT                              (USBD_PMA_EP0_IN + USBD_MAX_EP0_SIZE)
+#define USBD_PMA_MSC_IN                               (USBD_PMA_MSC_OUT + USBD_MSC_EPOUT_FS_MPS)
+/* Audio endpoints at the largest packet any alternate setting advertises,
+   in whole words */
+#define USBD_PMA_AUDIO_SIZE                           ((USB_AUDIO_EP_SIZE_LARGEST + 3U) & ~3U)
+#define USBD_PMA_AUDIO_OUT                            (USBD_PMA_MSC_IN + USBD_MSC_EPIN_FS_MPS)
+#define USBD_PMA_AUDIO_FB                             (USBD_PMA_AUDIO_OUT + USBD_PMA_AUDIO_SIZE)
+#define USBD_PMA_AUDIO_IN                             (USBD_PMA_AUDIO_FB + USBD_AUDIO_EPFB_SIZE)
+#define USBD_PMA_END                                  (USBD_PMA_AUDIO_IN + USBD_PMA_AUDIO_SIZE)
+#define USBD_PMA_SIZE                                 2048U
+#if USBD_PMA_END > USBD_PMA_SIZE
+#error "USB endpoint buffers do not fit the 2 KB packet memory"
+#endif
+
 #ifndef USBD_CONFIG_STR_DESC_IDX
 #define USBD_CONFIG_STR_DESC_IDX                      0U
 #endif /* USBD_CONFIG_STR_DESC_IDX */
@@ -23,8 +23,7 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-#include "board.h"
-#include "sdmmc.h"
+#include "msc_media.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -39,42 +38,55 @@
 
 /* Private macro -------------------------------------------------------------*/
 /* USER CODE BEGIN PM */
-#define SD_READ_FLAG   0x01
-#define SD_WRITE_FLAG  0x02
-#define SD_TIMEOUT     1000U
+
 /* USER CODE END PM */
 
 /* Private variables ---------------------------------------------------------*/
 /* USER CODE BEGIN PV */
-
+/* Block device behind each LUN */
+static const MSC_MediaTypeDef *const storage_media[STORAGE_NUMBER_LUN] =
+{
+  &MSC_Media_SD,
+  &MSC_Media_RAM,
+  &MSC_Media_Flash,
+};
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN PFP */
-
+static UINT storage_check_range(VOID *storage_instance, ULONG lun, UCHAR *data_pointer,
+                                ULONG number_blocks, ULONG lba, ULONG *media_status);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 /**
-  * @brief  check_sd_status
-  *         check SD card Transfer Status.
-  * @param  none
-  * @retval BSP status
+  * @brief  storage_check_range
+  *         The class passes the LBA of the CDB as it is: keep the block
+  *         devices within the capacity the host was given.
+  * @param  storage_instance : Pointer to the storage class instance.
+  * @param  lun: Logical unit number is the command is directed to.
+  * @param  data_pointer: Address of the buffer, NULL to abort.
+  * @param  number_blocks: number of sectors to read/write.
+  * @param  lba: Logical block address is the sector address to read/write.
+  * @param  media_status: sense status on error.
+  * @retval UX_STATE_NEXT or UX_STATE_ERROR
   */
-static int32_t check_sd_status(VOID)
+static UINT storage_check_range(VOID *storage_instance, ULONG lun, UCHAR *data_pointer,
+                                ULONG number_blocks, ULONG lba, ULONG *media_status)
 {
-  uint32_t start = HAL_GetTick();
+  ULONG last_lba = ((UX_SLAVE_CLASS_STORAGE *)storage_instance)->ux_slave_class_storage_lun[lun].
+                   ux_slave_class_storage_media_last_lba;
 
-  while (HAL_GetTick() - start < SD_TIMEOUT)
+  if ((data_pointer != UX_NULL) && (number_blocks != 0U) &&
+      ((lba > last_lba) || (number_blocks > (last_lba - lba + 1U))))
   {
-    if (HAL_SD_GetCardState(&hsd1) == HAL_SD_CARD_TRANSFER)
-    {
-      return 0;
-    }
+    *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(UX_SLAVE_CLASS_STORAGE_SENSE_KEY_ILLEGAL_REQUEST,
+                                                         0x21, 0x00);
+    return UX_STATE_ERROR;
   }
 
-  return -1;
+  return UX_STATE_NEXT;
 }
 /* USER CODE END 0 */
 
@@ -126,36 +138,13 @@ UINT USBD_STORAGE_Read(VOID *storage_instance, ULONG lun, UCHAR *data_pointer,
   UINT status = UX_SUCCESS;
 
   /* USER CODE BEGIN USBD_STORAGE_Read */
-  UX_PARAMETER_NOT_USED(storage_instance);
-  UX_PARAMETER_NOT_USED(lun);
-//  UX_PARAMETER_NOT_USED(data_pointer);
-//  UX_PARAMETER_NOT_USED(number_blocks);
-//  UX_PARAMETER_NOT_USED(lba);
-  UX_PARAMETER_NOT_USED(media_status);
-	
-
-  /* Check if the SD card is present */
-  if (board_sd_detect_getstate())
+  if (storage_check_range(storage_instance, lun, data_pointer, number_blocks, lba,
+                          media_status) != UX_STATE_NEXT)
   {
-    /* Check id SD card is ready */
-    if(check_sd_status() != 0)
-    {
-      Error_Handler();
-    }
-
-    /* Start the Dma write */
-    status =  HAL_SD_ReadBlocks(&hsd1,data_pointer, lba, number_blocks,10000);
-
-    if(status != HAL_OK)
-    {
-      Error_Handler();
-    }
-		
-		while (HAL_SD_GetCardState(&hsd1) != HAL_SD_CARD_TRANSFER)
-		{
-		}
-		status = UX_STATE_NEXT;
+    return UX_STATE_ERROR;
   }
+
+  status = MSC_Media_Read(storage_media[lun], data_pointer, number_blocks, lba, media_status);
   /* USER CODE END USBD_STORAGE_Read */
 
   return status;
@@ -179,33 +168,13 @@ UINT USBD_STORAGE_Write(VOID *storage_instance, ULONG lun, UCHAR *data_pointer,
   UINT status = UX_SUCCESS;
 
   /* USER CODE BEGIN USBD_STORAGE_Write */
-  UX_PARAMETER_NOT_USED(storage_instance);
-  UX_PARAMETER_NOT_USED(lun);
-  UX_PARAMETER_NOT_USED(media_status);
-
-  /* Check if the SD card is present */
-  if (board_sd_detect_getstate())
+  if (storage_check_range(storage_instance, lun, data_pointer, number_blocks, lba,
+                          media_status) != UX_STATE_NEXT)
   {
-    /* Check id SD card is ready */
-    if(check_sd_status() != 0)
-    {
-      Error_Handler();
-    }
-
-    /* Start the Dma write */
-    status = HAL_SD_WriteBlocks(&hsd1,data_pointer, lba, number_blocks,5000);
-
-    if(status != HAL_OK)
-    {
-      Error_Handler();
-    }
-		
-		while (HAL_SD_GetCardState(&hsd1) != HAL_SD_CARD_TRANSFER)
-		{
-		}
-		
-		status = UX_STATE_NEXT;
+    return UX_STATE_ERROR;
   }
+
+  status = MSC_Media_Write(storage_media[lun], data_pointer, number_blocks, lba, media_status);
   /* USER CODE END USBD_STORAGE_Write */
 
   return status;
@@ -229,10 +198,10 @@ UINT USBD_STORAGE_Flush(VOID *storage_instance, ULONG lun, ULONG number_blocks,
 
   /* USER CODE BEGIN USBD_STORAGE_Flush */
   UX_PARAMETER_NOT_USED(storage_instance);
-  UX_PARAMETER_NOT_USED(lun);
   UX_PARAMETER_NOT_USED(number_blocks);
   UX_PARAMETER_NOT_USED(lba);
-  UX_PARAMETER_NOT_USED(media_status);
+
+  status = MSC_Media_Flush(storage_media[lun], media_status);
   /* USER CODE END USBD_STORAGE_Flush */
 
   return status;
@@ -254,10 +223,24 @@ UINT USBD_STORAGE_Status(VOID *storage_instance, ULONG lun, ULONG media_id,
   UINT status = UX_SUCCESS;
 
   /* USER CODE BEGIN USBD_STORAGE_Status */
-  UX_PARAMETER_NOT_USED(storage_instance);
-  UX_PARAMETER_NOT_USED(lun);
+  UX_SLAVE_CLASS_STORAGE_LUN *storage_lun;
+
   UX_PARAMETER_NOT_USED(media_id);
-  UX_PARAMETER_NOT_USED(media_status);
+
+  status = storage_media[lun]->Status(media_status);
+
+  /* A removable media may have been swapped since the last command */
+  if ((status == UX_SUCCESS) && storage_media[lun]->removable)
+  {
+    storage_lun = &((UX_SLAVE_CLASS_STORAGE *)storage_instance)->ux_slave_class_storage_lun[lun];
+    storage_lun->ux_slave_class_storage_media_last_lba = storage_media[lun]->GetLastLba();
+    storage_lun->ux_slave_class_storage_media_block_length = storage_media[lun]->GetBlockLength();
+    if (storage_media[lun]->DiscardAsync != UX_NULL)
+    {
+      storage_lun->ux_slave_class_storage_media_unmap_granularity =
+        storage_media[lun]->GetDiscardGranularity();
+    }
+  }
   /* USER CODE END USBD_STORAGE_Status */
 
   return status;
@@ -303,9 +286,7 @@ ULONG USBD_STORAGE_GetMediaLastLba(VOID)
   ULONG LastLba = 0U;
 
   /* USER CODE BEGIN USBD_STORAGE_GetMediaLastLba */
-	HAL_SD_CardInfoTypeDef CardInfo;
-	HAL_SD_GetCardInfo(&hsd1, &CardInfo);
-	LastLba = (ULONG)(CardInfo.BlockNbr - 1);
+  LastLba = storage_media[0]->GetLastLba();
   /* USER CODE END USBD_STORAGE_GetMediaLastLba */
 
   return LastLba;
@@ -322,14 +303,92 @@ ULONG USBD_STORAGE_GetMediaBlocklength(VOID)
   ULONG MediaBlockLen = 0U;
 
   /* USER CODE BEGIN USBD_STORAGE_GetMediaBlocklength */
-	HAL_SD_CardInfoTypeDef CardInfo;
-	HAL_SD_GetCardInfo(&hsd1, &CardInfo);
-	MediaBlockLen = (ULONG) CardInfo.BlockSize;
+  MediaBlockLen = storage_media[0]->GetBlockLength();
   /* USER CODE END USBD_STORAGE_GetMediaBlocklength */
 
   return MediaBlockLen;
 }
 
 /* USER CODE BEGIN 1 */
+/**
+  * @brief  USBD_STORAGE_Discard
+  *         This function is invoked to discard blocks unmapped by the host.
+  * @param  storage_instance : Pointer to the storage class instance.
+  * @param  lun: Logical unit number is the command is directed to.
+  * @param  number_blocks: number of sectors to discard.
+  * @param  lba: Logical block address is the first sector to discard.
+  * @param  media_status: should be filled out exactly like the media status
+  *                       callback return value.
+  * @retval status
+  */
+UINT USBD_STORAGE_Discard(VOID *storage_instance, ULONG lun, ULONG number_blocks,
+                          ULONG lba, ULONG *media_status)
+{
+  UX_PARAMETER_NOT_USED(storage_instance);
+
+  return storage_media[lun]->DiscardAsync(number_blocks, lba, media_status);
+}
+
+/**
+  * @brief  USBD_STORAGE_SetLunParameters
+  *         Describe each LUN and its block device in the storage class
+  *         parameters, before the class is registered.
+  * @param  storage_parameter: storage class parameters.
+  * @retval none
+  */
+VOID USBD_STORAGE_SetLunParameters(UX_SLAVE_CLASS_STORAGE_PARAMETER *storage_parameter)
+{
+  UX_SLAVE_CLASS_STORAGE_LUN *lun;
+  ULONG lun_index;
+
+  storage_parameter->ux_slave_class_storage_parameter_number_lun = STORAGE_NUMBER_LUN;
 
+  for (lun_index = 0U; lun_index < STORAGE_NUMBER_LUN; lun_index++)
+  {
+    lun = &storage_parameter->ux_slave_class_storage_parameter_lun[lun_index];
+    lun->ux_slave_class_storage_media_last_lba = storage_media[lun_index]->GetLastLba();
+    lun->ux_slave_class_storage_media_block_length = storage_media[lun_index]->GetBlockLength();
+    lun->ux_slave_class_storage_media_type = 0U;
+    lun->ux_slave_class_storage_media_removable_flag =
+      storage_media[lun_index]->removable ? STORAGE_REMOVABLE_FLAG : 0U;
+    lun->ux_slave_class_storage_media_read_only_flag = storage_media[lun_index]->read_only;
+    lun->ux_slave_class_storage_media_read = USBD_STORAGE_Read;
+    lun->ux_slave_class_storage_media_write = USBD_STORAGE_Write;
+    lun->ux_slave_class_storage_media_flush = USBD_STORAGE_Flush;
+    lun->ux_slave_class_storage_media_status = USBD_STORAGE_Status;
+    lun->ux_slave_class_storage_media_notification = USBD_STORAGE_Notification;
+
+    /* UNMAP is only offered by block devices able to discard */
+    if (storage_media[lun_index]->DiscardAsync != UX_NULL)
+    {
+      lun->ux_slave_class_storage_media_discard = USBD_STORAGE_Discard;
+      lun->ux_slave_class_storage_media_unmap_granularity =
+        storage_media[lun_index]->GetDiscardGranularity();
+    }
+    else
+    {
+      lun->ux_slave_class_storage_media_discard = UX_NULL;
+      lun->ux_slave_class_storage_media_unmap_granularity = 0U;
+    }
+  }
+}
+
+/**
+  * @brief  USBD_STORAGE_Process
+  *         Background work of the block devices, called from the main loop.
+  * @param  none
+  * @retval none
+  */
+VOID USBD_STORAGE_Process(VOID)
+{
+  ULONG lun_index;
+
+  for (lun_index = 0U; lun_index < STORAGE_NUMBER_LUN; lun_index++)
+  {
+    if (storage_media[lun_index]->Process != UX_NULL)
+    {
+      storage_media[lun_index]->Process();
+    }
+  }
+}
 /* USER CODE END 1 */
@@ -29,7 +29,7 @@ extern "C" {
 #include "ux_api.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include "ux_device_class_storage.h"
 /* USER CODE END Includes */
 
 /* Exported types ------------------------------------------------------------*/
@@ -39,7 +39,7 @@ extern "C" {
 
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
-
+#define STORAGE_NUMBER_LUN   3
 /* USER CODE END EC */
 
 /* Exported macro ------------------------------------------------------------*/
@@ -65,7 +65,10 @@ ULONG USBD_STORAGE_GetMediaLastLba(VOID);
 ULONG USBD_STORAGE_GetMediaBlocklength(VOID);
 
 /* USER CODE BEGIN EFP */
-
+UINT USBD_STORAGE_Discard(VOID *storage_instance, ULONG lun, ULONG number_blocks,
+                          ULONG lba, ULONG *media_status);
+VOID USBD_STORAGE_SetLunParameters(UX_SLAVE_CLASS_STORAGE_PARAMETER *storage_parameter);
+VOID USBD_STORAGE_Process(VOID);
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
@@ -142,7 +142,7 @@
 /* Defined, this value is the maximum number of classes in the device stack that can be loaded by
    USBX.  */
 
-#define UX_MAX_SLAVE_CLASS_DRIVER    1
+#define UX_MAX_SLAVE_CLASS_DRIVER    4
 
 /* Defined, this value is the maximum number of interfaces in the device framework.  */
 
@@ -166,7 +166,7 @@
 /* Defined, this value represents the current number of SCSI logical units represented in the device
    storage class driver.  */
 
-/* #define UX_MAX_SLAVE_LUN    1 */
+#define UX_MAX_SLAVE_LUN    3
 
 /* Defined, this value represents the maximum number of SCSI logical units represented in the
    host storage class driver.  */
@@ -176,7 +176,9 @@
 /* Defined, this value represents the maximum number of bytes received on a control endpoint in
    the device stack. The default is 256 bytes but can be reduced in memory constrained environments.  */
 
-/* #define UX_SLAVE_REQUEST_CONTROL_MAX_LENGTH              256 */
+/* The audio configuration descriptor, with one alternate setting per streaming format,
+   is longer than the default.  */
+#define UX_SLAVE_REQUEST_CONTROL_MAX_LENGTH                 1024
 
 /* Defined, this value represents the maximum number of bytes that can be received or transmitted
    on any endpoint. This value cannot be less than the maximum packet size of any endpoint. The default
@@ -189,6 +191,14 @@
 
 /* #define UX_SLAVE_CLASS_STORAGE_INCLUDE_MMC */
 
+/* Defined, this value represents the size of each of the two storage class ping-pong buffers, so the
+   maximum number of bytes moved per disk read/write and per USB bulk transfer. While one buffer is
+   transferred on USB the other one is filled/drained by the media. In standalone mode it can be larger
+   than UX_SLAVE_REQUEST_DATA_MAX_LENGTH, the class then allocates the buffers from the USBX memory.
+   It must be a multiple of the media block length. The default is UX_SLAVE_REQUEST_DATA_MAX_LENGTH.  */
+
+#define UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE                  (8 * 1024)
+
 /* Defined, this value represents the maximum number of bytes that a storage payload can send/receive.
    The default is 8K bytes but can be reduced in memory constrained environments.  */
 